@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h> /* data types used in system calls */
+#include <sys/select.h> /* fd_set */
+#include "transport.h" /* message types */
+#include "admission.h"
+
+/* tokens per second of each message class by load level */
+const int classRates[ADMIT_CLASSES][ADMIT_LEVELS] = {
+	{ 200, 100, 50 }, /* ADMIT_MESSAGES */
+	{ 10, 5, 2 }, /* ADMIT_TURNS */
+	{ 5, 1, 0 }, /* ADMIT_CHAT */
+	{ 20, 10, 5 } /* ADMIT_QUERIES */
+};
+
+/* tokens a bucket of each message class holds */
+const int classBursts[ADMIT_CLASSES] = { 50, 5, 10, 20 };
+
+/* loop lag and backlog each level starts at */
+const long long levelLagNs[ADMIT_LEVELS] = { 0, ADMIT_PRESSURE_LAG_NS, ADMIT_OVERLOAD_LAG_NS };
+const int levelBacklog[ADMIT_LEVELS] = { 0, ADMIT_PRESSURE_BACKLOG, ADMIT_OVERLOAD_BACKLOG };
+
+/**
+ * the function refills the bucket at ratePerSec up to burst tokens without taking any
+ * returns cost of one token in ns, 0 if the rate admits nothing
+ **/
+long long bucketRefill(token_bucket_t * bucket, int ratePerSec, int burst, long long now) {
+	if (ratePerSec <= 0) {
+		return 0;
+	}
+	long long costNs = 1000000000LL / ratePerSec;
+	long long capacityNs = costNs * burst;
+	bucket->creditNs = (bucket->lastNs == 0) ? capacityNs : bucket->creditNs + (now - bucket->lastNs);
+	bucket->lastNs = now;
+	if (bucket->creditNs > capacityNs) {
+		bucket->creditNs = capacityNs;
+	}
+	return costNs;
+}
+
+/**
+ * the function takes token from the bucket refilled at ratePerSec up to burst tokens
+ * returns 1 if token was taken, 0 if bucket is empty
+ **/
+int bucketTake(token_bucket_t * bucket, int ratePerSec, int burst, long long now) {
+	long long costNs = bucketRefill(bucket, ratePerSec, burst, now);
+	if (costNs == 0 || bucket->creditNs < costNs) {
+		return 0;
+	}
+	bucket->creditNs -= costNs;
+	return 1;
+}
+
+/**
+ * the function returns class of the message type limited by its own bucket,
+ * ADMIT_MESSAGES if only the bucket of all messages limits it
+ **/
+admission_class_t messageClass(msgtype_t type) {
+	switch (type) {
+	case TURN_REQ:
+		return ADMIT_TURNS;
+	case CHAT:
+		return ADMIT_CHAT;
+	case PING:
+	case STATUS_REQ:
+	case ANALYZE:
+		return ADMIT_QUERIES;
+	default:
+		return ADMIT_MESSAGES;
+	}
+}
+
+/**
+ * the function admits message of connection with given buckets indexed by admission_class_t
+ * message takes token from the bucket of all messages and from the bucket of its class,
+ * both are checked before either is taken, so shed message costs no token
+ * move of current player must not be passed here - it is never shed
+ * returns 1 if message is admitted, 0 if it is shed
+ **/
+int admitMessage(admission_t * admission, token_bucket_t * buckets, msgtype_t type, long long now) {
+	if (!admission->enabled) {
+		return 1;
+	}
+	admission_class_t class = messageClass(type);
+	long long messageCostNs = bucketRefill(&buckets[ADMIT_MESSAGES], classRates[ADMIT_MESSAGES][admission->level], classBursts[ADMIT_MESSAGES], now);
+	if (messageCostNs == 0 || buckets[ADMIT_MESSAGES].creditNs < messageCostNs) {
+		admission->shed[ADMIT_MESSAGES]++;
+		return 0;
+	}
+	long long classCostNs = 0;
+	if (class != ADMIT_MESSAGES) {
+		classCostNs = bucketRefill(&buckets[class], classRates[class][admission->level], classBursts[class], now);
+		if (classCostNs == 0 || buckets[class].creditNs < classCostNs) {
+			admission->shed[class]++;
+			return 0;
+		}
+	}
+	buckets[ADMIT_MESSAGES].creditNs -= messageCostNs;
+	buckets[class].creditNs -= classCostNs;
+	return 1;
+}
+
+/**
+ * the function admits new client, spectators are rejected under pressure and everybody under overload
+ * returns 1 if client is admitted
+ **/
+int admitClient(admission_t * admission, int spectator) {
+	if (!admission->enabled || admission->level == ADMIT_NORMAL || (admission->level == ADMIT_PRESSURE && !spectator)) {
+		return 1;
+	}
+	if (spectator) {
+		admission->rejectedSpectators++;
+	} else {
+		admission->rejectedPlayers++;
+	}
+	return 0;
+}
+
+/**
+ * the function decides if spectators of a game skip the status: under pressure the game
+ * sends them status once in ADMIT_SPECTATOR_INTERVAL_NS, under overload not at all
+ * lastSentNs - time spectators of the game got status last
+ * returns 1 if the status is skipped
+ **/
+int shedSpectatorStatus(admission_t * admission, long long lastSentNs, long long now) {
+	if (!admission->enabled || admission->level == ADMIT_NORMAL) {
+		return 0;
+	}
+	return admission->level == ADMIT_OVERLOAD || now - lastSentNs < ADMIT_SPECTATOR_INTERVAL_NS;
+}
+
+/**
+ * the function updates load level by time of the loop iteration and backlog of connections
+ * level goes down only once load falls below half of the level threshold, so it doesn't flap
+ * returns 1 if level changed
+ **/
+int admissionUpdate(admission_t * admission, long long iterationNs, int backlog) {
+	admission->lagNs += (iterationNs - admission->lagNs) / ADMIT_LAG_WEIGHT;
+	admission->backlog = backlog;
+	admission_level_t level = ADMIT_NORMAL;
+	if (admission->lagNs >= ADMIT_OVERLOAD_LAG_NS || backlog >= ADMIT_OVERLOAD_BACKLOG) {
+		level = ADMIT_OVERLOAD;
+	} else if (admission->lagNs >= ADMIT_PRESSURE_LAG_NS || backlog >= ADMIT_PRESSURE_BACKLOG) {
+		level = ADMIT_PRESSURE;
+	}
+	if (level < admission->level && (admission->lagNs >= levelLagNs[admission->level] / 2 || backlog >= levelBacklog[admission->level] / 2)) {
+		level = admission->level;
+	}
+	if (level == admission->level) {
+		return 0;
+	}
+	admission->level = level;
+	admission->levelChanges++;
+	return 1;
+}
+
+/**
+ * the function prints load level and counters of shed work
+ **/
+void admissionPrintStats(FILE * out, admission_t * admission) {
+	if (!admission->enabled) {
+		return;
+	}
+	fprintf(out, "admission level=%d lag_us=%.1f backlog=%d level_changes=%ld shed_messages=%ld shed_turns=%ld shed_chat=%ld shed_queries=%ld shed_statuses=%ld rejected_players=%ld rejected_spectators=%ld\n",
+			admission->level, admission->lagNs / 1e3, admission->backlog, admission->levelChanges, admission->shed[ADMIT_MESSAGES], admission->shed[ADMIT_TURNS], admission->shed[ADMIT_CHAT],
+			admission->shed[ADMIT_QUERIES], admission->shedStatuses, admission->rejectedPlayers, admission->rejectedSpectators);
+}
@@ -0,0 +1,78 @@
+#define ADMIT_PRESSURE_LAG_NS (2000000LL) /* loop iteration time pressure starts at */
+#define ADMIT_OVERLOAD_LAG_NS (10000000LL) /* loop iteration time overload starts at */
+#define ADMIT_PRESSURE_BACKLOG (64) /* connections with unsent frames pressure starts at */
+#define ADMIT_OVERLOAD_BACKLOG (256) /* connections with unsent frames overload starts at */
+#define ADMIT_LAG_WEIGHT (8) /* iterations loop lag is averaged over */
+#define ADMIT_SPECTATOR_INTERVAL_NS (200000000LL) /* spectators of a game get statuses at most this often under pressure */
+
+/**
+ * load levels of the server, work is shed from the cheapest:
+ * ADMIT_NORMAL - everything is served within connection buckets
+ * ADMIT_PRESSURE - spectator statuses are coalesced, buckets are smaller, new spectators are rejected
+ * ADMIT_OVERLOAD - spectator statuses and chat are dropped, new clients are rejected
+ * moves of current players are never shed
+ **/
+typedef enum {
+	ADMIT_NORMAL, ADMIT_PRESSURE, ADMIT_OVERLOAD, ADMIT_LEVELS
+} admission_level_t;
+
+/**
+ * message classes limited by own token bucket of each connection
+ * ADMIT_MESSAGES - all messages of the connection
+ * ADMIT_TURNS - move requests out of player's turn
+ * ADMIT_CHAT - chat messages
+ * ADMIT_QUERIES - pings, keyframe and analysis requests
+ **/
+typedef enum {
+	ADMIT_MESSAGES, ADMIT_TURNS, ADMIT_CHAT, ADMIT_QUERIES, ADMIT_CLASSES
+} admission_class_t;
+
+/**
+ * token bucket
+ * creditNs - saved credit, one token costs 1e9 / rate ns
+ * lastNs - time credit was last added, 0 - bucket is full
+ **/
+typedef struct token_bucket {
+	long long creditNs;
+	long long lastNs;
+} token_bucket_t;
+
+/**
+ * overload controller of the server
+ * enabled - 1 if messages and clients are admitted by load, 0 - everything is admitted
+ * level - current admission_level_t
+ * lagNs - average time of main loop iteration
+ * backlog - connections with unsent frames or unread messages seen by last iteration
+ * shed - messages dropped by class
+ * shedStatuses - spectator statuses skipped
+ * rejectedPlayers, rejectedSpectators - new clients rejected
+ * levelChanges - number of level changes
+ **/
+typedef struct admission {
+	int enabled;
+	admission_level_t level;
+	long long lagNs;
+	int backlog;
+	long shed[ADMIT_CLASSES];
+	long shedStatuses;
+	long rejectedPlayers;
+	long rejectedSpectators;
+	long levelChanges;
+} admission_t;
+
+/* headers of admission functions */
+long long bucketRefill(token_bucket_t * bucket, int ratePerSec, int burst, long long now);
+
+int bucketTake(token_bucket_t * bucket, int ratePerSec, int burst, long long now);
+
+admission_class_t messageClass(msgtype_t type);
+
+int admitMessage(admission_t * admission, token_bucket_t * buckets, msgtype_t type, long long now);
+
+int admitClient(admission_t * admission, int spectator);
+
+int shedSpectatorStatus(admission_t * admission, long long lastSentNs, long long now);
+
+int admissionUpdate(admission_t * admission, long long iterationNs, int backlog);
+
+void admissionPrintStats(FILE * out, admission_t * admission);
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* for read(), write(), pipe() */
+#include <sys/types.h> /* data types used in system calls */
+#include <fcntl.h> /* for manipulating file descriptor */
+#include <string.h> /* string functions */
+#include <pthread.h> /* analysis worker */
+#include "transport.h" /* common data with client */
+#include "rules.h" /* game variant rules */
+#include "solver.h" /* solved positions */
+#include "analysis.h"
+
+/**
+ * the function returns shard of the key and its hash bucket in the shard
+ **/
+analysis_shard_t * keyShard(analyzer_t * analyzer, unsigned long long key, int * bucket) {
+	unsigned long long hash = key * 0x9e3779b97f4a7c15ULL;
+	*bucket = (hash >> 40) & (ANALYSIS_SHARD_BUCKETS - 1);
+	return &analyzer->shards[(hash >> 32) % ANALYSIS_SHARDS];
+}
+
+/**
+ * the function removes entry from LRU list of the shard
+ **/
+void lruUnlink(analysis_shard_t * shard, int idx) {
+	analysis_entry_t * entry = &shard->entries[idx];
+	if (entry->lruPrev != -1) {
+		shard->entries[entry->lruPrev].lruNext = entry->lruNext;
+	} else {
+		shard->lruHead = entry->lruNext;
+	}
+	if (entry->lruNext != -1) {
+		shard->entries[entry->lruNext].lruPrev = entry->lruPrev;
+	} else {
+		shard->lruTail = entry->lruPrev;
+	}
+}
+
+/**
+ * the function puts entry at the head of LRU list of the shard
+ **/
+void lruPushFront(analysis_shard_t * shard, int idx) {
+	analysis_entry_t * entry = &shard->entries[idx];
+	entry->lruPrev = -1;
+	entry->lruNext = shard->lruHead;
+	if (shard->lruHead != -1) {
+		shard->entries[shard->lruHead].lruPrev = idx;
+	} else {
+		shard->lruTail = idx;
+	}
+	shard->lruHead = idx;
+}
+
+/**
+ * the function finds entry of the key, found entry becomes most recently used
+ * shard should be locked
+ * returns entry index or -1 if the key is not cached
+ **/
+int cacheFind(analysis_shard_t * shard, int bucket, unsigned long long key) {
+	int idx;
+	for (idx = shard->buckets[bucket]; idx != -1; idx = shard->entries[idx].bucketNext) {
+		if (shard->entries[idx].key == key) {
+			if (shard->lruHead != idx) {
+				lruUnlink(shard, idx);
+				lruPushFront(shard, idx);
+			}
+			return idx;
+		}
+	}
+	return -1;
+}
+
+/**
+ * the function caches the entry, least recently used entry is replaced if the shard is full
+ * shard should be locked
+ **/
+void cachePut(analyzer_t * analyzer, analysis_shard_t * shard, int bucket, const analysis_entry_t * entry) {
+	if (cacheFind(shard, bucket, entry->key) != -1) { /* cached by previous request of the same position */
+		return;
+	}
+	int idx;
+	if (shard->entriesCnt < ANALYSIS_SHARD_ENTRIES) {
+		idx = shard->entriesCnt++;
+	} else {
+		idx = shard->lruTail;
+		lruUnlink(shard, idx);
+		int oldBucket;
+		keyShard(analyzer, shard->entries[idx].key, &oldBucket);
+		int * link = &shard->buckets[oldBucket];
+		while (*link != idx) {
+			link = &shard->entries[*link].bucketNext;
+		}
+		*link = shard->entries[idx].bucketNext;
+		shard->evictions++;
+	}
+	shard->entries[idx] = *entry;
+	shard->entries[idx].bucketNext = shard->buckets[bucket];
+	shard->buckets[bucket] = idx;
+	lruPushFront(shard, idx);
+}
+
+/**
+ * the function returns value of canonical position for the player to move
+ * closed forms are used where they exist: regular game is lost iff nim-sum of heaps modulo
+ * maxTake + 1 is 0, misere game without bound is the same unless no heap has more than
+ * one cube, then it is lost iff nim-sum is 1; misere game with bound is looked up in the table
+ **/
+solver_result_t positionValue(analyzer_t * analyzer, game_type_t gameType, const short * canonical) {
+	const rules_t * rules = &analyzer->rules[gameType];
+	if (analyzer->tables[gameType] != NULL) {
+		return solverResult(analyzer->tables[gameType], canonical);
+	}
+	int i, nimSum = 0;
+	for (i = 0; i < rules->heapsCnt; i++) {
+		nimSum ^= (rules->maxTake != 0) ? canonical[i] % (rules->maxTake + 1) : canonical[i];
+	}
+	if (gameType == MISERE && canonical[0] <= 1) { /* canonical heaps are sorted, first is the largest */
+		return (nimSum != 0) ? SOLVER_LOSS : SOLVER_WIN;
+	}
+	return (nimSum != 0) ? SOLVER_WIN : SOLVER_LOSS;
+}
+
+/**
+ * the function analyzes canonical position into entry:
+ * its value and up to MAX_WINNING_MOVES of moves leading to positions lost for the opponent
+ **/
+void analyzeCanonical(analyzer_t * analyzer, game_type_t gameType, const short * canonical, analysis_entry_t * entry) {
+	const rules_t * rules = &analyzer->rules[gameType];
+	solver_result_t result = positionValue(analyzer, gameType, canonical);
+	entry->value = (result == SOLVER_WIN) ? VALUE_WIN : (result == SOLVER_LOSS) ? VALUE_LOSS : VALUE_UNKNOWN;
+	entry->movesCnt = 0;
+	int i, cubes;
+	for (i = 0; i < rules->heapsCnt && result == SOLVER_WIN && entry->movesCnt < MAX_WINNING_MOVES; i++) {
+		if (i > 0 && canonical[i] == canonical[i - 1]) {
+			continue; /* same positions as moves on previous heap */
+		}
+		int maxCubes = (rules->maxTake != 0 && rules->maxTake < canonical[i]) ? rules->maxTake : canonical[i];
+		for (cubes = 1; cubes <= maxCubes && entry->movesCnt < MAX_WINNING_MOVES; cubes++) {
+			short child[MAX_HEAPS], next[MAX_HEAPS];
+			memcpy(child, canonical, sizeof(child));
+			child[i] -= cubes;
+			solverCanonical(child, rules->heapsCnt, next);
+			if (positionValue(analyzer, gameType, next) == SOLVER_LOSS) {
+				entry->moveHeaps[(int) entry->movesCnt] = canonical[i];
+				entry->moveAmounts[(int) entry->movesCnt] = cubes;
+				entry->movesCnt++;
+			}
+		}
+	}
+}
+
+/**
+ * the function fills analysis of asked position from cached entry of its canonical position
+ * winning moves take from the first heap of the cached size
+ **/
+void fillAnalysis(const analysis_entry_t * entry, int heapsCnt, analysis_t * out) {
+	int i, j;
+	out->value = entry->value;
+	out->movesCnt = entry->movesCnt;
+	for (i = 0; i < entry->movesCnt; i++) {
+		for (j = 0; j < heapsCnt - 1 && out->heapStatus.heap[j] != entry->moveHeaps[i]; j++) {
+		}
+		out->moves[i].heapIndex = j;
+		out->moves[i].amount = entry->moveAmounts[i];
+	}
+}
+
+/**
+ * the function starts analysis of the position: fills heaps and game type of out with value unknown
+ * key - set to key of canonical position
+ * returns 0 if the position can't be analyzed
+ **/
+int prepareAnalysis(analyzer_t * analyzer, game_type_t gameType, const short * heaps, analysis_t * out, unsigned long long * key) {
+	memset(out, 0, sizeof(analysis_t));
+	out->gameType = gameType;
+	out->value = VALUE_UNKNOWN;
+	memcpy(out->heapStatus.heap, heaps, sizeof(out->heapStatus.heap));
+	if (gameType != MISERE && gameType != REGULAR) {
+		return 0;
+	}
+	int i;
+	for (i = 0; i < analyzer->rules[gameType].heapsCnt; i++) {
+		if (heaps[i] < 0) {
+			return 0;
+		}
+	}
+	short canonical[MAX_HEAPS];
+	solverCanonical(heaps, analyzer->rules[gameType].heapsCnt, canonical);
+	*key = (positionKey(canonical) << 1) | gameType;
+	return 1;
+}
+
+/**
+ * the function analyzes the position, analysis of canonical position is cached
+ **/
+void analyzePosition(analyzer_t * analyzer, game_type_t gameType, const short * heaps, analysis_t * out) {
+	unsigned long long key;
+	if (!prepareAnalysis(analyzer, gameType, heaps, out, &key)) {
+		return;
+	}
+	int heapsCnt = analyzer->rules[gameType].heapsCnt, bucket;
+	analysis_shard_t * shard = keyShard(analyzer, key, &bucket);
+	analysis_entry_t entry;
+	pthread_mutex_lock(&shard->lock);
+	int idx = cacheFind(shard, bucket, key);
+	if (idx != -1) {
+		entry = shard->entries[idx];
+	}
+	pthread_mutex_unlock(&shard->lock);
+	if (idx == -1) { /* analyzed without the lock, main loop doesn't wait for it */
+		short canonical[MAX_HEAPS];
+		solverCanonical(heaps, heapsCnt, canonical);
+		entry.key = key;
+		analyzeCanonical(analyzer, gameType, canonical, &entry);
+		pthread_mutex_lock(&shard->lock);
+		cachePut(analyzer, shard, bucket, &entry);
+		pthread_mutex_unlock(&shard->lock);
+	}
+	fillAnalysis(&entry, heapsCnt, out);
+}
+
+/**
+ * the function looks analysis of the position up in the cache, lookups are counted
+ * returns 1 if out is the analysis: position is cached or can't be analyzed,
+ * 0 if the position should be analyzed by the worker
+ **/
+int analyzeCached(analyzer_t * analyzer, game_type_t gameType, const short * heaps, analysis_t * out) {
+	analyzer->requestsCnt++;
+	unsigned long long key;
+	if (!prepareAnalysis(analyzer, gameType, heaps, out, &key)) {
+		return 1;
+	}
+	int bucket;
+	analysis_shard_t * shard = keyShard(analyzer, key, &bucket);
+	pthread_mutex_lock(&shard->lock);
+	int idx = cacheFind(shard, bucket, key);
+	if (idx != -1) {
+		shard->hits++;
+		fillAnalysis(&shard->entries[idx], analyzer->rules[gameType].heapsCnt, out);
+	} else {
+		shard->misses++;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return idx != -1;
+}
+
+/**
+ * analysis worker - analyzes requests till the request pipe is closed
+ **/
+void * analysisWorker(void * arg) {
+	analyzer_t * analyzer = (analyzer_t *) arg;
+	analysis_request_t request;
+	while (read(analyzer->requestPipe[0], &request, sizeof(request)) == sizeof(request)) {
+		analysis_reply_t reply;
+		reply.conn = request.conn;
+		reply.gen = request.gen;
+		reply.session = request.session;
+		analyzePosition(analyzer, request.gameType, request.heaps, &reply.analysis);
+		/* replies are shorter than PIPE_BUF so they are never split */
+		if (write(analyzer->replyPipe[1], &reply, sizeof(reply)) != sizeof(reply)) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * the function queues request to the worker without blocking
+ * returns 0 if the worker queue is full
+ **/
+int analysisSubmit(analyzer_t * analyzer, const analysis_request_t * request) {
+	if (write(analyzer->requestPipe[1], request, sizeof(analysis_request_t)) != sizeof(analysis_request_t)) {
+		analyzer->droppedCnt++;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * the function takes analysis done by the worker without blocking
+ * returns 0 if there is none
+ **/
+int analysisReply(analyzer_t * analyzer, analysis_reply_t * reply) {
+	return read(analyzer->replyPipe[0], reply, sizeof(analysis_reply_t)) == sizeof(analysis_reply_t);
+}
+
+/**
+ * the function initializes empty cache and starts the worker
+ * misere game with bounded move has no closed form, its positions are looked up in table
+ * if it is of this variant, otherwise in on demand table
+ * returns 0 on error
+ **/
+int analyzerInit(analyzer_t * analyzer, int heapsCnt, int maxTake, solver_table_t * table) {
+	int i;
+	memset(analyzer, 0, sizeof(analyzer_t));
+	for (i = 0; i < ANALYSIS_SHARDS; i++) {
+		analysis_shard_t * shard = &analyzer->shards[i];
+		pthread_mutex_init(&shard->lock, NULL);
+		memset(shard->buckets, -1, sizeof(shard->buckets));
+		shard->lruHead = -1;
+		shard->lruTail = -1;
+	}
+	if (!initRules(&analyzer->rules[MISERE], MISERE, MOVES_ONE_HEAP, heapsCnt, maxTake) || !initRules(&analyzer->rules[REGULAR], REGULAR, MOVES_ONE_HEAP, heapsCnt, maxTake)) {
+		return 0;
+	}
+	if (maxTake != 0) {
+		if (table != NULL && table->header != NULL && table->header->gameType == MISERE && table->header->moveSet == MOVES_ONE_HEAP) {
+			analyzer->tables[MISERE] = table;
+		} else if (solverCreate(&analyzer->ownTable, MISERE, MOVES_ONE_HEAP, heapsCnt, maxTake, ANALYSIS_TABLE_CAPACITY)) {
+			analyzer->tables[MISERE] = &analyzer->ownTable;
+		} else {
+			return 0;
+		}
+	}
+	if (pipe(analyzer->requestPipe) == -1) {
+		return 0;
+	}
+	if (pipe(analyzer->replyPipe) == -1) {
+		return 0;
+	}
+	fcntl(analyzer->requestPipe[1], F_SETFL, fcntl(analyzer->requestPipe[1], F_GETFL) | O_NONBLOCK);
+	fcntl(analyzer->replyPipe[0], F_SETFL, fcntl(analyzer->replyPipe[0], F_GETFL) | O_NONBLOCK);
+	return pthread_create(&analyzer->worker, NULL, analysisWorker, analyzer) == 0;
+}
+
+/**
+ * the function prints analysis counters: hit rate is of lookups by the main loop,
+ * misses are analyzed by the worker
+ **/
+void analysisPrintStats(FILE * out, analyzer_t * analyzer) {
+	long hits = 0, misses = 0, evictions = 0, entriesCnt = 0;
+	int i;
+	for (i = 0; i < ANALYSIS_SHARDS; i++) {
+		analysis_shard_t * shard = &analyzer->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		hits += shard->hits;
+		misses += shard->misses;
+		evictions += shard->evictions;
+		entriesCnt += shard->entriesCnt;
+		pthread_mutex_unlock(&shard->lock);
+	}
+	fprintf(out, "analysis requests=%ld hits=%ld misses=%ld hit_rate=%.3f evictions=%ld entries=%ld dropped=%ld\n", analyzer->requestsCnt, hits, misses,
+			(hits + misses > 0) ? (double) hits / (hits + misses) : 0.0, evictions, entriesCnt, analyzer->droppedCnt);
+}
@@ -0,0 +1,108 @@
+#define ANALYSIS_SHARDS (16) /* cache shards, each with its own lock and LRU list */
+#define ANALYSIS_SHARD_ENTRIES (256) /* analyses kept by one shard */
+#define ANALYSIS_SHARD_BUCKETS (512) /* hash buckets of one shard, power of 2 */
+#define ANALYSIS_TABLE_CAPACITY (1LL << 20) /* entries of on demand table of variant without closed form */
+
+/**
+ * cached analysis of canonical position
+ * key - canonical position key << 1 | game type
+ * value - position_value_t
+ * movesCnt - number of winning moves kept
+ * moveHeaps - sizes of heaps winning moves take from, heap index is found in each asked position
+ * moveAmounts - cubes winning moves take
+ * bucketNext - next entry in hash bucket, -1 if last
+ * lruPrev, lruNext - neighbours in LRU list, most recently used first, -1 at the ends
+ **/
+typedef struct analysis_entry {
+	unsigned long long key;
+	char value;
+	char movesCnt;
+	short moveHeaps[MAX_WINNING_MOVES];
+	short moveAmounts[MAX_WINNING_MOVES];
+	int bucketNext;
+	int lruPrev;
+	int lruNext;
+} analysis_entry_t;
+
+/**
+ * shard of the cache, used by the main loop and the analysis worker under the lock
+ * entriesCnt - entries in use, entries are taken in order and reused from LRU tail once all are used
+ * buckets - first entry of each hash bucket, -1 if empty
+ * lruHead, lruTail - most and least recently used entry, -1 if empty
+ * hits, misses, evictions - counters of lookups and entries replaced
+ **/
+typedef struct analysis_shard {
+	pthread_mutex_t lock;
+	int entriesCnt;
+	int buckets[ANALYSIS_SHARD_BUCKETS];
+	int lruHead;
+	int lruTail;
+	long hits;
+	long misses;
+	long evictions;
+	analysis_entry_t entries[ANALYSIS_SHARD_ENTRIES];
+} analysis_shard_t;
+
+/**
+ * request queued to the analysis worker
+ * conn, gen, session - connection and its session the analysis is sent to, opaque to the worker
+ * gameType - MISERE or REGULAR
+ * heaps - position to analyze
+ **/
+typedef struct analysis_request {
+	int conn;
+	unsigned int gen;
+	unsigned short session;
+	game_type_t gameType;
+	short heaps[MAX_HEAPS];
+} analysis_request_t;
+
+/**
+ * analysis returned by the worker
+ * conn, gen, session - copied from the request
+ * analysis - analysis to send
+ **/
+typedef struct analysis_reply {
+	int conn;
+	unsigned int gen;
+	unsigned short session;
+	analysis_t analysis;
+} analysis_reply_t;
+
+/**
+ * position analyzer, cache misses are analyzed by worker thread so games never wait for it
+ * requests and replies pass through pipes, reply pipe is polled by the main loop
+ * shards - cache of analyses
+ * rules - rules of MISERE and REGULAR games
+ * tables - solved positions of variants without closed form, indexed by game type, NULL if not needed
+ * ownTable - on demand table, used if no table of the variant is given
+ * requestPipe, replyPipe - pipes to and from the worker, ends written by the main loop
+ * and read by it are non blocking
+ * worker - worker thread
+ * requestsCnt - analysis requests received
+ * droppedCnt - requests answered as unknown as the worker queue was full
+ **/
+typedef struct analyzer {
+	analysis_shard_t shards[ANALYSIS_SHARDS];
+	rules_t rules[2];
+	solver_table_t * tables[2];
+	solver_table_t ownTable;
+	int requestPipe[2];
+	int replyPipe[2];
+	pthread_t worker;
+	long requestsCnt;
+	long droppedCnt;
+} analyzer_t;
+
+/* headers of analysis functions */
+int analyzerInit(analyzer_t * analyzer, int heapsCnt, int maxTake, solver_table_t * table);
+
+void analyzePosition(analyzer_t * analyzer, game_type_t gameType, const short * heaps, analysis_t * out);
+
+int analyzeCached(analyzer_t * analyzer, game_type_t gameType, const short * heaps, analysis_t * out);
+
+int analysisSubmit(analyzer_t * analyzer, const analysis_request_t * request);
+
+int analysisReply(analyzer_t * analyzer, analysis_reply_t * reply);
+
+void analysisPrintStats(FILE * out, analyzer_t * analyzer);
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h> /* data types used in system calls */
+#include "transport.h" /* frame encoding */
+#include "capture.h"
+
+/**
+ * the function creates capture file and writes its header
+ * returns NULL on error
+ **/
+FILE * captureOpen(const char * path, const capture_header_t * header) {
+	FILE * out = fopen(path, "wb");
+	if (out == NULL) {
+		return NULL;
+	}
+	if (fwrite(header, sizeof(capture_header_t), 1, out) != 1) {
+		fclose(out);
+		return NULL;
+	}
+	return out;
+}
+
+/**
+ * the function appends record with encoded msg to the capture file,
+ * msg NULL writes record without frame
+ * records are buffered by stdio, caller flushes the file
+ * returns 0 on error
+ **/
+int captureWrite(FILE * out, long long ns, int conn, capture_kind_t kind, int flags, const game_msg_t * msg) {
+	char frame[CAPTURE_FRAME_SIZE];
+	capture_record_t record = { ns, conn, 0, kind, flags };
+	if (msg != NULL) {
+		record.size = encodeFrame(msg, frame, sizeof(frame));
+	}
+	return fwrite(&record, sizeof(record), 1, out) == 1 && fwrite(frame, 1, record.size, out) == record.size;
+}
+
+/**
+ * the function reads next record and its frame of CAPTURE_FRAME_SIZE bytes at most
+ * returns 0 at the end of file or on error
+ **/
+int captureRead(FILE * in, capture_record_t * record, char * frame) {
+	if (fread(record, sizeof(capture_record_t), 1, in) != 1 || record->size > CAPTURE_FRAME_SIZE) {
+		return 0;
+	}
+	return fread(frame, 1, record->size, in) == record->size;
+}
@@ -0,0 +1,54 @@
+#define CAPTURE_MAGIC 0x4e494d43 /* "NIMC" */
+#define CAPTURE_VERSION 3 /* layout of the capture file */
+#define CAPTURE_PEER_CLOSED (1) /* close flag: client closed the connection, server closed it otherwise */
+#define CAPTURE_FRAME_SIZE (MAX_FRAME_SIZE) /* maximal captured frame */
+
+/**
+ * definition of capture records:
+ * CAPTURE_OPEN - connection accepted
+ * CAPTURE_IN - frame received from the connection
+ * CAPTURE_OUT - frame queued to the connection, statuses are captured before coalescing
+ * CAPTURE_CLOSE - connection closed, flags tell which side closed it
+ **/
+typedef enum {
+	CAPTURE_OPEN, CAPTURE_IN, CAPTURE_OUT, CAPTURE_CLOSE
+} capture_kind_t;
+
+/**
+ * header of capture file, settings of the captured server
+ * sessionGraceSec - seconds seats were held, WELCOME carries random session token if not 0
+ **/
+typedef struct capture_header {
+	int magic;
+	int version;
+	int lobbyMode;
+	int p;
+	int gameType;
+	int M;
+	int heapsCnt;
+	int maxTake;
+	int sessionGraceSec;
+} capture_header_t;
+
+/**
+ * capture record, followed by size bytes of encoded frame
+ * ns - server time of the record
+ * conn - connection number, counted from 0 in order of accept
+ * size - size of the frame, 0 for open and close
+ * kind - capture_kind_t
+ * flags - CAPTURE_PEER_CLOSED for close
+ **/
+typedef struct capture_record {
+	long long ns;
+	int conn;
+	unsigned short size;
+	unsigned char kind;
+	unsigned char flags;
+} capture_record_t;
+
+/* headers of capture functions */
+FILE * captureOpen(const char * path, const capture_header_t * header);
+
+int captureWrite(FILE * out, long long ns, int conn, capture_kind_t kind, int flags, const game_msg_t * msg);
+
+int captureRead(FILE * in, capture_record_t * record, char * frame);
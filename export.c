@@ -0,0 +1,541 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* write(), close(), usleep() */
+#include <sys/types.h> /* data types used in system calls */
+#include <sys/socket.h> /* socket(), connect() */
+#include <sys/un.h> /* unix domain addresses */
+#include <netinet/in.h> /* internet domain addresses */
+#include <netdb.h> /* gethostbyname() */
+#include <fcntl.h> /* open(), nonblocking sink */
+#include <errno.h> /* EAGAIN */
+#include <poll.h> /* timed waits on the sink */
+#include <string.h> /* string functions */
+#include <time.h> /* clock_gettime() */
+#include <sys/stat.h> /* stat() of spill file */
+#include <pthread.h> /* sender thread */
+#include "export.h"
+
+#define RECORD_FIELDS 12 /* fields of record before its players */
+#define PLAYER_FIELDS 4 /* fields of each player */
+#define ALL_FIELDS (RECORD_FIELDS + PLAYER_FIELDS * EXPORT_PLAYERS)
+
+/**
+ * the function returns wall clock time in milliseconds, records are correlated by it downstream
+ **/
+long long wallMs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * the function lists numeric fields of record in encoding order, players past playersCnt are left 0
+ **/
+void recordFields(const export_record_t * record, long long * fields) {
+	memset(fields, 0, ALL_FIELDS * sizeof(long long));
+	fields[0] = (long long) record->seq;
+	fields[1] = record->serverStartMs;
+	fields[2] = record->startMs;
+	fields[3] = record->endMs;
+	fields[4] = record->slot;
+	fields[5] = record->gameType;
+	fields[6] = record->heapsCnt;
+	fields[7] = record->playersCnt;
+	fields[8] = record->tournament;
+	fields[9] = record->cubes;
+	fields[10] = record->movesCnt;
+	fields[11] = record->illegalCnt;
+	int i;
+	for (i = 0; i < record->playersCnt && i < EXPORT_PLAYERS; i++) {
+		long long * player = &fields[RECORD_FIELDS + i * PLAYER_FIELDS];
+		player[0] = record->players[i].playerId;
+		player[1] = record->players[i].clientId;
+		player[2] = record->players[i].result;
+		player[3] = record->players[i].moves;
+	}
+}
+
+/**
+ * the function writes record of listed fields
+ **/
+void fieldsRecord(const long long * fields, export_record_t * record) {
+	memset(record, 0, sizeof(export_record_t));
+	record->seq = (unsigned long long) fields[0];
+	record->serverStartMs = fields[1];
+	record->startMs = fields[2];
+	record->endMs = fields[3];
+	record->slot = fields[4];
+	record->gameType = fields[5];
+	record->heapsCnt = fields[6];
+	record->playersCnt = fields[7];
+	record->tournament = fields[8];
+	record->cubes = fields[9];
+	record->movesCnt = fields[10];
+	record->illegalCnt = fields[11];
+	int i;
+	for (i = 0; i < record->playersCnt; i++) {
+		const long long * player = &fields[RECORD_FIELDS + i * PLAYER_FIELDS];
+		record->players[i].playerId = player[0];
+		record->players[i].clientId = player[1];
+		record->players[i].result = player[2];
+		record->players[i].moves = player[3];
+	}
+}
+
+/**
+ * the function encodes records into out as deltas of their fields, out holds EXPORT_RECORD_MAX_SIZE per record
+ * returns size of encoded records
+ **/
+size_t exportEncode(const export_record_t * records, int recordsCnt, unsigned char * out) {
+	long long prev[ALL_FIELDS], fields[ALL_FIELDS];
+	memset(prev, 0, sizeof(prev));
+	size_t size = 0;
+	int i, f;
+	for (i = 0; i < recordsCnt; i++) {
+		recordFields(&records[i], fields);
+		int fieldsCnt = RECORD_FIELDS + PLAYER_FIELDS * records[i].playersCnt;
+		for (f = 0; f < fieldsCnt; f++) {
+			long long delta = fields[f] - prev[f];
+			unsigned long long zigzag = ((unsigned long long) delta << 1) ^ (unsigned long long) (delta >> 63);
+			while (zigzag >= 0x80) {
+				out[size++] = (unsigned char) (zigzag | 0x80);
+				zigzag >>= 7;
+			}
+			out[size++] = (unsigned char) zigzag;
+			prev[f] = fields[f];
+		}
+	}
+	return size;
+}
+
+/**
+ * the function decodes recordsCnt records encoded by exportEncode from size bytes of in
+ * returns 0 if the records are malformed or do not take exactly size bytes
+ **/
+int exportDecode(const unsigned char * in, size_t size, int recordsCnt, export_record_t * records) {
+	long long prev[ALL_FIELDS];
+	memset(prev, 0, sizeof(prev));
+	size_t pos = 0;
+	int i, f;
+	for (i = 0; i < recordsCnt; i++) {
+		int fieldsCnt = RECORD_FIELDS;
+		for (f = 0; f < fieldsCnt; f++) {
+			unsigned long long zigzag = 0;
+			int shift;
+			for (shift = 0;; shift += 7) {
+				if (pos == size || shift > 63) {
+					return 0;
+				}
+				zigzag |= (unsigned long long) (in[pos] & 0x7f) << shift;
+				if (!(in[pos++] & 0x80)) {
+					break;
+				}
+			}
+			prev[f] += (long long) ((zigzag >> 1) ^ -(zigzag & 1));
+			if (f == 7) { /* players count tells how many player fields follow */
+				if (prev[f] < 0 || prev[f] > EXPORT_PLAYERS) {
+					return 0;
+				}
+				fieldsCnt = RECORD_FIELDS + PLAYER_FIELDS * prev[f];
+			}
+		}
+		fieldsRecord(prev, &records[i]);
+	}
+	return pos == size;
+}
+
+/**
+ * the function connects the sink unless it is connected or waits for retry after failure
+ * returns 0 if the sink is not connected
+ **/
+int sinkConnect(exporter_t * exporter) {
+	if (exporter->sink != -1) {
+		return 1;
+	}
+	if (wallMs() < exporter->retryMs) {
+		return 0;
+	}
+	if (exporter->kind == EXPORT_FILE) {
+		exporter->sink = open(exporter->target, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	} else if ((exporter->sink = socket(exporter->addr.ss_family, SOCK_STREAM, 0)) != -1) {
+		fcntl(exporter->sink, F_SETFL, fcntl(exporter->sink, F_GETFL) | O_NONBLOCK);
+		if (connect(exporter->sink, (struct sockaddr *) &exporter->addr, exporter->addrLen) == -1) {
+			struct pollfd pfd = { exporter->sink, POLLOUT, 0 };
+			int error = 0;
+			socklen_t errorLen = sizeof(error);
+			if (errno != EINPROGRESS || poll(&pfd, 1, EXPORT_SEND_TIMEOUT_MS) != 1
+					|| getsockopt(exporter->sink, SOL_SOCKET, SO_ERROR, &error, &errorLen) == -1 || error != 0) {
+				close(exporter->sink);
+				exporter->sink = -1;
+			}
+		}
+	}
+	if (exporter->sink == -1) {
+		__atomic_add_fetch(&exporter->sinkFailures, 1, __ATOMIC_RELAXED);
+		exporter->retryMs = wallMs() + EXPORT_RETRY_MS;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * the function closes failed sink, it is connected again after EXPORT_RETRY_MS
+ **/
+void sinkFail(exporter_t * exporter) {
+	close(exporter->sink);
+	exporter->sink = -1;
+	__atomic_add_fetch(&exporter->sinkFailures, 1, __ATOMIC_RELAXED);
+	exporter->retryMs = wallMs() + EXPORT_RETRY_MS;
+}
+
+/**
+ * the function writes data to the sink, sink that fails or stalls longer than EXPORT_SEND_TIMEOUT_MS is closed
+ * returns 0 if the sink did not take all of it
+ **/
+int sinkWrite(exporter_t * exporter, const unsigned char * data, size_t size) {
+	long long deadlineMs = wallMs() + EXPORT_SEND_TIMEOUT_MS;
+	size_t done = 0;
+	while (done < size) {
+		ssize_t written = write(exporter->sink, data + done, size - done);
+		if (written > 0) {
+			done += written;
+			continue;
+		}
+		long long leftMs = deadlineMs - wallMs();
+		struct pollfd pfd = { exporter->sink, POLLOUT, 0 };
+		if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) && leftMs > 0 && poll(&pfd, 1, leftMs) != -1) {
+			continue;
+		}
+		sinkFail(exporter);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * the function waits for the sink to acknowledge the chunk, file sink is acknowledged once it is synced to disk
+ * sink that fails, acknowledges other chunk or does not acknowledge within EXPORT_SEND_TIMEOUT_MS is closed
+ * returns 0 if the chunk was not acknowledged
+ **/
+int sinkAwaitAck(exporter_t * exporter, const export_chunk_header_t * header) {
+	if (exporter->kind == EXPORT_FILE) {
+		if (fsync(exporter->sink) == 0) {
+			return 1;
+		}
+		sinkFail(exporter);
+		return 0;
+	}
+	export_ack_t ack;
+	long long deadlineMs = wallMs() + EXPORT_SEND_TIMEOUT_MS;
+	size_t done = 0;
+	while (done < sizeof(ack)) {
+		ssize_t got = read(exporter->sink, (char *) &ack + done, sizeof(ack) - done);
+		if (got > 0) {
+			done += got;
+			continue;
+		}
+		long long leftMs = deadlineMs - wallMs();
+		struct pollfd pfd = { exporter->sink, POLLIN, 0 };
+		if (got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) && leftMs > 0 && poll(&pfd, 1, leftMs) != -1) {
+			continue;
+		}
+		sinkFail(exporter);
+		return 0;
+	}
+	if (ack.magic != EXPORT_ACK_MAGIC || ack.firstSeq != header->firstSeq || ack.recordsCnt != header->recordsCnt) {
+		sinkFail(exporter);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * the function sends chunk to the sink and waits until the sink acknowledges it
+ * returns 0 if the chunk was not acknowledged
+ **/
+int sinkSend(exporter_t * exporter, const unsigned char * chunk) {
+	const export_chunk_header_t * header = (const export_chunk_header_t *) chunk;
+	return sinkConnect(exporter) && sinkWrite(exporter, chunk, sizeof(export_chunk_header_t) + header->size) && sinkAwaitAck(exporter, header);
+}
+
+/**
+ * the function appends chunk to the spill file
+ * returns 0 if the chunk could not be kept, it is lost
+ **/
+int spillChunk(exporter_t * exporter, const unsigned char * chunk, size_t size) {
+	int fd = open(exporter->spillPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd == -1) {
+		return 0;
+	}
+	int spilled = write(fd, chunk, size) == size;
+	close(fd);
+	if (spilled) {
+		exporter->spillBytes += size;
+		__atomic_add_fetch(&exporter->chunksSpilled, 1, __ATOMIC_RELAXED);
+	}
+	return spilled;
+}
+
+/**
+ * the function sends spilled chunks to the sink in the order they were spilled and empties the spill file
+ * once all of them were acknowledged, the spill file is kept whole if the sink fails in the middle,
+ * chunks acknowledged before are sent again
+ * returns 0 if the spill file is not empty
+ **/
+int replaySpill(exporter_t * exporter, unsigned char * chunk) {
+	if (exporter->spillBytes == 0) {
+		return 1;
+	}
+	if (!sinkConnect(exporter)) {
+		return 0;
+	}
+	int fd = open(exporter->spillPath, O_RDONLY);
+	if (fd == -1) {
+		exporter->spillBytes = 0;
+		return 1;
+	}
+	export_chunk_header_t * header = (export_chunk_header_t *) chunk;
+	long replayed = 0;
+	int sent = 1;
+	while (sent && read(fd, header, sizeof(export_chunk_header_t)) == sizeof(export_chunk_header_t)) {
+		if (header->magic != EXPORT_MAGIC || header->size > EXPORT_CHUNK_SIZE) { /* torn tail of the spill file */
+			break;
+		}
+		if (read(fd, header + 1, header->size) != header->size) {
+			break;
+		}
+		if ((sent = sinkSend(exporter, chunk))) {
+			replayed++;
+		}
+	}
+	close(fd);
+	if (!sent) {
+		return 0;
+	}
+	if (truncate(exporter->spillPath, 0) == 0) {
+		exporter->spillBytes = 0;
+	}
+	__atomic_add_fetch(&exporter->spillsReplayed, replayed, __ATOMIC_RELAXED);
+	return exporter->spillBytes == 0;
+}
+
+/**
+ * the function encodes records into chunk and delivers it: to the sink after spilled chunks,
+ * to the spill file if the sink does not acknowledge them
+ **/
+void deliverChunk(exporter_t * exporter, const export_record_t * records, int recordsCnt, unsigned char * chunk) {
+	export_chunk_header_t * header = (export_chunk_header_t *) chunk;
+	header->magic = EXPORT_MAGIC;
+	header->version = EXPORT_VERSION;
+	header->recordsCnt = recordsCnt;
+	header->firstSeq = records[0].seq;
+	header->size = exportEncode(records, recordsCnt, (unsigned char *) (header + 1));
+	size_t size = sizeof(export_chunk_header_t) + header->size;
+	if (exporter->spillBytes == 0 || replaySpill(exporter, (unsigned char *) (header + 1) + header->size)) {
+		if (sinkSend(exporter, chunk)) {
+			__atomic_add_fetch(&exporter->chunksSent, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&exporter->recordsSent, recordsCnt, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&exporter->bytesSent, size, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+	if (!spillChunk(exporter, chunk, size)) {
+		__atomic_add_fetch(&exporter->chunksLost, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * export sender - batches queued records into chunks till stopped, chunk is delivered
+ * once it is full or its oldest record waited EXPORT_FLUSH_MS, records queued when stopped are flushed
+ **/
+void * exportSender(void * arg) {
+	exporter_t * exporter = (exporter_t *) arg;
+	static export_record_t batch[EXPORT_CHUNK_RECORDS];
+	/* chunk being delivered followed by room for spilled chunk being replayed */
+	static unsigned char chunk[2 * (sizeof(export_chunk_header_t) + EXPORT_CHUNK_SIZE)];
+	int batchCnt = 0;
+	long long batchStartMs = 0;
+	while (1) {
+		int stop = __atomic_load_n(&exporter->stop, __ATOMIC_ACQUIRE);
+		unsigned long head = __atomic_load_n(&exporter->head, __ATOMIC_ACQUIRE);
+		unsigned long tail = exporter->tail;
+		while (tail != head && batchCnt < EXPORT_CHUNK_RECORDS) {
+			if (batchCnt == 0) {
+				batchStartMs = wallMs();
+			}
+			batch[batchCnt++] = exporter->ring[tail & (EXPORT_QUEUE_RECORDS - 1)];
+			tail++;
+		}
+		__atomic_store_n(&exporter->tail, tail, __ATOMIC_RELEASE); /* the main loop may reuse taken entries */
+		if (batchCnt > 0 && (batchCnt == EXPORT_CHUNK_RECORDS || stop || wallMs() - batchStartMs >= EXPORT_FLUSH_MS)) {
+			deliverChunk(exporter, batch, batchCnt, chunk);
+			batchCnt = 0;
+		} else if (tail == head) {
+			if (stop) {
+				break;
+			}
+			if (exporter->spillBytes != 0 && batchCnt == 0) { /* sink may be back while no games end */
+				replaySpill(exporter, chunk);
+			}
+			usleep(EXPORT_IDLE_MS * 1000);
+		}
+	}
+	if (exporter->sink != -1) {
+		close(exporter->sink);
+		exporter->sink = -1;
+	}
+	return NULL;
+}
+
+/**
+ * the function resolves sink given as unix:path, tcp:host:port, file:path or plain file path
+ * returns 0 if the sink is malformed or its host is unknown
+ **/
+int parseSink(exporter_t * exporter, const char * sink) {
+	if (strncmp(sink, "unix:", 5) == 0) {
+		struct sockaddr_un * addr = (struct sockaddr_un *) &exporter->addr;
+		if (strlen(sink + 5) == 0 || strlen(sink + 5) >= sizeof(addr->sun_path)) {
+			return 0;
+		}
+		exporter->kind = EXPORT_UNIX;
+		strcpy(exporter->target, sink + 5);
+		addr->sun_family = AF_UNIX;
+		strcpy(addr->sun_path, exporter->target);
+		exporter->addrLen = sizeof(struct sockaddr_un);
+	} else if (strncmp(sink, "tcp:", 4) == 0) {
+		struct sockaddr_in * addr = (struct sockaddr_in *) &exporter->addr;
+		const char * colon = strrchr(sink + 4, ':');
+		if (colon == NULL || colon == sink + 4 || colon - (sink + 4) >= sizeof(exporter->target) || atoi(colon + 1) <= 0) {
+			return 0;
+		}
+		exporter->kind = EXPORT_TCP;
+		memcpy(exporter->target, sink + 4, colon - (sink + 4));
+		struct hostent * host = gethostbyname(exporter->target); /* resolved once, the sender never blocks on DNS */
+		if (host == NULL || host->h_addrtype != AF_INET) {
+			return 0;
+		}
+		addr->sin_family = AF_INET;
+		addr->sin_port = htons(atoi(colon + 1));
+		memcpy(&addr->sin_addr, host->h_addr_list[0], sizeof(addr->sin_addr));
+		exporter->addrLen = sizeof(struct sockaddr_in);
+	} else {
+		const char * path = (strncmp(sink, "file:", 5) == 0) ? sink + 5 : sink;
+		if (strlen(path) == 0 || strlen(path) >= sizeof(exporter->target)) {
+			return 0;
+		}
+		exporter->kind = EXPORT_FILE;
+		strcpy(exporter->target, path);
+	}
+	return 1;
+}
+
+/**
+ * the function resolves the sink and starts the sender, spillPath NULL spills to EXPORT_SPILL_DEFAULT
+ * chunks spilled by previous server are sent before new ones
+ * returns 0 on error
+ **/
+int exportOpen(exporter_t * exporter, const char * sink, const char * spillPath) {
+	memset(exporter, 0, sizeof(exporter_t));
+	exporter->sink = -1;
+	exporter->spillPath = (spillPath != NULL) ? spillPath : EXPORT_SPILL_DEFAULT;
+	exporter->serverStartMs = wallMs();
+	if (!parseSink(exporter, sink)) {
+		return 0;
+	}
+	struct stat spillStat;
+	if (stat(exporter->spillPath, &spillStat) == 0) {
+		exporter->spillBytes = spillStat.st_size;
+	}
+	return pthread_create(&exporter->sender, NULL, exportSender, exporter) == 0;
+}
+
+/**
+ * the function stops the sender after it flushed backlog and queued records to the sink or the spill file
+ **/
+void exportClose(exporter_t * exporter) {
+	while (exportPump(exporter) > 0) { /* sender makes room as it spills at worst */
+		usleep(EXPORT_IDLE_MS * 1000);
+	}
+	free(exporter->backlog);
+	exporter->backlog = NULL;
+	exporter->backlogCap = 0;
+	__atomic_store_n(&exporter->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(exporter->sender, NULL);
+}
+
+/**
+ * the function puts copy of record to the ring of the sender
+ * returns 0 if the ring is full
+ **/
+int exportEnqueue(exporter_t * exporter, const export_record_t * record) {
+	unsigned long head = exporter->head;
+	if (head - __atomic_load_n(&exporter->tail, __ATOMIC_ACQUIRE) == EXPORT_QUEUE_RECORDS) {
+		return 0;
+	}
+	exporter->ring[head & (EXPORT_QUEUE_RECORDS - 1)] = *record;
+	__atomic_store_n(&exporter->head, head + 1, __ATOMIC_RELEASE); /* record is visible before the sender takes it */
+	return 1;
+}
+
+/**
+ * the function moves records waiting in backlog to the ring as far as the sender made room, called by the main loop
+ * returns number of records left in backlog
+ **/
+int exportPump(exporter_t * exporter) {
+	while (exporter->backlogHead < exporter->backlogCnt && exportEnqueue(exporter, &exporter->backlog[exporter->backlogHead])) {
+		exporter->backlogHead++;
+	}
+	if (exporter->backlogHead == exporter->backlogCnt) {
+		exporter->backlogHead = 0;
+		exporter->backlogCnt = 0;
+	}
+	return exporter->backlogCnt - exporter->backlogHead;
+}
+
+/**
+ * the function queues copy of record to the sender without blocking and gives it seq,
+ * record waits in backlog while the ring is full or older records wait there
+ * returns 0 if there is no memory for backlog, the record is dropped
+ **/
+int exportSubmit(exporter_t * exporter, export_record_t * record) {
+	record->seq = exporter->nextSeq;
+	record->serverStartMs = exporter->serverStartMs;
+	if (exportPump(exporter) == 0 && exportEnqueue(exporter, record)) {
+		exporter->nextSeq++;
+		exporter->queuedCnt++;
+		return 1;
+	}
+	if (exporter->backlogCnt == exporter->backlogCap && exporter->backlogHead > 0) { /* records moved to the ring make room */
+		exporter->backlogCnt -= exporter->backlogHead;
+		memmove(exporter->backlog, exporter->backlog + exporter->backlogHead, exporter->backlogCnt * sizeof(export_record_t));
+		exporter->backlogHead = 0;
+	}
+	if (exporter->backlogCnt == exporter->backlogCap) {
+		int cap = (exporter->backlogCap == 0) ? EXPORT_BACKLOG_MIN : exporter->backlogCap * 2;
+		export_record_t * backlog = (export_record_t *) realloc(exporter->backlog, cap * sizeof(export_record_t));
+		if (backlog == NULL) {
+			exporter->droppedCnt++;
+			return 0;
+		}
+		exporter->backlog = backlog;
+		exporter->backlogCap = cap;
+	}
+	exporter->backlog[exporter->backlogCnt++] = *record;
+	exporter->nextSeq++;
+	exporter->queuedCnt++;
+	exporter->backloggedCnt++;
+	return 1;
+}
+
+/**
+ * the function prints export counters, spilled chunks are sent again once the sink is back
+ **/
+void exportPrintStats(FILE * out, exporter_t * exporter) {
+	fprintf(out, "export queued=%ld backlogged=%ld backlog=%d dropped=%ld pending=%lu chunks=%ld records=%ld bytes=%lld spilled=%ld replayed=%ld lost=%ld sink_failures=%ld\n",
+			exporter->queuedCnt, exporter->backloggedCnt, exporter->backlogCnt - exporter->backlogHead, exporter->droppedCnt,
+			exporter->head - __atomic_load_n(&exporter->tail, __ATOMIC_ACQUIRE),
+			__atomic_load_n(&exporter->chunksSent, __ATOMIC_RELAXED), __atomic_load_n(&exporter->recordsSent, __ATOMIC_RELAXED),
+			__atomic_load_n(&exporter->bytesSent, __ATOMIC_RELAXED), __atomic_load_n(&exporter->chunksSpilled, __ATOMIC_RELAXED),
+			__atomic_load_n(&exporter->spillsReplayed, __ATOMIC_RELAXED), __atomic_load_n(&exporter->chunksLost, __ATOMIC_RELAXED),
+			__atomic_load_n(&exporter->sinkFailures, __ATOMIC_RELAXED));
+}
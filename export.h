@@ -0,0 +1,168 @@
+#define EXPORT_MAGIC 0x4e494d58 /* "NIMX" */
+#define EXPORT_VERSION 1 /* layout of export chunks */
+#define EXPORT_PLAYERS (9) /* players of exported game, MAX_PLAYERS of the server */
+#define EXPORT_QUEUE_RECORDS (4096) /* records queued to the sender, power of 2, results wait in backlog of the main loop when it is full */
+#define EXPORT_BACKLOG_MIN (256) /* records allocated first for the backlog, backlog doubles when full */
+#define EXPORT_CHUNK_RECORDS (256) /* records encoded in one chunk at most */
+#define EXPORT_RECORD_MAX_SIZE (256) /* encoded record never takes more */
+#define EXPORT_CHUNK_SIZE (EXPORT_CHUNK_RECORDS * EXPORT_RECORD_MAX_SIZE) /* encoded records of chunk fit in it */
+#define EXPORT_FLUSH_MS (200) /* chunk is sent when it is full or its oldest record waited this long */
+#define EXPORT_IDLE_MS (10) /* sender sleeps this long when the queue is empty */
+#define EXPORT_SEND_TIMEOUT_MS (500) /* sink slower than this to take or acknowledge the chunk gets it spilled */
+#define EXPORT_RETRY_MS (1000) /* sink that failed is connected again after this long */
+#define EXPORT_SPILL_DEFAULT "nim-export.spill" /* spill file of chunks the sink did not acknowledge */
+#define EXPORT_ACK_MAGIC 0x4e494d41 /* "NIMA" */
+
+/**
+ * sink kinds, given as unix:path, tcp:host:port or file:path
+ **/
+typedef enum {
+	EXPORT_UNIX, EXPORT_TCP, EXPORT_FILE
+} export_sink_kind_t;
+
+/**
+ * player of exported game
+ * playerId - identity of the player, 0 if anonymous
+ * clientId - client ID of the player in the game
+ * result - end_game_t of the player
+ * moves - moves the player made, illegal ones included
+ **/
+typedef struct export_player {
+	unsigned int playerId;
+	char clientId;
+	char result;
+	unsigned short moves;
+} export_player_t;
+
+/**
+ * result of ended game with summary of its moves
+ * seq - record sequence of the exporting server, resent duplicates have equal seq and serverStartMs
+ * serverStartMs - time the exporter of the server started
+ * startMs, endMs - wall clock time the game started and ended
+ * slot - game slot of the game
+ * gameType - game_type_t of the game
+ * heapsCnt - heaps in play
+ * cubes - cubes in each heap at start
+ * movesCnt - moves made, illegalCnt of them illegal
+ * playersCnt - entries of players
+ * tournament - 1 if the game was played for tournament
+ **/
+typedef struct export_record {
+	unsigned long long seq;
+	long long serverStartMs;
+	long long startMs;
+	long long endMs;
+	unsigned int slot;
+	unsigned char gameType;
+	unsigned char heapsCnt;
+	unsigned char playersCnt;
+	unsigned char tournament;
+	short cubes;
+	unsigned short movesCnt;
+	unsigned short illegalCnt;
+	export_player_t players[EXPORT_PLAYERS];
+} export_record_t;
+
+/**
+ * header of chunk, followed by size bytes of records compressed by delta and varint encoding:
+ * each numeric field is written as zigzag varint of its difference to the same field of previous record
+ * of the chunk, so records of one server mostly take a byte per field
+ * recordsCnt - records in the chunk
+ * size - size of encoded records
+ * firstSeq - seq of the first record
+ **/
+typedef struct export_chunk_header {
+	int magic;
+	short version;
+	unsigned short recordsCnt;
+	unsigned int size;
+	unsigned long long firstSeq;
+} export_chunk_header_t;
+
+/**
+ * acknowledgement the sink sends back once it took the chunk whole, socket sinks acknowledge every chunk
+ * before the next one is sent, file sink is acknowledged by fsync
+ * recordsCnt, firstSeq - equal to those of the chunk header
+ **/
+typedef struct export_ack {
+	int magic;
+	unsigned int recordsCnt;
+	unsigned long long firstSeq;
+} export_ack_t;
+
+/**
+ * exporter of game results, the main loop queues records to bounded lock-free ring
+ * and sender thread batches them into chunks delivered to the sink at least once:
+ * chunk stays with the sender until the sink acknowledges it, chunk not acknowledged in time
+ * is appended to spill file, spilled chunks are sent first once the sink is back and the file
+ * is emptied only after all of them were acknowledged, records the full ring can't take wait
+ * in the backlog of the main loop, so the main loop never waits for the sender
+ * ring - records, written only by the main loop and read only by the sender
+ * head - records queued, written by the main loop
+ * tail - records taken by the sender, written by the sender
+ * kind, target, addr - sink and its resolved address
+ * spillPath - spill file
+ * serverStartMs - time the exporter started, carried by the records
+ * nextSeq - seq of next record
+ * backlog - records waiting for room in the ring in submit order, owned by the main loop
+ * backlogHead, backlogCnt - records of backlog moved to the ring already and records in it
+ * backlogCap - size of backlog array
+ * stop - set to make the sender flush queued records and exit
+ * sender - sender thread
+ * sink - connected sink, -1 if none
+ * retryMs - time the sink is connected again after failure
+ * spillBytes - size of spill file, chunks in it are sent before new ones
+ * queuedCnt, backloggedCnt, droppedCnt - records queued, records that waited in backlog and records dropped
+ * as there was no memory for backlog, counted by the main loop
+ * chunksSent, recordsSent, bytesSent - chunks acknowledged by the sink with their records and bytes
+ * chunksSpilled, spillsReplayed, chunksLost, sinkFailures - counters of the sender,
+ * chunk is lost only if it was neither acknowledged nor spilled
+ **/
+typedef struct exporter {
+	export_record_t ring[EXPORT_QUEUE_RECORDS];
+	unsigned long head;
+	unsigned long tail;
+	export_sink_kind_t kind;
+	char target[256];
+	struct sockaddr_storage addr;
+	socklen_t addrLen;
+	const char * spillPath;
+	long long serverStartMs;
+	unsigned long long nextSeq;
+	export_record_t * backlog;
+	int backlogHead;
+	int backlogCnt;
+	int backlogCap;
+	int stop;
+	pthread_t sender;
+	int sink;
+	long long retryMs;
+	long long spillBytes;
+	long queuedCnt;
+	long backloggedCnt;
+	long droppedCnt;
+	long chunksSent;
+	long recordsSent;
+	long long bytesSent;
+	long chunksSpilled;
+	long spillsReplayed;
+	long chunksLost;
+	long sinkFailures;
+} exporter_t;
+
+/* headers of export functions */
+long long wallMs();
+
+int exportOpen(exporter_t * exporter, const char * sink, const char * spillPath);
+
+void exportClose(exporter_t * exporter);
+
+int exportSubmit(exporter_t * exporter, export_record_t * record);
+
+int exportPump(exporter_t * exporter);
+
+size_t exportEncode(const export_record_t * records, int recordsCnt, unsigned char * out);
+
+int exportDecode(const unsigned char * in, size_t size, int recordsCnt, export_record_t * records);
+
+void exportPrintStats(FILE * out, exporter_t * exporter);
@@ -0,0 +1,77 @@
+#define _GNU_SOURCE /* sched_setaffinity() */
+#include <stdio.h>
+#include <time.h> /* clock_gettime() */
+#include <sched.h> /* sched_setaffinity() */
+#include "latency.h"
+
+/**
+ * the function returns monotonic time in nanoseconds
+ * timestamps are meaningful only on the host that took them
+ **/
+long long nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * the function adds sample to histogram
+ * negative samples (clock skew between calls) are counted as 0
+ **/
+void histRecord(latency_hist_t * hist, long long ns) {
+	if (ns < 0) {
+		ns = 0;
+	}
+	int bucket = (ns == 0) ? 0 : 64 - __builtin_clzll((unsigned long long) ns);
+	if (bucket >= LATENCY_BUCKETS) {
+		bucket = LATENCY_BUCKETS - 1;
+	}
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->sumNs += ns;
+	if (ns > hist->maxNs) {
+		hist->maxNs = ns;
+	}
+}
+
+/**
+ * the function returns upper bound of the bucket holding the percentile
+ * returns 0 for empty histogram
+ **/
+long long histPercentile(const latency_hist_t * hist, double percentile) {
+	unsigned long long rank = (unsigned long long) (hist->count * percentile / 100.0);
+	unsigned long long seen = 0;
+	int i;
+	if (hist->count == 0) {
+		return 0;
+	}
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen > rank) {
+			long long upper = (i == 0) ? 0 : (1LL << i);
+			return (upper < hist->maxNs) ? upper : hist->maxNs;
+		}
+	}
+	return hist->maxNs;
+}
+
+/**
+ * the function prints histogram summary in one line of key=value pairs
+ **/
+void histPrint(FILE * out, const latency_hist_t * hist) {
+	fprintf(out, "latency name=%s count=%llu avg_us=%.1f p50_us=%.1f p90_us=%.1f p99_us=%.1f max_us=%.1f\n",
+			hist->name, hist->count, (hist->count) ? hist->sumNs / 1000.0 / hist->count : 0.0,
+			histPercentile(hist, 50) / 1000.0, histPercentile(hist, 90) / 1000.0,
+			histPercentile(hist, 99) / 1000.0, hist->maxNs / 1000.0);
+}
+
+/**
+ * the function pins the process to the cpu
+ * returns 0 on success
+ **/
+int pinCpu(int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
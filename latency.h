@@ -0,0 +1,28 @@
+#define LATENCY_BUCKETS (64) /* power of two buckets of nanoseconds */
+
+/**
+ * latency histogram
+ * name - name printed with the histogram
+ * buckets - bucket i counts samples in range [2^(i-1), 2^i) ns
+ * count - number of samples recorded
+ * sumNs - sum of samples
+ * maxNs - maximal sample
+ **/
+typedef struct latency_hist {
+	const char * name;
+	unsigned long long buckets[LATENCY_BUCKETS];
+	unsigned long long count;
+	long long sumNs;
+	long long maxNs;
+} latency_hist_t;
+
+/* headers of latency functions */
+long long nowNs();
+
+void histRecord(latency_hist_t * hist, long long ns);
+
+long long histPercentile(const latency_hist_t * hist, double percentile);
+
+void histPrint(FILE * out, const latency_hist_t * hist);
+
+int pinCpu(int cpu);
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h> /* data types used in system calls */
+#include <sys/select.h> /* fd_set */
+#include "transport.h" /* common data with client */
+#include "rules.h" /* game variant rules */
+#include "admission.h" /* load shedding */
+#include "nim-server.h" /* client structure */
+#include "lobby.h"
+
+/* queues by game type and number of players, index 0 holds spectators */
+lobby_queue_t lobbyQueues[2][MAX_PLAYERS + 1];
+
+/**
+ * the function returns queue for given game type and number of players
+ * playersCnt 0 returns spectators queue of the game type
+ * returns NULL if there is no such queue
+ **/
+lobby_queue_t * getLobbyQueue(game_type_t gameType, int playersCnt) {
+	if ((gameType != MISERE && gameType != REGULAR) || playersCnt < 0 || playersCnt > MAX_PLAYERS || playersCnt == 1) {
+		return NULL;
+	}
+	lobby_queue_t * queue = &lobbyQueues[gameType][playersCnt];
+	queue->gameType = gameType;
+	queue->playersCnt = playersCnt;
+	return queue;
+}
+
+/**
+ * the function adds client to the end of the queue
+ * returns 0 if there is no memory for queue links of the client
+ **/
+int lobbyPush(lobby_queue_t * queue, client_t * client) {
+	client_ext_t * ext = clientExt(client);
+	if (ext == NULL) {
+		return 0;
+	}
+	ext->queue = queue;
+	ext->queueNext = NULL;
+	ext->queuePrev = queue->tail;
+	if (queue->tail != NULL) {
+		queue->tail->ext->queueNext = client;
+	} else {
+		queue->head = client;
+	}
+	queue->tail = client;
+	queue->count++;
+	return 1;
+}
+
+/**
+ * the function removes client from its queue
+ * does nothing if client is not waiting
+ **/
+void lobbyRemove(client_t * client) {
+	client_ext_t * ext = client->ext;
+	lobby_queue_t * queue = (ext != NULL) ? ext->queue : NULL;
+	if (queue == NULL) {
+		return;
+	}
+	if (ext->queuePrev != NULL) {
+		ext->queuePrev->ext->queueNext = ext->queueNext;
+	} else {
+		queue->head = ext->queueNext;
+	}
+	if (ext->queueNext != NULL) {
+		ext->queueNext->ext->queuePrev = ext->queuePrev;
+	} else {
+		queue->tail = ext->queuePrev;
+	}
+	ext->queue = NULL;
+	ext->queuePrev = NULL;
+	ext->queueNext = NULL;
+	queue->count--;
+}
+
+/**
+ * the function takes first client from the queue
+ * returns NULL if queue is empty
+ **/
+client_t * lobbyPop(lobby_queue_t * queue) {
+	client_t * client = queue->head;
+	if (client != NULL) {
+		lobbyRemove(client);
+	}
+	return client;
+}
@@ -0,0 +1,23 @@
+/**
+ * lobby queue - FIFO of clients waiting for a game
+ * gameType - type of game clients wait for
+ * playersCnt - number of players in the game, 0 for spectators queue
+ * head, tail - first and last waiting clients
+ * count - number of waiting clients
+ **/
+typedef struct LobbyQueue {
+	game_type_t gameType;
+	int playersCnt;
+	client_t * head;
+	client_t * tail;
+	int count;
+} lobby_queue_t;
+
+/* headers of lobby functions */
+lobby_queue_t * getLobbyQueue(game_type_t gameType, int playersCnt);
+
+int lobbyPush(lobby_queue_t * queue, client_t * client);
+
+client_t * lobbyPop(lobby_queue_t * queue);
+
+void lobbyRemove(client_t * client);
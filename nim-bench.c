@@ -0,0 +1,589 @@
+#define _GNU_SOURCE /* sched_getcpu() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* for read(), write() */
+#include <sys/types.h> /* data types used in system calls */
+#include <sys/socket.h> /* definitions of structures needed for sockets */
+#include <string.h> /* string functions */
+#include <errno.h> /* error messages */
+#include <fcntl.h> /* open() */
+#include <sched.h> /* sched_getcpu() */
+#include "transport.h" /* common data with client */
+#include "latency.h" /* nowNs(), pinCpu() */
+#include "rules.h" /* game variant rules */
+#include "admission.h" /* load shedding */
+#include "nim-server.h" /* server game logic under benchmark */
+#include "solver.h" /* solved positions */
+#include "analysis.h" /* position analysis */
+#include "rating.h" /* player ratings */
+#include "snapshot.h" /* shared memory game snapshots */
+#include <pthread.h> /* sender of exporter */
+#include "export.h" /* export of game results */
+
+#define DEFAULT_ITERATIONS 200000 /* iterations in one repetition */
+#define DEFAULT_REPETITIONS 15 /* measured repetitions, median is reported */
+#define DEFAULT_WARMUP 20000 /* iterations run before measuring */
+#define MAX_REPETITIONS 101
+#define HEAP_CUBES 1500 /* cubes in each heap for game logic benchmarks */
+
+/* benchmark step - runs given number of iterations of the measured code */
+typedef void (*bench_fn_t)(long iterations);
+
+/* benchmark setup - prepares state for given parameter (roster size, cubes) */
+typedef void (*bench_setup_t)(int arg);
+
+/**
+ * benchmark description
+ * name - benchmark name printed in results
+ * setup - function preparing the state, can be NULL
+ * run - measured function
+ * arg - parameter passed to setup and printed in results
+ **/
+typedef struct bench {
+	const char * name;
+	bench_setup_t setup;
+	bench_fn_t run;
+	int arg;
+} bench_t;
+
+volatile long sink; /* consumes results so the compiler can't drop measured code */
+
+game_t * benchGame; /* game used by game logic benchmarks */
+int rosterSize; /* number of clients in benchGame for current benchmark */
+game_msg_t benchMsg; /* message used by current benchmark */
+char frame[MAX_FRAME_SIZE]; /* encoded benchMsg */
+size_t frameSize;
+int pairFd[2] = { -1, -1 }; /* socketpair for transport benchmarks */
+buffered_socket_t pairTx, pairRx; /* buffered ends of the socketpair */
+solver_table_t benchTable; /* in memory table for solver benchmarks */
+extern analyzer_t analyzer; /* analyzer of the server logic under benchmark */
+extern rating_table_t ratings; /* ratings of the server logic under benchmark */
+int ratedCnt; /* players rated by rating benchmarks */
+int ratedIdx[RATING_CAPACITY / 2]; /* table entries of the rated players */
+extern snapshot_map_t snapshots; /* game snapshots of the server logic under benchmark */
+extern exporter_t exporter; /* exporter of the server logic under benchmark, its sender is not started */
+export_record_t benchRecords[EXPORT_CHUNK_RECORDS]; /* results of consecutive games for export benchmarks */
+unsigned char benchChunk[EXPORT_CHUNK_SIZE]; /* encoded results of export benchmarks */
+
+/**
+ * the function frees clients created by setupRoster
+ **/
+void freeRoster() {
+	if (benchGame == NULL) {
+		return;
+	}
+	int id;
+	for (id = 0; id < MAX_ID; id++) {
+		client_t * client = benchGame->clientList[id];
+		if (client != NULL) {
+			connList[client->sock.socket] = NULL;
+			close(client->sock.socket);
+			releaseBuffers(&client->sock);
+			destroyClient(client);
+			benchGame->clientList[id] = NULL;
+		}
+	}
+	destroyGame(benchGame);
+	benchGame = NULL;
+	rosterSize = 0;
+}
+
+/**
+ * the function creates game with n players, first of them has the turn
+ * clients write to /dev/null descriptors which are never write-ready,
+ * so all output stays in their buffers
+ **/
+void setupRoster(int n) {
+	freeRoster();
+	benchGame = createGame(REGULAR, (n < MAX_NUM_OF_CLIENTS) ? n : MAX_NUM_OF_CLIENTS, HEAP_CUBES);
+	int id;
+	for (id = 0; id < n && id < MAX_ID; id++) {
+		client_t * client = createClient(open("/dev/null", O_WRONLY));
+		addClientToGame(benchGame, client, (id == 0) ? YOUR_TURN : PLAYING);
+	}
+	rosterSize = n;
+}
+
+/**
+ * the function empties output buffers of the roster
+ * called every few iterations so handleMsg never sees a full buffer
+ **/
+void drainRoster() {
+	int id;
+	for (id = 0; id < rosterSize; id++) {
+		releaseBuffers(&benchGame->clientList[id]->sock);
+	}
+}
+
+/* message setups */
+void setupStatusDelta(int arg) {
+	memset(&benchMsg, 0, sizeof(game_msg_t));
+	benchMsg.type = STATUS;
+	benchMsg.payload.status.seq = 7;
+	benchMsg.payload.status.clientStatus = PLAYING;
+	benchMsg.payload.status.endGame = NOT_FINISHED;
+	benchMsg.payload.status.changedHeap = 2;
+	benchMsg.payload.status.changedAmount = 11;
+	frameSize = encodeFrame(&benchMsg, frame, sizeof(frame));
+}
+
+void setupStatusKeyframe(int arg) {
+	setupStatusDelta(arg);
+	benchMsg.payload.status.flags = STATUS_KEYFRAME;
+	frameSize = encodeFrame(&benchMsg, frame, sizeof(frame));
+}
+
+void setupSessionStatusDelta(int arg) {
+	setupStatusDelta(arg);
+	benchMsg.session = arg;
+	frameSize = encodeFrame(&benchMsg, frame, sizeof(frame));
+}
+
+void setupChat(int arg) {
+	memset(&benchMsg, 0, sizeof(game_msg_t));
+	benchMsg.type = CHAT;
+	benchMsg.payload.chat.srcId = 1;
+	benchMsg.payload.chat.dstId = -1;
+	strcpy(benchMsg.payload.chat.text, "good luck, have fun");
+	frameSize = encodeFrame(&benchMsg, frame, sizeof(frame));
+}
+
+/**
+ * the function creates socketpair with buffered ends and status message to pass
+ **/
+void setupSocketPair(int arg) {
+	if (pairFd[0] == -1 && socketpair(AF_UNIX, SOCK_STREAM, 0, pairFd) == -1) {
+		fprintf(stderr, "Error creating socketpair: %s!\n", strerror(errno));
+		exit(1);
+	}
+	fcntl(pairFd[0], F_SETFL, fcntl(pairFd[0], F_GETFL, 0) | O_NONBLOCK);
+	fcntl(pairFd[1], F_SETFL, fcntl(pairFd[1], F_GETFL, 0) | O_NONBLOCK);
+	memset(&pairTx, 0, sizeof(buffered_socket_t));
+	memset(&pairRx, 0, sizeof(buffered_socket_t));
+	pairTx.socket = pairFd[0];
+	pairRx.socket = pairFd[1];
+	pairTx.writeReady = 1;
+	setupStatusDelta(arg);
+}
+
+/* game logic setups */
+void setupTurnReq(int arg) {
+	setupRoster(arg);
+	memset(&benchMsg, 0, sizeof(game_msg_t));
+	benchMsg.type = TURN_REQ;
+	benchMsg.payload.turnReq.heapIndex = 1;
+	benchMsg.payload.turnReq.amount = 1;
+}
+
+void setupChatRoster(int arg) {
+	setupRoster(arg);
+	setupChat(arg);
+}
+
+void setupStatusReq(int arg) {
+	setupRoster(arg);
+	memset(&benchMsg, 0, sizeof(game_msg_t));
+	benchMsg.type = STATUS_REQ;
+}
+
+void setupPing(int arg) {
+	setupRoster(arg);
+	memset(&benchMsg, 0, sizeof(game_msg_t));
+	benchMsg.type = PING;
+	benchMsg.payload.ping.seq = 1;
+	benchMsg.payload.ping.sentNs = 1;
+}
+
+/**
+ * the function asks for analysis of current heaps, analysis is cached before
+ **/
+void setupAnalyze(int arg) {
+	static int analyzerStarted = 0;
+	setupRoster(arg);
+	if (!analyzerStarted && !analyzerInit(&analyzer, NUM_OF_HEAPS, 0, NULL)) {
+		fprintf(stderr, "Error starting analyzer!\n");
+		exit(1);
+	}
+	analyzerStarted = 1;
+	memset(&benchMsg, 0, sizeof(game_msg_t));
+	benchMsg.type = ANALYZE;
+	benchMsg.payload.analyze.gameType = -1;
+	benchMsg.payload.analyze.current = 1;
+	analysis_t analysis;
+	analyzePosition(&analyzer, benchGame->gameType, GAME_HEAPS(benchGame), &analysis);
+}
+
+void setupHeaps(int arg) {
+	setupRoster(0);
+	int i;
+	for (i = 0; i < NUM_OF_HEAPS; i++) {
+		GAME_HEAPS(benchGame)[i] = arg;
+	}
+}
+
+void setupRulesHeaps(int arg) {
+	heapsCnt = arg; /* 4 heaps use specialized rules, 2 heaps generic ones */
+	setupRoster(2);
+	heapsCnt = NUM_OF_HEAPS;
+}
+
+/* measured functions */
+void benchCreateDestroy(long iterations) {
+	payload_t pl;
+	memset(&pl, 0, sizeof(payload_t));
+	long i;
+	for (i = 0; i < iterations; i++) {
+		pl.turnResp.resp = (turn_resp_t) (i & 1);
+		game_msg_t * msg = createMessage(TURN_RESP, pl);
+		sink += msg->type;
+		destroyMsg(&msg);
+	}
+}
+
+void benchEncode(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i++) {
+		sink += encodeFrame(&benchMsg, frame, sizeof(frame));
+	}
+}
+
+void benchDecode(long iterations) {
+	game_msg_t out;
+	long i;
+	for (i = 0; i < iterations; i++) {
+		sink += decodeFrame(frame, frameSize, &out);
+	}
+}
+
+void benchSocketPair(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i++) {
+		int isDisconnect;
+		if (!sendMessageB(&pairTx, &benchMsg)) {
+			fprintf(stderr, "sendMessageB failed\n");
+			exit(1);
+		}
+		game_msg_t * msg = receiveMessageB(&pairRx, &isDisconnect);
+		if (msg == NULL) {
+			fprintf(stderr, "receiveMessageB failed\n");
+			exit(1);
+		}
+		sink += msg->type;
+		destroyMsg(&msg);
+	}
+}
+
+void benchHandleMsg(long iterations) {
+	client_t * source = benchGame->clientList[0];
+	long i;
+	for (i = 0; i < iterations; i++) {
+		if ((i & 7) == 0) {
+			drainRoster();
+		}
+		handleMsg(&benchMsg, source);
+		GAME_HEAPS(benchGame)[1] = HEAP_CUBES; /* undo legal move */
+		GAME_FLAGS(benchGame) &= ~GAME_TURN_DONE; /* turn stays with source, status broadcast is not measured */
+	}
+	sink += GAME_FLAGS(benchGame);
+}
+
+void benchHandleMsgNotYourTurn(long iterations) {
+	client_t * source = benchGame->clientList[rosterSize - 1];
+	long i;
+	for (i = 0; i < iterations; i++) {
+		if ((i & 7) == 0) {
+			drainRoster();
+		}
+		handleMsg(&benchMsg, source);
+	}
+	sink += GAME_FLAGS(benchGame);
+}
+
+void benchSetNextPlayer(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i++) {
+		setNextPlayerAsCurrent(benchGame);
+	}
+	sink += getCurrentPlayer(benchGame)->sock.socket;
+}
+
+void benchIsUserMoveValid(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i++) {
+		sink += isUserMoveValid(benchGame, i & 3, 1 + (i & 7));
+	}
+}
+
+void benchCheckGameEnd(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i++) {
+		sink += checkGameEnd(benchGame);
+	}
+}
+
+/**
+ * the function solves in memory table of regular 4 heap game with heaps up to maxHeap
+ **/
+void setupSolver(int maxHeap) {
+	solverClose(&benchTable);
+	if (!solverOpen(&benchTable, NULL, REGULAR, MOVES_ONE_HEAP, 4, 0, maxHeap, 1)) {
+		fprintf(stderr, "Error solving table!\n");
+		exit(1);
+	}
+}
+
+void benchSolverResult(long iterations) {
+	int maxHeap = benchTable.header->maxHeap;
+	short heaps[MAX_HEAPS];
+	long i;
+	for (i = 0; i < iterations; i++) {
+		heaps[0] = i % (maxHeap + 1);
+		heaps[1] = (i * 7) % (maxHeap + 1);
+		heaps[2] = (i * 13) % (maxHeap + 1);
+		heaps[3] = (i * 31) % (maxHeap + 1);
+		sink += solverResult(&benchTable, heaps);
+	}
+}
+
+/**
+ * the function rates n players in memory table, one period of results waits to be closed
+ **/
+void setupRatings(int n) {
+	ratingClose(&ratings);
+	if (!ratingOpen(&ratings, NULL)) {
+		fprintf(stderr, "Error mapping ratings table!\n");
+		exit(1);
+	}
+	int i;
+	for (i = 0; i < n; i++) {
+		ratedIdx[i] = ratingFind(&ratings, i + 1);
+	}
+	ratedCnt = n;
+}
+
+void benchRatingResult(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i++) {
+		ratingResult(&ratings, ratedIdx[i % ratedCnt], ratedIdx[(i * 7 + 1) % ratedCnt]);
+	}
+}
+
+/* one iteration applies one table entry, closed periods follow each other */
+void benchRatingApply(long iterations) {
+	long i = 0;
+	while (i < iterations) {
+		if (!ratingApplyPending(&ratings)) {
+			ratingResult(&ratings, ratedIdx[i % ratedCnt], ratedIdx[(i * 7 + 1) % ratedCnt]);
+			ratingClosePeriod(&ratings, 0);
+		}
+		int budget = (iterations - i < RATING_APPLY_BUDGET) ? iterations - i : RATING_APPLY_BUDGET;
+		ratingApply(&ratings, budget);
+		i += budget;
+	}
+	sink += ratings.header->period;
+}
+
+void benchGameTableSweep(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i++) {
+		sink += gameTableNext(0, MAX_GAMES, GAME_TURN_DONE | GAME_SEND_STATUS);
+	}
+}
+
+/**
+ * the function maps snapshot region in memory and creates game with n players to publish
+ **/
+void setupSnapshots(int n) {
+	if (snapshots.header == NULL && !snapshotCreate(&snapshots, NULL, MAX_GAMES)) {
+		fprintf(stderr, "Error mapping snapshot region!\n");
+	}
+	setupRoster(n);
+}
+
+void benchPublishGame(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i++) {
+		GAME_HEAPS(benchGame)[i & 3] = HEAP_CUBES - (i & 7);
+		benchGame->rosterChanged |= 3; /* move passes the turn */
+		publishGame(benchGame, 0);
+	}
+	sink += snapshots.slots[benchGame - games].seq;
+}
+
+void benchSnapshotRead(long iterations) {
+	game_snapshot_t copy;
+	int slot = benchGame - games;
+	long i;
+	for (i = 0; i < iterations; i++) {
+		sink += snapshotRead(&snapshots, slot, &copy) + copy.heaps[i & 3];
+	}
+}
+
+/**
+ * the function fills results of consecutive games with n players like the server exports them
+ **/
+void setupExport(int n) {
+	long long startMs = wallMs();
+	int r, i;
+	memset(&exporter, 0, sizeof(exporter));
+	exporter.serverStartMs = startMs;
+	for (r = 0; r < EXPORT_CHUNK_RECORDS; r++) {
+		export_record_t * record = &benchRecords[r];
+		memset(record, 0, sizeof(export_record_t));
+		record->seq = r;
+		record->serverStartMs = startMs;
+		record->startMs = startMs + r * 40;
+		record->endMs = record->startMs + 900 + (r & 63);
+		record->slot = r & 31;
+		record->gameType = REGULAR;
+		record->heapsCnt = NUM_OF_HEAPS;
+		record->cubes = HEAP_CUBES;
+		record->movesCnt = 8 + (r & 7);
+		record->playersCnt = n;
+		for (i = 0; i < n; i++) {
+			record->players[i].playerId = 1000 + r * n + i;
+			record->players[i].clientId = i;
+			record->players[i].result = (i == 0) ? YOU_WIN : YOU_LOSE;
+			record->players[i].moves = record->movesCnt / n;
+		}
+	}
+}
+
+void benchExportSubmit(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i++) {
+		sink += exportSubmit(&exporter, &benchRecords[i & (EXPORT_CHUNK_RECORDS - 1)]);
+		exporter.tail = exporter.head; /* stands for the sender taking the record */
+	}
+}
+
+void benchExportEncode(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i += EXPORT_CHUNK_RECORDS) {
+		int recordsCnt = (iterations - i < EXPORT_CHUNK_RECORDS) ? iterations - i : EXPORT_CHUNK_RECORDS;
+		sink += exportEncode(benchRecords, recordsCnt, benchChunk);
+	}
+}
+
+/* benchmark table */
+bench_t benches[] = {
+	{ "createMessage_destroyMsg", NULL, benchCreateDestroy, 0 },
+	{ "encodeFrame_status_delta", setupStatusDelta, benchEncode, 0 },
+	{ "encodeFrame_status_keyframe", setupStatusKeyframe, benchEncode, 0 },
+	{ "encodeFrame_chat", setupChat, benchEncode, 0 },
+	{ "encodeFrame_session_status_delta", setupSessionStatusDelta, benchEncode, 5 },
+	{ "decodeFrame_status_delta", setupStatusDelta, benchDecode, 0 },
+	{ "decodeFrame_status_keyframe", setupStatusKeyframe, benchDecode, 0 },
+	{ "decodeFrame_chat", setupChat, benchDecode, 0 },
+	{ "decodeFrame_session_status_delta", setupSessionStatusDelta, benchDecode, 5 },
+	{ "sendMessageB_receiveMessageB_socketpair", setupSocketPair, benchSocketPair, 0 },
+	{ "handleMsg_TURN_REQ_legal", setupTurnReq, benchHandleMsg, 2 },
+	{ "handleMsg_TURN_REQ_legal", setupTurnReq, benchHandleMsg, 9 },
+	{ "handleMsg_TURN_REQ_not_your_turn", setupTurnReq, benchHandleMsgNotYourTurn, 2 },
+	{ "handleMsg_TURN_REQ_not_your_turn", setupTurnReq, benchHandleMsgNotYourTurn, 9 },
+	{ "handleMsg_CHAT_broadcast", setupChatRoster, benchHandleMsg, 2 },
+	{ "handleMsg_CHAT_broadcast", setupChatRoster, benchHandleMsg, 9 },
+	{ "handleMsg_STATUS_REQ", setupStatusReq, benchHandleMsg, 2 },
+	{ "handleMsg_PING", setupPing, benchHandleMsg, 2 },
+	{ "handleMsg_ANALYZE_cached", setupAnalyze, benchHandleMsg, 2 },
+	{ "setNextPlayerAsCurrent", setupRoster, benchSetNextPlayer, 2 },
+	{ "setNextPlayerAsCurrent", setupRoster, benchSetNextPlayer, 9 },
+	{ "setNextPlayerAsCurrent", setupRoster, benchSetNextPlayer, MAX_ID },
+	{ "checkGameEnd_running", setupHeaps, benchCheckGameEnd, HEAP_CUBES },
+	{ "checkGameEnd_ended", setupHeaps, benchCheckGameEnd, 0 },
+	{ "checkGameEnd_generic", setupRulesHeaps, benchCheckGameEnd, 2 },
+	{ "isUserMoveValid_specialized", setupRulesHeaps, benchIsUserMoveValid, 4 },
+	{ "isUserMoveValid_generic", setupRulesHeaps, benchIsUserMoveValid, 2 },
+	{ "solverResult_lookup", setupSolver, benchSolverResult, 30 },
+	{ "ratingResult", setupRatings, benchRatingResult, 10000 },
+	{ "ratingApply_entry", setupRatings, benchRatingApply, 10000 },
+	{ "gameTableNext_sweep", setupRoster, benchGameTableSweep, 2 },
+	{ "publishGame", setupSnapshots, benchPublishGame, 2 },
+	{ "publishGame", setupSnapshots, benchPublishGame, 9 },
+	{ "snapshotRead", setupSnapshots, benchSnapshotRead, 2 },
+	{ "exportSubmit", setupExport, benchExportSubmit, 2 },
+	{ "exportEncode_record", setupExport, benchExportEncode, 2 },
+	{ "exportEncode_record", setupExport, benchExportEncode, 9 },
+};
+
+int compareDouble(const void * a, const void * b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * the function runs warm-up and measured repetitions of the benchmark
+ * prints one CSV line: name,arg,iterations,repetitions,min,median,max (ns per op)
+ **/
+void runBench(bench_t * bench, long iterations, int repetitions, long warmup) {
+	double nsPerOp[MAX_REPETITIONS];
+	if (bench->setup != NULL) {
+		bench->setup(bench->arg);
+	}
+	bench->run(warmup);
+	int r;
+	for (r = 0; r < repetitions; r++) {
+		long long start = nowNs();
+		bench->run(iterations);
+		nsPerOp[r] = (double) (nowNs() - start) / iterations;
+	}
+	qsort(nsPerOp, repetitions, sizeof(double), compareDouble);
+	printf("%s,%d,%ld,%d,%.2f,%.2f,%.2f\n", bench->name, bench->arg, iterations, repetitions, nsPerOp[0], nsPerOp[repetitions / 2], nsPerOp[repetitions - 1]);
+	fflush(stdout);
+}
+
+/* main function */
+int main(int argc, char *argv[]) {
+	long iterations = DEFAULT_ITERATIONS;
+	int repetitions = DEFAULT_REPETITIONS;
+	long warmup = DEFAULT_WARMUP;
+	int cpu = -1; /* default - pin to the cpu benchmark started on */
+	const char * filter = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:r:w:c:f:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = atol(optarg);
+			break;
+		case 'r':
+			repetitions = atoi(optarg);
+			break;
+		case 'w':
+			warmup = atol(optarg);
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-r repetitions] [-w warmup] [-c cpu] [-f name-filter]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (iterations < 1 || repetitions < 1 || repetitions > MAX_REPETITIONS || warmup < 0) {
+		fprintf(stderr, "Error: iterations and repetitions (up to %d) should be positive!\n", MAX_REPETITIONS);
+		return 1;
+	}
+	if (cpu == -1) {
+		cpu = sched_getcpu();
+	}
+	if (pinCpu(cpu) == -1) {
+		fprintf(stderr, "Error pinning to cpu %d: %s!\n", cpu, strerror(errno));
+		return 1;
+	}
+	fprintf(stderr, "pinned to cpu %d\n", cpu);
+	printf("name,arg,iterations,repetitions,min_ns,median_ns,max_ns\n");
+	size_t i;
+	for (i = 0; i < sizeof(benches) / sizeof(bench_t); i++) {
+		if (filter == NULL || strstr(benches[i].name, filter) != NULL) {
+			runBench(&benches[i], iterations, repetitions, warmup);
+		}
+	}
+	freeRoster();
+	solverClose(&benchTable);
+	ratingClose(&ratings);
+	snapshotClose(&snapshots);
+	return 0;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* getopt() */
+#include <string.h> /* string functions */
+#include <sys/socket.h> /* sink addresses of exporter, listening sink */
+#include <sys/un.h> /* unix domain addresses */
+#include <netinet/in.h> /* internet domain addresses */
+#include <pthread.h> /* sender of exporter */
+#include "export.h"
+
+/* names of values exported by the server, in order of transport.h enums */
+const char * gameTypeNames[] = { "MISERE", "REGULAR" };
+const char * endGameNames[] = { "YOU_WIN", "YOU_LOSE", "YOU_WATCHED", "NOT_FINISHED" };
+
+#define NAME(names, i) (((unsigned) (i) < sizeof(names) / sizeof(names[0])) ? names[i] : "?")
+
+/**
+ * the function prints exported game result
+ **/
+void printRecord(const export_record_t * record) {
+	printf("result server=%lld seq=%llu game=%u %s heaps=%d cubes=%d tournament=%d start=%lld duration_ms=%lld moves=%d illegal=%d players", record->serverStartMs, record->seq,
+			record->slot, NAME(gameTypeNames, record->gameType), record->heapsCnt, record->cubes, record->tournament, record->startMs, record->endMs - record->startMs,
+			record->movesCnt, record->illegalCnt);
+	int i;
+	for (i = 0; i < record->playersCnt; i++) {
+		const export_player_t * player = &record->players[i];
+		printf(" %d:%u:%s:%d", player->clientId, player->playerId, NAME(endGameNames, (int) player->result), player->moves);
+	}
+	printf("\n");
+}
+
+/**
+ * the function prints chunks read from in till its end, printed chunk is acknowledged to ackFd, -1 - no acks
+ * returns 0 if a chunk is malformed
+ **/
+int printExport(FILE * in, int ackFd, int printChunks) {
+	static unsigned char payload[EXPORT_CHUNK_SIZE];
+	static export_record_t records[EXPORT_CHUNK_RECORDS];
+	export_chunk_header_t header;
+	long chunksCnt = 0, recordsCnt = 0;
+	int status = 1;
+	while (fread(&header, sizeof(header), 1, in) == 1) {
+		if (header.magic != EXPORT_MAGIC || header.version != EXPORT_VERSION || header.recordsCnt > EXPORT_CHUNK_RECORDS || header.size > EXPORT_CHUNK_SIZE) {
+			fprintf(stderr, "Error: chunk %ld is not export chunk of this version!\n", chunksCnt);
+			status = 0;
+			break;
+		}
+		if (fread(payload, 1, header.size, in) != header.size) { /* sink failed in the middle, the chunk was sent again whole */
+			fprintf(stderr, "chunk %ld truncated\n", chunksCnt);
+			break;
+		}
+		if (!exportDecode(payload, header.size, header.recordsCnt, records)) {
+			fprintf(stderr, "Error: chunk %ld is malformed!\n", chunksCnt);
+			status = 0;
+			break;
+		}
+		if (printChunks) {
+			printf("chunk %ld records=%d size=%u first_seq=%llu\n", chunksCnt, header.recordsCnt, header.size, header.firstSeq);
+		}
+		int i;
+		for (i = 0; i < header.recordsCnt; i++) {
+			printRecord(&records[i]);
+		}
+		chunksCnt++;
+		recordsCnt += header.recordsCnt;
+		if (ackFd != -1) { /* records are out before the server forgets the chunk */
+			export_ack_t ack = { EXPORT_ACK_MAGIC, header.recordsCnt, header.firstSeq };
+			fflush(stdout);
+			if (write(ackFd, &ack, sizeof(ack)) != sizeof(ack)) {
+				break;
+			}
+		}
+	}
+	fprintf(stderr, "%ld chunks, %ld results\n", chunksCnt, recordsCnt);
+	return status;
+}
+
+/**
+ * the function opens sink given as unix:path or tcp:port for servers to export to
+ * returns listening socket, -1 on error
+ **/
+int listenSink(const char * sink) {
+	int listSocket = -1;
+	if (strncmp(sink, "unix:", 5) == 0) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		if (strlen(sink + 5) == 0 || strlen(sink + 5) >= sizeof(addr.sun_path)) {
+			return -1;
+		}
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, sink + 5);
+		unlink(addr.sun_path);
+		if ((listSocket = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 || bind(listSocket, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+			return -1;
+		}
+	} else if (strncmp(sink, "tcp:", 4) == 0 && atoi(sink + 4) > 0) {
+		struct sockaddr_in addr;
+		int yes = 1;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(atoi(sink + 4));
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		if ((listSocket = socket(AF_INET, SOCK_STREAM, 0)) == -1 || setsockopt(listSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1
+				|| bind(listSocket, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+			return -1;
+		}
+	} else {
+		return -1;
+	}
+	return (listen(listSocket, 4) == 0) ? listSocket : -1;
+}
+
+/* main function */
+int main(int argc, char *argv[]) {
+	int printChunks = 0;
+	const char * sink = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "cl:")) != -1) {
+		switch (opt) {
+		case 'c': /* print chunk headers too */
+			printChunks = 1;
+			break;
+		case 'l': /* be the sink servers export to, chunks are acknowledged once printed */
+			sink = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c] export-file|-\n       %s [-c] -l unix:path|tcp:port\n", argv[0], argv[0]);
+			return 1;
+		}
+	}
+	if ((sink == NULL) != (optind == argc - 1)) {
+		fprintf(stderr, "Usage: %s [-c] export-file|-\n       %s [-c] -l unix:path|tcp:port\n", argv[0], argv[0]);
+		return 1;
+	}
+	if (sink != NULL) { /* servers are served one at a time till killed */
+		int listSocket = listenSink(sink);
+		if (listSocket == -1) {
+			fprintf(stderr, "Error listening on %s!\n", sink);
+			return 1;
+		}
+		while (1) {
+			int conn = accept(listSocket, NULL, NULL);
+			FILE * in = (conn != -1) ? fdopen(conn, "rb") : NULL;
+			if (in != NULL) {
+				printExport(in, conn, printChunks);
+				fclose(in);
+			} else if (conn != -1) {
+				close(conn);
+			}
+		}
+	}
+	FILE * in = (strcmp(argv[optind], "-") == 0) ? stdin : fopen(argv[optind], "rb");
+	if (in == NULL) {
+		fprintf(stderr, "Error opening %s!\n", argv[optind]);
+		return 1;
+	}
+	int status = !printExport(in, -1, printChunks);
+	if (in != stdin) {
+		fclose(in);
+	}
+	return status;
+}
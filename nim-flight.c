@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* getopt() */
+#include <string.h> /* string functions */
+#include "recorder.h"
+
+/* names of values recorded by the server, in order of transport.h enums */
+const char * msgTypeNames[] = { "WELCOME", "STATUS", "TURN_REQ", "TURN_RESP", "CHAT", "STATUS_REQ", "PING", "PONG", "JOIN", "ANALYZE", "ANALYSIS", "RESUME", "LEAVE", "STANDING" };
+const char * clientStatusNames[] = { "PLAYING", "SPECTATOR", "YOUR_TURN", "UNKNOWN" };
+const char * turnRespNames[] = { "LEGAL", "NOT_YOUR_TURN", "ILLEGAL" };
+
+#define NAME(names, i) (((unsigned) (i) < sizeof(names) / sizeof(names[0])) ? names[i] : "?")
+
+/**
+ * event with the ring it was recorded in
+ **/
+typedef struct timeline_event {
+	flight_ring_header_t ring;
+	flight_event_t event;
+} timeline_event_t;
+
+int compareEvents(const void * a, const void * b) {
+	unsigned int x = ((const timeline_event_t *) a)->event.seq, y = ((const timeline_event_t *) b)->event.seq;
+	return (x > y) - (x < y);
+}
+
+/**
+ * the function prints event data accordingly to event type
+ **/
+void printEvent(const flight_event_t * e) {
+	switch (e->event) {
+	case FLIGHT_RECV:
+		printf("%s size=%d", NAME(msgTypeNames, e->msgType), e->size);
+		break;
+	case FLIGHT_SEND:
+		printf("%s size=%d queued=%d coalesced=%d", NAME(msgTypeNames, e->msgType), e->size, e->a, e->b);
+		break;
+	case FLIGHT_SEND_FAILED:
+		printf("%s size=%d queued=%d", NAME(msgTypeNames, e->msgType), e->size, e->a);
+		break;
+	case FLIGHT_FLUSH:
+		printf("queued=%d", e->a);
+		break;
+	case FLIGHT_RECV_CLOSED:
+		printf("attempts=%d errno=%d (%s)", e->a, e->b, strerror(e->b));
+		break;
+	case FLIGHT_DISCONNECT:
+		printf("client=%d status=%s", e->a, NAME(clientStatusNames, e->b));
+		break;
+	case FLIGHT_STATUS_CHANGE:
+		printf("client=%d %s -> %s", e->a, NAME(clientStatusNames, e->b), NAME(clientStatusNames, e->size));
+		break;
+	case FLIGHT_TURN:
+		printf("client=%d heap=%d cubes=%d %s", e->size, e->a, e->b, NAME(turnRespNames, e->msgType));
+		break;
+	case FLIGHT_BROADCAST:
+		printf("seq=%d %s", e->a, (e->b) ? "keyframe" : "delta");
+		break;
+	case FLIGHT_GAME_START:
+		printf("players=%d heaps=%d", e->a, e->b);
+		break;
+	case FLIGHT_GAME_END:
+		printf("seq=%d", e->a);
+		break;
+	case FLIGHT_DATAGRAMS:
+		printf("spectators=%d sent=%d", e->a, e->b);
+		break;
+	case FLIGHT_DETACH:
+		printf("client=%d status=%s", e->a, NAME(clientStatusNames, e->b));
+		break;
+	case FLIGHT_RESUME:
+		printf("client=%d missed=%d", e->a, e->b);
+		break;
+	case FLIGHT_SHED:
+		printf("%s size=%d class=%d level=%d", NAME(msgTypeNames, e->msgType), e->size, e->a, e->b);
+		break;
+	}
+}
+
+/* main function */
+int main(int argc, char *argv[]) {
+	int connFilter = -1, gameFilter = -1;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:g:")) != -1) {
+		switch (opt) {
+		case 'c': /* only connection with this socket fd */
+			connFilter = atoi(optarg);
+			break;
+		case 'g': /* only game in this slot */
+			gameFilter = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c fd] [-g game] dump-file\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "Usage: %s [-c fd] [-g game] dump-file\n", argv[0]);
+		return 1;
+	}
+	FILE * in = fopen(argv[optind], "rb");
+	if (in == NULL) {
+		fprintf(stderr, "Error opening %s!\n", argv[optind]);
+		return 1;
+	}
+	flight_dump_header_t header;
+	if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != FLIGHT_MAGIC || header.version != FLIGHT_VERSION || header.ringSize != FLIGHT_RING_SIZE) {
+		fprintf(stderr, "Error: %s is not flight recorder dump of this version!\n", argv[optind]);
+		return 1;
+	}
+	timeline_event_t * timeline = (timeline_event_t *) malloc(sizeof(timeline_event_t) * FLIGHT_RING_SIZE * (header.ringsCnt + 1));
+	int eventsCnt = 0;
+	int i;
+	flight_ring_t * ring = (flight_ring_t *) malloc(FLIGHT_RING_BYTES(FLIGHT_RING_SIZE));
+	for (i = 0; i < header.ringsCnt; i++) {
+		flight_ring_header_t ringHeader;
+		if (fread(&ringHeader, sizeof(ringHeader), 1, in) != 1 || fread(ring, sizeof(flight_ring_t), 1, in) != 1
+				|| ring->size == 0 || ring->size > FLIGHT_RING_SIZE || (ring->size & (ring->size - 1)) != 0
+				|| fread(ring->events, sizeof(flight_event_t), ring->size, in) != ring->size) {
+			fprintf(stderr, "Error: dump is truncated!\n");
+			return 1;
+		}
+		if ((connFilter != -1 || gameFilter != -1) && !(ringHeader.kind == FLIGHT_RING_CONN && ringHeader.index == connFilter) && !(ringHeader.kind == FLIGHT_RING_GAME && ringHeader.index == gameFilter)) {
+			continue;
+		}
+		/* oldest event kept is head - size */
+		unsigned int first = (ring->head > ring->size) ? ring->head - ring->size : 0;
+		unsigned int n;
+		for (n = first; n < ring->head; n++) {
+			timeline[eventsCnt].ring = ringHeader;
+			timeline[eventsCnt].event = ring->events[n & (ring->size - 1)];
+			eventsCnt++;
+		}
+	}
+	free(ring);
+	fclose(in);
+	qsort(timeline, eventsCnt, sizeof(timeline_event_t), compareEvents);
+	for (i = 0; i < eventsCnt; i++) {
+		const flight_event_t * e = &timeline[i].event;
+		printf("%+14.3fus %s %-4d %-13s ", (e->ns - timeline[0].event.ns) / 1000.0, (timeline[i].ring.kind == FLIGHT_RING_CONN) ? "conn" : "game", timeline[i].ring.index, NAME(flightEventNames, e->event));
+		printEvent(e);
+		printf("\n");
+	}
+	free(timeline);
+	return 0;
+}
@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* for read(), write(), getopt() */
+#include <sys/types.h> /* data types used in system calls */
+#include <sys/socket.h> /* definitions of structures needed for sockets */
+#include <netinet/in.h> /* constants and structures needed for Internet domain addresses */
+#include <netdb.h> /* for gethostbyname() */
+#include <errno.h> /* error messages */
+#include <string.h> /* string functions */
+#include <sys/select.h> /* select */
+#include "transport.h" /* common data with server */
+#include "latency.h" /* nowNs() */
+#include "capture.h" /* capture file */
+
+#define LOCALHOST "127.0.0.1"
+#define DEFAULT_PORT 6325
+#define REPLAY_IDLE_NS (1000000000LL) /* replay ends after second without frames once all records are fed */
+#define REPLAY_HOLD_NS (1000000000LL) /* accelerated replay waits at most second for replies preceding inbound frame */
+#define MAX_REPORTED (10) /* mismatches printed in detail */
+
+/**
+ * captured record with its frame
+ * nextOut - index of next CAPTURE_OUT record of the same connection, -1 if none
+ **/
+typedef struct replay_record {
+	capture_record_t record;
+	char frame[CAPTURE_FRAME_SIZE];
+	int nextOut;
+} replay_record_t;
+
+/**
+ * replayed connection
+ * socket - socket connected to the server, -1 before open and after close
+ * expected - index of next CAPTURE_OUT record expected from the server, -1 if none
+ * peerClosed - client closed the connection in capture, frames the server queued after are not missing and extra ones are not mismatches
+ * in, inPos - bytes received and not decoded yet
+ * expHeaps, expSeq - heaps by captured statuses
+ * actHeaps, actSeq - heaps by received statuses
+ * expToken, actToken - session token of captured and received WELCOME, RESUME carrying captured one gets received one
+ **/
+typedef struct replay_conn {
+	int socket;
+	int expected;
+	int peerClosed;
+	char in[BUFFER_SIZE];
+	int inPos;
+	short expHeaps[MAX_HEAPS];
+	unsigned int expSeq;
+	short actHeaps[MAX_HEAPS];
+	unsigned int actSeq;
+	unsigned long long expToken;
+	unsigned long long actToken;
+} replay_conn_t;
+
+replay_record_t * records; /* records of capture file */
+int recordsCnt = 0;
+replay_conn_t * conns; /* connections indexed by capture number */
+int connsCnt = 0;
+int sessionGraceSec = 0; /* seconds captured server held seats, session tokens differ in replay if not 0 */
+long framesIn = 0; /* frames sent to the server */
+long framesCompared = 0; /* frames received and compared */
+long framesCoalesced = 0; /* captured statuses replaced by newer one in replay */
+long framesMismatched = 0; /* frames not identical to captured ones */
+long framesMissing = 0; /* captured frames not received */
+
+/**
+ * the function reads capture file into records and links captured frames of each connection
+ * returns 0 on error
+ **/
+int loadCapture(const char * path) {
+	FILE * in = fopen(path, "rb");
+	if (in == NULL) {
+		printf("Error opening %s: %s!\n", path, strerror(errno));
+		return 0;
+	}
+	capture_header_t header;
+	if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {
+		printf("Error: %s is not capture of this version!\n", path);
+		fclose(in);
+		return 0;
+	}
+	printf("captured server: %s p=%d M=%d misere=%d heaps=%d max-take=%d grace=%d\n", (header.lobbyMode) ? "lobby" : "single game", header.p, header.M,
+			header.gameType == MISERE, header.heapsCnt, header.maxTake, header.sessionGraceSec);
+	sessionGraceSec = header.sessionGraceSec;
+	int size = 1024;
+	records = (replay_record_t *) malloc(sizeof(replay_record_t) * size);
+	while (records != NULL && captureRead(in, &records[recordsCnt].record, records[recordsCnt].frame)) {
+		if (records[recordsCnt].record.conn >= connsCnt) {
+			connsCnt = records[recordsCnt].record.conn + 1;
+		}
+		if (++recordsCnt == size) {
+			size *= 2;
+			records = (replay_record_t *) realloc(records, sizeof(replay_record_t) * size);
+		}
+	}
+	fclose(in);
+	conns = (replay_conn_t *) calloc(connsCnt + 1, sizeof(replay_conn_t));
+	if (records == NULL || conns == NULL) {
+		printf("Error: not enough memory for capture!\n");
+		return 0;
+	}
+	/* link captured frames of each connection, backwards so each one points to the next */
+	int i;
+	for (i = 0; i < connsCnt; i++) {
+		conns[i].socket = -1;
+		conns[i].expected = -1;
+	}
+	for (i = recordsCnt - 1; i >= 0; i--) {
+		if (records[i].record.kind == CAPTURE_OUT) {
+			records[i].nextOut = conns[records[i].record.conn].expected;
+			conns[records[i].record.conn].expected = i;
+		}
+	}
+	return 1;
+}
+
+/**
+ * the function reports mismatch of received frame and captured one
+ **/
+void reportMismatch(int conn, const char * what, const game_msg_t * expected, const game_msg_t * actual) {
+	if (framesMismatched++ < MAX_REPORTED) {
+		printf("conn %d: %s, expected type %d, received type %d\n", conn, what, (expected != NULL) ? (int) expected->type : -1,
+				(actual != NULL) ? (int) actual->type : -1);
+	}
+}
+
+/**
+ * the function compares frame received from the server with the next captured frame
+ * statuses are compared by the state they carry: coalescing may skip captured ones
+ * or send keyframe instead of delta, and server measured durations are not compared
+ * session token of WELCOME is random when seats are held, it is masked
+ **/
+void compareFrame(int conn, const char * frame, size_t frameSize, const game_msg_t * actual) {
+	replay_conn_t * c = &conns[conn];
+	game_msg_t expected;
+	framesCompared++;
+	while (c->expected != -1) {
+		replay_record_t * r = &records[c->expected];
+		if (decodeFrame(r->frame, r->record.size, &expected) <= 0) {
+			reportMismatch(conn, "captured frame is not valid", NULL, actual);
+			c->expected = r->nextOut;
+			continue;
+		}
+		if (expected.type != STATUS || actual->type != STATUS || expected.payload.status.seq >= actual->payload.status.seq) {
+			break;
+		}
+		/* newer status replaced captured one */
+		applyStatus(c->expHeaps, &c->expSeq, &expected.payload.status);
+		framesCoalesced++;
+		c->expected = r->nextOut;
+	}
+	if (c->expected == -1) {
+		if (!c->peerClosed) {
+			/* server may send more till it reads close that came later in capture */
+			reportMismatch(conn, "frame not in capture", NULL, actual);
+		}
+		return;
+	}
+	replay_record_t * r = &records[c->expected];
+	c->expected = r->nextOut;
+	if (expected.type == STATUS && actual->type == STATUS) {
+		const status_t * e = &expected.payload.status, *a = &actual->payload.status;
+		applyStatus(c->expHeaps, &c->expSeq, e);
+		applyStatus(c->actHeaps, &c->actSeq, a);
+		if (e->seq != a->seq || e->clientStatus != a->clientStatus || e->endGame != a->endGame || (e->flags & STATUS_TIMED) != (a->flags & STATUS_TIMED)
+				|| ((e->flags & STATUS_TIMED) && e->timing.clientSentNs != a->timing.clientSentNs)
+				|| memcmp(c->expHeaps, c->actHeaps, sizeof(c->expHeaps)) != 0) {
+			reportMismatch(conn, "status differs", &expected, actual);
+		}
+	} else if (sessionGraceSec > 0 && expected.type == WELCOME && actual->type == WELCOME) {
+		game_msg_t masked = *actual;
+		char maskedFrame[CAPTURE_FRAME_SIZE];
+		c->expToken = expected.payload.welcomeMsg.sessionToken;
+		c->actToken = actual->payload.welcomeMsg.sessionToken;
+		masked.payload.welcomeMsg.sessionToken = c->expToken;
+		ssize_t maskedSize = encodeFrame(&masked, maskedFrame, sizeof(maskedFrame));
+		if (maskedSize != r->record.size || memcmp(r->frame, maskedFrame, maskedSize) != 0) {
+			reportMismatch(conn, "welcome differs", &expected, actual);
+		}
+	} else if (r->record.size != frameSize || memcmp(r->frame, frame, frameSize) != 0) {
+		reportMismatch(conn, "frame differs", &expected, actual);
+	}
+}
+
+/**
+ * the function reads frames the server sent to the connection and compares them
+ * returns 0 if the server closed the connection
+ **/
+int receiveFrames(int conn) {
+	replay_conn_t * c = &conns[conn];
+	ssize_t received = recv(c->socket, c->in + c->inPos, BUFFER_SIZE - c->inPos, 0);
+	if (received <= 0) {
+		return 0;
+	}
+	c->inPos += received;
+	int pos = 0;
+	game_msg_t actual;
+	ssize_t frameSize;
+	while ((frameSize = decodeFrame(c->in + pos, c->inPos - pos, &actual)) > 0) {
+		compareFrame(conn, c->in + pos, frameSize, &actual);
+		pos += frameSize;
+	}
+	if (frameSize < 0) {
+		printf("conn %d: server sent invalid frame!\n", conn);
+		return 0;
+	}
+	memmove(c->in, c->in + pos, c->inPos - pos);
+	c->inPos -= pos;
+	return 1;
+}
+
+/**
+ * the function closes replayed connection, captured frames not received are counted as missing
+ * unless client closed the connection in capture
+ **/
+void closeConn(int conn) {
+	replay_conn_t * c = &conns[conn];
+	close(c->socket);
+	c->socket = -1;
+	for (; c->expected != -1; c->expected = records[c->expected].nextOut) {
+		if (!c->peerClosed) {
+			framesMissing++;
+		}
+	}
+}
+
+/**
+ * the function tells if inbound record has to wait for frames the server sent its connection before it in capture
+ **/
+int awaitsReplies(int i) {
+	const replay_conn_t * c = &conns[records[i].record.conn];
+	return records[i].record.kind == CAPTURE_IN && c->socket != -1 && c->expected != -1 && c->expected < i;
+}
+
+/**
+ * the function replays one record
+ * returns 0 on error
+ **/
+int replayRecord(const replay_record_t * r, const struct sockaddr_in * serverAddress) {
+	replay_conn_t * c = &conns[r->record.conn];
+	switch (r->record.kind) {
+	case CAPTURE_OPEN:
+		if ((c->socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+			printf("Error creating socket: %s!\n", strerror(errno));
+			return 0;
+		}
+		if (c->socket >= FD_SETSIZE) {
+			printf("Error: too many connections replayed at once!\n");
+			return 0;
+		}
+		if (connect(c->socket, (struct sockaddr *) serverAddress, sizeof(*serverAddress))) {
+			printf("Error connection to server: %s!\n", strerror(errno));
+			return 0;
+		}
+		break;
+	case CAPTURE_IN:
+		if (c->socket != -1) {
+			game_msg_t msg;
+			char frame[CAPTURE_FRAME_SIZE];
+			size_t frameSize = r->record.size;
+			memcpy(frame, r->frame, frameSize);
+			int decoded = decodeFrame(frame, frameSize, &msg) > 0;
+			if (decoded && msg.type == JOIN && msg.payload.join.udpPort != 0) {
+				/* replay reads all statuses over TCP, datagrams captured are expected there */
+				msg.payload.join.udpPort = 0;
+				frameSize = encodeFrame(&msg, frame, sizeof(frame));
+			} else if (decoded && msg.type == RESUME && msg.payload.resume.sessionToken != 0) {
+				/* the seat was given token the server sent in replay */
+				int i;
+				for (i = 0; i < connsCnt && conns[i].expToken != msg.payload.resume.sessionToken; i++) {
+				}
+				if (i < connsCnt) {
+					msg.payload.resume.sessionToken = conns[i].actToken;
+					frameSize = encodeFrame(&msg, frame, sizeof(frame));
+				}
+			}
+			if (send(c->socket, frame, frameSize, MSG_NOSIGNAL) != frameSize) {
+				printf("conn %d: Error sending frame: %s!\n", r->record.conn, strerror(errno));
+			}
+			framesIn++;
+		}
+		break;
+	case CAPTURE_CLOSE:
+		if ((r->record.flags & CAPTURE_PEER_CLOSED) && c->socket != -1 && !c->peerClosed) {
+			/* frames in flight are still received till the server closes the connection */
+			c->peerClosed = 1;
+			shutdown(c->socket, SHUT_WR);
+		}
+		break;
+	}
+	return 1;
+}
+
+/* main function */
+int main(int argc, char *argv[]) {
+	double speed = 1; /* replay speed, 0 - as fast as possible */
+	int port = DEFAULT_PORT; /* default port */
+	char *inetAddr = LOCALHOST; /* default address */
+	struct sockaddr_in serverAddress; /* structure for socket parameters */
+	struct hostent *server; /* defines a host computer on the Internet */
+	int opt;
+	while ((opt = getopt(argc, argv, "x:")) != -1) {
+		switch (opt) {
+		case 'x': /* replay speed multiplier */
+			speed = atof(optarg);
+			break;
+		default:
+			printf("Usage: %s [-x speed] capture-file [host [port]]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc || argc - optind > 3 || speed < 0) {
+		printf("Usage: %s [-x speed] capture-file [host [port]]\n", argv[0]);
+		return 1;
+	}
+	if (argc - optind >= 2) {
+		inetAddr = argv[optind + 1];
+	}
+	if (argc - optind == 3) {
+		port = atoi(argv[optind + 2]);
+	}
+	if (!loadCapture(argv[optind])) {
+		return 1;
+	}
+	if ((server = gethostbyname(inetAddr)) == NULL) {
+		printf("Error: No server with such a name exists!\n");
+		return 1;
+	}
+	memset(&serverAddress, 0, sizeof(serverAddress));
+	serverAddress.sin_family = AF_INET;
+	memcpy(&serverAddress.sin_addr.s_addr, server->h_addr, server->h_length);
+	serverAddress.sin_port = htons(port);
+
+	long long startNs = nowNs(), lastFrameNs = startNs;
+	long long captureStartNs = (recordsCnt > 0) ? records[0].record.ns : 0;
+	int next = 0; /* next record to replay */
+	int accelerated = (speed == 0 || speed > 1); /* inbound frames can overtake replies they answered */
+	long long heldNs = 0; /* when feeding started waiting for replies, 0 if not waiting */
+	while (1) {
+		long long now = nowNs();
+		/* feed records that are due, in accelerated replay client does not send before it received what it saw in capture */
+		while (next < recordsCnt && (speed == 0 || startNs + (records[next].record.ns - captureStartNs) / speed <= now)) {
+			if (accelerated && awaitsReplies(next)) {
+				if (heldNs == 0) {
+					heldNs = now;
+				}
+				if (now - heldNs < REPLAY_HOLD_NS) {
+					break;
+				}
+			}
+			heldNs = 0;
+			if (!replayRecord(&records[next], &serverAddress)) {
+				return 1;
+			}
+			next++;
+		}
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		int highSD = -1, conn;
+		for (conn = 0; conn < connsCnt; conn++) {
+			if (conns[conn].socket != -1) {
+				FD_SET(conns[conn].socket, &readSet);
+				if (conns[conn].socket > highSD) {
+					highSD = conns[conn].socket;
+				}
+			}
+		}
+		long long waitNs;
+		if (heldNs != 0) {
+			waitNs = heldNs + REPLAY_HOLD_NS - now;
+		} else if (next < recordsCnt) {
+			waitNs = (speed == 0) ? 0 : startNs + (records[next].record.ns - captureStartNs) / speed - now;
+		} else if (highSD != -1) {
+			waitNs = lastFrameNs + REPLAY_IDLE_NS - now;
+			if (waitNs <= 0) {
+				break; /* server has nothing more to send */
+			}
+		} else {
+			break; /* all connections closed */
+		}
+		if (waitNs < 0) {
+			waitNs = 0;
+		}
+		struct timeval timeout = { waitNs / 1000000000LL, (waitNs % 1000000000LL) / 1000 };
+		if (select(highSD + 1, &readSet, NULL, NULL, &timeout) == -1) {
+			printf("Error in select: %s!\n", strerror(errno));
+			return 1;
+		}
+		for (conn = 0; conn < connsCnt; conn++) {
+			if (conns[conn].socket != -1 && FD_ISSET(conns[conn].socket, &readSet)) {
+				lastFrameNs = nowNs();
+				if (!receiveFrames(conn)) {
+					closeConn(conn);
+				}
+			}
+		}
+	}
+	int conn;
+	for (conn = 0; conn < connsCnt; conn++) {
+		if (conns[conn].socket != -1) {
+			closeConn(conn);
+		}
+	}
+	double captureSec = (recordsCnt > 0) ? (records[recordsCnt - 1].record.ns - captureStartNs) / 1e9 : 0;
+	printf("replayed %d connections, %ld frames in %.3f s (captured %.3f s)\n", connsCnt, framesIn, (lastFrameNs - startNs) / 1e9, captureSec);
+	printf("compared=%ld coalesced=%ld mismatched=%ld missing=%ld\n", framesCompared, framesCoalesced, framesMismatched, framesMissing);
+	free(records);
+	free(conns);
+	return (framesMismatched == 0 && framesMissing == 0) ? 0 : 2;
+}
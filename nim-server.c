@@ -4,48 +4,123 @@
 #include <sys/types.h> /* data types used in system calls */
 #include <sys/socket.h> /* definitions of structures needed for sockets */
 #include <netinet/in.h> /* constants and structures needed for Internet domain addresses */
+#include <netinet/tcp.h> /* TCP_FASTOPEN */
 #include <assert.h> /* asserts */
 #include <errno.h> /* error messages */
 #include <string.h> /* string functions */
 #include "transport.h" /* common data with client */
-#include <sys/select.h> /* select */
+#include <sys/epoll.h> /* epoll */
+#include <sys/resource.h> /* getrlimit() */
 #include <fcntl.h> /* for manipulating file descriptor */
+#include <signal.h> /* SIGUSR1 dumps latency histograms, SIGUSR2 upgrades server */
+#include <sys/wait.h> /* waitpid() */
+#include <pthread.h> /* analysis worker */
+#include <sys/random.h> /* getrandom() for session tokens */
+#include "latency.h" /* latency histograms */
+#include "rules.h" /* game variant rules */
+#include "admission.h" /* load shedding */
+#include "scheduler.h" /* budgets of main loop phases */
+#include "nim-server.h" /* server game logic shared with benchmarks */
+#include "lobby.h" /* matchmaking queues */
+#include "upgrade.h" /* handoff to upgraded server */
+#include "recorder.h" /* flight recorder */
+#include "capture.h" /* traffic capture */
+#include "solver.h" /* solved positions */
+#include "analysis.h" /* position analysis */
+#include "rating.h" /* player ratings */
+#include "tournament.h" /* tournaments */
+#include "snapshot.h" /* shared memory game snapshots */
+#include "export.h" /* export of game results */
 
-#define NUM_OF_HEAPS 4
 #define DEFAULT_PORT 6325
-#define MAX_NUM_OF_CLIENTS 9
-#define MAX_ID 25
 #define ALT(x, y) if(!(x)){(y);}
+#define SESSION_TICK_US 100000 /* epoll timeout while seats are held, held seats expire on it */
+#define EPOLL_BATCH 1024 /* ready sockets taken from epoll in one loop iteration, the rest is reported by the next wait */
+#define CONN_READABLE 0x01 /* connReady flag: socket was reported read-ready */
+#define CONN_LISTED 0x02 /* connReady flag: socket is in readyFds already */
+#define FAST_OPEN_QUEUE 256 /* pending fast open connections of the listener */
 
-/* structure for client with buffered socket */
-typedef struct Client {
-	buffered_socket_t sock;
-	client_status_t status;
-} client_t;
+#if NUM_OF_HEAPS != SNAPSHOT_HEAPS || MAX_ID != SNAPSHOT_ROSTER
+#error "game snapshots mirror heaps and roster of game_t"
+#endif
 
-client_t * clientList[MAX_ID]; /* array of maximum possible connected clients */
-int p; /* maximal number of players in current game to connect */
+client_t ** connList = NULL; /* connected clients indexed by socket fd */
+int connCap = 0; /* entries of tables indexed by socket fd, they grow with the highest fd accepted */
+game_t games[MAX_GAMES]; /* game slots */
+game_table_t gameTable; /* hot state of game slots, struct of arrays */
+int freeGames[MAX_GAMES]; /* stack of free game slots */
+int freeGamesCnt = -1; /* number of free game slots, -1 before initGames */
+game_t * newestGame[2]; /* newest running game of each game type, spectators join it */
+int lobbyMode = 0; /* 1 - clients are matched into new games, 0 - single game */
+int p; /* default number of players */
+game_type_t gameType = REGULAR; /* default game type */
+int M; /* number of cubes in the heaps */
+int heapsCnt = NUM_OF_HEAPS; /* number of heaps in play */
+int maxTake = 0; /* maximal number of cubes taken in one move, 0 if not bounded */
+long connectionsCnt = 0; /* number of connected clients */
+long gamesStarted = 0; /* number of games started by lobby */
+long playersMatched = 0; /* number of players matched by lobby */
+long framesDropped = 0; /* CHAT and TURN_RESP frames dropped because output queue of the client was full */
+long long moveRecvNs; /* time the message being handled was read from its socket */
+latency_hist_t validateHist = { "server_validate" }; /* move receipt till validated */
+latency_hist_t residenceHist = { "server_residence" }; /* move receipt till its status or NOT_YOUR_TURN response flushed */
+volatile sig_atomic_t dumpLatency = 0; /* set by SIGUSR1, dumps statistics and flight recorder */
+flight_ring_t ** connRings = NULL; /* recent events of connections indexed by socket fd, NULL until first event */
+flight_ring_t * gameRings[MAX_GAMES]; /* recent events of games indexed by game slot, NULL until first game in the slot */
+const char * flightPath = NULL; /* flight recorder dump file, NULL - nim-server-<pid>.flight */
+volatile sig_atomic_t upgradeRequested = 0; /* set by SIGUSR2 */
+FILE * captureFile = NULL; /* traffic capture file, NULL if not capturing */
+int * captureConn = NULL; /* capture numbers of connections indexed by socket fd, -1 if not captured, allocated only when capturing */
+int captureCap = 0; /* size of captureConn */
+int captureConnsCnt = 0; /* number of connections captured */
+int lowLatency = 0; /* 1 - TCP_NODELAY and frames flushed at the end of loop iteration */
+int busyPollUs = 0; /* microseconds of polling before main loop sleeps, 0 - no busy polling */
+int datagramMode = 0; /* 1 - statuses are sent to subscribed spectators as datagrams */
+int statusSocket = -1; /* UDP socket spectator statuses are sent from, -1 if datagrams are off */
+const char * solverPath = NULL; /* solved positions table file, NULL - no table */
+solver_table_t solverTable; /* positions of default game type, header is NULL if no table */
+analyzer_t analyzer; /* position analysis cache and worker */
+unsigned int * connGen = NULL; /* disconnects of socket fd, analysis for previous connection of the fd is dropped */
+unsigned char * connReady = NULL; /* CONN_ flags of socket fd in current loop iteration */
+int * readyFds = NULL; /* sockets whose messages are handled in current loop iteration */
+int readyCnt = 0; /* number of sockets in readyFds */
+int * carriedFds = NULL; /* sockets with buffered messages left for next loop iteration */
+int carriedCnt = 0; /* number of sockets in carriedFds */
+socket_poller_t connPoller = { -1, NULL, 0, 0 }; /* epoll of listening socket, analysis replies and connections */
+int sessionGraceSec = 0; /* seconds seat of disconnected player is held for, 0 - seats are not held */
+int detachedCnt = 0; /* players holding seats while disconnected */
+admission_t admission; /* overload controller, sheds work under load if enabled */
+long sessionsCnt = 0; /* number of sessions multiplexed over connections */
+scheduler_t sched; /* budgets and round robin cursors of main loop phases */
+const char * ratingsPath = NULL; /* player ratings file, NULL - ratings are kept in memory */
+rating_table_t ratings; /* player ratings, header is NULL if players are not rated */
+int tournamentSize = 0; /* entrants of each tournament, 0 - no tournaments */
+int tournamentRounds = 0; /* rounds of swiss tournament, 0 - round robin */
+int fastOpenQueue = 0; /* pending fast open connections of the listener, 0 - TCP Fast Open is off */
+const char * snapshotPath = NULL; /* shared memory file games are published to, NULL - not published */
+snapshot_map_t snapshots; /* published game snapshots, header is NULL if not published */
+const char * exportSink = NULL; /* sink results of ended games are exported to, NULL - not exported */
+const char * exportSpillPath = NULL; /* spill file of results the sink did not take, NULL - EXPORT_SPILL_DEFAULT */
+exporter_t exporter; /* queue and sender of exported results */
+int exporting = 0; /* 1 while the exporter runs */
+volatile sig_atomic_t terminateRequested = 0; /* set by SIGTERM while exporting, exported results are flushed before exit */
 
 /**
- * function checks for end of game
- * function sums cubes in heaps array
- * return 1 if there are no more cubes in array the game will end
+ * function checks for end of game by rules of the game variant
+ * return 1 if there are no more cubes in heaps the game will end
  * return 0 otherwise
  **/
-int checkGameEnd(short *heaps) {
-	int i, sum = 0;
-	for (i = 0; i < NUM_OF_HEAPS; i++) {
-		sum += heaps[i];
-	}
-	return sum == 0;
+int checkGameEnd(game_t * game) {
+	return rulesIsGameEnd(&game->rules, GAME_HEAPS(game));
 }
 
 /**
  * the function checks if user move that received from client is valid
+ * by rules of the game variant
  * returns 0 if the move is not valid, 1 otherwise
  **/
-int isUserMoveValid(short heapIndex, short cubes_num, short * heaps) {
-	return (heapIndex >= 0 && heapIndex <= NUM_OF_HEAPS && (cubes_num <= 1500) && (cubes_num > 0) && heaps[heapIndex] >= cubes_num);
+int isUserMoveValid(game_t * game, short heapIndex, short cubes_num) {
+	return rulesIsMoveValid(&game->rules, GAME_HEAPS(game), heapIndex, cubes_num);
 }
 
 /**
@@ -57,32 +132,22 @@ void playerMove(short *heaps, short heap, int num_of_cubes) {
 }
 
 /**
- * the function counts current number of clients
- * returns current number of clients
+ * the function returns current number of clients
  **/
-char getClientsCount() {
-	int id;
-	char cnt = 0;
-	for (id = 0; id < MAX_ID; id++) {
-		client_t* client;
-		client = clientList[id];
-		if (client != NULL) {
-			cnt++;
-		}
-	}
-	return cnt;
+char getClientsCount(game_t * game) {
+	return gameTable.clientsCnt[GAME_SLOT(game)];
 }
 
 /**
  * the function counts current number of players
  * returns current number of players
  **/
-char getPlayersCount() {
+char getPlayersCount(game_t * game) {
 	int id;
 	char cnt = 0;
 	for (id = 0; id < MAX_ID; id++) {
 		client_t* client;
-		client = clientList[id];
+		client = game->clientList[id];
 		if (client != NULL) {
 			if (client->status != SPECTATOR) {
 				cnt++;
@@ -96,41 +161,251 @@ char getPlayersCount() {
  * the function finds player that need to make move
  * returns player that need to make move
  **/
-client_t * getCurrentPlayer() {
-	int id;
-	for (id = 0; id < MAX_ID; id++) {
-		client_t* client;
-		client = clientList[id];
-		if (client != NULL) {
-			if (client->status == YOUR_TURN) {
-				return client;
-			}
-		}
-	}
-	return NULL;
+client_t * getCurrentPlayer(game_t * game) {
+	char id = gameTable.current[GAME_SLOT(game)];
+	return (id == CLIENT_ID_INVALID) ? NULL : game->clientList[(int) id];
 }
-char maxId = 0;
-char getMaxId() {
-	char current = maxId++;
+
+char getMaxId(game_t * game) {
+	char current = game->maxId++;
 	if (current >= MAX_ID) {
+		game->maxId = MAX_ID;
 		return CLIENT_ID_INVALID;
 	}
 	return current;
 }
 
 /**
- * the function sends welcome message
+ * the function writes traffic of the connection to the capture file when capturing,
+ * new connection gets next capture number, events of closed connection are ignored
+ * msg - frame of CAPTURE_IN and CAPTURE_OUT, NULL otherwise
  **/
-void sendWelcomeMsg(buffered_socket_t * fd, int clientId, game_type_t gameType, char p, client_status_t clientStatus) {
-	payload_t* pl = (payload_t*) malloc(sizeof(payload_t));
+void captureEvent(int fd, capture_kind_t kind, int flags, game_msg_t * msg) {
+	if (captureFile == NULL) {
+		return;
+	}
+	if (fd >= captureCap) { /* table follows connection table, connection opened before is not captured */
+		int * capture = (kind == CAPTURE_OPEN) ? (int *) realloc(captureConn, connCap * sizeof(int)) : NULL;
+		if (capture == NULL) {
+			return;
+		}
+		memset(capture + captureCap, -1, (connCap - captureCap) * sizeof(int));
+		captureConn = capture;
+		captureCap = connCap;
+	}
+	if (kind == CAPTURE_OPEN) {
+		captureConn[fd] = captureConnsCnt++;
+	}
+	if (captureConn[fd] == -1) {
+		return;
+	}
+	if (!captureWrite(captureFile, flightNowNs, captureConn[fd], kind, flags, msg)) {
+		printf("Error writing capture, capture stopped: %s!\n", strerror(errno));
+		fclose(captureFile);
+		captureFile = NULL;
+		return;
+	}
+	if (kind == CAPTURE_CLOSE) {
+		captureConn[fd] = -1;
+	}
+}
+
+/**
+ * the function checks if statuses of the client are sent as datagrams,
+ * only spectators subscribed to them get datagrams, players get statuses over TCP
+ **/
+int usesDatagrams(client_t * client) {
+	return statusSocket != -1 && CLIENT_EXT(client)->udpPort != 0 && client->status == SPECTATOR;
+}
+
+/**
+ * the function subscribes client to status datagrams sent to its address and port it asked for
+ **/
+void subscribeDatagrams(client_t * client, join_t * join) {
+	struct sockaddr_in address;
+	socklen_t addressLen = sizeof(address);
+	client_ext_t * ext;
+	if (statusSocket == -1 || isSession(client) || join->udpPort == 0 || getpeername(client->sock.socket, (struct sockaddr *) &address, &addressLen) == -1
+			|| (ext = clientExt(client)) == NULL) {
+		return; /* without memory client keeps getting statuses over TCP */
+	}
+	ext->udpAddr = address.sin_addr.s_addr;
+	ext->udpPort = join->udpPort;
+}
+
+/**
+ * the function checks if client holds its seat while disconnected
+ **/
+int isDetached(client_t * client) {
+	return client->sock.socket == -1;
+}
+
+/**
+ * the function checks if client is session multiplexed over connection of another client
+ **/
+int isSession(client_t * client) {
+	return client->sock.link != NULL;
+}
+
+/**
+ * the function returns slot referencing connected client: connList entry of connection
+ * or sessions entry of its link, slot not referencing the client any more tells it was disconnected
+ **/
+client_t ** getClientSlot(client_t * client) {
+	if (isSession(client)) {
+		client_t * link = (client_t *) client->sock.link; /* sock is the first member of client */
+		return &link->ext->sessions[client->sock.session];
+	}
+	return &connList[client->sock.socket];
+}
+
+/**
+ * the function returns client of session multiplexed over connection of link,
+ * session is created by its first frame and waits for its join request like new connection
+ * returns NULL if session ID is out of range or there is no memory
+ **/
+client_t * getSession(client_t * link, unsigned short session) {
+	client_ext_t * ext = (session < MAX_SESSIONS) ? clientExt(link) : NULL;
+	if (ext == NULL) {
+		return NULL;
+	}
+	if (link->sock.mux == NULL && (link->sock.mux = (socket_mux_t *) calloc(1, sizeof(socket_mux_t))) == NULL) {
+		return NULL;
+	}
+	if (session >= ext->sessionsCap) {
+		int cap = (ext->sessionsCap == 0) ? 16 : ext->sessionsCap;
+		while (cap <= session) {
+			cap *= 2;
+		}
+		client_t ** sessions = (client_t **) realloc(ext->sessions, cap * sizeof(client_t *));
+		if (sessions == NULL) {
+			return NULL;
+		}
+		memset(sessions + ext->sessionsCap, 0, (cap - ext->sessionsCap) * sizeof(client_t *));
+		ext->sessions = sessions;
+		ext->sessionsCap = cap;
+	}
+	if (ext->sessions[session] == NULL) {
+		client_t * client = (client_t *) calloc(1, sizeof(client_t));
+		if (client == NULL) {
+			return NULL;
+		}
+		if ((client->sock.mux = (socket_mux_t *) calloc(1, sizeof(socket_mux_t))) == NULL) {
+			free(client);
+			return NULL;
+		}
+		client->sock.socket = link->sock.socket;
+		client->sock.link = &link->sock;
+		client->sock.session = session;
+		client->status = UNKNOWN;
+		client->id = CLIENT_ID_INVALID;
+		ext->sessions[session] = client;
+		sessionsCnt++;
+		flightRecord(&connRings[link->sock.socket], FLIGHT_ACCEPT, 0, 0, session, 0);
+	}
+	return ext->sessions[session];
+}
+
+/**
+ * the function disconnects all sessions multiplexed over connection of link
+ * and frees multiplexing state of the connection
+ **/
+void closeSessions(client_t * link) {
+	client_ext_t * ext = link->ext;
+	int session;
+	for (session = 0; session < ext->sessionsCap; session++) {
+		if (ext->sessions[session] != NULL) {
+			onClientDisconnect(ext->sessions[session]);
+		}
+	}
+	free(ext->sessions);
+	ext->sessions = NULL;
+	ext->sessionsCap = 0;
+	free(link->sock.mux);
+	link->sock.mux = NULL;
+}
+
+/**
+ * the function returns token client resumes its seat with, 0 if seats are not held
+ * token carries game slot and client ID, its random part is checked on resume
+ **/
+unsigned long long getSessionToken(client_t * client) {
+	game_t * game = client->game;
+	if (game == NULL || game->seatTokens[(int) client->id] == 0) {
+		return 0;
+	}
+	return ((unsigned long long) game->seatTokens[(int) client->id] << 32) | ((game - games) << 8) | client->id;
+}
+
+/**
+ * the function sends message using buffer and records it in flight ring of the connection
+ * msg NULL flushes the buffer
+ * returns 1 on success or 0 on failure
+ **/
+int sendRecorded(buffered_socket_t * fd, game_msg_t * msg) {
+	int res = sendMessageB(fd, msg);
+	if (msg == NULL) {
+		flightRecord(&connRings[fd->socket], FLIGHT_FLUSH, 0, 0, fd->rxBuffPos, fd->statusPending);
+	} else {
+		flightRecord(&connRings[fd->socket], (res) ? FLIGHT_SEND : FLIGHT_SEND_FAILED, msg->type, payloadSize(msg), fd->rxBuffPos, fd->statusPending);
+		if (res) {
+			captureEvent(fd->socket, CAPTURE_OUT, 0, msg);
+		}
+	}
+	return res;
+}
+
+/**
+ * the function changes client status and records the change
+ * connection of player records in full ring, connection that only watches or waits keeps small one
+ **/
+void setClientStatus(client_t * client, client_status_t status) {
+	if (!isDetached(client)) {
+		if (status != SPECTATOR) {
+			flightResize(&connRings[client->sock.socket], FLIGHT_RING_SIZE);
+		}
+		flightRecord(&connRings[client->sock.socket], FLIGHT_STATUS_CHANGE, 0, status, client->id, client->status);
+	}
+	if (client->game != NULL) {
+		int slot = GAME_SLOT(client->game);
+		flightRecord(&gameRings[slot], FLIGHT_STATUS_CHANGE, 0, status, client->id, client->status);
+		client->game->rosterChanged |= 1u << client->id;
+		gameTable.flags[slot] |= GAME_PUBLISH;
+		if (status == YOUR_TURN) { /* turn cursor follows the status */
+			gameTable.current[slot] = client->id;
+		} else if (gameTable.current[slot] == client->id) {
+			gameTable.current[slot] = CLIENT_ID_INVALID;
+		}
+	}
+	client->status = status;
+}
+
+/**
+ * the function sends welcome message with flags, status keyframe given is merged into it
+ * returns 0 if client was disconnected
+ **/
+int sendWelcomeMsg(buffered_socket_t * fd, int clientId, game_type_t gameType, char p, client_status_t clientStatus, unsigned long long sessionToken, unsigned short rating, char flags, const status_t * status) {
+	payload_t* pl = (payload_t*) calloc(1, sizeof(payload_t));
 	pl->welcomeMsg.clientId = clientId;
 	pl->welcomeMsg.gameType = gameType;
 	pl->welcomeMsg.playersCnt = p;
 	pl->welcomeMsg.clientStatus = clientStatus;
+	pl->welcomeMsg.sessionToken = sessionToken;
+	pl->welcomeMsg.rating = rating;
+	pl->welcomeMsg.maxTake = maxTake;
+	pl->welcomeMsg.flags = flags;
+	if (status != NULL) {
+		pl->welcomeMsg.flags |= WELCOME_STATUS;
+		pl->welcomeMsg.clientStatus = status->clientStatus;
+		pl->welcomeMsg.statusSeq = status->seq;
+		pl->welcomeMsg.endGame = status->endGame;
+		pl->welcomeMsg.heapStatus = status->heapStatus;
+	}
 	game_msg_t* msg = createMessage(WELCOME, *pl);
-	sendMessageB(fd, msg);
+	int res = sendRecorded(fd, msg);
 	destroyMsg(&msg);
 	free(pl);
+	return res;
 }
 
 /**
@@ -141,70 +416,122 @@ void sendRejectMsg(int fd) {
 	pl->welcomeMsg.clientId = -1;
 	pl->welcomeMsg.gameType = REJECTED;
 	pl->welcomeMsg.playersCnt = -1;
+	pl->welcomeMsg.sessionToken = 0;
 	game_msg_t* msg = createMessage(WELCOME, *pl);
 	sendMessage(fd, msg);
+	captureEvent(fd, CAPTURE_OUT, 0, msg);
 	destroyMsg(&msg);
 	free(pl);
 }
 
 /**
- * the function sends turn response message
+ * the function settles send of message the client can do without (CHAT, TURN_RESP):
+ * message that does not fit full output queue of the client is dropped and counted, the client stays connected
+ * returns 0 if the connection failed
+ **/
+int dropOnOverflow(int sent) {
+	if (sent) {
+		return 1;
+	}
+	if (errno != ENOBUFS) {
+		return 0;
+	}
+	framesDropped++;
+	return 1;
+}
+
+/**
+ * the function sends turn response message, moveSeq of the move request is echoed back
  **/
-int sendTurnResponse(buffered_socket_t * fd, turn_resp_t l) {
+int sendTurnResponse(buffered_socket_t * fd, turn_resp_t l, unsigned short moveSeq) {
 	payload_t* pl = (payload_t*) malloc(sizeof(payload_t));
-	pl->turnResp = l;
+	pl->turnResp.resp = l;
+	pl->turnResp.moveSeq = moveSeq;
 	game_msg_t* msg = createMessage(TURN_RESP, *pl);
 	int res;
-	res = sendMessageB(fd, msg);
+	res = sendRecorded(fd, msg);
 	destroyMsg(&msg);
 	free(pl);
 	return res;
 }
 
+/**
+ * the function creates status message with current statusSeq of the game
+ * keyframe carries all heaps, delta carries only changedHeap (-1 if none changed)
+ **/
+game_msg_t * createStatusMsg(game_t * game, int keyframe, char changedHeap, client_status_t clientStatus, end_game_t endGame) {
+	payload_t pl;
+	memset(&pl, 0, sizeof(payload_t));
+	pl.status.seq = game->statusSeq;
+	pl.status.clientStatus = clientStatus;
+	pl.status.endGame = endGame;
+	pl.status.flags = (keyframe) ? STATUS_KEYFRAME : 0;
+	pl.status.changedHeap = (keyframe) ? -1 : changedHeap;
+	if (!keyframe && changedHeap >= 0) {
+		pl.status.changedAmount = GAME_HEAPS(game)[(int) changedHeap];
+	}
+	if (keyframe) {
+		int i;
+		for (i = 0; i < NUM_OF_HEAPS; i++) {
+			pl.status.heapStatus.heap[i] = GAME_HEAPS(game)[i];
+		}
+	}
+	return createMessage(STATUS, pl);
+}
+
+/**
+ * the function determines end game status of client that joined
+ * or asked for keyframe outside of the status broadcast
+ **/
+end_game_t getPersonalEndGame(client_t * client) {
+	if (!checkGameEnd(client->game)) {
+		return NOT_FINISHED;
+	}
+	if (client->status == SPECTATOR) {
+		return YOU_WATCHED;
+	}
+	/* current player made the last move - the same as in broadcastStatus */
+	if (client == getCurrentPlayer(client->game)) {
+		return client->game->rules.lastMoverEnd;
+	}
+	return client->game->rules.othersEnd;
+}
+
 /**
  * the function sends end message
  **/
 int sendEndMessage(buffered_socket_t * fd, end_game_t endGame, game_msg_t* statusMsg) {
 	statusMsg->payload.status.endGame = endGame;
 	int res;
-	res = sendMessageB(fd, statusMsg);
+	res = sendRecorded(fd, statusMsg);
 	return res;
 }
 
 /**
  * the function sets next player as player that need to make move
  **/
-void setNextPlayerAsCurrent() {
-	client_t* currentPlayer = getCurrentPlayer();
+void setNextPlayerAsCurrent(game_t * game) {
+	client_t* currentPlayer = getCurrentPlayer(game);
 	if (currentPlayer == NULL) {
 		int id;
 		for (id = 0; id < MAX_ID; id++) {
 			client_t* client;
-			client = clientList[id];
-			if (client != NULL) {
-				client->status = YOUR_TURN;
+			client = game->clientList[id];
+			if (client != NULL && client->status != SPECTATOR) {
+				setClientStatus(client, YOUR_TURN);
 				break;
 			}
 		}
 	} else {
-		currentPlayer->status = PLAYING;
-		int id;
-		for (id = 0; id < MAX_ID; id++) {
-			client_t* client;
-			client = clientList[id];
-			if (client != NULL) {
-				if (currentPlayer->sock.socket == client->sock.socket) {
-					int id2;
-					for (id2 = id + 1; id2 <= MAX_ID + id; id2++) {
-						client_t* client2;
-						client2 = clientList[id2 % MAX_ID];
-						if (client2 != NULL) {
-							if (client2->status != SPECTATOR) {
-								client2->status = YOUR_TURN;
-								break;
-							}
-						}
-					}
+		setClientStatus(currentPlayer, PLAYING);
+		int id = currentPlayer->id;
+		int id2;
+		for (id2 = id + 1; id2 <= MAX_ID + id; id2++) {
+			client_t* client2;
+			client2 = game->clientList[id2 % MAX_ID];
+			if (client2 != NULL) {
+				if (client2->status != SPECTATOR) {
+					setClientStatus(client2, YOUR_TURN);
 					break;
 				}
 			}
@@ -215,9 +542,9 @@ void setNextPlayerAsCurrent() {
 /**
  * the function determines client status
  **/
-client_status_t determineNewClientStatus(int p) {
-	char playersCount = getPlayersCount();
-	if (playersCount < p) {
+client_status_t determineNewClientStatus(game_t * game) {
+	char playersCount = getPlayersCount(game);
+	if (playersCount < game->p) {
 		return PLAYING;
 	} else {
 		return SPECTATOR;
@@ -227,16 +554,16 @@ client_status_t determineNewClientStatus(int p) {
 /**
  * the function updates client status
  **/
-void updateClientsStatus(int * needToSendStatus) {
-	char playersCount = getPlayersCount();
+void updateClientsStatus(game_t * game) {
+	char playersCount = getPlayersCount(game);
 	int id;
-	for (id = 0; id < MAX_ID && playersCount < p; id++) {
+	for (id = 0; id < MAX_ID && playersCount < game->p; id++) {
 		client_t* client;
-		client = clientList[id];
+		client = game->clientList[id];
 		if (client != NULL) {
 			if (client->status == SPECTATOR) {
-				client->status = PLAYING;
-				*needToSendStatus = 1;
+				setClientStatus(client, PLAYING);
+				GAME_FLAGS(game) |= GAME_SEND_STATUS;
 				playersCount++;
 			}
 		}
@@ -245,373 +572,1926 @@ void updateClientsStatus(int * needToSendStatus) {
 }
 
 /**
- * the function handles client disconnect
+ * the function prepares free game slots
  **/
-int onClientDisconnect(client_t * disconnected, int * isTurnDone, int * needToSendStatus) {
-	int id;
-	for (id = 0; id < MAX_ID; id++) {
-		if (clientList[id] != NULL && clientList[id]->sock.socket == disconnected->sock.socket) {
-			if (clientList[id]->status == YOUR_TURN) {
-				*isTurnDone = 1;
-			}
-			free(disconnected);
-			clientList[id] = NULL;
+void initGames() {
+	int i;
+	memset(games, 0, sizeof(games));
+	for (i = 0; i < MAX_GAMES; i++) {
+		freeGames[i] = MAX_GAMES - 1 - i;
+	}
+	freeGamesCnt = MAX_GAMES;
+}
+
+/**
+ * the function takes free game slot and starts new game in it
+ * returns NULL if all game slots are in use
+ **/
+game_t * createGame(game_type_t gameType, int p, int cubes) {
+	if (freeGamesCnt == -1) {
+		initGames();
+	}
+	if (freeGamesCnt == 0) {
+		return NULL;
+	}
+	game_t * game = &games[freeGames[--freeGamesCnt]];
+	int slot = GAME_SLOT(game);
+	memset(game, 0, sizeof(game_t));
+	memset(gameTable.heaps[slot], 0, sizeof(gameTable.heaps[slot]));
+	gameTable.flags[slot] = GAME_IN_USE | GAME_EMPTY | GAME_PUBLISH;
+	gameTable.current[slot] = CLIENT_ID_INVALID;
+	gameTable.clientsCnt[slot] = 0;
+	game->gameType = gameType;
+	game->rosterChanged = ROSTER_ALL; /* roster of previous game in the slot is cleared */
+	game->startMs = (exporting) ? wallMs() : 0;
+	initRules(&game->rules, gameType, MOVES_ONE_HEAP, heapsCnt, maxTake);
+	game->p = p;
+	int i;
+	for (i = 0; i < game->rules.heapsCnt; i++) {
+		gameTable.heaps[slot][i] = cubes;
+		game->sentHeaps[i] = cubes;
+	}
+	if (gameType == MISERE || gameType == REGULAR) {
+		newestGame[gameType] = game;
+	}
+	flightResize(&gameRings[slot], FLIGHT_RING_SIZE);
+	flightRecord(&gameRings[slot], FLIGHT_GAME_START, 0, 0, p, game->rules.heapsCnt);
+	publishGame(game, 0);
+	return game;
+}
+
+/**
+ * the function returns game slot to the free slots
+ * game should have no clients
+ **/
+void destroyGame(game_t * game) {
+	if (game->gameType == MISERE || game->gameType == REGULAR) {
+		if (newestGame[game->gameType] == game) {
+			newestGame[game->gameType] = NULL;
+		}
+	}
+	GAME_FLAGS(game) = 0;
+	freeGames[freeGamesCnt++] = game - games;
+	publishGame(game, 0);
+}
+
+/**
+ * the function returns first game slot from from up to to having any of flags, to if there is none
+ * flags of 8 slots are tested at once, so sweep over all slots is linear pass over the flags
+ **/
+int gameTableNext(int from, int to, unsigned char flags) {
+	unsigned long long mask = flags * 0x0101010101010101ULL;
+	int slot = from;
+	for (; slot < to && (slot & 7) != 0; slot++) {
+		if (gameTable.flags[slot] & flags) {
+			return slot;
+		}
+	}
+	for (; slot + 8 <= to; slot += 8) {
+		unsigned long long word;
+		memcpy(&word, &gameTable.flags[slot], sizeof(word));
+		if (word & mask) {
 			break;
 		}
 	}
-	//printf("onClientDisconnect getClientsCount=%d\n", getClientsCount());
-	updateClientsStatus(needToSendStatus);
-	return 1;
+	for (; slot < to; slot++) {
+		if (gameTable.flags[slot] & flags) {
+			return slot;
+		}
+	}
+	return to;
 }
 
 /**
- * the function handles received messages
+ * the function marks game holding seats and keeps time the earliest held seat was left
  **/
-void handleMsg(game_msg_t* msg, client_t * sourceClient, short * heap, int * isTurnDone, int * needToSendStatus) {
-	char destination;
-	switch (msg->type) {
-	/* handle chat message */
-	case CHAT:
-		//fprintf(stderr,"CHAT: src=%d dst=%d\n",msg->payload.chat.srcId,msg->payload.chat.dstId);
-		destination = msg->payload.chat.dstId;
-		int id;
-		for (id = 0; id < MAX_ID; id++) {
-			client_t* destinationCl;
-			destinationCl = clientList[id];
-			if (destinationCl != NULL && (destination == -1 || destination - 1 == id)) {
-				if (!sendMessageB(&destinationCl->sock, msg)) {
-					onClientDisconnect(destinationCl, isTurnDone, needToSendStatus);
-				}
+void indexSeats(game_t * game) {
+	int slot = GAME_SLOT(game);
+	gameTable.flags[slot] &= ~GAME_SEATS_HELD;
+	int id;
+	for (id = 0; id < MAX_ID; id++) {
+		client_t * client = game->clientList[id];
+		if (client != NULL && isDetached(client)) {
+			if (!(gameTable.flags[slot] & GAME_SEATS_HELD) || game->seatDetachedNs[id] < gameTable.heldSinceNs[slot]) {
+				gameTable.heldSinceNs[slot] = game->seatDetachedNs[id];
 			}
+			gameTable.flags[slot] |= GAME_SEATS_HELD;
 		}
-		break;
-	/* handle user move message */
-	case TURN_REQ:
-		//printf("turn_req\n");
-		if (getCurrentPlayer()->sock.socket != sourceClient->sock.socket) {
-			ALT(sendTurnResponse(&(sourceClient->sock), NOT_YOUR_TURN), onClientDisconnect(sourceClient, isTurnDone, needToSendStatus));
-		} else {
-			char heapIndex = msg->payload.turnReq.heapIndex;
-			short cubes = msg->payload.turnReq.amount;
-			int isLegal = isUserMoveValid(heapIndex, cubes, heap);
-			if (isLegal) {
-				playerMove(heap, heapIndex, cubes);
-				//printf("move done\n");
-			} else {
-				//fprintf(stderr, "skipping turn - illegal move\n");
+	}
+}
+
+/**
+ * the function recomputes game table entries of game from its roster, used for games restored on upgrade
+ **/
+void indexGame(game_t * game) {
+	int slot = GAME_SLOT(game);
+	gameTable.clientsCnt[slot] = 0;
+	gameTable.current[slot] = CLIENT_ID_INVALID;
+	int id;
+	for (id = 0; id < MAX_ID; id++) {
+		client_t * client = game->clientList[id];
+		if (client != NULL) {
+			gameTable.clientsCnt[slot]++;
+			if (client->status == YOUR_TURN) {
+				gameTable.current[slot] = id;
 			}
-			//printf("sending turn response\n");
-			ALT(sendTurnResponse(&(sourceClient->sock), (isLegal) ? LEGAL : ILLEGAL), onClientDisconnect(sourceClient, isTurnDone, needToSendStatus));
-			*isTurnDone = 1;
 		}
-		break;
-	default:
-		ALT(sendTurnResponse(&(sourceClient->sock), NOT_YOUR_TURN), onClientDisconnect(sourceClient, isTurnDone, needToSendStatus));
 	}
+	if (gameTable.clientsCnt[slot] > 0) {
+		gameTable.flags[slot] &= ~GAME_EMPTY;
+	} else {
+		gameTable.flags[slot] |= GAME_EMPTY;
+	}
+	game->rosterChanged = ROSTER_ALL;
+	gameTable.flags[slot] |= GAME_PUBLISH;
+	indexSeats(game);
 }
 
 /**
- * function sends reject message
- * and closes connection
- * returns 1 on socket error
- */
-int rejectClient(int newConnection) {
-	sendRejectMsg(newConnection); //send reject message to client
-	if ((close(newConnection) == -1)) { //close connection
-		printf("Error closing connection: %s!\n", strerror(errno));
-		return 1; //exit on error
+ * the function takes client ID out of the game roster
+ **/
+void removeClientFromGame(game_t * game, char id) {
+	int slot = GAME_SLOT(game);
+	game->clientList[(int) id] = NULL;
+	game->rosterChanged |= 1u << id;
+	gameTable.flags[slot] |= GAME_PUBLISH;
+	if (gameTable.current[slot] == id) {
+		gameTable.current[slot] = CLIENT_ID_INVALID;
+	}
+	if (--gameTable.clientsCnt[slot] == 0) {
+		gameTable.flags[slot] |= GAME_EMPTY;
 	}
-	return 0;
 }
 
 /**
- * function sets non-blocking socket
- */
-int setNonblocking(int fd) {
-int flags;
-/* if they have O_NONBLOCK, use the Posix way to do it */
-#if defined(O_NONBLOCK)
-	if (-1 == (flags = fcntl(fd, F_GETFL, 0)))
-		flags = 0;
-	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-#else
-/* otherwise, use the old way of doing it */
-	flags = 1;
-	return ioctl(fd, FIOBIO, &flags);
-#endif
+ * the function publishes heaps, roster and turn of the game to its snapshot slot for observers,
+ * only roster entries of changed clients are stored, so a move stores heaps and two entries
+ * to one cache line of shared memory and takes no locks or syscalls
+ **/
+void publishGame(game_t * game, int isGameEnded) {
+	if (snapshots.header == NULL) {
+		return;
+	}
+	game_snapshot_t * snap = snapshotBegin(&snapshots, game - games);
+	snap->statusSeq = game->statusSeq;
+	memcpy(snap->heaps, GAME_HEAPS(game), sizeof(snap->heaps));
+	snap->inUse = (GAME_FLAGS(game) & GAME_IN_USE) != 0;
+	snap->gameType = game->gameType;
+	snap->heapsCnt = game->rules.heapsCnt;
+	snap->ended = isGameEnded;
+	unsigned int changed = game->rosterChanged;
+	game->rosterChanged = 0;
+	GAME_FLAGS(game) &= ~GAME_PUBLISH;
+	while (changed != 0) {
+		int id = __builtin_ctz(changed);
+		changed &= changed - 1;
+		client_t * client = game->clientList[id];
+		snap->roster[id] = (client != NULL) ? client->status : SNAPSHOT_NO_CLIENT;
+		if (snap->roster[id] == YOUR_TURN) {
+			snap->current = id;
+		} else if (snap->current == id) {
+			snap->current = SNAPSHOT_NO_CLIENT;
+		}
+	}
+	snapshotEnd(snap);
 }
 
-/* main function */
-int main(int argc, char *argv[]) {
-	int M; /* number of cubes in the heaps */
-	game_type_t gameType = REGULAR; /* default game type */
-	int port = DEFAULT_PORT; /* default port */
-	struct sockaddr_in server_address, client_address; /* structure for socket parameters */
-	int listSocket; /* listening socket descriptor */
-	socklen_t clientLen; /* listening socket size */
-
-	fd_set readSet; /* set of read-ready socket file descriptors for select */
-	fd_set writeSet; /* set of write-ready socket file descriptors for select */
-	/* check for arguments received in the command line */
-	if (argc == 4 || argc == 5) { /* if there are 2 or 3 command line arguments */
-		p = atoi(argv[1]);
-		if (p < 2 || p > 9) { /* check if number of players is in range */
-			printf("Error: Number of players should be between 2 and 9!\n");
-			return 1; //exit on error
-		}
-		//printf("Can be simultaneously connected only %d clients. Max_num_of_players=%d\n", MAX_NUM_OF_CLIENTS, p);
-		M = atoi(argv[2]);
-		if (atoi(argv[3])) {
-			gameType = MISERE;
-		}
-		if (argc == 5) { /* if there are 3 command line arguments */
-			port = atoi(argv[4]);
-		}
-	} else {
-		printf("Error: Wrong number of arguments received!\n");
-		return 1; //exit on error
+/**
+ * the function grows tables indexed by socket fd so that fd fits, tables double
+ * tables grown before failure keep their new size, they are only bigger than connCap
+ * returns 0 if there is no memory
+ **/
+int growConnections(int fd) {
+	if (fd < connCap) {
+		return 1;
 	}
-	/* create listening socket */
-	if ((listSocket = socket(AF_INET, SOCK_STREAM, 0)) == -1) { /* create socket of Internet domain, messages read in streams, OS chooses TCP */
-		printf("Error creating socket: %s!\n", strerror(errno));
-		return errno; //exit on error
+	int cap = (connCap > 0) ? connCap : CONN_TABLE_MIN;
+	while (cap <= fd) {
+		cap *= 2;
 	}
-	/* set server address parameters */
-	memset((char *) &server_address, 0, sizeof(server_address));
-	server_address.sin_family = AF_INET; /* code for the address family, always set to the AF_INET */
-	server_address.sin_port = htons(port); /* port number, a port number in host byte order converted to a port number in network byte order */
-	server_address.sin_addr.s_addr = INADDR_ANY; /* field contains the IP address of the host, for server - IP address of the machine on which the server is running */
-	/* reuse server address */
-	int yes = 1;
-	if ((setsockopt(listSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1)) {
-		printf("Error reusing port: %s!\n", strerror(errno));
-		return errno; //exit on error
+	client_t ** list = (client_t **) realloc(connList, cap * sizeof(client_t *));
+	if (list == NULL) {
+		return 0;
 	}
-	/* bind the socket */
-	if ((bind(listSocket, (struct sockaddr *) &server_address, sizeof(server_address))) == -1) {
-		printf("Error binding socket: %s!\n", strerror(errno));
-		return errno; //exit on error
+	connList = list;
+	flight_ring_t ** rings = (flight_ring_t **) realloc(connRings, cap * sizeof(flight_ring_t *));
+	if (rings == NULL) {
+		return 0;
 	}
-	/* listen on the created socket, queue of MAX_NUM_OF_CLIENTS length */
-	if (listen(listSocket, MAX_NUM_OF_CLIENTS) == -1) {
-		printf("Error listening to socket: %s!\n", strerror(errno));
-		return errno; //exit on error
+	connRings = rings;
+	unsigned int * gen = (unsigned int *) realloc(connGen, cap * sizeof(unsigned int));
+	if (gen == NULL) {
+		return 0;
 	}
-	/* initialize heaps array */
-	short heaps[NUM_OF_HEAPS] = { M, M, M, M };
-	/* main loop of the game */
-	while (1) {
-		FD_ZERO(&readSet); /* initialize set of read-ready sockets */
-		FD_ZERO(&writeSet); /* initialize set of write-ready sockets */
-
-		int highSD = listSocket; /* highest socket descriptor */
-		FD_SET(listSocket, &readSet); /* add listening socket to read-ready set */
-		int numInList;
-		/* add clients to read and write ready sets */
-		for (numInList = 0; numInList < MAX_ID; numInList++) {
-			if (clientList[numInList] != NULL) {
-				buffered_socket_t sock = clientList[numInList]->sock;
-				int fd = sock.socket;
-				FD_SET(fd, &readSet);
-				if (sock.rxBuffPos > 0) {
-					FD_SET(fd, &writeSet);
-				}
-				if (fd > highSD) {
-					highSD = fd;
-				}
-			}
-		}
-		/* select active socket */
-		select(highSD + 1, &readSet, &writeSet, (fd_set *) 0, NULL);
-		int isTurnDone = 0;
-		int needToSendStatus = 0;
-		/* try to send messages to active write ready socket */
-		int id;
-		for (id = 0; id < MAX_ID; id++) {
+	connGen = gen;
+	unsigned char * ready = (unsigned char *) realloc(connReady, cap * sizeof(unsigned char));
+	if (ready == NULL) {
+		return 0;
+	}
+	connReady = ready;
+	int * readyList = (int *) realloc(readyFds, cap * sizeof(int));
+	if (readyList == NULL) {
+		return 0;
+	}
+	readyFds = readyList;
+	int * carried = (int *) realloc(carriedFds, cap * sizeof(int));
+	if (carried == NULL) {
+		return 0;
+	}
+	carriedFds = carried;
+	int added = cap - connCap;
+	memset(connList + connCap, 0, added * sizeof(client_t *));
+	memset(connRings + connCap, 0, added * sizeof(flight_ring_t *));
+	memset(connGen + connCap, 0, added * sizeof(unsigned int));
+	memset(connReady + connCap, 0, added * sizeof(unsigned char));
+	connCap = cap;
+	return 1;
+}
+
+const client_ext_t noClientExt; /* rarely used state of clients that have none, all fields zero */
+
+/**
+ * the function returns rarely used state of client for writing, allocated on first use
+ * returns NULL if there is no memory
+ **/
+client_ext_t * clientExt(client_t * client) {
+	if (client->ext == NULL) {
+		client->ext = (client_ext_t *) calloc(1, sizeof(client_ext_t));
+	}
+	return client->ext;
+}
+
+/**
+ * the function frees client with its out of line state, buffers of its socket must be released
+ **/
+void destroyClient(client_t * client) {
+	free(client->ext);
+	free(client->sock.mux);
+	free(client);
+}
+
+/**
+ * the function creates client for accepted connection and polls its socket
+ * client is not part of any game yet
+ * returns NULL if there is no memory or socket can't be polled
+ **/
+client_t * createClient(int fd) {
+	if (!growConnections(fd)) {
+		return NULL;
+	}
+	client_t * client = (client_t *) calloc(1, sizeof(client_t));
+	if (client == NULL) {
+		return NULL;
+	}
+	client->sock.socket = fd;
+	client->sock.rxBuffPos = 0;
+	client->sock.txBuffPos = 0;
+	client->sock.rxAttempt = 0;
+	client->sock.poller = &connPoller;
+	if (!pollerWatch(&client->sock)) {
+		free(client);
+		return NULL;
+	}
+	client->status = UNKNOWN;
+	client->id = CLIENT_ID_INVALID;
+	connList[fd] = client;
+	connectionsCnt++;
+	if (connRings[fd] != NULL) { /* ring of previous connection on the fd keeps its newest events */
+		flightResize(&connRings[fd], FLIGHT_SMALL_RING_SIZE);
+	}
+	flightRecord(&connRings[fd], FLIGHT_ACCEPT, 0, 0, 0, 0);
+	return client;
+}
+
+/**
+ * the function returns random nonzero part of session token
+ **/
+unsigned int newSeatToken() {
+	unsigned int token;
+	do {
+		if (getrandom(&token, sizeof(token), 0) != sizeof(token)) { /* no entropy - token is still unique */
+			token = (unsigned int) ((nowNs() * 0x9e3779b97f4a7c15ULL) >> 32);
+		}
+	} while (token == 0);
+	return token;
+}
+
+/**
+ * the function adds client to the game with given status
+ * returns client ID in the game or CLIENT_ID_INVALID if no more IDs available
+ **/
+char addClientToGame(game_t * game, client_t * client, client_status_t status) {
+	char clId = getMaxId(game);
+	if (clId == CLIENT_ID_INVALID) {
+		return CLIENT_ID_INVALID;
+	}
+	game->clientList[(int) clId] = client;
+	gameTable.clientsCnt[GAME_SLOT(game)]++;
+	GAME_FLAGS(game) &= ~GAME_EMPTY;
+	game->seatTokens[(int) clId] = (sessionGraceSec > 0 && status != SPECTATOR && !isSession(client)) ? newSeatToken() : 0;
+	game->seatDetachedNs[(int) clId] = 0;
+	client->game = game;
+	client->id = clId;
+	setClientStatus(client, status);
+	return clId;
+}
+
+/**
+ * the function sends welcome message and personal status keyframe
+ * to client that just entered the game, in one frame if client asked for fast join
+ * returns 0 if client was disconnected
+ **/
+int sendGameIntro(client_t * client) {
+	game_t * game = client->game;
+	client_status_t welcomeStatus = (client->status == SPECTATOR) ? SPECTATOR : PLAYING;
+	unsigned short rating = ratingValue(&ratings, ratingFind(&ratings, CLIENT_EXT(client)->playerId));
+	char flags = (client->provisional) ? WELCOME_PROVISIONAL : 0;
+	/* personal status is keyframe - client has no heaps state yet */
+	game_msg_t* personalHeapStatusMsg = createStatusMsg(game, 1, -1, client->status, getPersonalEndGame(client));
+	int res;
+	if (client->fastJoin) { /* client may move as soon as the welcome arrives */
+		res = sendWelcomeMsg(&client->sock, client->id, game->gameType, game->p, welcomeStatus, getSessionToken(client), rating, flags, &personalHeapStatusMsg->payload.status);
+	} else {
+		sendWelcomeMsg(&client->sock, client->id, game->gameType, game->p, welcomeStatus, getSessionToken(client), rating, flags, NULL);
+		/* send personal message with heap state */
+		res = sendRecorded(&client->sock, personalHeapStatusMsg);
+	}
+	destroyMsg(&(personalHeapStatusMsg));
+	if (!res) {
+		onClientDisconnect(client);
+	}
+	return res;
+}
+
+/**
+ * the function sends status of the game to all its clients
+ * status carries only the heap changed since previous seq
+ **/
+void broadcastStatus(game_t * game) {
+	game_msg_t* statusMsg[MAX_ID] = { NULL };
+	int isTurnDone = (GAME_FLAGS(game) & GAME_TURN_DONE) != 0;
+	GAME_FLAGS(game) &= ~(GAME_TURN_DONE | GAME_SEND_STATUS);
+	game->statusSeq++;
+	char changedHeap = -1;
+	int changedCnt = 0;
+	int i;
+	for (i = 0; i < NUM_OF_HEAPS; i++) {
+		if (GAME_HEAPS(game)[i] != game->sentHeaps[i]) {
+			changedHeap = i;
+			changedCnt++;
+		}
+	}
+	int keyframe = (changedCnt > 1 || game->statusSeq % KEYFRAME_INTERVAL == 0);
+	memcpy(game->sentHeaps, GAME_HEAPS(game), sizeof(game->sentHeaps));
+	/* check if game is ended */
+	int isGameEnded = checkGameEnd(game);
+	/* under load spectators skip statuses, the final one is always sent */
+	int shedSpectators = 0;
+	if (admission.level != ADMIT_NORMAL && !isGameEnded) {
+		long long now = nowNs();
+		shedSpectators = shedSpectatorStatus(&admission, game->spectatorsSentNs, now);
+		if (!shedSpectators) {
+			game->spectatorsSentNs = now;
+		}
+	}
+	int id;
+	for (id = 0; id < MAX_ID; id++) {
+		client_t* client;
+		client = game->clientList[id];
+		if (client == NULL || isDetached(client)) { /* player holding seat gets keyframe on resume */
+			continue;
+		}
+		if (client->status == SPECTATOR && shedSpectators) {
+			client->statusStale = 1;
+			admission.shedStatuses++;
+			continue;
+		}
+		/* delta can't replace coalesced or skipped status of slow client - it gets keyframe */
+		statusMsg[id] = createStatusMsg(game, keyframe || ((client->sock.statusPending || client->statusStale) && !usesDatagrams(client)), changedHeap, UNKNOWN, NOT_FINISHED);
+		client->statusStale = 0;
+	}
+	flightRecord(&gameRings[game - games], FLIGHT_BROADCAST, 0, 0, game->statusSeq, keyframe);
+	if (isGameEnded) { /* game is ended - update end game status for all */
+		flightRecord(&gameRings[game - games], FLIGHT_GAME_END, 0, 0, game->statusSeq, 0);
+		client_t* lastPlayed = getCurrentPlayer(game);
+		for (id = 0; id < MAX_ID; id++) {
+			client_t* client;
+			client = game->clientList[id];
+			if (statusMsg[id] != NULL) {
+				if (client->status == SPECTATOR) {
+					statusMsg[id]->payload.status.endGame = YOU_WATCHED;
+				} else if (client == lastPlayed) {
+					statusMsg[id]->payload.status.endGame = game->rules.lastMoverEnd;
+				} else {
+					statusMsg[id]->payload.status.endGame = game->rules.othersEnd;
+				}
+			}
+		}
+	} else { /* game is not ended - update client status for all */
+		if (isTurnDone) {
+			setNextPlayerAsCurrent(game);
+		}
+		for (id = 0; id < MAX_ID; id++) {
 			client_t* client;
-			client = clientList[id];
-			if (client != NULL) {
-				if (FD_ISSET(client->sock.socket, &writeSet)) {
-					ALT(sendMessageB(&client->sock,NULL), onClientDisconnect(client, &isTurnDone, &needToSendStatus));
+			client = game->clientList[id];
+			if (statusMsg[id] != NULL) {
+				statusMsg[id]->payload.status.clientStatus = client->status;
+			}
+		}
+	}
+	publishGame(game, isGameEnded); /* observers see the state no later than clients */
+	/* status answering timed move goes last, so the residence it carries back covers the broadcast */
+	client_t * timedClient = game->timedClient;
+	/* spectators subscribed to datagrams get the same status in one batch, final status goes over TCP */
+	struct sockaddr_in datagramAddrs[MAX_ID];
+	char datagram[FRAME_HEADER_SIZE + sizeof(payload_t)];
+	size_t datagramSize = 0;
+	int datagramsCnt = 0;
+	/* try to send messages to active write ready socket */
+	for (id = 0; id < MAX_ID; id++) {
+		client_t* client;
+		client = game->clientList[id];
+		if (client != NULL && client != timedClient && statusMsg[id] != NULL) {
+			if (!isGameEnded && usesDatagrams(client)) {
+				if (datagramsCnt == 0) {
+					datagramSize = encodeFrame(statusMsg[id], datagram, sizeof(datagram));
+				}
+				memset(&datagramAddrs[datagramsCnt], 0, sizeof(struct sockaddr_in));
+				datagramAddrs[datagramsCnt].sin_family = AF_INET;
+				datagramAddrs[datagramsCnt].sin_port = client->ext->udpPort;
+				datagramAddrs[datagramsCnt].sin_addr.s_addr = client->ext->udpAddr;
+				datagramsCnt++;
+				captureEvent(client->sock.socket, CAPTURE_OUT, 0, statusMsg[id]);
+			} else {
+				ALT(sendRecorded(&client->sock, statusMsg[id]), onClientDisconnect(client));
+			}
+			destroyMsg(&(statusMsg[id]));
+		}
+	}
+	if (datagramsCnt > 0) {
+		int sentCnt = sendDatagrams(statusSocket, datagram, datagramSize, datagramAddrs, datagramsCnt);
+		flightRecord(&gameRings[game - games], FLIGHT_DATAGRAMS, 0, 0, datagramsCnt, sentCnt);
+	}
+	if (timedClient != NULL && statusMsg[(int) timedClient->id] != NULL) {
+		game_msg_t * timedMsg = statusMsg[(int) timedClient->id];
+		game->pendingTiming.residenceNs = nowNs() - game->timedRecvNs;
+		timedMsg->payload.status.flags |= STATUS_TIMED;
+		timedMsg->payload.status.timing = game->pendingTiming;
+		ALT(sendRecorded(&timedClient->sock, timedMsg), onClientDisconnect(timedClient));
+		histRecord(&residenceHist, nowNs() - game->timedRecvNs);
+		destroyMsg(&(statusMsg[(int) timedClient->id]));
+	}
+	game->timedClient = NULL;
+	if (isGameEnded) {
+		recordGameResult(game);
+	}
+}
+
+/**
+ * the function queues result of ended game and its move counts to the exporter, the main loop never waits for the sink
+ **/
+void exportGameResult(game_t * game, client_t * lastPlayed) {
+	export_record_t record;
+	memset(&record, 0, sizeof(record));
+	record.startMs = game->startMs;
+	record.endMs = wallMs();
+	record.slot = GAME_SLOT(game);
+	record.gameType = game->gameType;
+	record.heapsCnt = game->rules.heapsCnt;
+	record.tournament = (game->tournament != NULL);
+	record.cubes = M;
+	record.movesCnt = game->movesCnt;
+	record.illegalCnt = game->illegalCnt;
+	int id;
+	for (id = 0; id < MAX_ID && record.playersCnt < EXPORT_PLAYERS; id++) {
+		client_t * client = game->clientList[id];
+		if (client == NULL || client->status == SPECTATOR) {
+			continue;
+		}
+		export_player_t * player = &record.players[record.playersCnt++];
+		player->playerId = CLIENT_EXT(client)->playerId;
+		player->clientId = id;
+		player->result = (client == lastPlayed) ? game->rules.lastMoverEnd : game->rules.othersEnd;
+		player->moves = game->movesBy[id];
+	}
+	exportSubmit(&exporter, &record);
+}
+
+/**
+ * the function records result of ended game once: in game of rated players every winner beats every loser,
+ * tournament game gives its pairing the result and its players go back to wait for the next round
+ **/
+void recordGameResult(game_t * game) {
+	if (game->resultRecorded) {
+		return;
+	}
+	game->resultRecorded = 1;
+	client_t * lastPlayed = getCurrentPlayer(game);
+	client_t * winners[MAX_ID];
+	client_t * losers[MAX_ID];
+	int winnersCnt = 0, losersCnt = 0;
+	int id;
+	for (id = 0; id < MAX_ID; id++) {
+		client_t * client = game->clientList[id];
+		if (client == NULL || client->status == SPECTATOR) {
+			continue;
+		}
+		if (((client == lastPlayed) ? game->rules.lastMoverEnd : game->rules.othersEnd) == YOU_WIN) {
+			winners[winnersCnt++] = client;
+		} else {
+			losers[losersCnt++] = client;
+		}
+	}
+	if (exporting) {
+		exportGameResult(game, lastPlayed);
+	}
+	if (game->tournament != NULL) {
+		if (winnersCnt == 1 && losersCnt == 1) {
+			tournamentGameOver(game, winners[0]);
+		}
+		return;
+	}
+	int i, j;
+	for (i = 0; i < winnersCnt && ratings.header != NULL; i++) {
+		for (j = 0; j < losersCnt; j++) {
+			ratingResult(&ratings, ratingFind(&ratings, CLIENT_EXT(winners[i])->playerId), ratingFind(&ratings, CLIENT_EXT(losers[j])->playerId));
+		}
+	}
+}
+
+/**
+ * the function checks if seat of disconnecting client is held for its return:
+ * seats are held for players of running games while session tokens are on
+ **/
+int holdsSeat(client_t * client) {
+	game_t * game = client->game;
+	return !isDetached(client) && game != NULL && game->seatTokens[(int) client->id] != 0 && client->status != SPECTATOR && !checkGameEnd(game);
+}
+
+/**
+ * the function closes connection of player whose seat is held,
+ * player stays in the game with its ID and status, game waits for it if it is its turn
+ **/
+void detachClient(client_t * client) {
+	game_t * game = client->game;
+	int fd = client->sock.socket;
+	flightRecord(&connRings[fd], FLIGHT_DISCONNECT, 0, 0, client->id, client->status);
+	flightRecord(&gameRings[game - games], FLIGHT_DETACH, 0, 0, client->id, client->status);
+	captureEvent(fd, CAPTURE_CLOSE, 0, NULL);
+	if (game->timedClient == client) {
+		game->timedClient = NULL;
+	}
+	if (CLIENT_EXT(client)->sessions != NULL) { /* sessions go with the connection, seat gets connection without them */
+		closeSessions(client);
+	}
+	if (connList[fd] == client) {
+		connList[fd] = NULL;
+	}
+	connGen[fd]++;
+	close(fd);
+	releaseBuffers(&client->sock);
+	client->sock.socket = -1;
+	if (client->ext != NULL) {
+		client->ext->udpPort = 0;
+	}
+	connectionsCnt--;
+	game->seatDetachedNs[(int) client->id] = nowNs();
+	if (!(GAME_FLAGS(game) & GAME_SEATS_HELD)) {
+		gameTable.heldSinceNs[GAME_SLOT(game)] = game->seatDetachedNs[(int) client->id];
+		GAME_FLAGS(game) |= GAME_SEATS_HELD;
+	}
+	detachedCnt++;
+}
+
+/**
+ * the function releases seats held longer than grace period and seats of ended games
+ **/
+void expireSessions() {
+	long long expiredNs = nowNs() - sessionGraceSec * 1000000000LL;
+	int gameIdx, id;
+	for (gameIdx = gameTableNext(0, MAX_GAMES, GAME_SEATS_HELD); gameIdx < MAX_GAMES && detachedCnt > 0; gameIdx = gameTableNext(gameIdx + 1, MAX_GAMES, GAME_SEATS_HELD)) {
+		game_t * game = &games[gameIdx];
+		if (gameTable.heldSinceNs[gameIdx] > expiredNs && !checkGameEnd(game)) { /* no seat of the game expired yet */
+			continue;
+		}
+		for (id = 0; id < MAX_ID; id++) {
+			client_t * client = game->clientList[id];
+			if (client != NULL && isDetached(client) && (game->seatDetachedNs[id] <= expiredNs || checkGameEnd(game))) {
+				onClientDisconnect(client);
+			}
+		}
+		indexSeats(game);
+	}
+}
+
+/**
+ * the function handles client disconnect
+ * removes client from its game or lobby queue, closes its socket and frees it
+ * seat of player is held instead while session tokens are on, held seat is released by next call
+ * sessions multiplexed over the connection are disconnected with it, session leaves connection open
+ **/
+int onClientDisconnect(client_t * disconnected) {
+	if (holdsSeat(disconnected)) {
+		detachClient(disconnected);
+		return 1;
+	}
+	if (CLIENT_EXT(disconnected)->tournament != NULL) { /* tournament game of the entrant is forfeited */
+		tournamentWithdraw(disconnected);
+	}
+	game_t * game = disconnected->game;
+	if (CLIENT_EXT(disconnected)->sessions != NULL) {
+		closeSessions(disconnected);
+	}
+	lobbyRemove(disconnected);
+	int fd = disconnected->sock.socket;
+	if (fd != -1) {
+		flightRecord(&connRings[fd], FLIGHT_DISCONNECT, 0, 0, disconnected->id, disconnected->status);
+	}
+	if (fd != -1 && !isSession(disconnected)) {
+		captureEvent(fd, CAPTURE_CLOSE, 0, NULL);
+	}
+	if (game != NULL) {
+		flightRecord(&gameRings[game - games], FLIGHT_DISCONNECT, 0, 0, disconnected->id, disconnected->status);
+		if (disconnected->status == YOUR_TURN) {
+			GAME_FLAGS(game) |= GAME_TURN_DONE;
+		}
+		if (game->timedClient == disconnected) {
+			game->timedClient = NULL;
+		}
+		removeClientFromGame(game, disconnected->id);
+	}
+	if (fd == -1) { /* held seat released */
+		game->seatDetachedNs[(int) disconnected->id] = 0;
+		detachedCnt--;
+	} else if (isSession(disconnected)) {
+		*getClientSlot(disconnected) = NULL;
+		releaseBuffers(&disconnected->sock);
+		sessionsCnt--;
+	} else {
+		if (connList[fd] == disconnected) {
+			connList[fd] = NULL;
+		}
+		connGen[fd]++;
+		close(fd);
+		releaseBuffers(&disconnected->sock);
+		connectionsCnt--;
+	}
+	destroyClient(disconnected);
+	//printf("onClientDisconnect getClientsCount=%d\n", getClientsCount());
+	if (game != NULL) {
+		updateClientsStatus(game);
+	}
+	return 1;
+}
+
+/**
+ * the function starts game for the players waiting in full queue
+ * spectators waiting for game of this type are added to it
+ **/
+void startLobbyGame(lobby_queue_t * queue) {
+	game_t * game = createGame(queue->gameType, queue->playersCnt, M);
+	if (game == NULL) { /* all slots busy - players keep waiting */
+		return;
+	}
+	int i;
+	for (i = 0; i < queue->playersCnt; i++) {
+		addClientToGame(game, lobbyPop(queue), PLAYING);
+	}
+	lobby_queue_t * spectators = getLobbyQueue(queue->gameType, 0);
+	while (spectators->count > 0 && game->maxId < MAX_ID) {
+		addClientToGame(game, lobbyPop(spectators), SPECTATOR);
+	}
+	setNextPlayerAsCurrent(game);
+	gamesStarted++;
+	playersMatched += queue->playersCnt;
+	int id;
+	for (id = 0; id < MAX_ID; id++) {
+		if (game->clientList[id] != NULL) {
+			sendGameIntro(game->clientList[id]);
+		}
+	}
+}
+
+/**
+ * the function handles join request of client waiting in lobby
+ * players are queued by game type and number of players,
+ * game starts as soon as the queue holds enough players
+ * spectators join the newest running game of the type or wait for the next one
+ * tournament entrants wait for the tournament to fill up, entrant is rejected if no tournament can be opened
+ **/
+void handleJoin(client_t * client, join_t * join) {
+	if (!lobbyMode || client->game != NULL || CLIENT_EXT(client)->queue != NULL || CLIENT_EXT(client)->tournament != NULL) {
+		return; /* single game server or client already placed */
+	}
+	if (!admitClient(&admission, join->spectate)) { /* under load new spectators are rejected first */
+		rejectNewClient(client);
+		return;
+	}
+	if (join->playerId != 0 || client->ext != NULL) { /* anonymous client needs no state for it */
+		if (clientExt(client) == NULL) {
+			rejectNewClient(client);
+			return;
+		}
+		client->ext->playerId = join->playerId;
+	}
+	if (join->tournament && !join->spectate) {
+		if (tournamentSize == 0 || tournamentEnroll(client, tournamentSize, tournamentRounds, gameType, M) == NULL) {
+			rejectNewClient(client);
+		}
+		return;
+	}
+	game_type_t joinType = (join->gameType == MISERE || join->gameType == REGULAR) ? (game_type_t) join->gameType : gameType;
+	int joinPlayers = (join->playersCnt >= 2 && join->playersCnt <= MAX_PLAYERS) ? join->playersCnt : p;
+	if (join->spectate) {
+		game_t * game = newestGame[joinType];
+		if (game != NULL && !checkGameEnd(game) && addClientToGame(game, client, SPECTATOR) != CLIENT_ID_INVALID) {
+			sendGameIntro(client);
+		} else if (!lobbyPush(getLobbyQueue(joinType, 0), client)) {
+			rejectNewClient(client);
+		}
+		return;
+	}
+	lobby_queue_t * queue = getLobbyQueue(joinType, joinPlayers);
+	if (!lobbyPush(queue, client)) {
+		rejectNewClient(client);
+		return;
+	}
+	if (queue->count >= joinPlayers) {
+		startLobbyGame(queue);
+	}
+}
+
+/**
+ * the function tells client whose JOIN was shed that the server is busy, the client stays connected and may join again
+ * returns 0 if the connection failed
+ **/
+int sendBusyReply(client_t * client) {
+	game_msg_t busy;
+	memset(&busy, 0, sizeof(game_msg_t));
+	busy.type = WELCOME;
+	busy.payload.welcomeMsg.gameType = REJECTED;
+	busy.payload.welcomeMsg.clientId = -1;
+	busy.payload.welcomeMsg.playersCnt = -1;
+	busy.payload.welcomeMsg.flags = WELCOME_RETRY;
+	return dropOnOverflow(sendRecorded(&client->sock, &busy));
+}
+
+/**
+ * the function rejects client not placed in any game yet and frees it
+ * returns 1 on socket error
+ **/
+int rejectNewClient(client_t * client) {
+	int fd = client->sock.socket;
+	if (isSession(client)) { /* session is rejected by message, its connection stays */
+		game_msg_t reject;
+		memset(&reject, 0, sizeof(game_msg_t));
+		reject.type = WELCOME;
+		reject.payload.welcomeMsg.gameType = REJECTED;
+		reject.payload.welcomeMsg.clientId = -1;
+		reject.payload.welcomeMsg.playersCnt = -1;
+		sendRecorded(&client->sock, &reject);
+		onClientDisconnect(client);
+		return 0;
+	}
+	lobbyRemove(client);
+	connList[fd] = NULL;
+	releaseBuffers(&client->sock);
+	destroyClient(client);
+	connectionsCnt--;
+	return rejectClient(fd);
+}
+
+/**
+ * the function places client in the game of single game server and sends it the intro
+ * client is rejected if no more IDs are available
+ * returns 1 on socket error
+ **/
+int joinSingleGame(game_t * game, client_t * client) {
+	client_status_t status = determineNewClientStatus(game);
+	/* under load new spectators are rejected first, more than 25 clients can't connect during one game */
+	if (!admitClient(&admission, status == SPECTATOR) || addClientToGame(game, client, status) == CLIENT_ID_INVALID) {
+		return rejectNewClient(client);
+	}
+	if (getCurrentPlayer(game) == NULL) {
+		updateClientsStatus(game);
+		setNextPlayerAsCurrent(game);
+	}
+	sendGameIntro(client);
+	return 0;
+}
+
+/**
+ * the function takes client placed on connect out of its game, its connection moves to the held seat
+ **/
+void unplaceClient(client_t * client) {
+	game_t * game = client->game;
+	if (client->status == YOUR_TURN) {
+		GAME_FLAGS(game) |= GAME_TURN_DONE;
+	}
+	if (game->timedClient == client) {
+		game->timedClient = NULL;
+	}
+	removeClientFromGame(game, client->id);
+	client->game = NULL;
+	updateClientsStatus(game);
+}
+
+/**
+ * the function gives seat held for the session back to reconnected client:
+ * connection moves to the held client, which gets WELCOME with its ID and current status,
+ * status keyframe follows only if statuses were sent since lastSeq
+ * client with unknown or expired token is placed as new client, client placed on connect
+ * keeps its place and gets its WELCOME again, so RESUME is always answered
+ * client already waiting in lobby queue or tournament, or carrying sessions, stays where it is
+ * as other structures point to it
+ **/
+void handleResume(client_t * client, resume_t * resume) {
+	if (CLIENT_EXT(client)->queue != NULL || CLIENT_EXT(client)->tournament != NULL || CLIENT_EXT(client)->sessions != NULL) {
+		return;
+	}
+	unsigned long long token = resume->sessionToken;
+	unsigned int slot = (token >> 8) & 0xffffff;
+	int id = token & 0xff;
+	client_t * seat = (slot < MAX_GAMES && id < MAX_ID && (gameTable.flags[slot] & GAME_IN_USE)) ? games[slot].clientList[id] : NULL;
+	if (seat == NULL || isSession(client) || !isDetached(seat) || games[slot].seatTokens[id] != (unsigned int) (token >> 32)) {
+		if (client->game != NULL) {
+			sendGameIntro(client);
+		} else if (lobbyMode) {
+			join_t join = { -1, 0, 0, 0 };
+			handleJoin(client, &join);
+		} else {
+			joinSingleGame(newestGame[gameType], client);
+		}
+		return;
+	}
+	game_t * game = &games[slot];
+	int fd = client->sock.socket;
+	if (client->game != NULL) {
+		unplaceClient(client);
+	}
+	seat->sock = client->sock;
+	pollerMoved(&seat->sock);
+	connList[fd] = seat;
+	connGen[fd]++; /* analyses queued for the new client are not for the seat */
+	free(client->ext);
+	free(client);
+	game->seatDetachedNs[id] = 0;
+	detachedCnt--;
+	flightRecord(&connRings[fd], FLIGHT_RESUME, 0, 0, id, game->statusSeq - resume->lastSeq);
+	flightRecord(&gameRings[slot], FLIGHT_RESUME, 0, 0, id, game->statusSeq - resume->lastSeq);
+	sendWelcomeMsg(&seat->sock, id, game->gameType, game->p, seat->status, token, ratingValue(&ratings, ratingFind(&ratings, CLIENT_EXT(seat)->playerId)), 0, NULL);
+	int res = 1;
+	if (resume->lastSeq != game->statusSeq) { /* one keyframe replaces statuses missed */
+		game_msg_t* keyframeMsg = createStatusMsg(game, 1, -1, seat->status, getPersonalEndGame(seat));
+		res = sendRecorded(&seat->sock, keyframeMsg);
+		destroyMsg(&keyframeMsg);
+	}
+	ALT(res, onClientDisconnect(seat));
+}
+
+/**
+ * the function answers analysis request from the cache or queues it to the analysis worker
+ * current heaps are analyzed by rules of client's game, client waiting in lobby has no current heaps
+ **/
+void handleAnalyze(client_t * client, analyze_t * analyze) {
+	game_t * game = client->game;
+	analysis_request_t request;
+	request.conn = client->sock.socket;
+	request.gen = connGen[client->sock.socket];
+	request.session = client->sock.session;
+	request.gameType = (analyze->gameType == MISERE || analyze->gameType == REGULAR) ? (game_type_t) analyze->gameType : (game != NULL) ? game->gameType : gameType;
+	memcpy(request.heaps, (analyze->current && game != NULL) ? GAME_HEAPS(game) : analyze->heapStatus.heap, sizeof(request.heaps));
+	game_msg_t reply;
+	memset(&reply, 0, sizeof(game_msg_t));
+	reply.type = ANALYSIS;
+	if (analyze->current && game == NULL) {
+		reply.payload.analysis.gameType = request.gameType;
+		reply.payload.analysis.value = VALUE_UNKNOWN;
+	} else if (!analyzeCached(&analyzer, request.gameType, request.heaps, &reply.payload.analysis) && analysisSubmit(&analyzer, &request)) {
+		return; /* worker analyzes the position, reply is sent by sendAnalyses */
+	}
+	ALT(sendRecorded(&client->sock, &reply), onClientDisconnect(client));
+}
+
+/**
+ * the function sends analyses done by the worker
+ * analysis for connection closed meanwhile is dropped
+ **/
+void sendAnalyses() {
+	analysis_reply_t reply;
+	while (analysisReply(&analyzer, &reply)) {
+		client_t * client = connList[reply.conn];
+		if (client != NULL && reply.session != 0) {
+			client = (reply.session < CLIENT_EXT(client)->sessionsCap) ? client->ext->sessions[reply.session] : NULL;
+		}
+		if (client != NULL && connGen[reply.conn] == reply.gen) {
+			game_msg_t msg;
+			msg.type = ANALYSIS;
+			msg.session = 0;
+			msg.payload.analysis = reply.analysis;
+			ALT(sendRecorded(&client->sock, &msg), onClientDisconnect(client));
+		}
+	}
+}
+
+/**
+ * the function handles received messages
+ **/
+void handleMsg(game_msg_t* msg, client_t * sourceClient) {
+	char destination;
+	if (msg->session != 0 && (sourceClient = getSession(sourceClient, msg->session)) == NULL) {
+		return; /* session can't be opened */
+	}
+	game_t * game = sourceClient->game;
+	flightRecord(&connRings[sourceClient->sock.socket], FLIGHT_RECV, msg->type, payloadSize(msg), msg->session, 0);
+	captureEvent(sourceClient->sock.socket, CAPTURE_IN, 0, msg);
+	msg->session = 0; /* frames sent to session are stamped with its ID on the way out */
+	if (sourceClient->provisional) { /* first message of client placed while seats are held, RESUME is never shed */
+		sourceClient->provisional = 0;
+		if (msg->type == RESUME) {
+			handleResume(sourceClient, &msg->payload.resume);
+			return;
+		}
+	}
+	/* moves of current player are never shed, other messages are limited by buckets of the connection,
+	 * buckets are allocated once admission control is on, without memory for them the message is shed */
+	if ((msg->type != TURN_REQ || game == NULL || getCurrentPlayer(game) != sourceClient) && admission.enabled
+			&& (clientExt(sourceClient) == NULL || !admitMessage(&admission, sourceClient->ext->buckets, msg->type, moveRecvNs))) {
+		flightRecord(&connRings[sourceClient->sock.socket], FLIGHT_SHED, msg->type, payloadSize(msg), messageClass(msg->type), admission.level);
+		if (msg->type == JOIN && game == NULL && CLIENT_EXT(sourceClient)->queue == NULL && CLIENT_EXT(sourceClient)->tournament == NULL) {
+			/* client not placed yet is told to join again later */
+			ALT(sendBusyReply(sourceClient), onClientDisconnect(sourceClient));
+		}
+		return;
+	}
+	if (msg->type == LEAVE) {
+		if (isSession(sourceClient)) {
+			onClientDisconnect(sourceClient);
+		}
+		return;
+	}
+	if (msg->type == JOIN) {
+		subscribeDatagrams(sourceClient, &msg->payload.join);
+		sourceClient->fastJoin = msg->payload.join.fastJoin;
+	}
+	if (game == NULL && msg->type == RESUME) { /* reconnected client asks for its seat */
+		handleResume(sourceClient, &msg->payload.resume);
+		return;
+	}
+	if (game == NULL && !lobbyMode) { /* new session of single game server */
+		client_t ** slot = getClientSlot(sourceClient);
+		joinSingleGame(newestGame[gameType], sourceClient);
+		if (*slot != sourceClient) { /* rejected or disconnected */
+			return;
+		}
+		game = sourceClient->game;
+	} else if (game == NULL) { /* client waits in lobby */
+		if (msg->type == JOIN) {
+			handleJoin(sourceClient, &msg->payload.join);
+			return;
+		}
+		if (msg->type != PING && msg->type != ANALYZE) {
+			return;
+		}
+	}
+	if (game != NULL && (GAME_FLAGS(game) & GAME_TURN_DONE)) { /* status of the move goes out before the game handles next message */
+		broadcastStatus(game);
+	}
+	switch (msg->type) {
+	/* handle chat message */
+	case CHAT:
+		//fprintf(stderr,"CHAT: src=%d dst=%d\n",msg->payload.chat.srcId,msg->payload.chat.dstId);
+		destination = msg->payload.chat.dstId;
+		int id;
+		for (id = 0; id < MAX_ID; id++) {
+			client_t* destinationCl;
+			destinationCl = game->clientList[id];
+			if (destinationCl != NULL && !isDetached(destinationCl) && (destination == -1 || destination - 1 == id)) {
+				ALT(dropOnOverflow(sendRecorded(&destinationCl->sock, msg)), onClientDisconnect(destinationCl));
+			}
+		}
+		break;
+	/* handle user move message */
+	case TURN_REQ:
+		//printf("turn_req\n");
+		if (getCurrentPlayer(game) != sourceClient) {
+			long long validatedNs = (msg->payload.turnReq.clientSentNs != 0) ? nowNs() : 0;
+			flightRecord(&gameRings[game - games], FLIGHT_TURN, NOT_YOUR_TURN, sourceClient->id, msg->payload.turnReq.heapIndex, msg->payload.turnReq.amount);
+			ALT(dropOnOverflow(sendTurnResponse(&(sourceClient->sock), NOT_YOUR_TURN, msg->payload.turnReq.moveSeq)), onClientDisconnect(sourceClient));
+			if (validatedNs != 0) { /* rejected move is timed as well, its response is all that answers it */
+				histRecord(&validateHist, validatedNs - moveRecvNs);
+				histRecord(&residenceHist, nowNs() - moveRecvNs);
+			}
+		} else {
+			char heapIndex = msg->payload.turnReq.heapIndex;
+			short cubes = msg->payload.turnReq.amount;
+			int isLegal = isUserMoveValid(game, heapIndex, cubes);
+			flightRecord(&gameRings[game - games], FLIGHT_TURN, (isLegal) ? LEGAL : ILLEGAL, sourceClient->id, heapIndex, cubes);
+			game->movesCnt++;
+			game->illegalCnt += !isLegal;
+			game->movesBy[(int) sourceClient->id]++;
+			if (msg->payload.turnReq.clientSentNs != 0) { /* client measures this move */
+				long long validatedNs = nowNs();
+				histRecord(&validateHist, validatedNs - moveRecvNs);
+				game->timedClient = sourceClient;
+				game->timedRecvNs = moveRecvNs;
+				game->pendingTiming.clientSentNs = msg->payload.turnReq.clientSentNs;
+				game->pendingTiming.validateNs = validatedNs - moveRecvNs;
+			}
+			if (isLegal) {
+				playerMove(GAME_HEAPS(game), heapIndex, cubes);
+				//printf("move done\n");
+			} else {
+				//fprintf(stderr, "skipping turn - illegal move\n");
+			}
+			GAME_FLAGS(game) |= GAME_TURN_DONE;
+			//printf("sending turn response\n");
+			ALT(dropOnOverflow(sendTurnResponse(&(sourceClient->sock), (isLegal) ? LEGAL : ILLEGAL, msg->payload.turnReq.moveSeq)), onClientDisconnect(sourceClient));
+		}
+		break;
+	/* handle keyframe request from client that detected gap */
+	case STATUS_REQ: {
+		game_msg_t* keyframeMsg = createStatusMsg(game, 1, -1, sourceClient->status, getPersonalEndGame(sourceClient));
+		ALT(sendRecorded(&(sourceClient->sock), keyframeMsg), onClientDisconnect(sourceClient));
+		destroyMsg(&keyframeMsg);
+		break;
+	}
+	/* echo round trip probe back to the sender */
+	case PING: {
+		game_msg_t pong = *msg;
+		pong.type = PONG;
+		ALT(sendRecorded(&(sourceClient->sock), &pong), onClientDisconnect(sourceClient));
+		break;
+	}
+	/* client already placed in the game */
+	case JOIN:
+	case RESUME:
+		break;
+	/* position analysis, answered aside of the game */
+	case ANALYZE:
+		handleAnalyze(sourceClient, &msg->payload.analyze);
+		break;
+	default:
+		ALT(dropOnOverflow(sendTurnResponse(&(sourceClient->sock), NOT_YOUR_TURN, 0)), onClientDisconnect(sourceClient));
+	}
+}
+
+/**
+ * the function looks at join request that came with the connection in fast open SYN without taking it
+ * from the socket, client of single game server placed on accept gets merged intro if it asked for it
+ **/
+void peekFastJoin(client_t * client) {
+	char frame[MAX_FRAME_SIZE];
+	game_msg_t msg;
+	ssize_t peeked = recv(client->sock.socket, frame, sizeof(frame), MSG_PEEK | MSG_DONTWAIT);
+	if (peeked > 0 && decodeFrame(frame, peeked, &msg) > 0 && msg.type == JOIN && msg.session == 0) {
+		client->fastJoin = msg.payload.join.fastJoin;
+	}
+}
+
+/**
+ * function sends reject message
+ * and closes connection
+ * returns 1 on socket error
+ */
+int rejectClient(int newConnection) {
+	sendRejectMsg(newConnection); //send reject message to client
+	captureEvent(newConnection, CAPTURE_CLOSE, 0, NULL);
+	if ((close(newConnection) == -1)) { //close connection
+		printf("Error closing connection: %s!\n", strerror(errno));
+		return 1; //exit on error
+	}
+	return 0;
+}
+
+/**
+ * function sets non-blocking socket
+ */
+int setNonblocking(int fd) {
+int flags;
+/* if they have O_NONBLOCK, use the Posix way to do it */
+#if defined(O_NONBLOCK)
+	if (-1 == (flags = fcntl(fd, F_GETFL, 0)))
+		flags = 0;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#else
+/* otherwise, use the old way of doing it */
+	flags = 1;
+	return ioctl(fd, FIOBIO, &flags);
+#endif
+}
+
+/**
+ * the function opens UDP socket status datagrams are sent from, bound to the port of listening socket
+ * so spectators take datagrams of the server only, SO_REUSEADDR lets upgraded server bind it too
+ * returns -1 on error
+ **/
+int openStatusSocket(int listSocket) {
+	struct sockaddr_in address;
+	socklen_t addressLen = sizeof(address);
+	int yes = 1;
+	int sock_d = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock_d == -1) {
+		return -1;
+	}
+	if (getsockname(listSocket, (struct sockaddr *) &address, &addressLen) == -1 || setsockopt(sock_d, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1
+			|| bind(sock_d, (struct sockaddr *) &address, addressLen) == -1) {
+		close(sock_d);
+		return -1;
+	}
+	setNonblocking(sock_d);
+	return sock_d;
+}
+
+#ifndef NIM_SERVER_NO_MAIN
+/**
+ * SIGUSR1 handler - requests statistics and flight recorder dump from main loop
+ **/
+void onDumpSignal(int sig) {
+	dumpLatency = 1;
+}
+
+/**
+ * SIGUSR2 handler - requests handoff to upgraded server from main loop
+ **/
+void onUpgradeSignal(int sig) {
+	upgradeRequested = 1;
+}
+
+/**
+ * SIGTERM handler while exporting - requests exit from main loop, queued results are flushed first
+ **/
+void onTerminateSignal(int sig) {
+	terminateRequested = 1;
+}
+
+/**
+ * the function waits for ready sockets like epoll_wait(), in busy polling mode blocking wait
+ * is preceded by busyPollUs microseconds of polling that keeps the cpu awake
+ * signal received while polling is reported as EINTR
+ **/
+int waitEvents(struct epoll_event * events, int maxEvents, int timeoutMs) {
+	if (busyPollUs > 0 && timeoutMs == -1) {
+		long long pollEndNs = nowNs() + busyPollUs * 1000LL;
+		do {
+			int ready = epoll_wait(connPoller.epollFd, events, maxEvents, 0);
+			if (ready != 0) {
+				return ready;
+			}
+			if (dumpLatency || upgradeRequested || terminateRequested) {
+				errno = EINTR;
+				return -1;
+			}
+		} while (nowNs() < pollEndNs);
+	}
+	return epoll_wait(connPoller.epollFd, events, maxEvents, timeoutMs);
+}
+
+/**
+ * the function sends frames queued during loop iteration without waiting for next epoll_wait,
+ * sockets are assumed write-ready, frames that don't fit socket buffer stay queued
+ * connections are written within the rest of flush budget newest first, the others wait
+ * for the poller to report them write-ready
+ **/
+void flushClients() {
+	int i;
+	for (i = connPoller.waitingCnt - 1; i >= 0; i--) { /* written socket leaves the list, the last one takes its place */
+		if (i >= connPoller.waitingCnt) { /* clients disconnected while written left the list */
+			continue;
+		}
+		if (!schedTake(&sched, SCHED_FLUSH)) {
+			schedCarry(&sched, SCHED_FLUSH, 0);
+			return;
+		}
+		client_t * client = connList[connPoller.waiting[i]->socket];
+		client->sock.writeReady = 1;
+		if (sendRecorded(&client->sock, NULL)) {
+			client->sock.writeReady = 0;
+		} else {
+			onClientDisconnect(client);
+		}
+	}
+}
+
+/**
+ * the function orders socket fds ascending
+ **/
+int compareFds(const void * a, const void * b) {
+	return *(const int *) a - *(const int *) b;
+}
+
+/**
+ * the function appends socket whose messages remain buffered to sockets handled in next loop iteration
+ **/
+void carryConnection(int fd) {
+	if (connList[fd] != NULL && hasPendingMessage(&connList[fd]->sock)) {
+		carriedFds[carriedCnt++] = fd;
+	}
+}
+
+/**
+ * the function receives and handles messages of read ready client or client with buffered messages,
+ * SCHED_CONN_BUDGET messages at most, messages left wait for next iteration
+ * returns 0 if read budget of the iteration is spent
+ **/
+int serveClient(int fd, int readReady) {
+	client_t * client = connList[fd];
+	int served;
+	for (served = 0; served < SCHED_CONN_BUDGET; served++) {
+		if (!(served == 0 && readReady) && !hasPendingMessage(&client->sock)) {
+			return 1;
+		}
+		if (!schedTake(&sched, SCHED_READ)) {
+			return 0;
+		}
+		game_msg_t* msg;
+		int isDisconnect = 0;
+		errno = 0;
+		msg = receiveMessageB(&(client->sock), &isDisconnect);
+		moveRecvNs = client->sock.rxNs;
+		flightNowNs = nowNs();
+		if (isDisconnect) {
+			flightRecord(&connRings[fd], FLIGHT_RECV_CLOSED, 0, 0, client->sock.rxAttempt, errno);
+			captureEvent(fd, CAPTURE_CLOSE, CAPTURE_PEER_CLOSED, NULL);
+			onClientDisconnect(client);
+			return 1;
+		}
+		if (msg == NULL) { /* frame is not complete yet */
+			return 1;
+		}
+		handleMsg(msg, client);
+		destroyMsg(&msg);
+		if (connList[fd] != client) { /* disconnected while handled */
+			return 1;
+		}
+	}
+	return 1;
+}
+
+/**
+ * the function prints server latency histograms and lobby counters
+ **/
+void printStats() {
+	histPrint(stderr, &validateHist);
+	histPrint(stderr, &residenceHist);
+	long poolBytes = bufferPool.slabsCnt * POOL_SLAB_BUFFERS * POOL_BUFFER_SIZE;
+	/* tables indexed by socket fd: connList, connRings, connGen, connReady, readyFds, carriedFds, and captureConn while capturing */
+	long tableBytes = connCap * (long) (sizeof(client_t *) + sizeof(flight_ring_t *) + sizeof(unsigned int) + sizeof(unsigned char) + 2 * sizeof(int)) + captureCap * (long) sizeof(int);
+	/* out of line state of connections and their sessions with session tables, rings of connections */
+	long extBytes = 0, muxBytes = 0, ringBytes = 0;
+	int fd, session;
+	for (fd = 0; fd < connCap; fd++) {
+		client_t * client = connList[fd];
+		for (session = -1; client != NULL && session < CLIENT_EXT(client)->sessionsCap; session++) {
+			client_t * counted = (session == -1) ? client : client->ext->sessions[session];
+			if (counted != NULL) {
+				extBytes += (counted->ext != NULL) ? sizeof(client_ext_t) : 0;
+				muxBytes += (counted->sock.mux != NULL) ? sizeof(socket_mux_t) + counted->sock.mux->backlogCap : 0;
+			}
+		}
+		extBytes += (client != NULL) ? CLIENT_EXT(client)->sessionsCap * sizeof(client_t *) : 0;
+		ringBytes += (connRings[fd] != NULL) ? FLIGHT_RING_BYTES(connRings[fd]->size) : 0;
+	}
+	long clientBytes = (connectionsCnt + sessionsCnt) * sizeof(client_t) + extBytes + muxBytes;
+	fprintf(stderr, "memory connections=%ld sessions=%ld client_bytes=%zu ext_bytes=%ld mux_bytes=%ld ring_bytes=%ld buffers_in_use=%ld pool_bytes=%ld table_bytes=%ld bytes_per_connection=%.1f\n",
+			connectionsCnt, sessionsCnt, sizeof(client_t), extBytes, muxBytes, ringBytes, bufferPool.inUse, poolBytes, tableBytes,
+			(connectionsCnt > 0) ? (double) (clientBytes + ringBytes + tableBytes + poolBytes) / connectionsCnt : 0.0);
+	fprintf(stderr, "output frames_dropped=%ld\n", framesDropped);
+	analysisPrintStats(stderr, &analyzer);
+	admissionPrintStats(stderr, &admission);
+	schedulerPrintStats(stderr, &sched);
+	if (lobbyMode) {
+		fprintf(stderr, "lobby games_started=%ld players_matched=%ld games_running=%d\n", gamesStarted, playersMatched, MAX_GAMES - freeGamesCnt);
+	}
+	ratingPrintStats(stderr, &ratings);
+	if (tournamentSize > 0) {
+		tournamentsPrintStats(stderr);
+	}
+	if (snapshots.header != NULL) {
+		fprintf(stderr, "snapshots slots=%d published=%ld\n", snapshots.header->slotsCnt, snapshots.published);
+	}
+	if (exporting) {
+		exportPrintStats(stderr, &exporter);
+	}
+}
+
+/**
+ * the function starts upgraded server binary and hands listening socket,
+ * clients and games over to it through unix socket
+ * returns 1 if successor took over, 0 if this server keeps serving
+ **/
+int handoffServer(const char * path, int listSocket) {
+	int channel[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, channel) == -1) {
+		printf("Error creating upgrade channel: %s!\n", strerror(errno));
+		return 0;
+	}
+	pid_t pid = fork();
+	if (pid == -1) {
+		printf("Error starting upgraded server: %s!\n", strerror(errno));
+		close(channel[0]);
+		close(channel[1]);
+		return 0;
+	}
+	if (pid == 0) { /* successor receives sockets through the channel only */
+		struct rlimit limit; /* any descriptor below the limit may be open */
+		int fd, fdsEnd = (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) ? (int) limit.rlim_cur : connCap + CONN_TABLE_MIN;
+		for (fd = STDERR_FILENO + 1; fd < fdsEnd; fd++) {
+			if (fd != channel[1]) {
+				close(fd);
+			}
+		}
+		char channelArg[16];
+		snprintf(channelArg, sizeof(channelArg), "%d", channel[1]);
+		char * args[14];
+		int argsCnt = 0;
+		args[argsCnt++] = (char *) path;
+		if (solverPath != NULL) { /* table is mapped again, not solved */
+			args[argsCnt++] = "-S";
+			args[argsCnt++] = (char *) solverPath;
+		}
+		if (ratingsPath != NULL) { /* ratings continue from the file */
+			args[argsCnt++] = "-R";
+			args[argsCnt++] = (char *) ratingsPath;
+		}
+		if (snapshotPath != NULL) { /* observers keep reading the same region */
+			args[argsCnt++] = "-m";
+			args[argsCnt++] = (char *) snapshotPath;
+		}
+		if (exportSink != NULL) { /* successor sends chunks this server spilled */
+			args[argsCnt++] = "-e";
+			args[argsCnt++] = (char *) exportSink;
+		}
+		if (exportSpillPath != NULL) {
+			args[argsCnt++] = "-E";
+			args[argsCnt++] = (char *) exportSpillPath;
+		}
+		args[argsCnt++] = "-u";
+		args[argsCnt++] = channelArg;
+		args[argsCnt] = NULL;
+		execv(path, args);
+		fprintf(stderr, "Error starting %s: %s!\n", path, strerror(errno));
+		_exit(1);
+	}
+	close(channel[1]);
+	upgrade_settings_t settings = { lobbyMode, p, gameType, M, heapsCnt, maxTake, lowLatency, busyPollUs, datagramMode, sessionGraceSec, admission.enabled, tournamentSize, tournamentRounds, gamesStarted, playersMatched };
+	struct timeval timeout = { UPGRADE_ACK_TIMEOUT, 0 };
+	setsockopt(channel[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	char ack = 0;
+	if (upgradeSend(channel[0], listSocket, &settings) && read(channel[0], &ack, 1) == 1 && ack == 1) {
+		close(channel[0]);
+		return 1;
+	}
+	printf("Error: upgraded server did not take over, keep serving!\n");
+	close(channel[0]);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	return 0;
+}
+
+/**
+ * the function takes over state handed over by previous server
+ * returns 0 on error
+ **/
+int resumeServer(int channel, int * listSocket) {
+	upgrade_settings_t settings;
+	if (!upgradeReceive(channel, listSocket, &settings)) {
+		printf("Error receiving state of previous server!\n");
+		return 0;
+	}
+	int fd;
+	for (fd = 0; fd < connCap; fd++) { /* restored output waits for write readiness, restored messages are handled first */
+		if (connList[fd] != NULL && HAS_QUEUED_OUTPUT(&connList[fd]->sock) && !pollerWaitWrite(&connList[fd]->sock)) {
+			return 0;
+		}
+		carryConnection(fd);
+	}
+	lobbyMode = settings.lobbyMode;
+	p = settings.p;
+	gameType = settings.gameType;
+	M = settings.M;
+	heapsCnt = settings.heapsCnt;
+	maxTake = settings.maxTake;
+	lowLatency = settings.lowLatency;
+	busyPollUs = settings.busyPollUs;
+	datagramMode = settings.datagramMode;
+	sessionGraceSec = settings.sessionGraceSec;
+	admission.enabled = settings.overloadControl;
+	tournamentSize = settings.tournamentSize;
+	tournamentRounds = settings.tournamentRounds;
+	gamesStarted = settings.gamesStarted;
+	playersMatched = settings.playersMatched;
+	char ack = 1;
+	if (write(channel, &ack, 1) != 1) {
+		printf("Error confirming upgrade: %s!\n", strerror(errno));
+		return 0;
+	}
+	close(channel);
+	return 1;
+}
+
+/**
+ * the function writes flight rings of connections and games to the dump file
+ **/
+void dumpFlightRecorder() {
+	char defaultPath[64];
+	const char * path = flightPath;
+	if (path == NULL) {
+		snprintf(defaultPath, sizeof(defaultPath), "nim-server-%d.flight", (int) getpid());
+		path = defaultPath;
+	}
+	if (flightDump(path, connRings, connCap, gameRings, MAX_GAMES)) {
+		fprintf(stderr, "flight recorder dumped to %s\n", path);
+	} else {
+		fprintf(stderr, "Error dumping flight recorder to %s: %s!\n", path, strerror(errno));
+	}
+}
+
+/* main function */
+int main(int argc, char *argv[]) {
+	int port = DEFAULT_PORT; /* default port */
+	struct sockaddr_in server_address, client_address; /* structure for socket parameters */
+	int listSocket; /* listening socket descriptor */
+	socklen_t clientLen; /* listening socket size */
+	game_t * game = NULL; /* the game of single game server */
+	const char * serverPath = argv[0]; /* binary started on upgrade */
+	int upgradeChannel = -1; /* unix socket previous server hands state over */
+	const char * capturePath = NULL; /* traffic capture file */
+
+	struct epoll_event events[EPOLL_BATCH]; /* ready sockets of loop iteration */
+	/* check for options received in the command line */
+	int opt;
+	while ((opt = getopt(argc, argv, "ldLOFb:a:n:k:f:c:S:R:T:r:m:e:E:u:")) != -1) {
+		switch (opt) {
+		case 'l': /* lobby - match clients into new games */
+			lobbyMode = 1;
+			break;
+		case 'd': /* statuses to spectators as datagrams */
+			datagramMode = 1;
+			break;
+		case 'L': /* low latency - TCP_NODELAY, frames flushed at the end of loop iteration */
+			lowLatency = 1;
+			break;
+		case 'b': /* busy polling, implies low latency */
+			busyPollUs = atoi(optarg);
+			lowLatency = 1;
+			break;
+		case 'F': /* TCP Fast Open - join request rides in SYN */
+			fastOpenQueue = FAST_OPEN_QUEUE;
+			break;
+		case 'O': /* overload control - shed spectator statuses, chat and message floods under load */
+			admission.enabled = 1;
+			break;
+		case 'a': /* pin server to cpu */
+			if (pinCpu(atoi(optarg)) == -1) {
+				printf("Error pinning to cpu %s: %s!\n", optarg, strerror(errno));
+				return 1; //exit on error
+			}
+			break;
+		case 'n': /* number of heaps in play */
+			heapsCnt = atoi(optarg);
+			if (heapsCnt < 1 || heapsCnt > NUM_OF_HEAPS) {
+				printf("Error: Number of heaps should be between 1 and %d!\n", NUM_OF_HEAPS);
+				return 1; //exit on error
+			}
+			break;
+		case 'k': /* bounded take - at most k cubes in one move */
+			maxTake = atoi(optarg);
+			if (maxTake < 0) {
+				printf("Error: Move bound should not be negative!\n");
+				return 1; //exit on error
+			}
+			break;
+		case 'f': /* flight recorder dump file */
+			flightPath = optarg;
+			break;
+		case 'c': /* capture traffic to file */
+			capturePath = optarg;
+			break;
+		case 'S': /* solved positions table file */
+			solverPath = optarg;
+			break;
+		case 'R': /* player ratings file */
+			ratingsPath = optarg;
+			break;
+		case 'T': /* tournaments of entrants, swiss of given rounds or round robin */
+			tournamentSize = atoi(optarg);
+			tournamentRounds = (strchr(optarg, ':') != NULL) ? atoi(strchr(optarg, ':') + 1) : 0;
+			if (tournamentSize < 2 || tournamentSize > TOURNAMENT_MAX_ENTRANTS || tournamentRounds < 0) {
+				printf("Error: Tournament should have between 2 and %d entrants!\n", TOURNAMENT_MAX_ENTRANTS);
+				return 1; //exit on error
+			}
+			break;
+		case 'r': /* hold seat of disconnected player for grace seconds */
+			sessionGraceSec = atoi(optarg);
+			if (sessionGraceSec < 0) {
+				printf("Error: Grace period should not be negative!\n");
+				return 1; //exit on error
+			}
+			break;
+		case 'm': /* publish game snapshots to shared memory file */
+			snapshotPath = optarg;
+			break;
+		case 'e': /* export results of ended games to sink */
+			exportSink = optarg;
+			break;
+		case 'E': /* spill file of exported results the sink did not take */
+			exportSpillPath = optarg;
+			break;
+		case 'u': /* started by previous server on upgrade */
+			upgradeChannel = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-l] [-d] [-L] [-O] [-F] [-b busy-poll-usec] [-a cpu] [-n heaps] [-k max-take] [-f flight-dump] [-c capture-file] [-S solver-table] [-R ratings-file] [-T entrants[:rounds]] [-r grace-sec] [-m snapshot-file] [-e unix:path|tcp:host:port|file:path] [-E spill-file] p M misere [port]\n", argv[0]);
+			return 1;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+	/* check for arguments received in the command line */
+	if (argc == 4 || argc == 5) { /* if there are 2 or 3 command line arguments */
+		p = atoi(argv[1]);
+		if (p < 2 || p > MAX_PLAYERS) { /* check if number of players is in range */
+			printf("Error: Number of players should be between 2 and 9!\n");
+			return 1; //exit on error
+		}
+		//printf("Can be simultaneously connected only %d clients. Max_num_of_players=%d\n", MAX_NUM_OF_CLIENTS, p);
+		M = atoi(argv[2]);
+		if (atoi(argv[3])) {
+			gameType = MISERE;
+		}
+		if (argc == 5) { /* if there are 3 command line arguments */
+			port = atoi(argv[4]);
+		}
+	} else if (upgradeChannel == -1) { /* upgraded server gets settings from previous one */
+		printf("Error: Wrong number of arguments received!\n");
+		return 1; //exit on error
+	}
+	if ((connPoller.epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		printf("Error creating epoll: %s!\n", strerror(errno));
+		return errno; //exit on error
+	}
+	if (upgradeChannel != -1) { /* take over listening socket, clients and games */
+		if (!resumeServer(upgradeChannel, &listSocket)) {
+			return 1; //exit on error
+		}
+		socklen_t queueLen = sizeof(fastOpenQueue); /* listener keeps fast open of previous server */
+		if (getsockopt(listSocket, IPPROTO_TCP, TCP_FASTOPEN, &fastOpenQueue, &queueLen) == -1) {
+			fastOpenQueue = 0;
+		}
+		int gameIdx;
+		for (gameIdx = 0; gameIdx < MAX_GAMES && !lobbyMode; gameIdx++) {
+			if (gameTable.flags[gameIdx] & GAME_IN_USE) {
+				game = &games[gameIdx];
+				break;
+			}
+		}
+	} else {
+		/* create listening socket */
+		if ((listSocket = socket(AF_INET, SOCK_STREAM, 0)) == -1) { /* create socket of Internet domain, messages read in streams, OS chooses TCP */
+			printf("Error creating socket: %s!\n", strerror(errno));
+			return errno; //exit on error
+		}
+		/* set server address parameters */
+		memset((char *) &server_address, 0, sizeof(server_address));
+		server_address.sin_family = AF_INET; /* code for the address family, always set to the AF_INET */
+		server_address.sin_port = htons(port); /* port number, a port number in host byte order converted to a port number in network byte order */
+		server_address.sin_addr.s_addr = INADDR_ANY; /* field contains the IP address of the host, for server - IP address of the machine on which the server is running */
+		/* reuse server address */
+		int yes = 1;
+		if ((setsockopt(listSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1)) {
+			printf("Error reusing port: %s!\n", strerror(errno));
+			return errno; //exit on error
+		}
+		/* bind the socket */
+		if ((bind(listSocket, (struct sockaddr *) &server_address, sizeof(server_address))) == -1) {
+			printf("Error binding socket: %s!\n", strerror(errno));
+			return errno; //exit on error
+		}
+		/* listen on the created socket, queue of MAX_NUM_OF_CLIENTS length, lobby takes connect bursts */
+		if (listen(listSocket, (lobbyMode) ? SOMAXCONN : MAX_NUM_OF_CLIENTS) == -1) {
+			printf("Error listening to socket: %s!\n", strerror(errno));
+			return errno; //exit on error
+		}
+		if (fastOpenQueue > 0 && setsockopt(listSocket, IPPROTO_TCP, TCP_FASTOPEN, &fastOpenQueue, sizeof(fastOpenQueue)) == -1) {
+			printf("Error enabling TCP Fast Open: %s!\n", strerror(errno));
+			fastOpenQueue = 0;
+		}
+	}
+	setNonblocking(listSocket); /* accept loop ends when backlog is empty */
+	flightNowNs = nowNs();
+	if (datagramMode && (statusSocket = openStatusSocket(listSocket)) == -1) {
+		printf("Error opening status datagram socket: %s!\n", strerror(errno));
+		return 1; //exit on error
+	}
+	if (capturePath != NULL) {
+		capture_header_t header = { CAPTURE_MAGIC, CAPTURE_VERSION, lobbyMode, p, gameType, M, heapsCnt, maxTake, sessionGraceSec };
+		if ((captureFile = captureOpen(capturePath, &header)) == NULL) {
+			printf("Error creating capture file %s: %s!\n", capturePath, strerror(errno));
+			return 1; //exit on error
+		}
+	}
+	if (solverPath != NULL && (gameType != MISERE || maxTake == 0)) { /* analyzer uses closed form of the variant */
+		printf("Solver table %s not used, game has closed form\n", solverPath);
+		solverPath = NULL;
+	}
+	if (solverPath != NULL) { /* map table solved before or solve it on all cpus */
+		long long solveStartNs = nowNs();
+		errno = 0;
+		if (!solverOpen(&solverTable, solverPath, gameType, MOVES_ONE_HEAP, heapsCnt, maxTake, M, sysconf(_SC_NPROCESSORS_ONLN))) {
+			printf("Error opening solver table %s: %s!\n", solverPath, (errno == EEXIST) ? "not a table of the game" : (errno != 0) ? strerror(errno) : "too many positions");
+			return 1; //exit on error
+		}
+		printf("Solver table %s %s in %.3f ms, %lld positions\n", solverPath, (solverTable.loaded) ? "loaded" : "solved", (nowNs() - solveStartNs) / 1e6, solverTable.header->solvedCnt);
+	}
+	if (tournamentSize > 0 && !lobbyMode) {
+		printf("Error: Tournaments are played in lobby mode only!\n");
+		return 1; //exit on error
+	}
+	if ((ratingsPath != NULL || tournamentSize > 0) && !ratingOpen(&ratings, ratingsPath)) {
+		printf("Error opening ratings %s: %s!\n", (ratingsPath != NULL) ? ratingsPath : "table", strerror(errno));
+		return 1; //exit on error
+	}
+	if (tournamentsActive > 0) { /* entrants of tournaments handed over by previous server */
+		tournamentsRateEntrants();
+	}
+	if (!analyzerInit(&analyzer, heapsCnt, maxTake, (solverPath != NULL) ? &solverTable : NULL)) {
+		printf("Error starting position analysis: %s!\n", strerror(errno));
+		return 1; //exit on error
+	}
+	if (snapshotPath != NULL && !snapshotCreate(&snapshots, snapshotPath, MAX_GAMES)) {
+		printf("Error mapping game snapshots %s: %s!\n", snapshotPath, strerror(errno));
+		return 1; //exit on error
+	}
+	errno = 0;
+	if (exportSink != NULL && !(exporting = exportOpen(&exporter, exportSink, exportSpillPath))) {
+		printf("Error exporting results to %s: %s!\n", exportSink, (errno != 0) ? strerror(errno) : "unknown sink");
+		return 1; //exit on error
+	}
+	/* create the game of single game server */
+	if (upgradeChannel == -1) {
+		initGames();
+		if (!lobbyMode) {
+			game = createGame(gameType, p, M);
+		}
+	}
+	int slot;
+	for (slot = 0; slot < MAX_GAMES && snapshots.header != NULL; slot++) { /* slots of previous server are overwritten */
+		games[slot].rosterChanged = ROSTER_ALL;
+		publishGame(&games[slot], (gameTable.flags[slot] & GAME_IN_USE) && checkGameEnd(&games[slot]));
+	}
+	struct epoll_event listenEvent = { EPOLLIN, { .fd = listSocket } }, analysesEvent = { EPOLLIN, { .fd = analyzer.replyPipe[0] } };
+	if (epoll_ctl(connPoller.epollFd, EPOLL_CTL_ADD, listSocket, &listenEvent) == -1 || epoll_ctl(connPoller.epollFd, EPOLL_CTL_ADD, analyzer.replyPipe[0], &analysesEvent) == -1) {
+		printf("Error polling listening socket: %s!\n", strerror(errno));
+		return errno; //exit on error
+	}
+	signal(SIGUSR1, onDumpSignal);
+	signal(SIGUSR2, onUpgradeSignal);
+	signal(SIGPIPE, SIG_IGN); /* client that went away is disconnected on send error */
+	if (exporting) {
+		signal(SIGTERM, onTerminateSignal);
+	}
+	/* main loop of the game */
+	schedulerInit(&sched);
+	while (1) {
+		sched.iterations++;
+		if ((detachedCnt > 0 || ratings.header != NULL) && schedTimersDue(&sched, nowNs())) {
+			if (detachedCnt > 0) {
+				expireSessions();
+			}
+			/* results of lobby and tournament games are applied once in period */
+			if (ratings.header != NULL && nowNs() - ratings.periodStartNs >= RATING_PERIOD_NS) {
+				ratingClosePeriod(&ratings, nowNs());
+			}
+		}
+		if (upgradeRequested) { /* hand clients over to upgraded server and exit */
+			upgradeRequested = 0;
+			if (exporting) { /* results queued so far are flushed, successor exports the rest */
+				exportClose(&exporter);
+				exporting = 0;
+			}
+			if (handoffServer(serverPath, listSocket)) {
+				printf("Server upgraded\n");
+				break;
+			}
+			exporting = (exportSink != NULL && exportOpen(&exporter, exportSink, exportSpillPath));
+		}
+		if (terminateRequested) {
+			break;
+		}
+		int hasPending = (carriedCnt > 0); /* some client has complete message already buffered */
+		int exportWaiting = (exporting && exportPump(&exporter) > 0); /* results wait for the sender to make room */
+		if (ratingApplyPending(&ratings)) { /* closed rating period is applied in steps between the games */
+			hasPending |= ratingApply(&ratings, RATING_APPLY_BUDGET);
+		}
+		int backlog = connPoller.waitingCnt + carriedCnt; /* connections with unsent frames or unread messages */
+		int gameIdx;
+		if (gameTableNext(0, MAX_GAMES, GAME_TURN_DONE | GAME_SEND_STATUS) < MAX_GAMES) {
+			hasPending = 1; /* status broadcast is due */
+		}
+		/* wait for ready sockets */
+		/* do not block while buffered messages wait to be handled, held seats expire without traffic */
+		int eventsCnt = waitEvents(events, EPOLL_BATCH, (hasPending) ? 0 : (detachedCnt > 0 || exportWaiting || (ratings.header != NULL && ratings.header->periodResults > 0)) ? SESSION_TICK_US / 1000 : -1);
+		if (eventsCnt == -1) {
+			if (errno == EINTR) { /* interrupted by signal - no events were taken */
+				if (dumpLatency) {
+					printStats();
+					dumpFlightRecorder();
+					dumpLatency = 0;
+				}
+				continue; /* upgrade request is handled on loop start */
+			}
+			printf("Error in epoll_wait: %s!\n", strerror(errno));
+			return errno;
+		}
+		flightNowNs = nowNs();
+		int i, fd, listenReady = 0, analysesReady = 0, flushExhausted = 0;
+		/* try to send messages to write ready sockets, sockets beyond flush budget are reported again by next wait */
+		schedStart(&sched, SCHED_FLUSH, 0);
+		for (i = 0; i < eventsCnt; i++) {
+			fd = events[i].data.fd;
+			if (fd == listSocket) {
+				listenReady = 1;
+			} else if (fd == analyzer.replyPipe[0]) {
+				analysesReady = 1;
+			} else if ((events[i].events & EPOLLOUT) && connList[fd] != NULL && !flushExhausted) {
+				if (!schedTake(&sched, SCHED_FLUSH)) {
+					schedCarry(&sched, SCHED_FLUSH, 0);
+					flushExhausted = 1;
+					continue;
 				}
+				client_t * client = connList[fd];
+				client->sock.writeReady = 1; /* frames queued later in the iteration are sent at once */
+				ALT(sendRecorded(&client->sock,NULL), onClientDisconnect(client));
 			}
 		}
-		/* listening socket is read-ready - new client available */
-		if (FD_ISSET(listSocket, &readSet)) {
-			int newConnection;
-			/* accept client connection */
-			clientLen = sizeof(client_address);
-			if ((newConnection = accept(listSocket, (struct sockaddr *) &client_address, &clientLen)) == -1) {
-				printf("Error in accept: %s!\n", strerror(errno));
-				return errno;
-			}
-			/* if maximum number of clients already connected */
-			if (getClientsCount() >= MAX_NUM_OF_CLIENTS) {
-				//printf("Only %d clients can be connected simultaneously!\n", MAX_NUM_OF_CLIENTS);
-				if (rejectClient(newConnection)) {
-					return 1; //exit on error
+		if (analysesReady) {
+			sendAnalyses();
+		}
+		/* listening socket is read-ready - new clients available, backlog beyond accept budget waits for next iteration */
+		if (listenReady) {
+			schedStart(&sched, SCHED_ACCEPT, 0);
+			while (1) {
+				int newConnection;
+				if (!schedTake(&sched, SCHED_ACCEPT)) {
+					schedCarry(&sched, SCHED_ACCEPT, 0);
+					break;
 				}
-			} else { /* if there are less than MAX_NUM_OF_CLIENTS */
-				setNonblocking(newConnection);
-				int clId;
-				clId = getMaxId(clientList); /* check if there is available client ID (between 1 and 25) */
-				/* try to find place for new connection listSocket */
-				//printf("\nConnection accepted:   FD=%d; id=%d\n", newConnection, clId);
-				/* if client ID is available and no more than MAX_NUM_OF_CLIENTS connected simultaneously */
-				if (clId != CLIENT_ID_INVALID) { /* if client got ID set its parameters */
-					clientList[clId] = (client_t *) malloc(sizeof(client_t));
-					clientList[clId]->sock.socket = newConnection;
-					clientList[clId]->sock.rxBuffPos = 0;
-					clientList[clId]->sock.writeSet = &writeSet;
-					clientList[clId]->status = (getPlayersCount() <= p) ? PLAYING : SPECTATOR; /* there are can be up to p players */
-					if (getPlayersCount() > p) {
-						clientList[clId]->status = SPECTATOR;
+				/* accept client connection */
+				clientLen = sizeof(client_address);
+				if ((newConnection = accept(listSocket, (struct sockaddr *) &client_address, &clientLen)) == -1) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) { /* backlog is empty */
+						break;
 					}
-					//printf("clientList[clId]->sock.socket=%d clientList[clId]->status=%d\n", clientList[clId]->sock.socket, clientList[clId]->status);
-					//printf("Currently connected %d clients\n", getClientsCount());
-					sendWelcomeMsg(&clientList[clId]->sock, clId, gameType, p, clientList[clId]->status);
-					if (getCurrentPlayer() == NULL) {
-						updateClientsStatus(&needToSendStatus);
-						setNextPlayerAsCurrent();
+					printf("Error in accept: %s!\n", strerror(errno));
+					return errno;
+				}
+				if (!growConnections(newConnection)) { /* no memory for tables of the descriptor */
+					if (rejectClient(newConnection)) {
+						return 1; //exit on error
 					}
-					payload_t* pl = (payload_t*) malloc(sizeof(payload_t));
-					/* get heap state */
-					int i;
-					for (i = 0; i < NUM_OF_HEAPS; i++) {
-						pl->status.heapStatus.heap[i] = heaps[i];
+					continue;
+				}
+				captureEvent(newConnection, CAPTURE_OPEN, 0, NULL);
+				if (lowLatency && !setLowLatency(newConnection, busyPollUs)) {
+					printf("Error setting low latency options: %s!\n", strerror(errno));
+				}
+				client_t * client = NULL;
+				/* if maximum number of clients already connected */
+				if (!lobbyMode && getClientsCount(game) >= MAX_NUM_OF_CLIENTS) {
+					//printf("Only %d clients can be connected simultaneously!\n", MAX_NUM_OF_CLIENTS);
+				} else {
+					setNonblocking(newConnection);
+					client = createClient(newConnection);
+				}
+				if (client == NULL) {
+					if (rejectClient(newConnection)) {
+						return 1; //exit on error
 					}
-					/* get client status */
-					pl->status.clientStatus = clientList[clId]->status;
-					/* check end of game */
-					int isGameEnded = checkGameEnd(heaps);
-					/* set end game status to client accordingly to game type */
-					if (isGameEnded) {
-						if (clientList[clId]->status == SPECTATOR) {
-							pl->status.endGame = YOU_WATCHED;
-						} else {
-							pl->status.endGame = (gameType != MISERE) ? YOU_LOSE : YOU_WIN;
-						}
-					} else { /* if game not finished yet */
-						pl->status.endGame = NOT_FINISHED;
+				} else if (lobbyMode) { /* client waits in lobby for its join request */
+					if (fastOpenQueue > 0) { /* join request that came in SYN is handled without waiting for epoll */
+						serveClient(newConnection, 1);
+						carryConnection(newConnection);
 					}
-					/* send personal message with heap state */
-					game_msg_t* personalHeapStatusMsg = createMessage(STATUS, *pl);
-					if (!sendMessageB(&clientList[clId]->sock, personalHeapStatusMsg)) {
-						onClientDisconnect(clientList[clId], &isTurnDone, &needToSendStatus);
+				} else { /* if there are less than MAX_NUM_OF_CLIENTS */
+					if (fastOpenQueue > 0) {
+						peekFastJoin(client);
 					}
-					destroyMsg(&(personalHeapStatusMsg));
-				} else if (clId == CLIENT_ID_INVALID) { /* if invalid ID received by client*/
-					//printf("Cann't accept connection! More than 25 players connected during one game!\n");
-					if (rejectClient(newConnection)) { /* reject connection */
+					/* while seats are held new client may be player resuming its seat - its RESUME moves it there later */
+					client->provisional = (detachedCnt > 0);
+					if (joinSingleGame(game, client)) {
 						return 1; //exit on error
 					}
-				}
-			} /* playing client accepted */
+				} /* playing client accepted */
+			}
 		} /* handling listening socket */
-		else { /* not listening socket */
-			/* try to receive messages from active read ready socket */
-			int id;
-			for (id = 0; id < MAX_ID; id++) {
-				client_t* client;
-				client = clientList[id];
-				if (client != NULL) {
-					if (FD_ISSET(client->sock.socket, &readSet)) {
-						game_msg_t* msg;
-						int isDisconnect = 0;
-						msg = receiveMessageB(&(client->sock), &isDisconnect);
-						if (isDisconnect) {
-							onClientDisconnect(client, &isTurnDone, &needToSendStatus);
-						} else {
-							if (msg != NULL) {
-								handleMsg(msg, client, heaps, &isTurnDone, &needToSendStatus);
-								destroyMsg(&msg);
-							}
-						}
-						break; /* one client per cycle */
-					}
+		/* receive messages of sockets with buffered messages and read ready sockets in turns by fd, each connection within its budget */
+		readyCnt = 0;
+		for (i = 0; i < carriedCnt; i++) {
+			connReady[carriedFds[i]] = CONN_LISTED;
+			readyFds[readyCnt++] = carriedFds[i];
+		}
+		for (i = 0; i < eventsCnt; i++) {
+			fd = events[i].data.fd;
+			if (fd != listSocket && fd != analyzer.replyPipe[0] && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+				if (!(connReady[fd] & CONN_LISTED)) {
+					readyFds[readyCnt++] = fd;
 				}
+				connReady[fd] = CONN_LISTED | CONN_READABLE;
 			}
-			/* if turn done or need to send status */
-			if (isTurnDone || needToSendStatus) {
-				game_msg_t* statusMsg[MAX_ID];
-				for (id = 0; id < MAX_ID; id++) {
-					client_t* client;
-					client = clientList[id];
-					if (client != NULL) {
-						payload_t* pl = (payload_t*) malloc(sizeof(payload_t));
-						int i;
-						for (i = 0; i < NUM_OF_HEAPS; i++) {
-							pl->status.heapStatus.heap[i] = heaps[i];
-						}
-						pl->status.clientStatus = UNKNOWN;
-						pl->status.endGame = NOT_FINISHED;
-						statusMsg[id] = createMessage(STATUS, *pl);
-					}
-				}
-				/* check if game is ended */
-				int isGameEnded = checkGameEnd(heaps);
-				if (isGameEnded) { /* game is ended - update end game status for all */
-					client_t* lastPlayed = getCurrentPlayer();
-					int lastPlayedSocket = (lastPlayed != NULL) ? lastPlayed->sock.socket : -1;
-					int id;
-					for (id = 0; id < MAX_ID; id++) {
-						client_t* client;
-						client = clientList[id];
-						if (client != NULL) {
-							if (client->status == SPECTATOR) {
-								statusMsg[id]->payload.status.endGame = YOU_WATCHED;
-							} else if (client->sock.socket == lastPlayedSocket) {
-								statusMsg[id]->payload.status.endGame = (gameType == MISERE) ? YOU_LOSE : YOU_WIN;
-							} else {
-								statusMsg[id]->payload.status.endGame = (gameType != MISERE) ? YOU_LOSE : YOU_WIN;
-							}
-						}
-					}
-				} else { /* game is not ended - update client status for all */
-					if (isTurnDone) {
-						setNextPlayerAsCurrent();
-					}
-					int id;
-					for (id = 0; id < MAX_ID; id++) {
-						client_t* client;
-						client = clientList[id];
-						if (client != NULL) {
-							//printf("client ID is %d, fd=%d, client status is %d\n", id, clientList[id]->sock.socket, client->status);
-							statusMsg[id]->payload.status.clientStatus = client->status;
-						}
+		}
+		carriedCnt = 0;
+		qsort(readyFds, readyCnt, sizeof(int), compareFds);
+		int start = schedStart(&sched, SCHED_READ, connCap), first = 0, readExhausted = 0;
+		while (first < readyCnt && readyFds[first] < start) { /* turn continues from the socket the last one stopped at */
+			first++;
+		}
+		for (i = 0; i < readyCnt; i++) {
+			fd = readyFds[(first + i) % readyCnt];
+			int readReady = connReady[fd] & CONN_READABLE;
+			connReady[fd] = 0;
+			if (connList[fd] != NULL && !readExhausted && !serveClient(fd, readReady)) {
+				schedCarry(&sched, SCHED_READ, fd);
+				readExhausted = 1; /* sockets left unread are reported again by next wait */
+			}
+			carryConnection(fd);
+		}
+		/* if turn done or need to send status, due games are found by their flags from start slot round */
+		unsigned char dueFlags = GAME_TURN_DONE | GAME_SEND_STATUS | ((snapshots.header != NULL) ? GAME_PUBLISH : 0);
+		start = schedStart(&sched, SCHED_GAMES, MAX_GAMES);
+		int pass, exhausted = 0;
+		for (pass = 0; pass < 2 && !exhausted; pass++) {
+			int end = (pass == 0) ? MAX_GAMES : start;
+			for (gameIdx = gameTableNext((pass == 0) ? start : 0, end, dueFlags); gameIdx < end; gameIdx = gameTableNext(gameIdx + 1, end, dueFlags)) {
+				game_t * current = &games[gameIdx];
+				if (gameTable.flags[gameIdx] & (GAME_TURN_DONE | GAME_SEND_STATUS)) {
+					if (!schedTake(&sched, SCHED_GAMES)) {
+						schedCarry(&sched, SCHED_GAMES, gameIdx);
+						exhausted = 1;
+						break;
 					}
+					broadcastStatus(current);
+				} else { /* joins and leaves without status broadcast */
+					publishGame(current, checkGameEnd(current));
 				}
-				/* try to send messages to active write ready socket */
-				for (id = 0; id < MAX_ID; id++) {
-					client_t* client;
-					client = clientList[id];
-					if (client != NULL) {
-						ALT(sendMessageB(&client->sock, statusMsg[id]), onClientDisconnect(client, &isTurnDone, &needToSendStatus));
-						destroyMsg(&(statusMsg[id]));
-					}
+			}
+		}
+		if (!lobbyMode) {
+			if (checkGameEnd(game)) {/* if no more cubes remains */
+				/* exit when no more clients remain */
+				if (getClientsCount(game) == 0) {
+					break;
 				}
 			}
+		} else { /* free slots of games all clients left */
+			for (gameIdx = gameTableNext(0, MAX_GAMES, GAME_EMPTY); gameIdx < MAX_GAMES; gameIdx = gameTableNext(gameIdx + 1, MAX_GAMES, GAME_EMPTY)) {
+				destroyGame(&games[gameIdx]);
+			}
+			tournamentsRun(); /* pairings waiting for game slots start, rounds whose games all ended are closed */
 		}
-		if (checkGameEnd(heaps)) {/* if no more cubes remains */
-			/* exit when no more clients remain */
-			if (getClientsCount() == 0) {
-				break;
+		if (lowLatency) { /* frames of the iteration leave together, responses don't wait for next epoll_wait */
+			flushClients();
+		}
+		for (i = 0; i < eventsCnt; i++) { /* write readiness holds for the iteration it was reported in */
+			fd = events[i].data.fd;
+			if ((events[i].events & EPOLLOUT) && fd != listSocket && fd != analyzer.replyPipe[0] && connList[fd] != NULL) {
+				connList[fd]->sock.writeReady = 0;
 			}
 		}
+		if (captureFile != NULL) { /* captured records reach the file once per loop iteration */
+			fflush(captureFile);
+		}
+		if (admission.enabled) { /* load of the iteration sets what is shed in the next ones */
+			admissionUpdate(&admission, nowNs() - flightNowNs, backlog);
+		}
 	} //while
 	//close sockets
-	int id;
-	for (id = 0; id < MAX_ID; id++) {
+	int fd;
+	for (fd = 0; fd < connCap; fd++) {
 		client_t* client;
-		client = clientList[id];
+		client = connList[fd];
 		if (client != NULL) {
 			if (close(client->sock.socket) == -1) {
-				printf("Error in closing client #%d socket: %s!\n", id, strerror(errno));
+				printf("Error in closing client #%d socket: %s!\n", client->id, strerror(errno));
 			}
 		}
 	}
 	if (close(listSocket) == -1) {
 		printf("Error in closing listSocket: %s!\n", strerror(errno));
 	}
+	if (statusSocket != -1 && close(statusSocket) == -1) {
+		printf("Error in closing statusSocket: %s!\n", strerror(errno));
+	}
+	if (captureFile != NULL && fclose(captureFile) != 0) {
+		printf("Error closing capture file: %s!\n", strerror(errno));
+	}
+	solverClose(&solverTable);
+	if (exporting) {
+		exportClose(&exporter);
+	}
+	printStats();
+	ratingClose(&ratings);
+	snapshotClose(&snapshots);
 	return 0; //end of program
 }
+#endif /* NIM_SERVER_NO_MAIN */
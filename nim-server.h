@@ -0,0 +1,259 @@
+#define NUM_OF_HEAPS 4
+#define MAX_NUM_OF_CLIENTS 9
+#define MAX_PLAYERS 9 /* maximal number of players in one game */
+#define MAX_ID 25
+#ifndef MAX_GAMES
+#define MAX_GAMES 256 /* maximal number of games running simultaneously, -DMAX_GAMES=131072 builds server for many multiplexed games */
+#endif
+#define CONN_TABLE_MIN 1024 /* entries of tables indexed by socket fd allocated first, tables double when fd doesn't fit */
+#define ROSTER_ALL ((1u << MAX_ID) - 1) /* rosterChanged of every client ID */
+
+/* flags of game slot in game table */
+#define GAME_IN_USE 0x01 /* slot holds running game */
+#define GAME_TURN_DONE 0x02 /* turn finished, status broadcast needed */
+#define GAME_SEND_STATUS 0x04 /* client statuses changed, status broadcast needed */
+#define GAME_PUBLISH 0x08 /* roster changed since game snapshot was published */
+#define GAME_EMPTY 0x10 /* all clients left, lobby releases the slot */
+#define GAME_SEATS_HELD 0x20 /* players hold seats while disconnected */
+
+#define GAME_SLOT(game) ((int) ((game) - games)) /* game slot of game_t pointer */
+#define GAME_HEAPS(game) (gameTable.heaps[GAME_SLOT(game)]) /* heaps of game */
+#define GAME_FLAGS(game) (gameTable.flags[GAME_SLOT(game)]) /* GAME_* flags of game */
+
+struct Game;
+struct LobbyQueue;
+struct Tournament;
+
+/**
+ * rarely used state of client, kept out of line so that idle connection stays small
+ * udpPort, udpAddr - UDP port and address in network byte order statuses are sent to while client watches,
+ * udpPort 0 - TCP only
+ * queue - lobby queue client waits in, NULL if not waiting
+ * queuePrev, queueNext - neighbours in lobby queue
+ * buckets - token buckets limiting messages of the connection, indexed by admission_class_t
+ * sessions - clients of sessions multiplexed over the connection indexed by session ID, NULL if none
+ * sessionsCap - size of sessions array
+ * playerId - identity player is rated by, 0 if anonymous
+ * tournament - tournament client entered, NULL if none
+ * entrant - entrant index of the client in its tournament
+ **/
+typedef struct ClientExt {
+	unsigned short udpPort;
+	unsigned int udpAddr;
+	struct LobbyQueue * queue;
+	struct Client * queuePrev;
+	struct Client * queueNext;
+	token_bucket_t buckets[ADMIT_CLASSES];
+	struct Client ** sessions;
+	int sessionsCap;
+	unsigned int playerId;
+	struct Tournament * tournament;
+	int entrant;
+} client_ext_t;
+
+/**
+ * structure for client with buffered socket
+ * sock - buffered socket of the client
+ * status - client status in its game
+ * id - client ID in its game
+ * statusStale - 1 if statuses were shed, next status is keyframe
+ * fastJoin - 1 if client asked for WELCOME merged with its first status keyframe
+ * provisional - 1 if client was placed on connect while seats are held and sent no message yet
+ * game - game client plays or watches, NULL while client waits in lobby
+ * ext - rarely used state, NULL until one of its fields is set, read through CLIENT_EXT
+ **/
+typedef struct Client {
+	buffered_socket_t sock;
+	client_status_t status;
+	char id;
+	char statusStale;
+	char fastJoin;
+	char provisional;
+	struct Game * game;
+	client_ext_t * ext;
+} client_t;
+
+extern const client_ext_t noClientExt;
+#define CLIENT_EXT(client) (((client)->ext != NULL) ? (const client_ext_t *) (client)->ext : &noClientExt) /* rarely used state for reading, zeroed if not allocated */
+
+/**
+ * game data, kept apart from the hot state every sweep reads which lives in gameTable
+ * clientList - clients of the game indexed by client ID
+ * sentHeaps - heaps state as of statusSeq, deltas are computed against it
+ * statusSeq - sequence number of the last status update
+ * gameType - MISERE or REGULAR
+ * rules - rules of the game variant
+ * p - maximal number of players in the game
+ * maxId - next client ID to give out
+ * timedClient - player whose timed move waits for status broadcast
+ * pendingTiming - timestamps of timedClient move
+ * timedRecvNs - time timedClient move was received
+ * seatTokens - random part of session tokens of players indexed by client ID, 0 if seat is not held on disconnect
+ * seatDetachedNs - time player holding seat disconnected, indexed by client ID
+ * spectatorsSentNs - time spectators got status last
+ * tournament - tournament the game is played for, NULL for lobby and single games
+ * pairing - pairing of current tournament round the game is played for
+ * resultRecorded - 1 once result of ended game is recorded
+ * rosterChanged - bit of each client ID whose status or seat changed since the game snapshot was published
+ * startMs - wall clock time the game started, exported with its result
+ * movesCnt, illegalCnt - moves made in the game and illegal ones of them
+ * movesBy - moves made by players indexed by client ID
+ **/
+typedef struct Game {
+	client_t * clientList[MAX_ID];
+	short sentHeaps[NUM_OF_HEAPS];
+	unsigned int statusSeq;
+	game_type_t gameType;
+	rules_t rules;
+	int p;
+	char maxId;
+	client_t * timedClient;
+	move_timing_t pendingTiming;
+	long long timedRecvNs;
+	unsigned int seatTokens[MAX_ID];
+	long long seatDetachedNs[MAX_ID];
+	long long spectatorsSentNs;
+	struct Tournament * tournament;
+	int pairing;
+	int resultRecorded;
+	unsigned int rosterChanged;
+	long long startMs;
+	unsigned short movesCnt;
+	unsigned short illegalCnt;
+	unsigned short movesBy[MAX_ID];
+} game_t;
+
+/**
+ * hot state of all game slots in struct of arrays layout indexed by game slot,
+ * sweeps of the main loop over all slots read a byte or two of each game
+ * and never touch game_t with its client pointers and seat data
+ * flags - GAME_* flags of the slots, 0 for free slot
+ * current - turn cursor: client ID having the turn, CLIENT_ID_INVALID if none
+ * clientsCnt - clients of the games, players holding seats included
+ * heldSinceNs - time the earliest seat still held in the game was left, meaningful with GAME_SEATS_HELD
+ * heaps - heaps of the games, heaps of one game are adjacent
+ **/
+typedef struct game_table {
+	unsigned char flags[MAX_GAMES];
+	char current[MAX_GAMES];
+	unsigned char clientsCnt[MAX_GAMES];
+	long long heldSinceNs[MAX_GAMES];
+	short heaps[MAX_GAMES][NUM_OF_HEAPS];
+} game_table_t;
+
+/* server state shared by server functions */
+extern int heapsCnt;
+extern int maxTake;
+extern client_t ** connList;
+extern int connCap;
+extern game_t games[MAX_GAMES];
+extern game_table_t gameTable;
+extern game_t * newestGame[2];
+extern int detachedCnt;
+extern admission_t admission;
+extern long sessionsCnt;
+
+/* headers of server game logic functions */
+int checkGameEnd(game_t * game);
+
+int isUserMoveValid(game_t * game, short heapIndex, short cubes_num);
+
+void playerMove(short *heaps, short heap, int num_of_cubes);
+
+char getClientsCount(game_t * game);
+
+char getPlayersCount(game_t * game);
+
+client_t * getCurrentPlayer(game_t * game);
+
+char getMaxId(game_t * game);
+
+int isDetached(client_t * client);
+
+int isSession(client_t * client);
+
+client_t ** getClientSlot(client_t * client);
+
+client_t * getSession(client_t * link, unsigned short session);
+
+void closeSessions(client_t * link);
+
+unsigned long long getSessionToken(client_t * client);
+
+int sendRecorded(buffered_socket_t * fd, game_msg_t * msg);
+
+void setClientStatus(client_t * client, client_status_t status);
+
+int sendWelcomeMsg(buffered_socket_t * fd, int clientId, game_type_t gameType, char p, client_status_t clientStatus, unsigned long long sessionToken, unsigned short rating, char flags, const status_t * status);
+
+void sendRejectMsg(int fd);
+
+int sendTurnResponse(buffered_socket_t * fd, turn_resp_t l, unsigned short moveSeq);
+
+game_msg_t * createStatusMsg(game_t * game, int keyframe, char changedHeap, client_status_t clientStatus, end_game_t endGame);
+
+end_game_t getPersonalEndGame(client_t * client);
+
+int sendEndMessage(buffered_socket_t * fd, end_game_t endGame, game_msg_t* statusMsg);
+
+void setNextPlayerAsCurrent(game_t * game);
+
+client_status_t determineNewClientStatus(game_t * game);
+
+void updateClientsStatus(game_t * game);
+
+void initGames();
+
+game_t * createGame(game_type_t gameType, int p, int cubes);
+
+void destroyGame(game_t * game);
+
+int gameTableNext(int from, int to, unsigned char flags);
+
+void indexGame(game_t * game);
+
+void removeClientFromGame(game_t * game, char id);
+
+void publishGame(game_t * game, int isGameEnded);
+
+int growConnections(int fd);
+
+client_t * createClient(int fd);
+
+client_ext_t * clientExt(client_t * client);
+
+void destroyClient(client_t * client);
+
+unsigned int newSeatToken();
+
+char addClientToGame(game_t * game, client_t * client, client_status_t status);
+
+int sendGameIntro(client_t * client);
+
+void broadcastStatus(game_t * game);
+
+void recordGameResult(game_t * game);
+
+int holdsSeat(client_t * client);
+
+void detachClient(client_t * client);
+
+void expireSessions();
+
+int onClientDisconnect(client_t * disconnected);
+
+void handleMsg(game_msg_t* msg, client_t * sourceClient);
+
+void handleJoin(client_t * client, join_t * join);
+
+int rejectNewClient(client_t * client);
+
+int joinSingleGame(game_t * game, client_t * client);
+
+void handleResume(client_t * client, resume_t * resume);
+
+void handleAnalyze(client_t * client, analyze_t * analyze);
+
+int rejectClient(int newConnection);
+
+int setNonblocking(int fd);
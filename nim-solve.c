@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* getopt(), sysconf() */
+#include <sys/types.h> /* data types used in system calls */
+#include <errno.h> /* error messages */
+#include <string.h> /* string functions */
+#include "transport.h" /* game types */
+#include "rules.h" /* game variant rules */
+#include "solver.h" /* solved positions */
+#include "latency.h" /* nowNs() */
+
+/* main function */
+int main(int argc, char *argv[]) {
+	int threadsCnt = sysconf(_SC_NPROCESSORS_ONLN);
+	int heapsCnt = MAX_HEAPS;
+	int maxTake = 0;
+	move_set_t moveSet = MOVES_ONE_HEAP;
+	int opt;
+	while ((opt = getopt(argc, argv, "t:n:k:w")) != -1) {
+		switch (opt) {
+		case 't': /* number of solver threads */
+			threadsCnt = atoi(optarg);
+			break;
+		case 'n': /* number of heaps in play */
+			heapsCnt = atoi(optarg);
+			break;
+		case 'k': /* bounded take - at most k cubes in one move */
+			maxTake = atoi(optarg);
+			break;
+		case 'w': /* Wythoff moves - the same number of cubes can be taken from two heaps */
+			moveSet = MOVES_WYTHOFF;
+			break;
+		default:
+			printf("Usage: %s [-t threads] [-n heaps] [-k max-take] [-w] max-heap misere table-file\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 3) {
+		printf("Usage: %s [-t threads] [-n heaps] [-k max-take] [-w] max-heap misere table-file\n", argv[0]);
+		return 1;
+	}
+	int maxHeap = atoi(argv[optind]);
+	game_type_t gameType = (atoi(argv[optind + 1])) ? MISERE : REGULAR;
+	const char * path = argv[optind + 2];
+	if (heapsCnt < 1 || heapsCnt > MAX_HEAPS || maxTake < 0) {
+		printf("Error: Number of heaps should be between 1 and %d and move bound should not be negative!\n", MAX_HEAPS);
+		return 1;
+	}
+	solver_table_t table;
+	long long startNs = nowNs();
+	errno = 0;
+	if (!solverOpen(&table, path, gameType, moveSet, heapsCnt, maxTake, maxHeap, threadsCnt)) {
+		printf("Error opening solver table %s: %s!\n", path, (errno == EEXIST) ? "not a table of the variant" : (errno != 0) ? strerror(errno) : "too many positions");
+		return 1;
+	}
+	double ms = (nowNs() - startNs) / 1e6;
+	short heaps[MAX_HEAPS] = { 0 };
+	int i;
+	for (i = 0; i < heapsCnt; i++) {
+		heaps[i] = maxHeap;
+	}
+	solver_result_t start = solverResult(&table, heaps);
+	printf("%s %s: max-heap=%d heaps=%d max-take=%d wythoff=%d misere=%d positions=%lld capacity=%lld threads=%d time=%.3fms start=%s\n", path, (table.loaded) ? "loaded" : "solved",
+			table.header->maxHeap, heapsCnt, maxTake, moveSet == MOVES_WYTHOFF, gameType == MISERE, table.header->solvedCnt, table.header->capacity, (table.loaded) ? 0 : threadsCnt, ms,
+			(start == SOLVER_WIN) ? "win" : (start == SOLVER_LOSS) ? "loss" : "unknown");
+	solverClose(&table);
+	return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* getopt(), usleep() */
+#include <sched.h> /* sched_yield() */
+#include <string.h> /* string functions */
+#include "snapshot.h"
+
+/* names of values published by the server, in order of transport.h enums */
+const char * gameTypeNames[] = { "MISERE", "REGULAR" };
+const char * clientStatusNames[] = { "PLAYING", "SPECTATOR", "YOUR_TURN", "UNKNOWN" };
+
+#define READ_ATTEMPTS 16 /* reads of slot, cpu is yielded to preempted server between them */
+#define NAME(names, i) (((unsigned) (i) < sizeof(names) / sizeof(names[0])) ? names[i] : "?")
+
+/**
+ * the function prints snapshot of game slot
+ **/
+void printSnapshot(int slot, const game_snapshot_t * snap) {
+	printf("game %d seq %u %s heaps", slot, snap->statusSeq, NAME(gameTypeNames, snap->gameType));
+	int i;
+	for (i = 0; i < snap->heapsCnt && i < SNAPSHOT_HEAPS; i++) {
+		printf(" %d", snap->heaps[i]);
+	}
+	if (snap->ended) {
+		printf(" ended");
+	} else if (snap->current != SNAPSHOT_NO_CLIENT) {
+		printf(" turn %d", snap->current);
+	}
+	printf(" roster");
+	for (i = 0; i < SNAPSHOT_ROSTER; i++) {
+		if (snap->roster[i] != SNAPSHOT_NO_CLIENT) {
+			printf(" %d:%s", i, NAME(clientStatusNames, snap->roster[i]));
+		}
+	}
+	printf("\n");
+}
+
+/* main function */
+int main(int argc, char *argv[]) {
+	int intervalMs = 0, gameFilter = -1;
+	int opt;
+	while ((opt = getopt(argc, argv, "i:g:")) != -1) {
+		switch (opt) {
+		case 'i': /* print snapshots again every interval, 0 - once */
+			intervalMs = atoi(optarg);
+			break;
+		case 'g': /* only game in this slot */
+			gameFilter = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-i interval-ms] [-g game] snapshot-file\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "Usage: %s [-i interval-ms] [-g game] snapshot-file\n", argv[0]);
+		return 1;
+	}
+	snapshot_map_t map;
+	if (!snapshotAttach(&map, argv[optind])) {
+		fprintf(stderr, "Error: %s is not game snapshot region of this version!\n", argv[optind]);
+		return 1;
+	}
+	do {
+		printf("server %d games", map.header->pid);
+		int running = 0;
+		int slot;
+		for (slot = 0; slot < map.header->slotsCnt; slot++) {
+			running += map.slots[slot].inUse;
+		}
+		printf(" %d\n", running);
+		for (slot = 0; slot < map.header->slotsCnt; slot++) {
+			game_snapshot_t snap;
+			if ((gameFilter != -1 && slot != gameFilter) || !map.slots[slot].inUse) {
+				continue;
+			}
+			int attempts, copied = 0;
+			for (attempts = 0; attempts < READ_ATTEMPTS && !copied; attempts++) {
+				if (!(copied = snapshotRead(&map, slot, &snap))) {
+					sched_yield();
+				}
+			}
+			if (!copied) {
+				printf("game %d busy\n", slot);
+			} else if (snap.inUse) {
+				printSnapshot(slot, &snap);
+			}
+		}
+		fflush(stdout);
+		if (intervalMs > 0) {
+			usleep(intervalMs * 1000);
+		}
+	} while (intervalMs > 0);
+	snapshotClose(&map);
+	return 0;
+}
@@ -11,15 +11,57 @@
 #include <string.h> /* string functions */
 #include <strings.h> /* string functions */
 #include "transport.h" /* common data with client */
+#include "latency.h" /* latency histograms */
+#include "rules.h" /* local validation of moves */
 #include <sys/select.h> /* select */
+#include <time.h> /* time() of address cache entries */
 
 #define LOCALHOST "127.0.0.1"
 #define DEFAULT_HOSTNAME LOCALHOST
 #define DEFAULT_PORT 6325
+#define PING_INTERVAL (5) /* seconds of silence before round trip probe is sent */
+#define RESUME_ATTEMPTS (5) /* reconnects tried after connection is lost */
+#define RESUME_DELAY_US (200000) /* delay before first reconnect, doubled for each next one */
+#define HOSTS_CACHE ".nim-hosts" /* addresses of server names resolved before, in home directory */
+#define HOSTS_CACHE_ENTRIES (32) /* names kept in the address cache */
+#define HOSTS_CACHE_TTL (3600) /* seconds cached address is used without resolving the name again */
+#define PENDING_MOVES (8) /* optimistic moves awaiting response of the server, later moves are not applied locally */
+#define JOIN_RETRY_SEC (1) /* seconds before JOIN shed by busy server is sent again */
+
+/**
+ * move applied locally before the server answered it
+ * moveSeq - sequence number the move was sent with
+ * heapIndex, amount - the move
+ * predicted - response expected by local validation, replaced by the response of the server
+ * answered - 1 once the server responded, the move is dropped when the status following the response is applied
+ **/
+typedef struct pending_move {
+	unsigned short moveSeq;
+	char heapIndex;
+	short amount;
+	turn_resp_t predicted;
+	int answered;
+} pending_move_t;
 
 int spect = 0; //if client is spectator
 int clID = 0; //client ID
 game_msg_t * INVALID_TURN_MSG;
+short heaps[MAX_HEAPS]; //heaps state kept locally, updated by status deltas
+unsigned int lastSeq = 0; //sequence number of the last status applied to heaps
+unsigned int pingSeq = 0; //number of the last ping sent
+unsigned long long sessionToken = 0; //token resuming the seat after reconnect, 0 if server doesn't hold seats
+int fastJoin = 0; //1 - join and resume requests ride in SYN by TCP Fast Open, welcome carries first status
+int optimistic = 0; //1 - moves are validated and shown locally before the server answers, server status reconciles them
+rules_t rules; //rules of the game the moves are validated by locally
+short shownHeaps[MAX_HEAPS]; //heaps shown to the user - heaps of the last status with pending moves applied
+int myTurn = 0; //1 - last status gave the turn to this client
+unsigned short moveSeq = 0; //sequence number of the last tagged move
+pending_move_t pendingMoves[PENDING_MOVES]; //moves applied locally, oldest first
+int pendingCnt = 0; //entries of pendingMoves
+latency_hist_t pingHist = { "client_ping_rtt" }; //ping round trip
+latency_hist_t moveHist = { "client_move_rtt" }; //move sent till its status received
+latency_hist_t residenceHist = { "client_server_residence" }; //move time spent in server
+latency_hist_t networkHist = { "client_network" }; //move round trip without server residence
 
 /**
  * the function prints states of the heaps in the heaps array
@@ -44,17 +86,152 @@ void processTurnResponse(turn_resp_t move) {
 	}
 }
 
+/**
+ * the function rebuilds shown heaps from heaps of the last status and pending moves expected to be legal
+ * returns 1 if shown heaps changed
+ **/
+int rebuildShownHeaps() {
+	short rebuilt[MAX_HEAPS];
+	memcpy(rebuilt, heaps, sizeof(rebuilt));
+	int i;
+	for (i = 0; i < pendingCnt; i++) {
+		pending_move_t * move = &pendingMoves[i];
+		if (move->predicted == LEGAL && rulesIsMoveValid(&rules, rebuilt, move->heapIndex, move->amount)) {
+			rebuilt[(int) move->heapIndex] -= move->amount;
+		}
+	}
+	int changed = memcmp(rebuilt, shownHeaps, sizeof(rebuilt)) != 0;
+	memcpy(shownHeaps, rebuilt, sizeof(rebuilt));
+	return changed;
+}
+
+/**
+ * the function forgets pending moves, their responses are lost with the connection or the game
+ **/
+void resetPendingMoves() {
+	pendingCnt = 0;
+	rebuildShownHeaps();
+}
+
+/**
+ * the function validates the move against shown heaps by the rules of the server and shows the expected
+ * response and heaps at once, the move is tagged so its response can be matched
+ * move sent when too many moves are pending is left to the server
+ **/
+void applyOptimisticMove(turn_req_t * move) {
+	if (pendingCnt == PENDING_MOVES) {
+		move->moveSeq = 0;
+		return;
+	}
+	pending_move_t * pending = &pendingMoves[pendingCnt++];
+	move->moveSeq = ++moveSeq;
+	if (moveSeq == 0) { /* 0 marks untagged move */
+		move->moveSeq = ++moveSeq;
+	}
+	pending->moveSeq = move->moveSeq;
+	pending->heapIndex = move->heapIndex;
+	pending->amount = move->amount;
+	pending->answered = 0;
+	if (!myTurn) {
+		pending->predicted = NOT_YOUR_TURN;
+	} else {
+		pending->predicted = (rulesIsMoveValid(&rules, shownHeaps, move->heapIndex, move->amount)) ? LEGAL : ILLEGAL;
+		myTurn = 0; /* illegal move loses the turn as well */
+	}
+	processTurnResponse(pending->predicted);
+	if (rebuildShownHeaps()) {
+		printHeapState(shownHeaps);
+	}
+}
+
+/**
+ * the function processes turn response of the server, response to optimistic move is matched by its sequence number
+ * and the move is rolled back or applied if the server decided otherwise than local validation
+ **/
+void processTurnResult(const turn_result_t * result) {
+	int i;
+	for (i = 0; i < pendingCnt && pendingMoves[i].moveSeq != result->moveSeq; i++) {
+	}
+	if (result->moveSeq == 0 || i == pendingCnt) { /* move was not applied locally */
+		processTurnResponse(result->resp);
+		return;
+	}
+	pending_move_t * pending = &pendingMoves[i];
+	if (pending->predicted != result->resp) {
+		printf("Server corrected the move: ");
+		processTurnResponse(result->resp);
+		if (pending->predicted == NOT_YOUR_TURN) { /* the move was made - status of the server gives the next turn */
+			myTurn = 0;
+		}
+	}
+	pending->predicted = result->resp;
+	pending->answered = 1;
+	if (result->resp == NOT_YOUR_TURN) { /* no status follows the move, it is forgotten at once */
+		memmove(pending, pending + 1, (pendingCnt - i - 1) * sizeof(pending_move_t));
+		pendingCnt--;
+	}
+	if (rebuildShownHeaps()) {
+		printHeapState(shownHeaps);
+	}
+}
+
+/**
+ * the function prints analysis received from server, winning moves are printed as move input
+ **/
+void printAnalysis(const analysis_t * analysis) {
+	const short * heap = analysis->heapStatus.heap;
+	printf("Position %d, %d, %d, %d (%s) is ", heap[0], heap[1], heap[2], heap[3], (analysis->gameType == MISERE) ? "misere" : "regular");
+	if (analysis->value == VALUE_WIN) {
+		printf("winning:");
+		int i;
+		for (i = 0; i < analysis->movesCnt && i < MAX_WINNING_MOVES; i++) {
+			printf(" %c %d", 'A' + analysis->moves[i].heapIndex, analysis->moves[i].amount);
+		}
+		printf("\n");
+	} else if (analysis->value == VALUE_LOSS) {
+		printf("losing\n");
+	} else {
+		printf("not analyzed\n");
+	}
+}
+
+/**
+ * the function records timestamps of the move returned in timed status
+ **/
+void recordMoveTiming(const move_timing_t * timing) {
+	long long rtt = nowNs() - timing->clientSentNs;
+	histRecord(&moveHist, rtt);
+	histRecord(&residenceHist, timing->residenceNs);
+	histRecord(&networkHist, rtt - timing->residenceNs);
+}
+
+/**
+ * the function prints client latency histograms
+ **/
+void printLatency() {
+	histPrint(stdout, &pingHist);
+	histPrint(stdout, &moveHist);
+	histPrint(stdout, &residenceHist);
+	histPrint(stdout, &networkHist);
+}
+
 /**
  * the function gets input from user
  * it checks for valid structure of the input
  * returns message with user input - can be chat or move
  * if user entered Q - sets doExit to 1
+ * if user entered STATS - prints latency and sets isLocal to 1
+ * ANALYZE [m|r [heaps]] asks for analysis of current heaps or of given position
  * returns NULL on invalid input
  **/
-game_msg_t * getPlayerInput(int * doExit) {
+game_msg_t * getPlayerInput(int * doExit, int * isLocal) {
 	game_msg_t* out;
 	char line[1024], line2[1024];
-	fgets(line, sizeof(line), stdin);
+	*isLocal = 0;
+	if (fgets(line, sizeof(line), stdin) == NULL) { /* end of input - same as Q */
+		*doExit = 1;
+		return NULL;
+	}
 	/* check if it is message */
 	if (strstr(line, "MSG ") == line) {
 		*doExit = 0;
@@ -70,7 +247,7 @@ game_msg_t * getPlayerInput(int * doExit) {
 			text[strlen(text)-1]='\0';
 		}
 		/* if it is message */
-		out = (game_msg_t *) malloc(sizeof(game_msg_t));
+		out = (game_msg_t *) calloc(1, sizeof(game_msg_t));
 		out->type = CHAT;
 		out->payload.chat.dstId = clientId;
 		strcpy(out->payload.chat.text, text);
@@ -81,6 +258,32 @@ game_msg_t * getPlayerInput(int * doExit) {
 		*doExit=1;
 		return NULL;
 	}
+	/* user asked for latency statistics */
+	else if(!strcmp(line,"STATS")||!strcmp(line,"STATS\n")) {
+		*doExit=0;
+		*isLocal=1;
+		printLatency();
+		return NULL;
+	}
+	/* user asked for analysis of current heaps or of given position */
+	else if (strstr(line, "ANALYZE") == line) {
+		*doExit = 0;
+		char type;
+		int heap[MAX_HEAPS] = { 0 };
+		int fields = sscanf(line, "ANALYZE %c %d %d %d %d", &type, &heap[0], &heap[1], &heap[2], &heap[3]);
+		if (fields >= 1 && type != 'm' && type != 'r') {
+			return NULL;
+		}
+		out = (game_msg_t *) malloc(sizeof(game_msg_t));
+		memset(out, 0, sizeof(game_msg_t));
+		out->type = ANALYZE;
+		out->payload.analyze.gameType = (fields < 1) ? -1 : (type == 'm') ? MISERE : REGULAR;
+		out->payload.analyze.current = (fields <= 1);
+		int i;
+		for (i = 0; i < MAX_HEAPS; i++) {
+			out->payload.analyze.heapStatus.heap[i] = heap[i];
+		}
+	}
 	/* if it is not a message */
 	else {
 		*doExit=0;
@@ -91,70 +294,393 @@ game_msg_t * getPlayerInput(int * doExit) {
 		if (strstr(line, line2) != line) {
 			return NULL;
 		}
-		out = (game_msg_t *) malloc(sizeof(game_msg_t));
+		out = (game_msg_t *) calloc(1, sizeof(game_msg_t));
 		out->type = TURN_REQ;
 		out->payload.turnReq.heapIndex = (heap) - 'A';
 		out->payload.turnReq.amount = cubes;
+		out->payload.turnReq.clientSentNs = 0;
 	}
 	return out;
 }
 
+/**
+ * the function opens UDP socket for status datagrams of the server, connected to the server address
+ * so datagrams of other senders are dropped by the kernel
+ * returns -1 on error
+ **/
+int openStatusSocket(struct sockaddr_in * serverAddress) {
+	struct sockaddr_in address;
+	int sock_d = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock_d == -1) {
+		return -1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = INADDR_ANY;
+	address.sin_port = 0; /* any free port, sent to the server in join request */
+	if (bind(sock_d, (struct sockaddr *) &address, sizeof(address)) == -1 || connect(sock_d, (struct sockaddr *) serverAddress, sizeof(*serverAddress)) == -1) {
+		close(sock_d);
+		return -1;
+	}
+	return sock_d;
+}
+
+/**
+ * the function returns path of the address cache in home directory, NULL if there is no home
+ **/
+const char * hostsCachePath(char * path, size_t size) {
+	const char * home = getenv("HOME");
+	if (home == NULL || snprintf(path, size, "%s/" HOSTS_CACHE, home) >= size) {
+		return NULL;
+	}
+	return path;
+}
+
+/**
+ * the function resolves server name to address, numeric address is not resolved
+ * name resolved less than HOSTS_CACHE_TTL seconds ago is taken from the address cache if useCache is set,
+ * resolved name is stored in the cache so next client starts without waiting for the resolver
+ * returns 0 if no server with such a name exists
+ **/
+int resolveServer(const char * host, struct in_addr * address, int useCache) {
+	if (inet_aton(host, address)) {
+		return 1;
+	}
+	char path[512], names[HOSTS_CACHE_ENTRIES][256];
+	struct in_addr addresses[HOSTS_CACHE_ENTRIES];
+	long resolvedAt[HOSTS_CACHE_ENTRIES];
+	int entriesCnt = 0, i;
+	FILE * cache = (hostsCachePath(path, sizeof(path)) != NULL) ? fopen(path, "r") : NULL;
+	if (cache != NULL) {
+		char addressText[INET_ADDRSTRLEN];
+		while (entriesCnt < HOSTS_CACHE_ENTRIES && fscanf(cache, "%255s %15s %ld", names[entriesCnt], addressText, &resolvedAt[entriesCnt]) == 3) {
+			if (inet_aton(addressText, &addresses[entriesCnt])) {
+				entriesCnt++;
+			}
+		}
+		fclose(cache);
+	}
+	for (i = 0; i < entriesCnt && strcmp(names[i], host) != 0; i++) {
+	}
+	if (useCache && i < entriesCnt && time(NULL) - resolvedAt[i] < HOSTS_CACHE_TTL) {
+		*address = addresses[i];
+		return 1;
+	}
+	struct hostent * server = gethostbyname(host);
+	if (server == NULL || server->h_addrtype != AF_INET) {
+		return 0;
+	}
+	memcpy(address, server->h_addr, sizeof(*address));
+	if (i == entriesCnt) { /* new name replaces the oldest entry if the cache is full */
+		if (entriesCnt == HOSTS_CACHE_ENTRIES) {
+			memmove(names, names + 1, sizeof(names[0]) * (HOSTS_CACHE_ENTRIES - 1));
+			memmove(addresses, addresses + 1, sizeof(addresses[0]) * (HOSTS_CACHE_ENTRIES - 1));
+			memmove(resolvedAt, resolvedAt + 1, sizeof(resolvedAt[0]) * (HOSTS_CACHE_ENTRIES - 1));
+			i--;
+		}
+		snprintf(names[i], sizeof(names[i]), "%s", host);
+		entriesCnt = i + 1;
+	}
+	addresses[i] = *address;
+	resolvedAt[i] = time(NULL);
+	if (strlen(host) < sizeof(names[0]) && strchr(host, ' ') == NULL && (cache = (hostsCachePath(path, sizeof(path)) != NULL) ? fopen(path, "w") : NULL) != NULL) {
+		for (i = 0; i < entriesCnt; i++) {
+			fprintf(cache, "%s %s %ld\n", names[i], inet_ntoa(addresses[i]), resolvedAt[i]);
+		}
+		fclose(cache);
+	}
+	return 1;
+}
+
+/**
+ * the function connects socket to the server and sends the first message of the connection,
+ * with fast join the message is sent with SYN by TCP Fast Open, so the server gets it after one trip,
+ * kernel without fast open cookie for the server falls back to plain handshake by itself
+ * returns 0 on error
+ **/
+int connectServer(int sock_d, struct sockaddr_in * serverAddress, game_msg_t * first) {
+	if (fastJoin) {
+		char frame[MAX_FRAME_SIZE];
+		size_t frameSize = encodeFrame(first, frame, sizeof(frame));
+		ssize_t sent = sendto(sock_d, frame, frameSize, MSG_FASTOPEN, (struct sockaddr *) serverAddress, sizeof(*serverAddress));
+		if (sent == frameSize) {
+			return 1;
+		}
+		if (sent > 0) { /* rest of the frame follows the handshake */
+			return sendSafe(sock_d, frame + sent, frameSize - sent) == frameSize - sent;
+		}
+		if (errno != EOPNOTSUPP) {
+			return 0;
+		}
+	}
+	if (connect(sock_d, (struct sockaddr *) serverAddress, sizeof(*serverAddress)) == -1) {
+		return 0;
+	}
+	return sendMessage(sock_d, first);
+}
+
+/**
+ * the function prints welcome message data and keeps client ID, status and session token
+ **/
+void processWelcome(const welcome_msg_t * welcome) {
+	printf("This is a %s game\n", (welcome->gameType == MISERE) ? "Misere" : "Regular"); /* print game type */
+	printf("Number of players is %d\n", welcome->playersCnt); /* print number of players */
+	printf("You are client %d\n", welcome->clientId + 1); /* print client ID */
+	clID = welcome->clientId + 1;
+	sessionToken = welcome->sessionToken;
+	/* heaps out of play are empty, so all heaps are validated */
+	initRules(&rules, welcome->gameType, MOVES_ONE_HEAP, MAX_HEAPS, welcome->maxTake);
+	if (welcome->rating != 0) {
+		printf("Your rating is %d\n", welcome->rating);
+	}
+	if (welcome->clientStatus != SPECTATOR) { /* print client status */
+		printf("You are playing\n");
+	} else {
+		printf("You are only viewing\n");
+		spect = 1; /* this client is spectator */
+	}
+}
+
+/**
+ * the function receives welcome of the next game, tournament entrant gets standings meanwhile
+ * returns NULL if connection is lost or tournament is over, isOver is set in the latter case
+ **/
+game_msg_t * receiveWelcome(int clienSocket, int * isOver) {
+	while (1) {
+		game_msg_t * msg = receiveMessage(clienSocket);
+		if (msg == NULL || msg->type == WELCOME) {
+			return msg;
+		}
+		if (msg->type == STANDING) {
+			standing_t * standing = &msg->payload.standing;
+			printf("Round %d of %d: place %d of %d with %d points", standing->round, standing->rounds, standing->place, standing->entrants, standing->points);
+			if (standing->rating != 0) {
+				printf(", rating %d", standing->rating);
+			}
+			printf("\n");
+			if (standing->round >= standing->rounds) {
+				printf("Tournament over\n");
+				*isOver = 1;
+				destroyMsg(&msg);
+				return NULL;
+			}
+		}
+		destroyMsg(&msg);
+	}
+}
+
+/**
+ * the function reconnects to the server and asks for the seat of the session
+ * client whose seat was released is welcomed as new client
+ * returns socket of the new connection or -1 if server can't be reached or rejected the client
+ **/
+int resumeSession(struct sockaddr_in * serverAddress, int lowLatency, int busyPollUs) {
+	int attempt;
+	for (attempt = 0; attempt < RESUME_ATTEMPTS; attempt++) {
+		usleep(RESUME_DELAY_US << attempt);
+		int sock_d = socket(AF_INET, SOCK_STREAM, 0);
+		if (sock_d == -1) {
+			return -1;
+		}
+		if (lowLatency && !setLowLatency(sock_d, busyPollUs)) {
+			printf("Error setting low latency options: %s!\n", strerror(errno));
+		}
+		payload_t resumePl;
+		memset(&resumePl, 0, sizeof(payload_t));
+		resumePl.resume.sessionToken = sessionToken;
+		resumePl.resume.lastSeq = lastSeq;
+		game_msg_t* resumeMsg = createMessage(RESUME, resumePl);
+		int sent = connectServer(sock_d, serverAddress, resumeMsg);
+		destroyMsg(&resumeMsg);
+		game_msg_t* welcome = (sent) ? receiveMessage(sock_d) : NULL;
+		if (welcome != NULL && welcome->type == WELCOME && (welcome->payload.welcomeMsg.flags & WELCOME_PROVISIONAL)) {
+			/* server placed the connection before RESUME arrived - another WELCOME answers it */
+			do {
+				destroyMsg(&welcome);
+				welcome = receiveMessage(sock_d);
+			} while (welcome != NULL && welcome->type != WELCOME);
+		}
+		if (welcome == NULL || welcome->type != WELCOME) {
+			destroyMsg(&welcome);
+			close(sock_d);
+			continue;
+		}
+		if (welcome->payload.welcomeMsg.gameType == REJECTED) {
+			printf("Client rejected: too many clients are already connected\n");
+			destroyMsg(&welcome);
+			close(sock_d);
+			return -1;
+		}
+		if (welcome->payload.welcomeMsg.clientId + 1 == clID && welcome->payload.welcomeMsg.sessionToken == sessionToken) {
+			printf("Reconnected as client %d\n", clID);
+			myTurn = welcome->payload.welcomeMsg.clientStatus == YOUR_TURN;
+			if (welcome->payload.welcomeMsg.clientStatus == YOUR_TURN) {
+				printHeapState(heaps);
+				printf("Your turn:\n");
+			}
+		} else { /* seat was released - heaps come in keyframe of the new seat */
+			printf("Seat was lost, joined again\n");
+			lastSeq = 0;
+			processWelcome(&welcome->payload.welcomeMsg);
+		}
+		destroyMsg(&welcome);
+		return sock_d;
+	}
+	return -1;
+}
+
+/**
+ * the function applies status received from the server to the heaps and prints them,
+ * keyframe is requested if the status does not follow the last one applied
+ * returns -1 if the request could not be sent, 1 if the game ended and winner is set, 0 otherwise
+ **/
+int processStatus(int clienSocket, const status_t * status, end_game_t * winner) {
+	if (lastSeq != 0 && status->seq <= lastSeq) {
+		/* late datagram or keyframe - newer state is already applied */
+		return 0;
+	}
+	if (status->flags & STATUS_TIMED) {
+		recordMoveTiming(&status->timing);
+	}
+	if (!applyStatus(heaps, &lastSeq, status)) {
+		/* gap in status sequence - heaps are stale until keyframe arrives */
+		game_msg_t keyframeReq;
+		memset(&keyframeReq, 0, sizeof(game_msg_t));
+		keyframeReq.type = STATUS_REQ;
+		return (sendMessage(clienSocket, &keyframeReq)) ? 0 : -1;
+	}
+	myTurn = status->clientStatus == YOUR_TURN;
+	if (optimistic) { /* answered moves are in the status, heaps already shown are not printed again */
+		int i, kept = 0;
+		for (i = 0; i < pendingCnt; i++) {
+			if (!pendingMoves[i].answered) {
+				pendingMoves[kept++] = pendingMoves[i];
+			}
+		}
+		pendingCnt = kept;
+		if (rebuildShownHeaps() || myTurn) {
+			printHeapState(shownHeaps);
+		}
+	} else {
+		printHeapState(heaps);
+	}
+	/* this client was spectator */
+	if (spect == 1 && status->clientStatus != SPECTATOR && status->endGame == NOT_FINISHED) {
+		printf("You are now playing!\n");
+		spect = 0; /* now playing */
+	}
+	if (status->clientStatus == YOUR_TURN) {
+		printf("Your turn:\n");
+	} else if (status->endGame != NOT_FINISHED) {
+		*winner = status->endGame;
+		return 1;
+	}
+	return 0;
+}
+
 /**
  * the function executes the client part of the game
- * checks if stdin or server socket ready and act accordingly
+ * checks if stdin, server socket or status datagram socket ready and act accordingly
+ * introStatus - first status keyframe merged into welcome, NULL if it comes as STATUS
  * returns 0 if there are any errors
  * returns 1 on success, when game finished and the winner defined
  * returns 2 if user asked to quit
  **/
-int runGameClient(int clienSocket, end_game_t * winner) {
+int runGameClient(int clienSocket, int statusSocket, const status_t * introStatus, end_game_t * winner) {
 	fd_set readSet; /* set of read-ready socket file descriptors for select */
 	fd_set writeSet; /* set of read-ready socket file descriptors for select */
 	FD_ZERO(&readSet); /* initialize set of read-ready sockets */
 	FD_ZERO(&writeSet); /* initialize set of write-ready sockets */
+	resetPendingMoves();
+	if (introStatus != NULL) {
+		int introResult = processStatus(clienSocket, introStatus, winner);
+		if (introResult == -1) {
+			printf("Error in sending message!\n");
+			return 0;
+		}
+		if (introResult == 1) {
+			return 1;
+		}
+	}
 	/* game cycle */
 	while (1) {
 		int highSD = clienSocket; /* highest socket descriptor */
 		FD_SET(clienSocket, &readSet); /* add clienSocket socket to read-ready set */
 		FD_SET(0, &readSet); /* add stdin to read-ready set */
+		if (statusSocket != -1) { /* statuses while watching come as datagrams */
+			FD_SET(statusSocket, &readSet);
+			if (statusSocket > highSD) {
+				highSD = statusSocket;
+			}
+		}
 		/* Number of sockets ready for reading */
-		select(highSD + 1, &readSet, (fd_set *) 0, (fd_set *) 0, NULL);
+		struct timeval pingTimeout = { PING_INTERVAL, 0 };
+		int ready = select(highSD + 1, &readSet, (fd_set *) 0, (fd_set *) 0, &pingTimeout);
+		if (ready == 0) { /* nothing happened - probe round trip to the server */
+			game_msg_t ping;
+			memset(&ping, 0, sizeof(game_msg_t));
+			ping.type = PING;
+			ping.payload.ping.seq = ++pingSeq;
+			ping.payload.ping.sentNs = nowNs();
+			if (!sendMessage(clienSocket, &ping)) {
+				printf("Error in sending message!\n");
+				return 0;
+			}
+			continue;
+		}
+		game_msg_t* resp = NULL;
 		/* clienSocket socket is read-ready - new message is available */
 		if (FD_ISSET(clienSocket, &readSet)) {
-			game_msg_t* resp = receiveMessage(clienSocket);
+			resp = receiveMessage(clienSocket);
 			if (resp == NULL) {
 				printf("Error in receiving message!\n");
 				//die("receiveMessage");
 				return 0;
 			}
+		} else if (statusSocket != -1 && FD_ISSET(statusSocket, &readSet)) { /* invalid datagram is dropped */
+			resp = receiveDatagram(statusSocket);
+		}
+		if (resp != NULL) {
 			if (resp->type == TURN_RESP) {
-				processTurnResponse(resp->payload.turnResp);
+				processTurnResult(&resp->payload.turnResp);
 			} else if (resp->type == CHAT) {
 				printf("%d: %s\n", resp->payload.chat.srcId, resp->payload.chat.text);
+			} else if (resp->type == PONG) {
+				histRecord(&pingHist, nowNs() - resp->payload.ping.sentNs);
+			} else if (resp->type == ANALYSIS) {
+				printAnalysis(&resp->payload.analysis);
 			} else if (resp->type == STATUS) {
-				printHeapState(resp->payload.status.heapStatus.heap);
-				/* this client was spectator */
-				if (spect == 1 && resp->payload.status.clientStatus != SPECTATOR && resp->payload.status.endGame == NOT_FINISHED) {
-					printf("You are now playing!\n");
-					spect = 0; /* now playing */
+				int statusResult = processStatus(clienSocket, &resp->payload.status, winner);
+				destroyMsg(&resp);
+				if (statusResult == -1) {
+					printf("Error in sending message!\n");
+					return 0;
 				}
-				if (resp->payload.status.clientStatus == YOUR_TURN) {
-					printf("Your turn:\n");
-				} else if (resp->payload.status.endGame != NOT_FINISHED) {
-					*winner = resp->payload.status.endGame;
+				if (statusResult == 1) {
 					return 1;
 				}
-				destroyMsg(&resp);
 			}
 		}
 		/* stdin is read-ready - new input is available */
 		if (FD_ISSET(0, &readSet)) {
 			int doExit = 0;
+			int isLocal = 0;
 			game_msg_t * msg;
-			msg = getPlayerInput(&doExit);
+			msg = getPlayerInput(&doExit, &isLocal);
 			if (doExit) {
 				return 2;
 			}
-			if (!sendMessage(clienSocket, (msg != NULL) ? msg : INVALID_TURN_MSG)) {
+			if (isLocal) {
+				continue;
+			}
+			game_msg_t * toSend = (msg != NULL) ? msg : INVALID_TURN_MSG;
+			if (toSend->type == TURN_REQ) {
+				toSend->payload.turnReq.clientSentNs = nowNs();
+				if (optimistic) {
+					applyOptimisticMove(&toSend->payload.turnReq);
+				}
+			}
+			if (!sendMessage(clienSocket, toSend)) {
 				printf("Error in sending message!\n");
 				//die("sendTurnMessage");
 				return 0;
@@ -170,7 +696,63 @@ int main(int argc, char *argv[]) {
 	int port = DEFAULT_PORT; /* default port */
 	char *inetAddr = LOCALHOST; /* default address */
 	struct sockaddr_in server_address; /* structure for socket parameters */
-	struct hostent *server; /* defines a host computer on the Internet */
+	payload_t joinPl; /* game client asks lobby for, defaults of the server */
+	memset(&joinPl, 0, sizeof(payload_t));
+	joinPl.join.gameType = -1;
+	int lowLatency = 0; /* 1 - TCP_NODELAY on server socket */
+	int busyPollUs = 0; /* microseconds the kernel busy polls before read sleeps */
+	int useDatagrams = 0; /* 1 - statuses while watching come as datagrams */
+	int statusSocket = -1; /* UDP socket of status datagrams */
+	int isOver = 0; /* 1 - tournament ended */
+	/* check for options received in the command line */
+	int opt;
+	while ((opt = getopt(argc, argv, "g:p:sdLFob:a:i:T")) != -1) {
+		switch (opt) {
+		case 'g': /* game type - m for misere, r for regular */
+			joinPl.join.gameType = (optarg[0] == 'm') ? MISERE : REGULAR;
+			break;
+		case 'p': /* number of players */
+			joinPl.join.playersCnt = atoi(optarg);
+			break;
+		case 's': /* watch the game */
+			joinPl.join.spectate = 1;
+			break;
+		case 'i': /* player ID the player is rated by */
+			joinPl.join.playerId = strtoul(optarg, NULL, 10);
+			break;
+		case 'T': /* enter tournament - games follow each other until the last round */
+			joinPl.join.tournament = 1;
+			break;
+		case 'd': /* statuses as datagrams while watching */
+			useDatagrams = 1;
+			break;
+		case 'L': /* low latency - TCP_NODELAY */
+			lowLatency = 1;
+			break;
+		case 'F': /* fast join - TCP Fast Open, welcome merged with first status, cached server address */
+			fastJoin = 1;
+			joinPl.join.fastJoin = 1;
+			break;
+		case 'o': /* optimistic moves - shown before the server answers, rolled back if it rejects them */
+			optimistic = 1;
+			break;
+		case 'b': /* busy polling, implies low latency */
+			busyPollUs = atoi(optarg);
+			lowLatency = 1;
+			break;
+		case 'a': /* pin client to cpu */
+			if (pinCpu(atoi(optarg)) == -1) {
+				printf("Error pinning to cpu %s: %s!\n", optarg, strerror(errno));
+				return 1;
+			}
+			break;
+		default:
+			printf("Usage: %s [-g m|r] [-p players] [-s] [-d] [-L] [-F] [-o] [-b busy-poll-usec] [-a cpu] [-i player-id] [-T] [host [port]]\n", argv[0]);
+			return 1;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
 	/* check for arguments received in the command line */
 	if (argc == 1 || argc == 2 || argc == 3) { /* if there are 0, 1 or 2 command line arguments */
 		if (argc == 2) { /* host name received */
@@ -189,24 +771,58 @@ int main(int argc, char *argv[]) {
 		printf("Error creating socket: %s!\n", strerror(errno));
 		return errno; //exit on error
 	}
-	/* returns a pointer to a structure w/ an information about host */
-	if ((server = gethostbyname(inetAddr)) == NULL) {
+	bzero((char *) &server_address, sizeof(server_address));
+	server_address.sin_family = AF_INET; /* code for the address family, always set to the AF_INET */
+	/* fast join takes address resolved before from the cache */
+	if (!resolveServer(inetAddr, &server_address.sin_addr, fastJoin)) {
 		printf("Error: No server with such a name exists!\n");
 		return 1; //exit on error
 	}
-
-	bzero((char *) &server_address, sizeof(server_address));
-	server_address.sin_family = AF_INET; /* code for the address family, always set to the AF_INET */
-	bcopy((char *) server->h_addr, (char *)&server_address.sin_addr.s_addr, server->h_length);
 	server_address.sin_port = htons(port); /* set default port */
-	/* connect to the server */
-	if (connect(clienSocket, (struct sockaddr *) &server_address, sizeof(server_address))) { /* connect from socket w/ file descriptor socket to socket w/ address specified by address and length arguments */
-		printf("Error connection to server: %s!\n", strerror(errno));
+	if (lowLatency && !setLowLatency(clienSocket, busyPollUs)) {
+		printf("Error setting low latency options: %s!\n", strerror(errno));
 		return errno; //exit on error
 	}
-	/* receive message from server */
-	game_msg_t* gameType = receiveMessage(clienSocket);
-	if (gameType != NULL) {
+	if (useDatagrams) { /* server without datagrams keeps sending statuses over TCP */
+		struct sockaddr_in statusAddress;
+		socklen_t statusAddressLen = sizeof(statusAddress);
+		if ((statusSocket = openStatusSocket(&server_address)) == -1 || getsockname(statusSocket, (struct sockaddr *) &statusAddress, &statusAddressLen) == -1) {
+			printf("Error opening status datagram socket: %s!\n", strerror(errno));
+			return 1; //exit on error
+		}
+		joinPl.join.udpPort = statusAddress.sin_port;
+	}
+	/* connect and ask lobby for a game and for status datagrams, single game server ignores game request */
+	game_msg_t* joinMsg = createMessage(JOIN, joinPl);
+	if (!connectServer(clienSocket, &server_address, joinMsg)) {
+		struct in_addr cachedAddr = server_address.sin_addr;
+		/* cached address may be stale - name is resolved again */
+		if (!fastJoin || !resolveServer(inetAddr, &server_address.sin_addr, 0) || server_address.sin_addr.s_addr == cachedAddr.s_addr
+				|| close(clienSocket) == -1 || (clienSocket = socket(AF_INET, SOCK_STREAM, 0)) == -1 || !connectServer(clienSocket, &server_address, joinMsg)) {
+			printf("Error connection to server: %s!\n", strerror(errno));
+			return errno; //exit on error
+		}
+	}
+	/* create invalid turn message */
+	INVALID_TURN_MSG = (game_msg_t *) calloc(1, sizeof(game_msg_t));
+	INVALID_TURN_MSG->type = TURN_REQ;
+	INVALID_TURN_MSG->payload.turnReq.heapIndex = 'Z';
+	INVALID_TURN_MSG->payload.turnReq.amount = -1;
+	/* receive message from server, tournament entrant plays games until the tournament is over */
+	game_msg_t* gameType = receiveWelcome(clienSocket, &isOver);
+	while (gameType != NULL && gameType->payload.welcomeMsg.gameType == REJECTED && (gameType->payload.welcomeMsg.flags & WELCOME_RETRY)) {
+		printf("Server is busy, joining again in %d s\n", JOIN_RETRY_SEC);
+		destroyMsg(&gameType);
+		sleep(JOIN_RETRY_SEC);
+		if (sendMessage(clienSocket, joinMsg)) {
+			gameType = receiveWelcome(clienSocket, &isOver);
+		}
+	}
+	destroyMsg(&joinMsg);
+	if (gameType == NULL && !isOver) {
+		printf("Disconnected from server\n");
+	}
+	while (gameType != NULL) {
 		assert(gameType->type == WELCOME);
 		//if connected rejected by server
 		if (gameType->payload.welcomeMsg.gameType == REJECTED) {
@@ -218,24 +834,30 @@ int main(int argc, char *argv[]) {
 			return 1; //exit after connection reject
 		}
 		/* print welcome message data */
-		printf("This is a %s game\n", (gameType->payload.welcomeMsg.gameType == MISERE) ? "Misere" : "Regular"); /* print game type */
-		printf("Number of players is %d\n", gameType->payload.welcomeMsg.playersCnt); /* print number of players */
-		printf("You are client %d\n", gameType->payload.welcomeMsg.clientId + 1); /* print client ID */
-		clID=gameType->payload.welcomeMsg.clientId + 1;
-		if (gameType->payload.welcomeMsg.clientStatus == PLAYING) { /* print client status */
-			printf("You are playing\n");
-		} else {
-			printf("You are only viewing\n");
-			spect = 1; /* this client is spectator */
-		}
-		/* create invalid turn message */
-		INVALID_TURN_MSG = (game_msg_t *) malloc(sizeof(game_msg_t));
-		INVALID_TURN_MSG->type = TURN_REQ;
-		INVALID_TURN_MSG->payload.turnReq.heapIndex = 'Z';
-		INVALID_TURN_MSG->payload.turnReq.amount = -1;
+		processWelcome(&gameType->payload.welcomeMsg);
+		status_t introStatus; /* first status keyframe if welcome carries it */
+		const welcome_msg_t * welcome = &gameType->payload.welcomeMsg;
+		memset(&introStatus, 0, sizeof(introStatus));
+		introStatus.seq = welcome->statusSeq;
+		introStatus.clientStatus = welcome->clientStatus;
+		introStatus.endGame = welcome->endGame;
+		introStatus.flags = STATUS_KEYFRAME;
+		introStatus.heapStatus = welcome->heapStatus;
+		int hasIntroStatus = (welcome->flags & WELCOME_STATUS) != 0;
+		destroyMsg(&gameType);
 		/* check winner */
 		end_game_t winner;
-		int result = runGameClient(clienSocket, &winner);
+		int result = runGameClient(clienSocket, statusSocket, (hasIntroStatus) ? &introStatus : NULL, &winner);
+		while (result == 0 && sessionToken != 0) { /* server holds the seat - reconnect and take it back */
+			printf("Connection lost, resuming session\n");
+			int resumedSocket = resumeSession(&server_address, lowLatency, busyPollUs);
+			if (resumedSocket == -1) {
+				break;
+			}
+			close(clienSocket);
+			clienSocket = resumedSocket;
+			result = runGameClient(clienSocket, statusSocket, NULL, &winner);
+		}
 		switch (result) {
 		case (0):
 			printf("Disconnected from server\n");
@@ -259,8 +881,17 @@ int main(int argc, char *argv[]) {
 			/*on quit dies silently*/
 			break;
 		}
-	} else {
-		printf("Disconnected from server\n");
+		if (result != 1 || !joinPl.join.tournament) {
+			break;
+		}
+		/* next game of the tournament starts from its own keyframe */
+		lastSeq = 0;
+		spect = 0;
+		memset(heaps, 0, sizeof(heaps));
+		gameType = receiveWelcome(clienSocket, &isOver);
+		if (gameType == NULL && !isOver) {
+			printf("Disconnected from server\n");
+		}
 	}
 	destroyMsg(&INVALID_TURN_MSG);
 	/* close client's socket */
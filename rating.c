@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* read(), close(), ftruncate() */
+#include <fcntl.h> /* open() */
+#include <string.h> /* memset() */
+#include <math.h> /* sqrt(), pow() */
+#include <sys/mman.h> /* mmap() */
+#include <sys/stat.h> /* fstat() */
+#include "latency.h" /* nowNs() */
+#include "rating.h"
+
+#define RATING_Q (0.0057565f) /* ln(10) / 400 */
+#define RATING_PI (3.14159265f)
+
+/**
+ * the function returns Glicko weight of opponent's rating deviation
+ **/
+float ratingWeight(float rd) {
+	return 1.0f / sqrtf(1.0f + 3.0f * RATING_Q * RATING_Q * rd * rd / (RATING_PI * RATING_PI));
+}
+
+/**
+ * the function returns expected score of player against opponent
+ **/
+float ratingExpected(float rating, float opponentRating, float opponentWeight) {
+	return 1.0f / (1.0f + powf(10.0f, -opponentWeight * (rating - opponentRating) / 400.0f));
+}
+
+/**
+ * the function maps ratings table from file, table of other version or size is created again,
+ * path NULL maps table in anonymous memory
+ * returns 0 on error
+ **/
+int ratingOpen(rating_table_t * table, const char * path) {
+	memset(table, 0, sizeof(rating_table_t));
+	size_t mapSize = sizeof(rating_header_t) + RATING_CAPACITY * sizeof(rating_entry_t);
+	int loaded = 0;
+	int fd = -1;
+	if (path != NULL) {
+		rating_header_t header;
+		struct stat fileStat;
+		if ((fd = open(path, O_RDWR | O_CREAT, 0644)) == -1) {
+			return 0;
+		}
+		if (read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == RATING_MAGIC && header.version == RATING_VERSION && header.capacity > 0
+				&& (header.capacity & (header.capacity - 1)) == 0 && fstat(fd, &fileStat) == 0
+				&& fileStat.st_size == sizeof(rating_header_t) + header.capacity * sizeof(rating_entry_t)) {
+			mapSize = fileStat.st_size;
+			loaded = 1;
+		} else if (ftruncate(fd, 0) == -1 || ftruncate(fd, mapSize) == -1) {
+			close(fd);
+			return 0;
+		}
+	}
+	void * map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, (fd == -1) ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED, fd, 0);
+	if (fd != -1) {
+		close(fd);
+	}
+	if (map == MAP_FAILED) {
+		return 0;
+	}
+	table->header = (rating_header_t *) map;
+	table->entries = (rating_entry_t *) (table->header + 1);
+	table->mapSize = mapSize;
+	if (!loaded) {
+		rating_header_t header = { RATING_MAGIC, RATING_VERSION, RATING_CAPACITY, 0, 1, RATING_CAPACITY, 0 };
+		*table->header = header;
+	}
+	table->periodStartNs = nowNs();
+	return 1;
+}
+
+/**
+ * the function writes the table back and unmaps it
+ **/
+void ratingClose(rating_table_t * table) {
+	if (table->header != NULL) {
+		msync(table->header, table->mapSize, MS_SYNC);
+		munmap(table->header, table->mapSize);
+		table->header = NULL;
+		table->entries = NULL;
+	}
+}
+
+/**
+ * the function finds entry of player, new player gets entry with initial rating
+ * returns index of the entry or -1 if player is anonymous or the table is full
+ **/
+int ratingFind(rating_table_t * table, unsigned int playerId) {
+	if (table->header == NULL || playerId == 0) {
+		return -1;
+	}
+	int mask = table->header->capacity - 1;
+	int idx = (int) ((playerId * 2654435761u) & mask);
+	while (table->entries[idx].playerId != 0) {
+		if (table->entries[idx].playerId == playerId) {
+			return idx;
+		}
+		idx = (idx + 1) & mask;
+	}
+	if (table->header->playersCnt >= table->header->capacity / 4 * 3) {
+		return -1;
+	}
+	rating_entry_t * entry = &table->entries[idx];
+	memset(entry, 0, sizeof(rating_entry_t));
+	entry->playerId = playerId;
+	entry->rating = RATING_INITIAL;
+	entry->rd = RATING_INITIAL_RD;
+	entry->lastPeriod = table->header->period;
+	table->header->playersCnt++;
+	return idx;
+}
+
+/**
+ * the function returns rounded rating of entry, 0 if idx is -1
+ **/
+unsigned short ratingValue(rating_table_t * table, int idx) {
+	if (table->header == NULL || idx < 0) {
+		return 0;
+	}
+	float rating = table->entries[idx].rating;
+	return (rating < 1.0f) ? 1 : (rating > 65535.0f) ? 65535 : (unsigned short) (rating + 0.5f);
+}
+
+/**
+ * the function adds game won by winner against loser to the current period,
+ * ratings change only when the period is applied, so results are taken against ratings of the period start
+ * (or new ratings of opponents already updated while previous period is being applied)
+ **/
+void ratingResult(rating_table_t * table, int winnerIdx, int loserIdx) {
+	if (table->header == NULL || winnerIdx < 0 || loserIdx < 0 || winnerIdx == loserIdx) {
+		return;
+	}
+	int parity = table->header->period & 1;
+	rating_entry_t * winner = &table->entries[winnerIdx];
+	rating_entry_t * loser = &table->entries[loserIdx];
+	float winnerWeight = ratingWeight(winner->rd), loserWeight = ratingWeight(loser->rd);
+	float winnerExpected = ratingExpected(winner->rating, loser->rating, loserWeight);
+	float loserExpected = ratingExpected(loser->rating, winner->rating, winnerWeight);
+	winner->periodV[parity] += loserWeight * loserWeight * winnerExpected * (1.0f - winnerExpected);
+	winner->periodDelta[parity] += loserWeight * (1.0f - winnerExpected);
+	loser->periodV[parity] += winnerWeight * winnerWeight * loserExpected * (1.0f - loserExpected);
+	loser->periodDelta[parity] -= winnerWeight * loserExpected;
+	winner->games++;
+	winner->wins++;
+	loser->games++;
+	table->header->periodResults++;
+	table->resultsCnt++;
+}
+
+/**
+ * the function closes current rating period, its results are applied by ratingApply in budgeted steps
+ * while previous period is still applied closing waits for it, period without results is not closed
+ **/
+void ratingClosePeriod(rating_table_t * table, long long now) {
+	rating_header_t * header = table->header;
+	if (header == NULL) {
+		return;
+	}
+	if (header->applyCursor < header->capacity) {
+		table->closeRequested = 1;
+		return;
+	}
+	table->periodStartNs = now;
+	if (header->periodResults == 0) {
+		return;
+	}
+	header->period++;
+	header->periodResults = 0;
+	header->applyCursor = 0;
+	table->periodsClosed++;
+}
+
+/**
+ * the function applies results of closed period to budget entries at most
+ * once all entries are applied the table is written back and period waiting to close is closed
+ * returns 1 if entries remain to be applied
+ **/
+int ratingApply(rating_table_t * table, int budget) {
+	rating_header_t * header = table->header;
+	if (!ratingApplyPending(table)) {
+		return 0;
+	}
+	unsigned int period = header->period - 1;
+	int parity = period & 1;
+	while (budget-- > 0 && header->applyCursor < header->capacity) {
+		rating_entry_t * entry = &table->entries[header->applyCursor++];
+		if (entry->playerId == 0 || entry->periodV[parity] <= 0.0f) {
+			continue;
+		}
+		/* deviation grows while player is idle */
+		float rd2 = entry->rd * entry->rd + RATING_IDLE_RD * RATING_IDLE_RD * (float) (period - entry->lastPeriod);
+		if (rd2 > RATING_INITIAL_RD * RATING_INITIAL_RD) {
+			rd2 = RATING_INITIAL_RD * RATING_INITIAL_RD;
+		}
+		float precision = 1.0f / rd2 + RATING_Q * RATING_Q * entry->periodV[parity]; /* 1 / rd^2 + 1 / d^2 */
+		entry->rating += RATING_Q / precision * entry->periodDelta[parity];
+		entry->rd = sqrtf(1.0f / precision);
+		if (entry->rd < RATING_MIN_RD) {
+			entry->rd = RATING_MIN_RD;
+		}
+		entry->lastPeriod = period;
+		entry->periodV[parity] = 0.0f;
+		entry->periodDelta[parity] = 0.0f;
+	}
+	if (header->applyCursor < header->capacity) {
+		return 1;
+	}
+	msync(header, table->mapSize, MS_ASYNC);
+	if (table->closeRequested) {
+		table->closeRequested = 0;
+		ratingClosePeriod(table, nowNs());
+	}
+	return ratingApplyPending(table);
+}
+
+/**
+ * the function checks if closed period waits to be applied
+ **/
+int ratingApplyPending(rating_table_t * table) {
+	return table->header != NULL && table->header->applyCursor < table->header->capacity;
+}
+
+/**
+ * the function prints size of the table and rating periods
+ **/
+void ratingPrintStats(FILE * out, rating_table_t * table) {
+	if (table->header == NULL) {
+		return;
+	}
+	fprintf(out, "ratings players=%d capacity=%d period=%u periods_closed=%ld results=%ld period_results=%lld applying=%d\n", table->header->playersCnt, table->header->capacity,
+			table->header->period, table->periodsClosed, table->resultsCnt, table->header->periodResults, ratingApplyPending(table));
+}
@@ -0,0 +1,88 @@
+#define RATING_MAGIC 0x4e494d52 /* "NIMR" */
+#define RATING_VERSION 1 /* layout of the table file */
+#define RATING_CAPACITY (1 << 17) /* entries of new table, power of 2, filled up to 3/4 */
+#define RATING_INITIAL (1500.0f) /* rating of new player */
+#define RATING_INITIAL_RD (350.0f) /* rating deviation of new player, also the largest one */
+#define RATING_MIN_RD (30.0f) /* rating deviation never gets below it */
+#define RATING_IDLE_RD (35.0f) /* rating deviation growth of player idle for one period */
+#define RATING_APPLY_BUDGET (4096) /* entries updated in one loop iteration when period closes */
+#define RATING_PERIOD_NS (60000000000LL) /* rating period closes at least this often */
+
+/**
+ * rating of player by Glicko, results are applied once per rating period:
+ * each result adds terms computed from opponent's rating to accumulators of the period,
+ * closing the period turns accumulated terms into new rating and deviation
+ * playerId - identity of the player, 0 if entry is empty
+ * rating, rd - rating and its deviation
+ * lastPeriod - last period player had results in
+ * games, wins - results of the player
+ * periodV - sum of g(rd)^2 * E * (1 - E) over results of the period, indexed by period parity
+ * periodDelta - sum of g(rd) * (score - E) over results of the period, indexed by period parity
+ **/
+typedef struct rating_entry {
+	unsigned int playerId;
+	float rating;
+	float rd;
+	unsigned int lastPeriod;
+	unsigned int games;
+	unsigned int wins;
+	float periodV[2];
+	float periodDelta[2];
+} rating_entry_t;
+
+/**
+ * header of table file, followed by capacity entries
+ * capacity - number of entries, power of 2
+ * playersCnt - number of entries in use
+ * period - current rating period, results are added to accumulators of its parity
+ * applyCursor - next entry previous period is applied to, capacity if previous period is applied
+ * periodResults - results in current period
+ **/
+typedef struct rating_header {
+	int magic;
+	int version;
+	int capacity;
+	int playersCnt;
+	unsigned int period;
+	int applyCursor;
+	long long periodResults;
+} rating_header_t;
+
+/**
+ * ratings table mapped from file or anonymous memory, the file holds all the state
+ * so the next server or upgraded one continues where the previous stopped
+ * header - mapped header
+ * entries - mapped entries after the header, open addressed by player ID
+ * mapSize - size of the mapping
+ * closeRequested - 1 if period should close as soon as previous one is applied
+ * periodStartNs - time current period started
+ * periodsClosed, resultsCnt - counters of closed periods and results
+ **/
+typedef struct rating_table {
+	rating_header_t * header;
+	rating_entry_t * entries;
+	size_t mapSize;
+	int closeRequested;
+	long long periodStartNs;
+	long periodsClosed;
+	long resultsCnt;
+} rating_table_t;
+
+/* headers of rating functions */
+int ratingOpen(rating_table_t * table, const char * path);
+
+void ratingClose(rating_table_t * table);
+
+int ratingFind(rating_table_t * table, unsigned int playerId);
+
+unsigned short ratingValue(rating_table_t * table, int idx);
+
+void ratingResult(rating_table_t * table, int winnerIdx, int loserIdx);
+
+void ratingClosePeriod(rating_table_t * table, long long now);
+
+int ratingApply(rating_table_t * table, int budget);
+
+int ratingApplyPending(rating_table_t * table);
+
+void ratingPrintStats(FILE * out, rating_table_t * table);
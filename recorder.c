@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "recorder.h"
+
+const char * flightEventNames[FLIGHT_EVENTS_NUM] = { "ACCEPT", "RECV", "SEND", "SEND_FAILED", "FLUSH", "RECV_CLOSED", "DISCONNECT",
+		"STATUS_CHANGE", "TURN", "BROADCAST", "GAME_START", "GAME_END", "DATAGRAMS",
+		"DETACH", "RESUME", "SHED" };
+
+long long flightNowNs; /* time of recorded events, updated by the main loop */
+unsigned int flightSeq; /* number of events recorded in all rings */
+
+/**
+ * the function records event in the ring, oldest event is overwritten
+ * ring is allocated small if it has no event yet, event is lost if there is no memory for it
+ **/
+void flightRecord(flight_ring_t ** ring, flight_event_type_t event, int msgType, int size, int a, int b) {
+	if (*ring == NULL) {
+		flightResize(ring, FLIGHT_SMALL_RING_SIZE);
+		if (*ring == NULL) {
+			return;
+		}
+	}
+	flight_event_t * slot = &(*ring)->events[(*ring)->head++ & ((*ring)->size - 1)];
+	slot->ns = flightNowNs;
+	slot->seq = flightSeq++;
+	slot->event = event;
+	slot->msgType = msgType;
+	slot->size = size;
+	slot->a = a;
+	slot->b = b;
+}
+
+/**
+ * the function resizes the ring keeping its newest events, ring not allocated yet is allocated
+ * ring stays as it is if there is no memory
+ **/
+void flightResize(flight_ring_t ** ring, unsigned int size) {
+	flight_ring_t * old = *ring;
+	if (old != NULL && old->size == size) {
+		return;
+	}
+	flight_ring_t * resized = (flight_ring_t *) malloc(FLIGHT_RING_BYTES(size));
+	if (resized == NULL) {
+		return;
+	}
+	resized->head = 0;
+	resized->size = size;
+	if (old != NULL) { /* kept events are renumbered from 0 */
+		unsigned int kept = (old->head < old->size) ? old->head : old->size;
+		unsigned int n;
+		for (n = old->head - ((kept < size) ? kept : size); n != old->head; n++) {
+			resized->events[resized->head++] = old->events[n & (old->size - 1)];
+		}
+		free(old);
+	}
+	*ring = resized;
+}
+
+/**
+ * the function writes rings that recorded any event to the file
+ * returns 0 on error
+ **/
+int flightDump(const char * path, flight_ring_t ** connRings, int connRingsCnt, flight_ring_t ** gameRings, int gameRingsCnt) {
+	FILE * out = fopen(path, "wb");
+	if (out == NULL) {
+		return 0;
+	}
+	flight_dump_header_t header = { FLIGHT_MAGIC, FLIGHT_VERSION, FLIGHT_RING_SIZE, 0 };
+	int i;
+	for (i = 0; i < connRingsCnt + gameRingsCnt; i++) {
+		flight_ring_t * ring = (i < connRingsCnt) ? connRings[i] : gameRings[i - connRingsCnt];
+		header.ringsCnt += (ring != NULL && ring->head != 0);
+	}
+	int res = fwrite(&header, sizeof(header), 1, out) == 1;
+	for (i = 0; i < connRingsCnt + gameRingsCnt && res; i++) {
+		flight_ring_t * ring = (i < connRingsCnt) ? connRings[i] : gameRings[i - connRingsCnt];
+		flight_ring_header_t ringHeader = { (i < connRingsCnt) ? FLIGHT_RING_CONN : FLIGHT_RING_GAME, (i < connRingsCnt) ? i : i - connRingsCnt };
+		if (ring != NULL && ring->head != 0) {
+			res = fwrite(&ringHeader, sizeof(ringHeader), 1, out) == 1 && fwrite(ring, FLIGHT_RING_BYTES(ring->size), 1, out) == 1;
+		}
+	}
+	return (fclose(out) == 0) && res;
+}
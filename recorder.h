@@ -0,0 +1,100 @@
+#define FLIGHT_RING_SIZE 64 /* events kept in ring of game or player connection, power of 2 */
+#define FLIGHT_SMALL_RING_SIZE 8 /* events kept in ring of connection not playing, power of 2 */
+#define FLIGHT_MAGIC 0x4e494d46 /* "NIMF" */
+#define FLIGHT_VERSION 2 /* layout of the dump file */
+
+/**
+ * definition of recorded events, meaning of msgType, size, a and b fields:
+ * FLIGHT_ACCEPT - connection accepted
+ * FLIGHT_RECV - message received: msgType, size - payload size
+ * FLIGHT_SEND - message queued: msgType, size, a - output buffer depth, b - status coalesced
+ * FLIGHT_SEND_FAILED - message didn't fit output buffer: msgType, size, a - output buffer depth
+ * FLIGHT_FLUSH - write-ready socket flushed: a - output buffer depth left
+ * FLIGHT_RECV_CLOSED - read failed or peer closed: a - read attempts, b - errno
+ * FLIGHT_DISCONNECT - client removed: a - client ID, b - client status
+ * FLIGHT_STATUS_CHANGE - client status changed: a - client ID, b - old status, size - new status
+ * FLIGHT_TURN - move handled: msgType - turn response, a - heap, b - cubes, size - client ID
+ * FLIGHT_BROADCAST - status broadcast: a - status seq, b - 1 for keyframe
+ * FLIGHT_GAME_START - game created: a - number of players, b - number of heaps
+ * FLIGHT_GAME_END - no cubes remain: a - status seq
+ * FLIGHT_DATAGRAMS - status sent to spectators as datagrams: a - spectators, b - datagrams sent
+ * FLIGHT_DETACH - player disconnected, seat held: a - client ID, b - client status
+ * FLIGHT_RESUME - reconnected player took held seat back: a - client ID, b - statuses missed
+ * FLIGHT_SHED - message dropped under load: a - admission class, b - load level
+ **/
+typedef enum {
+	FLIGHT_ACCEPT, FLIGHT_RECV, FLIGHT_SEND, FLIGHT_SEND_FAILED, FLIGHT_FLUSH, FLIGHT_RECV_CLOSED, FLIGHT_DISCONNECT,
+	FLIGHT_STATUS_CHANGE, FLIGHT_TURN, FLIGHT_BROADCAST, FLIGHT_GAME_START, FLIGHT_GAME_END, FLIGHT_DATAGRAMS,
+	FLIGHT_DETACH, FLIGHT_RESUME, FLIGHT_SHED, FLIGHT_EVENTS_NUM
+} flight_event_type_t;
+
+/**
+ * kind of the ring in dump
+ * FLIGHT_RING_CONN - ring of connection, index is socket fd
+ * FLIGHT_RING_GAME - ring of game, index is game slot
+ **/
+typedef enum {
+	FLIGHT_RING_CONN, FLIGHT_RING_GAME
+} flight_ring_kind_t;
+
+/**
+ * recorded event
+ * ns - flightNowNs when the event was recorded, recording doesn't read the clock itself
+ * seq - order of the event among events of all rings
+ * event - flight_event_type_t
+ * msgType, size, a, b - event data, see flight_event_type_t
+ **/
+typedef struct flight_event {
+	long long ns;
+	unsigned int seq;
+	unsigned char event;
+	unsigned char msgType;
+	unsigned short size;
+	int a;
+	int b;
+} flight_event_t;
+
+/**
+ * ring of recent events, written by the main loop only so no locking is needed,
+ * ring is allocated by its first event and is FLIGHT_SMALL_RING_SIZE long until it is resized
+ * head - number of events recorded since the ring was sized, next event goes to head % size
+ * size - number of events kept, power of 2 not above FLIGHT_RING_SIZE
+ * events - last size events
+ **/
+typedef struct flight_ring {
+	unsigned int head;
+	unsigned int size;
+	flight_event_t events[];
+} flight_ring_t;
+
+#define FLIGHT_RING_BYTES(size) (sizeof(flight_ring_t) + (size) * sizeof(flight_event_t)) /* allocation of ring keeping size events */
+
+/**
+ * header of dump file, followed by ringsCnt triples of flight_ring_header_t, flight_ring_t and its events
+ **/
+typedef struct flight_dump_header {
+	int magic;
+	int version;
+	int ringSize;
+	int ringsCnt;
+} flight_dump_header_t;
+
+/**
+ * header of ring in dump file
+ * kind - flight_ring_kind_t
+ * index - socket fd or game slot
+ **/
+typedef struct flight_ring_header {
+	int kind;
+	int index;
+} flight_ring_header_t;
+
+extern const char * flightEventNames[FLIGHT_EVENTS_NUM];
+extern long long flightNowNs;
+
+/* headers of flight recorder functions */
+void flightRecord(flight_ring_t ** ring, flight_event_type_t event, int msgType, int size, int a, int b);
+
+void flightResize(flight_ring_t ** ring, unsigned int size);
+
+int flightDump(const char * path, flight_ring_t ** connRings, int connRingsCnt, flight_ring_t ** gameRings, int gameRingsCnt);
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h> /* data types used in system calls */
+#include <string.h> /* memcpy() */
+#include "transport.h" /* common data with client */
+#include "rules.h"
+
+/**
+ * specialized rules table
+ * heapsCnt, maxTake - variant the checks are specialized for
+ **/
+struct {
+	int heapsCnt;
+	int maxTake;
+	rules_variant_t variant;
+} specializedRules[] = {
+	{ 4, 0, RULES_HEAPS4 },
+	{ 3, 0, RULES_HEAPS3 },
+	{ 4, 3, RULES_HEAPS4_TAKE3 },
+};
+
+/**
+ * generic move validation for any number of heaps and move bound
+ **/
+int genericIsMoveValid(const rules_t * rules, const short * heaps, int heapIndex, int cubes) {
+	if (heapIndex < 0 || heapIndex >= rules->heapsCnt || cubes <= 0) {
+		return 0;
+	}
+	if (rules->maxTake != 0 && cubes > rules->maxTake) {
+		return 0;
+	}
+	return heaps[heapIndex] >= cubes;
+}
+
+/**
+ * generic end detection for any number of heaps
+ **/
+int genericIsGameEnd(const rules_t * rules, const short * heaps) {
+	int i;
+	for (i = 0; i < rules->heapsCnt; i++) {
+		if (heaps[i] != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * move enumeration of moves taking from one heap, heap equal to the previous one is skipped
+ * as its moves lead to the same canonical positions
+ **/
+int oneHeapNextChild(const rules_t * rules, const short * heaps, move_iter_t * iter, short * child) {
+	for (; iter->heap < rules->heapsCnt; iter->heap++, iter->cubes = 0) {
+		int i = iter->heap;
+		int maxCubes = (rules->maxTake != 0 && rules->maxTake < heaps[i]) ? rules->maxTake : heaps[i];
+		if (iter->cubes < maxCubes && !(i > 0 && heaps[i] == heaps[i - 1])) {
+			iter->cubes++;
+			memcpy(child, heaps, MAX_HEAPS * sizeof(short));
+			child[i] -= iter->cubes;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * move enumeration of Wythoff moves: moves taking from one heap are followed by moves
+ * taking the same number of cubes from two heaps, maxTake bounds cubes taken from each heap
+ **/
+int wythoffNextChild(const rules_t * rules, const short * heaps, move_iter_t * iter, short * child) {
+	while (iter->heap < rules->heapsCnt) {
+		int maxCubes = (heaps[iter->heap] < heaps[iter->other]) ? heaps[iter->heap] : heaps[iter->other];
+		if (rules->maxTake != 0 && rules->maxTake < maxCubes) {
+			maxCubes = rules->maxTake;
+		}
+		if (iter->cubes < maxCubes) {
+			iter->cubes++;
+			memcpy(child, heaps, MAX_HEAPS * sizeof(short));
+			child[iter->heap] -= iter->cubes;
+			if (iter->other != iter->heap) {
+				child[iter->other] -= iter->cubes;
+			}
+			return 1;
+		}
+		iter->cubes = 0;
+		if (++iter->other >= rules->heapsCnt) {
+			iter->other = ++iter->heap;
+		}
+	}
+	return 0;
+}
+
+/**
+ * the function fills rules of the variant,
+ * specialized checks are used when available, generic ones otherwise
+ * returns 0 if variant is not valid
+ **/
+int initRules(rules_t * rules, game_type_t gameType, move_set_t moveSet, int heapsCnt, int maxTake) {
+	if (heapsCnt < 1 || heapsCnt > MAX_HEAPS || maxTake < 0 || (gameType != MISERE && gameType != REGULAR) || (moveSet != MOVES_ONE_HEAP && moveSet != MOVES_WYTHOFF)) {
+		return 0;
+	}
+	rules->moveSet = moveSet;
+	rules->heapsCnt = heapsCnt;
+	rules->maxTake = maxTake;
+	rules->lastMoverEnd = (gameType == MISERE) ? YOU_LOSE : YOU_WIN;
+	rules->othersEnd = (gameType == MISERE) ? YOU_WIN : YOU_LOSE;
+	rules->variant = RULES_GENERIC;
+	size_t i;
+	for (i = 0; i < sizeof(specializedRules) / sizeof(specializedRules[0]); i++) {
+		if (specializedRules[i].heapsCnt == heapsCnt && specializedRules[i].maxTake == maxTake) {
+			rules->variant = specializedRules[i].variant;
+			break;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,127 @@
+struct Rules;
+
+/**
+ * definition of move sets:
+ * MOVES_ONE_HEAP - move takes cubes from one heap
+ * MOVES_WYTHOFF - move takes cubes from one heap or the same number of cubes from two heaps,
+ * game of more than two heaps has no closed form
+ **/
+typedef enum {
+	MOVES_ONE_HEAP, MOVES_WYTHOFF
+} move_set_t;
+
+/**
+ * position of move enumeration, zeroed before the first move
+ * heap - heap the move takes from
+ * other - second heap the move takes from, heap itself if the move takes from one heap
+ * cubes - cubes taken from each heap by the last enumerated move
+ **/
+typedef struct move_iter {
+	int heap;
+	int other;
+	int cubes;
+} move_iter_t;
+
+/**
+ * definition of rule checks, chosen once by initRules:
+ * RULES_GENERIC - any number of heaps and move bound
+ * RULES_HEAPS4, RULES_HEAPS3 - 4 or 3 heaps, move not bounded
+ * RULES_HEAPS4_TAKE3 - 4 heaps, 3 cubes at most
+ **/
+typedef enum {
+	RULES_GENERIC, RULES_HEAPS4, RULES_HEAPS3, RULES_HEAPS4_TAKE3
+} rules_variant_t;
+
+/**
+ * rules of the game variant
+ * moveSet - moves allowed by the variant
+ * heapsCnt - number of heaps in play, heaps after it are always empty
+ * maxTake - maximal number of cubes taken in one move, 0 if not bounded
+ * lastMoverEnd - end game status of the player who took the last cube
+ * othersEnd - end game status of the other players
+ * variant - rule checks of rulesIsMoveValid and rulesIsGameEnd, specialized for common variants,
+ * moves validated by rulesIsMoveValid take from one heap
+ **/
+typedef struct Rules {
+	move_set_t moveSet;
+	int heapsCnt;
+	int maxTake;
+	end_game_t lastMoverEnd;
+	end_game_t othersEnd;
+	rules_variant_t variant;
+} rules_t;
+
+#if MAX_HEAPS != 4
+#error "RULES_SPECIALIZE unrolls exactly 4 heaps"
+#endif
+
+/**
+ * the macro defines rule checks specialized for HEAPS heaps and at most MAX_TAKE cubes per move
+ * (0 - not bounded), the checks have no branches and loops are unrolled up to MAX_HEAPS
+ * heap index is masked so invalid index never reads outside of heaps
+ **/
+#define RULES_SPECIALIZE(NAME, HEAPS, MAX_TAKE) \
+static inline int NAME##IsMoveValid(const short * heaps, int heapIndex, int cubes) { \
+	return ((unsigned) heapIndex < (HEAPS)) & (cubes > 0) & (((MAX_TAKE) == 0) | (cubes <= (MAX_TAKE))) \
+			& (heaps[(unsigned) heapIndex % (HEAPS)] >= cubes); \
+} \
+static inline int NAME##IsGameEnd(const short * heaps) { \
+	return (((HEAPS) > 0 ? heaps[0] : 0) | ((HEAPS) > 1 ? heaps[1] : 0) \
+			| ((HEAPS) > 2 ? heaps[2] : 0) | ((HEAPS) > 3 ? heaps[3] : 0)) == 0; \
+}
+
+/* specializations for common variants */
+RULES_SPECIALIZE(heaps4, 4, 0)
+RULES_SPECIALIZE(heaps3, 3, 0)
+RULES_SPECIALIZE(heaps4Take3, 4, 3)
+
+/* headers of rules functions */
+int genericIsMoveValid(const rules_t * rules, const short * heaps, int heapIndex, int cubes);
+
+int genericIsGameEnd(const rules_t * rules, const short * heaps);
+
+int oneHeapNextChild(const rules_t * rules, const short * heaps, move_iter_t * iter, short * child);
+
+int wythoffNextChild(const rules_t * rules, const short * heaps, move_iter_t * iter, short * child);
+
+int initRules(rules_t * rules, game_type_t gameType, move_set_t moveSet, int heapsCnt, int maxTake);
+
+/**
+ * the function tells if cubes can be taken from heap heapIndex, the check of the variant is called directly
+ **/
+static inline int rulesIsMoveValid(const rules_t * rules, const short * heaps, int heapIndex, int cubes) {
+	switch (rules->variant) {
+	case RULES_HEAPS4:
+		return heaps4IsMoveValid(heaps, heapIndex, cubes);
+	case RULES_HEAPS3:
+		return heaps3IsMoveValid(heaps, heapIndex, cubes);
+	case RULES_HEAPS4_TAKE3:
+		return heaps4Take3IsMoveValid(heaps, heapIndex, cubes);
+	default:
+		return genericIsMoveValid(rules, heaps, heapIndex, cubes);
+	}
+}
+
+/**
+ * the function tells if no cubes remain, the check of the variant is called directly
+ **/
+static inline int rulesIsGameEnd(const rules_t * rules, const short * heaps) {
+	switch (rules->variant) {
+	case RULES_HEAPS4:
+		return heaps4IsGameEnd(heaps);
+	case RULES_HEAPS3:
+		return heaps3IsGameEnd(heaps);
+	case RULES_HEAPS4_TAKE3:
+		return heaps4Take3IsGameEnd(heaps);
+	default:
+		return genericIsGameEnd(rules, heaps);
+	}
+}
+
+/**
+ * the function fills child with position after the next move of the move set
+ * returns 0 if no move is left
+ **/
+static inline int rulesNextChild(const rules_t * rules, const short * heaps, move_iter_t * iter, short * child) {
+	return (rules->moveSet == MOVES_WYTHOFF) ? wythoffNextChild(rules, heaps, iter, child) : oneHeapNextChild(rules, heaps, iter, child);
+}
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+#include "scheduler.h"
+
+/* names of phases in statistics */
+const char * schedPhaseNames[SCHED_PHASES] = { "accept", "read", "games", "flush", "timers" };
+
+/**
+ * the function sets budgets of all phases, timers are due at once
+ **/
+void schedulerInit(scheduler_t * sched) {
+	memset(sched, 0, sizeof(scheduler_t));
+	sched->budget[SCHED_ACCEPT] = SCHED_ACCEPT_BUDGET;
+	sched->budget[SCHED_READ] = SCHED_READ_BUDGET;
+	sched->budget[SCHED_GAMES] = SCHED_GAMES_BUDGET;
+	sched->budget[SCHED_FLUSH] = SCHED_FLUSH_BUDGET;
+}
+
+/**
+ * the function starts phase of the iteration over n connections or games
+ * returns index the phase starts from: where it stopped last time it ran out of budget
+ **/
+int schedStart(scheduler_t * sched, sched_phase_t phase, int n) {
+	sched->used[phase] = 0;
+	return (n > 0) ? sched->cursor[phase] % n : 0;
+}
+
+/**
+ * the function takes one work unit of the phase
+ * returns 1 if the work can be done in this iteration, 0 if budget of the phase is spent
+ **/
+int schedTake(scheduler_t * sched, sched_phase_t phase) {
+	if (sched->used[phase] >= sched->budget[phase]) {
+		return 0;
+	}
+	sched->used[phase]++;
+	return 1;
+}
+
+/**
+ * the function stops phase that ran out of budget, next iteration starts it from next
+ **/
+void schedCarry(scheduler_t * sched, sched_phase_t phase, int next) {
+	sched->cursor[phase] = next;
+	sched->carried[phase]++;
+}
+
+/**
+ * the function checks if timers are due and schedules their next run
+ * returns 1 if timers run in this iteration
+ **/
+int schedTimersDue(scheduler_t * sched, long long now) {
+	if (now < sched->timersDueNs) {
+		return 0;
+	}
+	sched->timersDueNs = now + SCHED_TIMER_INTERVAL_NS;
+	sched->timerRuns++;
+	return 1;
+}
+
+/**
+ * the function prints how often each phase carried work over to the next iteration
+ **/
+void schedulerPrintStats(FILE * out, scheduler_t * sched) {
+	int phase;
+	fprintf(out, "scheduler iterations=%ld", sched->iterations);
+	for (phase = 0; phase < SCHED_TIMERS; phase++) {
+		fprintf(out, " carried_%s=%ld", schedPhaseNames[phase], sched->carried[phase]);
+	}
+	fprintf(out, " timer_runs=%ld\n", sched->timerRuns);
+}
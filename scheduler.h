@@ -0,0 +1,53 @@
+#define SCHED_ACCEPT_BUDGET (32) /* connections accepted in one loop iteration */
+#define SCHED_READ_BUDGET (256) /* messages handled in one loop iteration over all connections */
+#define SCHED_CONN_BUDGET (4) /* messages of one connection handled in one loop iteration */
+#define SCHED_GAMES_BUDGET (64) /* status broadcasts in one loop iteration */
+#define SCHED_FLUSH_BUDGET (512) /* connections written in one loop iteration */
+#define SCHED_TIMER_INTERVAL_NS (100000000LL) /* held seats are checked for expiry this often */
+
+/**
+ * phases of main loop iteration, each but timers has own budget of work units:
+ * SCHED_ACCEPT - accepted connections
+ * SCHED_READ - received and handled messages
+ * SCHED_GAMES - games whose status is broadcast
+ * SCHED_FLUSH - connections whose output is written
+ * SCHED_TIMERS - expiry checks of held seats, run once in SCHED_TIMER_INTERVAL_NS
+ **/
+typedef enum {
+	SCHED_ACCEPT, SCHED_READ, SCHED_GAMES, SCHED_FLUSH, SCHED_TIMERS, SCHED_PHASES
+} sched_phase_t;
+
+/**
+ * round robin scheduler of main loop work
+ * phase that runs out of budget stops at its cursor and the next iteration continues from it,
+ * so work left over is carried over in order and no connection or game is served ahead of the others
+ * budget - work units of each phase per iteration
+ * used - work units of each phase taken in current iteration
+ * cursor - connection or game each phase continues from
+ * carried - iterations each phase ran out of budget with work left
+ * timersDueNs - time timers run next
+ * timerRuns - number of times timers ran
+ * iterations - number of loop iterations
+ **/
+typedef struct scheduler {
+	int budget[SCHED_PHASES];
+	int used[SCHED_PHASES];
+	int cursor[SCHED_PHASES];
+	long carried[SCHED_PHASES];
+	long long timersDueNs;
+	long timerRuns;
+	long iterations;
+} scheduler_t;
+
+/* headers of scheduler functions */
+void schedulerInit(scheduler_t * sched);
+
+int schedStart(scheduler_t * sched, sched_phase_t phase, int n);
+
+int schedTake(scheduler_t * sched, sched_phase_t phase);
+
+void schedCarry(scheduler_t * sched, sched_phase_t phase, int next);
+
+int schedTimersDue(scheduler_t * sched, long long now);
+
+void schedulerPrintStats(FILE * out, scheduler_t * sched);
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* read(), close(), ftruncate(), getpid() */
+#include <fcntl.h> /* open() */
+#include <string.h> /* memset(), memcpy() */
+#include <sys/mman.h> /* mmap() */
+#include <sys/stat.h> /* fstat() */
+#include "latency.h" /* nowNs() */
+#include "snapshot.h"
+
+/**
+ * the function maps snapshot region of slotsCnt slots for publishing, path NULL maps it in anonymous memory
+ * region of the same layout is taken over with its sequences, so observers of upgraded server
+ * keep reading the mapping they have, region of other layout is created again
+ * returns 0 on error
+ **/
+int snapshotCreate(snapshot_map_t * map, const char * path, int slotsCnt) {
+	memset(map, 0, sizeof(snapshot_map_t));
+	size_t mapSize = sizeof(snapshot_header_t) + slotsCnt * sizeof(game_snapshot_t);
+	int loaded = 0;
+	int fd = -1;
+	if (path != NULL) {
+		snapshot_header_t header;
+		struct stat fileStat;
+		if ((fd = open(path, O_RDWR | O_CREAT, 0644)) == -1) {
+			return 0;
+		}
+		if (read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == SNAPSHOT_MAGIC && header.version == SNAPSHOT_VERSION
+				&& header.slotsCnt == slotsCnt && fstat(fd, &fileStat) == 0 && fileStat.st_size == mapSize) {
+			loaded = 1;
+		} else if (ftruncate(fd, 0) == -1 || ftruncate(fd, mapSize) == -1) {
+			close(fd);
+			return 0;
+		}
+	}
+	void * region = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, (fd == -1) ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED, fd, 0);
+	if (fd != -1) {
+		close(fd);
+	}
+	if (region == MAP_FAILED) {
+		return 0;
+	}
+	map->header = (snapshot_header_t *) region;
+	map->slots = (game_snapshot_t *) (map->header + 1);
+	map->mapSize = mapSize;
+	if (!loaded) {
+		map->header->slotsCnt = slotsCnt;
+		map->header->version = SNAPSHOT_VERSION;
+		map->header->startedNs = nowNs();
+		__atomic_store_n(&map->header->magic, SNAPSHOT_MAGIC, __ATOMIC_RELEASE); /* observers check magic last */
+	}
+	map->header->pid = getpid();
+	return 1;
+}
+
+/**
+ * the function maps snapshot region read only for observing
+ * returns 0 on error or if the file is not snapshot region of this version
+ **/
+int snapshotAttach(snapshot_map_t * map, const char * path) {
+	memset(map, 0, sizeof(snapshot_map_t));
+	snapshot_header_t header;
+	struct stat fileStat;
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return 0;
+	}
+	if (read(fd, &header, sizeof(header)) != sizeof(header) || header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION || header.slotsCnt <= 0
+			|| fstat(fd, &fileStat) == -1 || fileStat.st_size != sizeof(snapshot_header_t) + header.slotsCnt * sizeof(game_snapshot_t)) {
+		close(fd);
+		return 0;
+	}
+	void * region = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (region == MAP_FAILED) {
+		return 0;
+	}
+	map->header = (snapshot_header_t *) region;
+	map->slots = (game_snapshot_t *) (map->header + 1);
+	map->mapSize = fileStat.st_size;
+	return 1;
+}
+
+/**
+ * the function unmaps snapshot region, the file stays for observers
+ **/
+void snapshotClose(snapshot_map_t * map) {
+	if (map->header != NULL) {
+		munmap(map->header, map->mapSize);
+		map->header = NULL;
+		map->slots = NULL;
+	}
+}
+
+/**
+ * the function opens slot for writing, fields stored until snapshotEnd are seen by readers all or none
+ * returns the slot to store the fields to
+ **/
+game_snapshot_t * snapshotBegin(snapshot_map_t * map, int slot) {
+	game_snapshot_t * snap = &map->slots[slot];
+	__atomic_store_n(&snap->seq, snap->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE); /* odd seq is visible before any field */
+	map->published++;
+	return snap;
+}
+
+/**
+ * the function publishes fields stored to slot since snapshotBegin
+ **/
+void snapshotEnd(game_snapshot_t * snap) {
+	__atomic_store_n(&snap->seq, snap->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * the function copies consistent snapshot of slot without locks, retries while the slot is written
+ * returns 1 if copied or 0 if writer did not finish the slot in SNAPSHOT_READ_TRIES tries
+ **/
+int snapshotRead(const snapshot_map_t * map, int slot, game_snapshot_t * copy) {
+	const game_snapshot_t * snap = &map->slots[slot];
+	int tries;
+	for (tries = 0; tries < SNAPSHOT_READ_TRIES; tries++) {
+		unsigned int seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			continue;
+		}
+		memcpy(copy, snap, sizeof(game_snapshot_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE); /* copy is done before seq is checked again */
+		if (__atomic_load_n(&snap->seq, __ATOMIC_RELAXED) == seq) {
+			copy->seq = seq;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+#define SNAPSHOT_MAGIC 0x4e494d57 /* "NIMW" */
+#define SNAPSHOT_VERSION 1 /* layout of the snapshot region */
+#define SNAPSHOT_HEAPS (4) /* heaps of game snapshot, NUM_OF_HEAPS of the server */
+#define SNAPSHOT_ROSTER (25) /* client statuses of game snapshot, MAX_ID of the server */
+#define SNAPSHOT_NO_CLIENT (0xff) /* roster entry of client ID not in use */
+#define SNAPSHOT_READ_TRIES (1 << 12) /* reader gives up on slot being written, writer may be preempted in the middle */
+
+/**
+ * published state of one game slot, one cache line so publishing touches a single line
+ * protected by seqlock: writer makes seq odd, stores the fields and makes seq even again,
+ * reader copies the slot and retries if seq was odd or changed meanwhile
+ * seq - seqlock sequence, odd while the slot is written
+ * statusSeq - status sequence of the game the snapshot was taken at
+ * heaps - heaps of the game
+ * inUse - 1 if the slot holds running game
+ * gameType - game_type_t of the game
+ * heapsCnt - heaps in play
+ * current - client ID having the turn, SNAPSHOT_NO_CLIENT if none
+ * ended - 1 once the game is ended
+ * roster - client_status_t of clients indexed by client ID, SNAPSHOT_NO_CLIENT if ID is not in use
+ **/
+typedef struct game_snapshot {
+	unsigned int seq;
+	unsigned int statusSeq;
+	short heaps[SNAPSHOT_HEAPS];
+	unsigned char inUse;
+	unsigned char gameType;
+	unsigned char heapsCnt;
+	unsigned char current;
+	unsigned char ended;
+	unsigned char roster[SNAPSHOT_ROSTER];
+} __attribute__((aligned(64))) game_snapshot_t;
+
+/**
+ * header of snapshot region, followed by slotsCnt slots
+ * slotsCnt - number of game slots
+ * pid - server publishing to the region, successor on upgrade takes it over
+ * startedNs - time the region was created
+ **/
+typedef struct snapshot_header {
+	int magic;
+	int version;
+	int slotsCnt;
+	int pid;
+	long long startedNs;
+} __attribute__((aligned(64))) snapshot_header_t;
+
+/**
+ * snapshot region mapped from file, tmpfs file like /dev/shm/nim makes it plain shared memory
+ * header - mapped header
+ * slots - mapped slots after the header, indexed by game slot
+ * mapSize - size of the mapping
+ * published - snapshots published by this process
+ **/
+typedef struct snapshot_map {
+	snapshot_header_t * header;
+	game_snapshot_t * slots;
+	size_t mapSize;
+	long published;
+} snapshot_map_t;
+
+/* headers of snapshot functions */
+int snapshotCreate(snapshot_map_t * map, const char * path, int slotsCnt);
+
+int snapshotAttach(snapshot_map_t * map, const char * path);
+
+void snapshotClose(snapshot_map_t * map);
+
+game_snapshot_t * snapshotBegin(snapshot_map_t * map, int slot);
+
+void snapshotEnd(game_snapshot_t * snap);
+
+int snapshotRead(const snapshot_map_t * map, int slot, game_snapshot_t * copy);
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* for read(), ftruncate() */
+#include <sys/types.h> /* data types used in system calls */
+#include <sys/stat.h> /* fstat() */
+#include <sys/mman.h> /* mmap() */
+#include <fcntl.h> /* open() */
+#include <string.h> /* string functions */
+#include <errno.h> /* EEXIST */
+#include <pthread.h> /* solver threads */
+#include "transport.h" /* common data with client */
+#include "rules.h" /* game variant rules */
+#include "solver.h"
+
+#define SOLVER_MIN_CAPACITY (1024) /* entries of the smallest table */
+#define SOLVER_MAX_CAPACITY (1LL << 28) /* entries of the largest table, 2GB */
+
+/**
+ * work shared by solver threads
+ * table - table positions are solved into
+ * next - index of next chunk of positions, positions are numbered as heap tuples
+ * with first heap most significant, so small positions are solved first
+ * total - number of heap tuples
+ **/
+typedef struct solver_job {
+	solver_table_t * table;
+	long long next;
+	long long total;
+} solver_job_t;
+
+/**
+ * the function sorts the heaps in play in descending order, heaps after heapsCnt are zeroed
+ * positions that differ by heaps order only have the same canonical position
+ **/
+void solverCanonical(const short * heaps, int heapsCnt, short * canonical) {
+	int i, j;
+	for (i = 0; i < MAX_HEAPS; i++) {
+		canonical[i] = (i < heapsCnt) ? heaps[i] : 0;
+	}
+	for (i = 1; i < heapsCnt; i++) {
+		short heap = canonical[i];
+		for (j = i; j > 0 && canonical[j - 1] < heap; j--) {
+			canonical[j] = canonical[j - 1];
+		}
+		canonical[j] = heap;
+	}
+}
+
+/**
+ * the function packs canonical position into table key
+ **/
+unsigned long long positionKey(const short * canonical) {
+	unsigned long long key = 0;
+	int i;
+	for (i = 0; i < MAX_HEAPS; i++) {
+		key = (key << SOLVER_HEAP_BITS) | (unsigned short) canonical[i];
+	}
+	return key;
+}
+
+/**
+ * the function returns first entry index probed for the key, taken from high bits of
+ * multiplicative hash as low bits of the key are mostly the zero smallest heaps
+ **/
+unsigned long long keySlot(const solver_table_t * table, unsigned long long key) {
+	return (key * 0x9e3779b97f4a7c15ULL) >> (64 - __builtin_ctzll(table->header->capacity));
+}
+
+/**
+ * the function looks position up in the table
+ * returns SOLVER_UNKNOWN if position is not solved yet
+ **/
+solver_result_t tableGet(const solver_table_t * table, unsigned long long key) {
+	unsigned long long mask = table->header->capacity - 1;
+	unsigned long long slot = keySlot(table, key);
+	long long probes;
+	for (probes = 0; probes < table->header->capacity; probes++, slot = (slot + 1) & mask) {
+		unsigned long long entry = __atomic_load_n(&table->entries[slot], __ATOMIC_ACQUIRE);
+		if (entry == 0) {
+			return SOLVER_UNKNOWN;
+		}
+		if ((entry >> 2) == key) {
+			return (solver_result_t) (entry & 3);
+		}
+	}
+	return SOLVER_UNKNOWN;
+}
+
+/**
+ * the function stores solved position in the table, entries are never changed once written
+ * so thread that lost the race for the slot just keeps probing
+ * returns 0 if the table is full
+ **/
+int tablePut(solver_table_t * table, unsigned long long key, solver_result_t result) {
+	unsigned long long mask = table->header->capacity - 1;
+	unsigned long long slot = keySlot(table, key);
+	unsigned long long value = (key << 2) | result;
+	if (__atomic_load_n(&table->header->solvedCnt, __ATOMIC_RELAXED) >= table->header->capacity / 4 * 3) {
+		return 0; /* probe sequences would get too long */
+	}
+	long long probes;
+	for (probes = 0; probes < table->header->capacity; probes++, slot = (slot + 1) & mask) {
+		unsigned long long entry = __atomic_load_n(&table->entries[slot], __ATOMIC_ACQUIRE);
+		if (entry == 0 && __atomic_compare_exchange_n(&table->entries[slot], &entry, value, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+			__atomic_fetch_add(&table->header->solvedCnt, 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+		if ((entry >> 2) == key) {
+			return 1; /* solved by another thread meanwhile */
+		}
+	}
+	return 0;
+}
+
+/**
+ * the function solves canonical position by searching all moves enumerated by the rules,
+ * solved positions are memoized
+ **/
+solver_result_t solvePosition(solver_table_t * table, const short * canonical) {
+	unsigned long long key = positionKey(canonical);
+	solver_result_t result = tableGet(table, key);
+	if (result != SOLVER_UNKNOWN) {
+		return result;
+	}
+	const rules_t * rules = &table->rules;
+	if (rulesIsGameEnd(rules, canonical)) {
+		/* previous player took the last cube */
+		result = (rules->lastMoverEnd == YOU_WIN) ? SOLVER_LOSS : SOLVER_WIN;
+	} else {
+		result = SOLVER_LOSS;
+		move_iter_t iter = { 0, 0, 0 };
+		short child[MAX_HEAPS], next[MAX_HEAPS];
+		while (result == SOLVER_LOSS && rulesNextChild(rules, canonical, &iter, child)) {
+			solverCanonical(child, rules->heapsCnt, next);
+			if (solvePosition(table, next) == SOLVER_LOSS) {
+				result = SOLVER_WIN;
+			}
+		}
+	}
+	tablePut(table, key, result);
+	return result;
+}
+
+/**
+ * solver thread - solves chunks of positions till all are taken
+ **/
+void * solverThread(void * arg) {
+	solver_job_t * job = (solver_job_t *) arg;
+	int heapsCnt = job->table->rules.heapsCnt, maxHeap = job->table->header->maxHeap;
+	long long first;
+	while ((first = __atomic_fetch_add(&job->next, SOLVER_CHUNK, __ATOMIC_RELAXED)) < job->total) {
+		long long index;
+		for (index = first; index < first + SOLVER_CHUNK && index < job->total; index++) {
+			short heaps[MAX_HEAPS] = { 0 };
+			long long rest = index;
+			int i, isCanonical = 1;
+			for (i = heapsCnt - 1; i >= 0; i--) {
+				heaps[i] = rest % (maxHeap + 1);
+				rest /= maxHeap + 1;
+			}
+			for (i = 1; i < heapsCnt; i++) {
+				if (heaps[i] > heaps[i - 1]) {
+					isCanonical = 0;
+				}
+			}
+			if (isCanonical) {
+				solvePosition(job->table, heaps);
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * the function solves all positions with heaps up to maxHeap by threadsCnt threads
+ **/
+void solveAll(solver_table_t * table, int threadsCnt) {
+	solver_job_t job = { table, 0, 1 };
+	pthread_t threads[threadsCnt];
+	int i, started = 0;
+	for (i = 0; i < table->rules.heapsCnt; i++) {
+		job.total *= table->header->maxHeap + 1;
+	}
+	for (i = 1; i < threadsCnt; i++) {
+		if (pthread_create(&threads[started], NULL, solverThread, &job) == 0) {
+			started++;
+		}
+	}
+	solverThread(&job);
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+/**
+ * the function returns table capacity for positions with heapsCnt heaps up to maxHeap:
+ * number of canonical positions C(maxHeap + heapsCnt, heapsCnt) doubled and rounded up to power of 2
+ * returns 0 if the table would be larger than SOLVER_MAX_CAPACITY
+ **/
+long long tableCapacity(int heapsCnt, int maxHeap) {
+	long double positionsCnt = 1;
+	int i;
+	for (i = 1; i <= heapsCnt; i++) {
+		positionsCnt = positionsCnt * (maxHeap + i) / i;
+	}
+	long long capacity = SOLVER_MIN_CAPACITY;
+	while (capacity < 2 * positionsCnt) {
+		if (capacity >= SOLVER_MAX_CAPACITY) {
+			return 0;
+		}
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+/**
+ * the function maps table of the rules from file, file solved before for the same rules and
+ * at least maxHeap is only mapped, otherwise all positions with heaps up to maxHeap are solved
+ * by threadsCnt threads and saved, path NULL keeps the table in memory only
+ * file of other content than table of the same rules is never overwritten
+ * returns 0 on error, errno is EEXIST if the file is not table of the rules
+ **/
+int solverOpen(solver_table_t * table, const char * path, game_type_t gameType, move_set_t moveSet, int heapsCnt, int maxTake, int maxHeap, int threadsCnt) {
+	memset(table, 0, sizeof(solver_table_t));
+	long long capacity = tableCapacity(heapsCnt, maxHeap);
+	if (!initRules(&table->rules, gameType, moveSet, heapsCnt, maxTake) || maxHeap < 0 || maxHeap >= (1 << SOLVER_HEAP_BITS) || capacity == 0) {
+		return 0;
+	}
+	size_t mapSize = sizeof(solver_header_t) + capacity * sizeof(unsigned long long);
+	int fd = -1;
+	if (path != NULL) {
+		solver_header_t header;
+		struct stat fileStat;
+		if ((fd = open(path, O_RDWR | O_CREAT, 0644)) == -1) {
+			return 0;
+		}
+		ssize_t readCnt = read(fd, &header, sizeof(header));
+		/* magic is 0 while the table is being solved */
+		int sameRules = readCnt == sizeof(header) && (header.magic == SOLVER_MAGIC || header.magic == 0) && header.version == SOLVER_VERSION
+				&& header.gameType == gameType && header.moveSet == moveSet && header.heapsCnt == heapsCnt && header.maxTake == maxTake;
+		if (sameRules && header.magic == SOLVER_MAGIC && header.maxHeap >= maxHeap && fstat(fd, &fileStat) == 0
+				&& fileStat.st_size == sizeof(solver_header_t) + header.capacity * sizeof(unsigned long long)) {
+			mapSize = fileStat.st_size;
+			table->loaded = 1;
+		} else if (readCnt != 0 && !sameRules) {
+			close(fd);
+			errno = EEXIST;
+			return 0;
+		} else if (ftruncate(fd, 0) == -1 || ftruncate(fd, mapSize) == -1) {
+			close(fd);
+			return 0;
+		}
+	}
+	void * map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, (fd == -1) ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED, fd, 0);
+	if (fd != -1) {
+		close(fd);
+	}
+	if (map == MAP_FAILED) {
+		return 0;
+	}
+	table->header = (solver_header_t *) map;
+	table->entries = (unsigned long long *) (table->header + 1);
+	table->mapSize = mapSize;
+	if (!table->loaded) {
+		solver_header_t header = { 0, SOLVER_VERSION, gameType, moveSet, heapsCnt, maxTake, maxHeap, capacity, 0 };
+		*table->header = header;
+		solveAll(table, (threadsCnt > 0) ? threadsCnt : 1);
+		/* table is valid only once fully solved */
+		table->header->magic = SOLVER_MAGIC;
+		if (path != NULL && msync(map, mapSize, MS_SYNC) == -1) {
+			solverClose(table);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * the function creates empty in memory table of capacity entries, power of 2,
+ * positions are solved on demand by solverResult
+ * returns 0 on error
+ **/
+int solverCreate(solver_table_t * table, game_type_t gameType, move_set_t moveSet, int heapsCnt, int maxTake, long long capacity) {
+	memset(table, 0, sizeof(solver_table_t));
+	if (!initRules(&table->rules, gameType, moveSet, heapsCnt, maxTake) || capacity < SOLVER_MIN_CAPACITY || capacity > SOLVER_MAX_CAPACITY || (capacity & (capacity - 1)) != 0) {
+		return 0;
+	}
+	size_t mapSize = sizeof(solver_header_t) + capacity * sizeof(unsigned long long);
+	void * map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		return 0;
+	}
+	table->header = (solver_header_t *) map;
+	table->entries = (unsigned long long *) (table->header + 1);
+	table->mapSize = mapSize;
+	solver_header_t header = { SOLVER_MAGIC, SOLVER_VERSION, gameType, moveSet, heapsCnt, maxTake, -1, capacity, 0 };
+	*table->header = header;
+	return 1;
+}
+
+/**
+ * the function unmaps the table
+ **/
+void solverClose(solver_table_t * table) {
+	if (table->header != NULL) {
+		munmap(table->header, table->mapSize);
+		table->header = NULL;
+		table->entries = NULL;
+	}
+}
+
+/**
+ * the function returns value of the position for the player to move,
+ * positions beyond solved heaps are searched and added if all canonical positions with
+ * heaps up to its largest heap fit the room left in the table, search that can't be memoized never ends
+ **/
+solver_result_t solverResult(solver_table_t * table, const short * heaps) {
+	short canonical[MAX_HEAPS];
+	int i;
+	for (i = 0; i < table->rules.heapsCnt; i++) {
+		if (heaps[i] < 0 || heaps[i] >= (1 << SOLVER_HEAP_BITS)) {
+			return SOLVER_UNKNOWN;
+		}
+	}
+	solverCanonical(heaps, table->rules.heapsCnt, canonical);
+	solver_result_t result = tableGet(table, positionKey(canonical));
+	long double reachableCnt = 1;
+	for (i = 1; i <= table->rules.heapsCnt; i++) {
+		reachableCnt = reachableCnt * (canonical[0] + i) / i;
+	}
+	if (result == SOLVER_UNKNOWN && __atomic_load_n(&table->header->solvedCnt, __ATOMIC_RELAXED) + reachableCnt < table->header->capacity / 4 * 3) {
+		result = solvePosition(table, canonical);
+	}
+	return result;
+}
@@ -0,0 +1,65 @@
+#define SOLVER_MAGIC 0x4e494d53 /* "NIMS" */
+#define SOLVER_VERSION 2 /* layout of the table file */
+#define SOLVER_HEAP_BITS (15) /* bits of one heap in position key, heaps are positive shorts */
+#define SOLVER_CHUNK (1024) /* positions taken by solver thread at once */
+
+/**
+ * definition of position values for the player to move:
+ * SOLVER_UNKNOWN - position is not in the table and the table is full
+ * SOLVER_LOSS - every move leads to position winning for the opponent
+ * SOLVER_WIN - some move leads to position losing for the opponent
+ **/
+typedef enum {
+	SOLVER_UNKNOWN, SOLVER_LOSS, SOLVER_WIN
+} solver_result_t;
+
+/**
+ * header of table file, followed by capacity entries
+ * gameType, moveSet, heapsCnt, maxTake - rules the table is solved for
+ * maxHeap - all positions with heaps up to maxHeap are solved, -1 if positions are solved on demand only
+ * capacity - number of entries, power of 2
+ * solvedCnt - number of entries in use
+ **/
+typedef struct solver_header {
+	int magic;
+	int version;
+	int gameType;
+	int moveSet;
+	int heapsCnt;
+	int maxTake;
+	int maxHeap;
+	long long capacity;
+	long long solvedCnt;
+} solver_header_t;
+
+/**
+ * transposition table mapped from file or anonymous memory
+ * entries are open addressed, written once by compare and swap, so solver threads
+ * and processes sharing the file need no locks:
+ * entry is 0 if empty, key of canonical position << 2 | solver_result_t otherwise
+ * header - mapped header
+ * entries - mapped entries after the header
+ * mapSize - size of the mapping
+ * rules - rules positions are solved by
+ * loaded - 1 if the table was solved before and only loaded
+ **/
+typedef struct solver_table {
+	solver_header_t * header;
+	unsigned long long * entries;
+	size_t mapSize;
+	rules_t rules;
+	int loaded;
+} solver_table_t;
+
+/* headers of solver functions */
+void solverCanonical(const short * heaps, int heapsCnt, short * canonical);
+
+unsigned long long positionKey(const short * canonical);
+
+int solverOpen(solver_table_t * table, const char * path, game_type_t gameType, move_set_t moveSet, int heapsCnt, int maxTake, int maxHeap, int threadsCnt);
+
+int solverCreate(solver_table_t * table, game_type_t gameType, move_set_t moveSet, int heapsCnt, int maxTake, long long capacity);
+
+void solverClose(solver_table_t * table);
+
+solver_result_t solverResult(solver_table_t * table, const short * heaps);
@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> /* memset() */
+#include <sys/types.h> /* data types used in system calls */
+#include <sys/select.h> /* fd_set */
+#include "transport.h" /* common data with client */
+#include "rules.h" /* game variant rules */
+#include "admission.h" /* load shedding */
+#include "nim-server.h" /* games and clients */
+#include "latency.h" /* nowNs() */
+#include "rating.h" /* player ratings */
+#include "tournament.h"
+
+tournament_t tournaments[MAX_TOURNAMENTS]; /* tournament slots */
+int tournamentsActive = 0; /* tournaments registering or running */
+long tournamentsFinished = 0; /* tournaments played to the end */
+long tournamentGames = 0; /* games of tournaments started */
+long tournamentByes = 0; /* rounds entrants had no opponent */
+long tournamentForfeits = 0; /* games won as opponent withdrew */
+
+/**
+ * the function takes free tournament slot and opens registration in it
+ * rounds 0 plays round robin, other number of rounds plays swiss
+ * returns NULL if all slots are in use or there is no memory
+ **/
+tournament_t * tournamentOpen(int size, int rounds, game_type_t gameType, int cubes) {
+	tournament_t * tournament = NULL;
+	int i;
+	for (i = 0; i < MAX_TOURNAMENTS && tournament == NULL; i++) {
+		if (tournaments[i].state == TOURNAMENT_FREE) {
+			tournament = &tournaments[i];
+		}
+	}
+	if (tournament == NULL || size < 2 || size > TOURNAMENT_MAX_ENTRANTS) {
+		return NULL;
+	}
+	memset(tournament, 0, sizeof(tournament_t));
+	tournament->kind = (rounds == 0) ? ROUND_ROBIN : SWISS;
+	tournament->gameType = gameType;
+	tournament->cubes = cubes;
+	tournament->size = size;
+	/* odd number of entrants has one bye in each round */
+	tournament->rounds = (rounds == 0 || rounds > size - 1 + size % 2) ? size - 1 + size % 2 : rounds;
+	tournament->entrants = (entrant_t *) calloc(size, sizeof(entrant_t));
+	tournament->pairings = (pairing_t *) calloc(size / 2 + 1, sizeof(pairing_t));
+	tournament->order = (int *) calloc(size, sizeof(int));
+	if (tournament->kind == SWISS) {
+		tournament->opponents = (int *) malloc(sizeof(int) * size * tournament->rounds);
+	}
+	if (tournament->entrants == NULL || tournament->pairings == NULL || tournament->order == NULL || (tournament->kind == SWISS && tournament->opponents == NULL)) {
+		free(tournament->entrants);
+		free(tournament->pairings);
+		free(tournament->order);
+		free(tournament->opponents);
+		return NULL;
+	}
+	tournament->state = TOURNAMENT_REGISTERING;
+	tournamentsActive++;
+	return tournament;
+}
+
+/**
+ * the function releases tournament slot, its entrants stay connected in lobby
+ **/
+void tournamentFree(tournament_t * tournament) {
+	int i;
+	for (i = 0; i < tournament->entrantsCnt; i++) {
+		if (tournament->entrants[i].client != NULL) {
+			tournament->entrants[i].client->ext->tournament = NULL;
+		}
+	}
+	free(tournament->entrants);
+	free(tournament->pairings);
+	free(tournament->order);
+	free(tournament->opponents);
+	memset(tournament, 0, sizeof(tournament_t));
+	tournamentsActive--;
+}
+
+/**
+ * the function enrolls client in registering tournament or opens new one,
+ * tournament is paired as soon as it is full
+ * returns tournament the client entered, NULL if no tournament can be opened or there is no memory
+ **/
+tournament_t * tournamentEnroll(client_t * client, int size, int rounds, game_type_t gameType, int cubes) {
+	client_ext_t * ext = clientExt(client);
+	tournament_t * tournament = NULL;
+	int i;
+	if (ext == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < MAX_TOURNAMENTS && tournament == NULL; i++) {
+		if (tournaments[i].state == TOURNAMENT_REGISTERING) {
+			tournament = &tournaments[i];
+		}
+	}
+	if (tournament == NULL && (tournament = tournamentOpen(size, rounds, gameType, cubes)) == NULL) {
+		return NULL;
+	}
+	entrant_t * entrant = &tournament->entrants[tournament->entrantsCnt];
+	entrant->client = client;
+	entrant->playerId = ext->playerId;
+	entrant->ratingIdx = ratingFind(&ratings, ext->playerId);
+	entrant->seed = ratingValue(&ratings, entrant->ratingIdx);
+	entrant->points = 0;
+	entrant->byes = 0;
+	ext->tournament = tournament;
+	ext->entrant = tournament->entrantsCnt++;
+	if (tournament->entrantsCnt == tournament->size) {
+		tournament->state = TOURNAMENT_RUNNING;
+		tournamentPair(tournament);
+	}
+	return tournament;
+}
+
+/* tournament ranked by tournamentCompare */
+static tournament_t * rankedTournament;
+
+/**
+ * the function orders entrants by points, then by seed, then by enrollment
+ **/
+int tournamentCompare(const void * a, const void * b) {
+	const entrant_t * first = &rankedTournament->entrants[*(const int *) a];
+	const entrant_t * second = &rankedTournament->entrants[*(const int *) b];
+	if (first->points != second->points) {
+		return (first->points > second->points) ? -1 : 1;
+	}
+	if (first->seed != second->seed) {
+		return (first->seed > second->seed) ? -1 : 1;
+	}
+	return *(const int *) a - *(const int *) b;
+}
+
+/**
+ * the function ranks entrants into order
+ **/
+void tournamentRank(tournament_t * tournament) {
+	int i;
+	for (i = 0; i < tournament->size; i++) {
+		tournament->order[i] = i;
+	}
+	rankedTournament = tournament;
+	qsort(tournament->order, tournament->size, sizeof(int), tournamentCompare);
+}
+
+/**
+ * the function checks if entrants met in previous rounds of swiss tournament
+ **/
+int tournamentMet(tournament_t * tournament, int first, int second) {
+	int round;
+	for (round = 0; round < tournament->round - 1; round++) {
+		if (tournament->opponents[first * tournament->rounds + round] == second) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * the function adds pairing to current round, second -1 for bye
+ **/
+void tournamentAddPairing(tournament_t * tournament, int first, int second) {
+	pairing_t * pairing = &tournament->pairings[tournament->pairingsCnt++];
+	pairing->first = first;
+	pairing->second = second;
+	pairing->game = NULL;
+	pairing->done = 0;
+	if (tournament->opponents != NULL) {
+		tournament->opponents[first * tournament->rounds + tournament->round - 1] = second;
+		if (second != -1) {
+			tournament->opponents[second * tournament->rounds + tournament->round - 1] = first;
+		}
+	}
+}
+
+/**
+ * the function returns entrant at position of round robin circle in round counted from 0,
+ * position 0 stays, the others rotate by one each round
+ **/
+int tournamentCircle(int position, int round, int circle) {
+	return (position == 0) ? 0 : (position - 1 + round) % (circle - 1) + 1;
+}
+
+/**
+ * the function pairs next round, games are started by tournamentRun
+ * round robin pairs all entrants by the circle, withdrawn ones forfeit,
+ * swiss pairs entrants still in from the top of the ranking, each with the best ranked one it didn't meet,
+ * lowest ranked entrant without bye has bye if their number is odd
+ **/
+void tournamentPair(tournament_t * tournament) {
+	tournament->round++;
+	tournament->pairingsCnt = 0;
+	tournament->nextPairing = 0;
+	int i, j;
+	if (tournament->kind == ROUND_ROBIN) {
+		int circle = tournament->size + tournament->size % 2;
+		for (i = 0; i < circle / 2; i++) {
+			int first = tournamentCircle(i, tournament->round - 1, circle);
+			int second = tournamentCircle(circle - 1 - i, tournament->round - 1, circle);
+			if (first >= tournament->size) { /* entrant paired with the missing one has bye */
+				tournamentAddPairing(tournament, second, -1);
+			} else {
+				tournamentAddPairing(tournament, first, (second >= tournament->size) ? -1 : second);
+			}
+		}
+		tournament->pairingsLeft = tournament->pairingsCnt;
+		return;
+	}
+	tournamentRank(tournament);
+	int * order = tournament->order;
+	int activeCnt = 0;
+	for (i = 0; i < tournament->size; i++) {
+		if (tournament->entrants[order[i]].client != NULL) {
+			order[activeCnt++] = order[i];
+		}
+	}
+	if (activeCnt % 2 == 1) {
+		int bye = activeCnt - 1;
+		while (bye >= 0 && tournament->entrants[order[bye]].byes > 0) {
+			bye--;
+		}
+		if (bye < 0) { /* everybody had bye already */
+			bye = activeCnt - 1;
+		}
+		tournamentAddPairing(tournament, order[bye], -1);
+		memmove(&order[bye], &order[bye + 1], sizeof(int) * (activeCnt - bye - 1));
+		activeCnt--;
+	}
+	for (i = 0; i < activeCnt; i++) {
+		if (order[i] == -1) { /* paired already */
+			continue;
+		}
+		int opponent = -1;
+		for (j = i + 1; j < activeCnt; j++) {
+			if (order[j] == -1) {
+				continue;
+			}
+			if (opponent == -1) { /* rematch if all the rest were met */
+				opponent = j;
+			}
+			if (!tournamentMet(tournament, order[i], order[j])) {
+				opponent = j;
+				break;
+			}
+		}
+		tournamentAddPairing(tournament, order[i], order[opponent]);
+		order[i] = -1;
+		order[opponent] = -1;
+	}
+	tournament->pairingsLeft = tournament->pairingsCnt;
+}
+
+/**
+ * the function ends the round and sends standings to entrants, rating period is not closed
+ * as it batches results of lobby games and other tournaments too
+ * tournament ends after its last round or once less than two entrants are left
+ **/
+void tournamentFinishRound(tournament_t * tournament) {
+	tournamentRank(tournament);
+	game_msg_t msg;
+	memset(&msg, 0, sizeof(game_msg_t));
+	msg.type = STANDING;
+	msg.payload.standing.round = tournament->round;
+	msg.payload.standing.rounds = tournament->rounds;
+	msg.payload.standing.entrants = tournament->size;
+	int activeCnt = 0;
+	int i;
+	for (i = 0; i < tournament->size; i++) {
+		if (tournament->entrants[i].client != NULL) {
+			activeCnt++;
+		}
+	}
+	int isLast = (tournament->round >= tournament->rounds || activeCnt < 2);
+	if (isLast) { /* standing of the last round tells tournament is over */
+		msg.payload.standing.rounds = tournament->round;
+	}
+	int place = 1;
+	for (i = 0; i < tournament->size; i++) {
+		entrant_t * entrant = &tournament->entrants[tournament->order[i]];
+		if (i > 0 && entrant->points < tournament->entrants[tournament->order[i - 1]].points) {
+			place = i + 1;
+		}
+		client_t * client = entrant->client;
+		if (client == NULL) {
+			continue;
+		}
+		msg.payload.standing.place = place;
+		msg.payload.standing.points = entrant->points;
+		msg.payload.standing.rating = ratingValue(&ratings, entrant->ratingIdx);
+		if (!sendRecorded(&client->sock, &msg)) { /* entrant withdraws, entrants list stays */
+			onClientDisconnect(client);
+		}
+	}
+	if (isLast) {
+		tournamentsFinished++;
+		tournamentFree(tournament);
+	} else {
+		tournamentPair(tournament);
+	}
+}
+
+/**
+ * the function starts games of pairings waiting for game slots, settles byes and forfeits
+ * and moves to the next round once all games of the round ended
+ **/
+void tournamentRun(tournament_t * tournament) {
+	while (tournament->state == TOURNAMENT_RUNNING) {
+		while (tournament->nextPairing < tournament->pairingsCnt) {
+			pairing_t * pairing = &tournament->pairings[tournament->nextPairing];
+			entrant_t * first = &tournament->entrants[pairing->first];
+			entrant_t * second = (pairing->second != -1) ? &tournament->entrants[pairing->second] : NULL;
+			if (second == NULL || first->client == NULL || second->client == NULL) { /* bye or forfeit */
+				if (second == NULL) {
+					first->byes++;
+					tournamentByes++;
+				} else if (first->client != NULL || second->client != NULL) {
+					tournamentForfeits++;
+				}
+				entrant_t * winner = (first->client != NULL) ? first : second;
+				if (winner != NULL && winner->client != NULL) {
+					winner->points++;
+				}
+				pairing->done = 1;
+				tournament->pairingsLeft--;
+				tournament->nextPairing++;
+				continue;
+			}
+			game_t * game = createGame(tournament->gameType, 2, tournament->cubes);
+			if (game == NULL) { /* pairings wait for games of other rounds and lobby to end */
+				return;
+			}
+			game->tournament = tournament;
+			game->pairing = tournament->nextPairing++;
+			pairing->game = game;
+			/* entrants take turns to move first */
+			addClientToGame(game, (tournament->round % 2 == 1) ? first->client : second->client, PLAYING);
+			addClientToGame(game, (tournament->round % 2 == 1) ? second->client : first->client, PLAYING);
+			game->seatTokens[0] = 0; /* entrant that disconnects forfeits, its seat is not held */
+			game->seatTokens[1] = 0;
+			setNextPlayerAsCurrent(game);
+			tournamentGames++;
+			int id;
+			for (id = 0; id < 2; id++) {
+				if (game->clientList[id] != NULL) {
+					sendGameIntro(game->clientList[id]);
+				}
+			}
+		}
+		if (tournament->pairingsLeft > 0) {
+			return;
+		}
+		tournamentFinishRound(tournament);
+	}
+}
+
+/**
+ * the function runs all tournaments, called once in loop iteration after ended games released their slots
+ **/
+void tournamentsRun() {
+	int i;
+	for (i = 0; i < MAX_TOURNAMENTS && tournamentsActive > 0; i++) {
+		if (tournaments[i].state == TOURNAMENT_RUNNING) {
+			tournamentRun(&tournaments[i]);
+		}
+	}
+}
+
+/**
+ * the function records result of ended tournament game and takes its players out of it,
+ * they wait in lobby for the next round, the empty game is released by the main loop
+ **/
+void tournamentGameOver(game_t * game, client_t * winner) {
+	tournament_t * tournament = game->tournament;
+	pairing_t * pairing = &tournament->pairings[game->pairing];
+	entrant_t * first = &tournament->entrants[pairing->first];
+	entrant_t * second = &tournament->entrants[pairing->second];
+	entrant_t * won = (winner == first->client) ? first : second;
+	entrant_t * lost = (won == first) ? second : first;
+	won->points++;
+	ratingResult(&ratings, won->ratingIdx, lost->ratingIdx);
+	int id;
+	for (id = 0; id < MAX_ID; id++) {
+		client_t * client = game->clientList[id];
+		if (client != NULL) {
+			setClientStatus(client, UNKNOWN);
+			removeClientFromGame(game, id);
+			client->game = NULL;
+			client->id = CLIENT_ID_INVALID;
+		}
+	}
+	game->timedClient = NULL;
+	game->tournament = NULL;
+	game->resultRecorded = 1;
+	pairing->game = NULL;
+	pairing->done = 1;
+	tournament->pairingsLeft--;
+}
+
+/**
+ * the function takes disconnecting client out of its tournament
+ * entrant of registering tournament is removed, entrant of running one stays in standings and gets no more games,
+ * its running game is forfeited - the opponent wins unless the game ended by its last move already
+ **/
+void tournamentWithdraw(client_t * client) {
+	client_ext_t * ext = client->ext;
+	tournament_t * tournament = ext->tournament;
+	ext->tournament = NULL;
+	if (tournament->state == TOURNAMENT_REGISTERING) {
+		entrant_t * last = &tournament->entrants[--tournament->entrantsCnt];
+		tournament->entrants[ext->entrant] = *last;
+		if (last->client != client) {
+			last->client->ext->entrant = ext->entrant;
+		}
+		if (tournament->entrantsCnt == 0) {
+			tournamentFree(tournament);
+		}
+		return;
+	}
+	tournament->entrants[ext->entrant].client = NULL;
+	game_t * game = client->game;
+	if (game == NULL || game->tournament != tournament) {
+		return;
+	}
+	client_t * opponent = game->clientList[1 - client->id];
+	if (opponent == NULL) {
+		return;
+	}
+	end_game_t endGame = YOU_WIN;
+	if (checkGameEnd(game)) { /* final status is not broadcast yet, rules decide the game */
+		endGame = (getCurrentPlayer(game) == opponent) ? game->rules.lastMoverEnd : game->rules.othersEnd;
+	} else {
+		tournamentForfeits++;
+	}
+	tournamentGameOver(game, (endGame == YOU_WIN) ? opponent : client);
+	game->statusSeq++;
+	game_msg_t * statusMsg = createStatusMsg(game, 1, -1, PLAYING, endGame);
+	if (!sendRecorded(&opponent->sock, statusMsg)) {
+		onClientDisconnect(opponent);
+	}
+	destroyMsg(&statusMsg);
+}
+
+/**
+ * the function looks up ratings of entrants of tournaments handed over by previous server,
+ * called once ratings are open
+ **/
+void tournamentsRateEntrants() {
+	int i, j;
+	for (i = 0; i < MAX_TOURNAMENTS; i++) {
+		for (j = 0; j < tournaments[i].entrantsCnt; j++) {
+			tournaments[i].entrants[j].ratingIdx = ratingFind(&ratings, tournaments[i].entrants[j].playerId);
+		}
+	}
+}
+
+/**
+ * the function prints tournament counters
+ **/
+void tournamentsPrintStats(FILE * out) {
+	fprintf(out, "tournaments active=%d finished=%ld games=%ld byes=%ld forfeits=%ld\n", tournamentsActive, tournamentsFinished, tournamentGames, tournamentByes, tournamentForfeits);
+}
@@ -0,0 +1,114 @@
+#define MAX_TOURNAMENTS (16) /* tournaments registering or running at once */
+#define TOURNAMENT_MAX_ENTRANTS (65535) /* entrants of one tournament, standings carry them as unsigned short */
+
+/**
+ * tournament kinds:
+ * ROUND_ROBIN - every entrant plays every other one, rounds are made by circle method
+ * SWISS - entrants with equal points are paired for fixed number of rounds, rematches are avoided
+ **/
+typedef enum {
+	ROUND_ROBIN, SWISS
+} tournament_kind_t;
+
+/**
+ * tournament states:
+ * TOURNAMENT_FREE - slot is not used
+ * TOURNAMENT_REGISTERING - entrants are enrolled until the tournament is full
+ * TOURNAMENT_RUNNING - rounds are played
+ **/
+typedef enum {
+	TOURNAMENT_FREE, TOURNAMENT_REGISTERING, TOURNAMENT_RUNNING
+} tournament_state_t;
+
+/**
+ * entrant of tournament
+ * client - client of the entrant, NULL once it withdrew
+ * playerId - identity the entrant is rated by, 0 if anonymous
+ * ratingIdx - entry of the entrant in ratings table, -1 if not rated
+ * seed - rating at enrollment, orders entrants with equal points
+ * points - games won, byes and forfeits of opponents
+ * byes - rounds the entrant had no opponent
+ **/
+typedef struct entrant {
+	client_t * client;
+	unsigned int playerId;
+	int ratingIdx;
+	unsigned short seed;
+	unsigned short points;
+	unsigned short byes;
+} entrant_t;
+
+/**
+ * pairing of round
+ * first, second - entrants of the game, second -1 for bye
+ * game - game the pairing is played in, NULL before it starts and after it ends
+ * done - 1 once the result is in
+ **/
+typedef struct pairing {
+	int first;
+	int second;
+	game_t * game;
+	char done;
+} pairing_t;
+
+/**
+ * tournament played in lobby games of two players
+ * rounds are played one after another, games of a round run concurrently as game slots allow,
+ * round ends when its last game ends, results are rated in the timed rating period shared with lobby games
+ * state - tournament_state_t
+ * kind - ROUND_ROBIN or SWISS
+ * gameType, cubes - variant and heap size of the games
+ * size - entrants the tournament starts with
+ * entrantsCnt - entrants enrolled
+ * rounds - number of rounds
+ * round - current round counted from 1, 0 while registering
+ * entrants - enrolled entrants
+ * opponents - entrant i met opponents[i * rounds + round - 1] in round, -1 for bye,
+ * NULL for round robin whose rounds follow from the circle
+ * pairings - pairings of current round
+ * pairingsCnt - number of pairings of current round
+ * nextPairing - first pairing of current round waiting for game slot
+ * pairingsLeft - pairings of current round without result
+ * order - entrants ranked by points and seed, scratch of pairing and standings
+ **/
+typedef struct Tournament {
+	tournament_state_t state;
+	tournament_kind_t kind;
+	game_type_t gameType;
+	int cubes;
+	int size;
+	int entrantsCnt;
+	int rounds;
+	int round;
+	entrant_t * entrants;
+	int * opponents;
+	pairing_t * pairings;
+	int pairingsCnt;
+	int nextPairing;
+	int pairingsLeft;
+	int * order;
+} tournament_t;
+
+/* server state of tournaments */
+extern tournament_t tournaments[MAX_TOURNAMENTS];
+extern int tournamentsActive;
+extern rating_table_t ratings;
+
+/* headers of tournament functions */
+tournament_t * tournamentOpen(int size, int rounds, game_type_t gameType, int cubes);
+
+void tournamentsRateEntrants();
+
+tournament_t * tournamentEnroll(client_t * client, int size, int rounds, game_type_t gameType, int cubes);
+
+void tournamentRun(tournament_t * tournament);
+
+void tournamentsRun();
+
+void tournamentGameOver(game_t * game, client_t * winner);
+
+void tournamentWithdraw(client_t * client);
+
+void tournamentPair(tournament_t * tournament);
+
+void tournamentsPrintStats(FILE * out);
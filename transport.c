@@ -1,13 +1,199 @@
+#define _GNU_SOURCE /* sendmmsg() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h> /* for read(), write() */
 #include <sys/types.h> /* data types used in system calls */
 #include <sys/socket.h> /* definitions of structures needed for sockets */
 #include <netinet/in.h> /* constants and structures needed for Internet domain addresses */
+#include <netinet/tcp.h> /* TCP_NODELAY */
+#include <stddef.h> /* offsetof */
 #include <assert.h>
 #include <errno.h> /* error messages */
 #include <string.h> /* string functions */
+#include <sys/epoll.h> /* epoll_ctl() */
 #include "transport.h" /* common data with client */
+#include "latency.h" /* nowNs() */
+
+buffer_pool_t bufferPool; /* I/O buffers of buffered sockets */
+
+/**
+ * the function takes buffer from the pool, pool grows by a slab when empty
+ * returns NULL if no memory
+ **/
+char * poolAttach() {
+	if (bufferPool.freeList == NULL) {
+		char * slab = (char *) malloc(POOL_BUFFER_SIZE * POOL_SLAB_BUFFERS);
+		if (slab == NULL) {
+			return NULL;
+		}
+		int i;
+		for (i = 0; i < POOL_SLAB_BUFFERS; i++) {
+			poolRelease(slab + i * POOL_BUFFER_SIZE);
+			bufferPool.inUse++;
+		}
+		bufferPool.slabsCnt++;
+	}
+	char * buffer = bufferPool.freeList;
+	bufferPool.freeList = *(char **) buffer;
+	bufferPool.inUse++;
+	return buffer;
+}
+
+/**
+ * the function returns buffer to the pool
+ **/
+void poolRelease(char * buffer) {
+	*(char **) buffer = bufferPool.freeList;
+	bufferPool.freeList = buffer;
+	bufferPool.inUse--;
+}
+
+/**
+ * the function puts session at the end of pending list of its link
+ **/
+void linkPending(buffered_socket_t * socket) {
+	socket_mux_t * linkMux = socket->link->mux;
+	if (linkMux->pendingTail != NULL) {
+		linkMux->pendingTail->mux->pendingNext = socket;
+	} else {
+		linkMux->pendingHead = socket;
+	}
+	linkMux->pendingTail = socket;
+}
+
+/**
+ * the function takes session out of pending list of its link
+ **/
+void unlinkPending(buffered_socket_t * socket) {
+	socket_mux_t * linkMux = socket->link->mux;
+	buffered_socket_t ** prev = &linkMux->pendingHead;
+	buffered_socket_t * last = NULL;
+	while (*prev != socket) {
+		last = *prev;
+		prev = &(*prev)->mux->pendingNext;
+	}
+	*prev = socket->mux->pendingNext;
+	if (linkMux->pendingTail == socket) {
+		linkMux->pendingTail = last;
+	}
+	socket->mux->pendingNext = NULL;
+}
+
+/**
+ * the function returns buffers of the socket to the pool
+ * buffered data is dropped, session is taken out of pending list of its link and its backlog is freed
+ **/
+void releaseBuffers(buffered_socket_t * socket) {
+	if (socket->link != NULL) {
+		if (SESSION_PENDING(socket)) {
+			unlinkPending(socket);
+		}
+		free(socket->mux->backlog);
+		socket->mux->backlog = NULL;
+		socket->mux->backlogLen = 0;
+		socket->mux->backlogCap = 0;
+	}
+	if (socket->rxBuff != NULL) {
+		poolRelease(socket->rxBuff);
+		socket->rxBuff = NULL;
+	}
+	if (socket->txBuff != NULL) {
+		poolRelease(socket->txBuff);
+		socket->txBuff = NULL;
+	}
+	socket->rxBuffPos = 0;
+	socket->txBuffPos = 0;
+	socket->statusPending = 0;
+	pollerUnwaitWrite(socket);
+}
+
+/**
+ * the function registers socket with its poller for read readiness
+ * returns 0 on error
+ **/
+int pollerWatch(buffered_socket_t * socket) {
+	socket_poller_t * poller = socket->poller;
+	if (poller == NULL || poller->epollFd == -1) {
+		return 1;
+	}
+	struct epoll_event event = { EPOLLIN, { .fd = socket->socket } };
+	return epoll_ctl(poller->epollFd, EPOLL_CTL_ADD, socket->socket, &event) != -1;
+}
+
+/**
+ * the function puts socket with queued output in waiting list of its poller
+ * and watches it for write readiness until the output is sent
+ * returns 0 on error
+ **/
+int pollerWaitWrite(buffered_socket_t * socket) {
+	socket_poller_t * poller = socket->poller;
+	if (poller == NULL || socket->waitSlot != 0) {
+		return 1;
+	}
+	if (poller->waitingCnt == poller->waitingCap) {
+		int cap = (poller->waitingCap > 0) ? poller->waitingCap * 2 : POLLER_WAITING_MIN;
+		buffered_socket_t ** waiting = (buffered_socket_t **) realloc(poller->waiting, cap * sizeof(buffered_socket_t *));
+		if (waiting == NULL) {
+			return 0;
+		}
+		poller->waiting = waiting;
+		poller->waitingCap = cap;
+	}
+	if (poller->epollFd != -1) {
+		struct epoll_event event = { EPOLLIN | EPOLLOUT, { .fd = socket->socket } };
+		if (epoll_ctl(poller->epollFd, EPOLL_CTL_MOD, socket->socket, &event) == -1) {
+			return 0;
+		}
+	}
+	poller->waiting[poller->waitingCnt++] = socket;
+	socket->waitSlot = poller->waitingCnt;
+	return 1;
+}
+
+/**
+ * the function takes socket whose output is sent out of waiting list of its poller,
+ * the last socket of the list takes its place
+ **/
+void pollerUnwaitWrite(buffered_socket_t * socket) {
+	socket_poller_t * poller = socket->poller;
+	if (poller == NULL || socket->waitSlot == 0) {
+		return;
+	}
+	buffered_socket_t * last = poller->waiting[--poller->waitingCnt];
+	poller->waiting[socket->waitSlot - 1] = last;
+	last->waitSlot = socket->waitSlot;
+	socket->waitSlot = 0;
+	if (poller->epollFd != -1) { /* fails harmlessly if the socket is closed already */
+		struct epoll_event event = { EPOLLIN, { .fd = socket->socket } };
+		epoll_ctl(poller->epollFd, EPOLL_CTL_MOD, socket->socket, &event);
+	}
+}
+
+/**
+ * the function updates waiting list of poller after socket was copied to another client
+ **/
+void pollerMoved(buffered_socket_t * socket) {
+	if (socket->waitSlot != 0) {
+		socket->poller->waiting[socket->waitSlot - 1] = socket;
+	}
+}
+
+/**
+ * the function sets socket options of low latency mode:
+ * small frames are sent at once instead of waiting for ACK of previous ones (Nagle),
+ * busyPollUs > 0 lets the kernel busy poll the device queue that long before read sleeps
+ * returns 0 on error
+ **/
+int setLowLatency(int sock_d, int busyPollUs) {
+	int yes = 1;
+	if (setsockopt(sock_d, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)) == -1) {
+		return 0;
+	}
+	if (busyPollUs > 0 && setsockopt(sock_d, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs, sizeof(busyPollUs)) == -1) {
+		return 0;
+	}
+	return 1;
+}
 
 /**
  * the function sends the message till there are no bytes remain
@@ -16,65 +202,376 @@
 ssize_t sendSafe(int sock_d, void * msg, size_t len) {
 	ssize_t bytes_sent = 0;
 	while (bytes_sent < len) {
-		bytes_sent += send(sock_d, (ssize_t *) msg + bytes_sent, len - bytes_sent, 0);
+		ssize_t sentNow = send(sock_d, (char *) msg + bytes_sent, len - bytes_sent, 0);
+		if (sentNow == -1) {
+			return 0;
+		}
+		bytes_sent += sentNow;
 	}
-	if(bytes_sent == -1){
+	return bytes_sent;
+}
+
+/**
+ * the function returns number of payload bytes sent for the message
+ * status is sent without parts its flags don't mark, chat without unused text
+ **/
+size_t payloadSize(const game_msg_t * msg) {
+	switch (msg->type) {
+	case WELCOME: /* heaps only with the merged status keyframe */
+		return (msg->payload.welcomeMsg.flags & WELCOME_STATUS) ? sizeof(welcome_msg_t) : offsetof(welcome_msg_t, heapStatus);
+	case STATUS:
+		return offsetof(status_t, heapStatus)
+				+ ((msg->payload.status.flags & STATUS_KEYFRAME) ? sizeof(heap_status_t) : 0)
+				+ ((msg->payload.status.flags & STATUS_TIMED) ? sizeof(move_timing_t) : 0);
+	case TURN_REQ:
+		return sizeof(turn_req_t);
+	case TURN_RESP: /* sequence only for tagged move */
+		return (msg->payload.turnResp.moveSeq != 0) ? sizeof(turn_result_t) : sizeof(turn_resp_t);
+	case CHAT:
+		return offsetof(chat_t, text) + strnlen(msg->payload.chat.text, MAX_CHAT_TEXT - 1);
+	case PING:
+	case PONG:
+		return sizeof(ping_t);
+	case JOIN:
+		return sizeof(join_t);
+	case ANALYZE:
+		return sizeof(analyze_t);
+	case RESUME:
+		return sizeof(resume_t);
+	case LEAVE:
+		return 0;
+	case STANDING:
+		return sizeof(standing_t);
+	case ANALYSIS:
+		return offsetof(analysis_t, moves) + ((unsigned char) msg->payload.analysis.movesCnt <= MAX_WINNING_MOVES ? msg->payload.analysis.movesCnt : MAX_WINNING_MOVES) * sizeof(winning_move_t);
+	default:
 		return 0;
 	}
-	return bytes_sent;
+}
+
+/**
+ * the function encodes message into frame:
+ * payload length, message type and payload bytes,
+ * message of multiplexed session has SESSION_FLAG in type and session ID after the header
+ * returns size of the frame or 0 if there is no room in out
+ **/
+size_t encodeFrame(const game_msg_t * msg, char * out, size_t outSize) {
+	size_t len = payloadSize(msg);
+	size_t header = (msg->session != 0) ? FRAME_HEADER_SIZE + SESSION_HEADER_SIZE : FRAME_HEADER_SIZE;
+	if (header + len > outSize) {
+		return 0;
+	}
+	out[0] = (unsigned char) len;
+	out[1] = (unsigned char) msg->type;
+	if (msg->session != 0) {
+		out[1] |= SESSION_FLAG;
+		out[2] = (unsigned char) msg->session;
+		out[3] = (unsigned char) (msg->session >> 8);
+	}
+	if (msg->type == STATUS && !(msg->payload.status.flags & STATUS_KEYFRAME)) {
+		/* delta status - timing follows the header directly */
+		const status_t * status = &msg->payload.status;
+		memcpy(out + header, status, offsetof(status_t, heapStatus));
+		memcpy(out + header + offsetof(status_t, heapStatus), &status->timing, len - offsetof(status_t, heapStatus));
+	} else {
+		memcpy(out + header, &msg->payload, len);
+	}
+	return header + len;
+}
+
+/**
+ * the function decodes one frame from the in buffer into out message
+ * payload bytes not present in the frame are zeroed
+ * returns number of bytes consumed, 0 if frame is not complete yet
+ * and -1 if frame is malformed
+ **/
+ssize_t decodeFrame(const char * in, size_t inSize, game_msg_t * out) {
+	if (inSize < FRAME_HEADER_SIZE) {
+		return 0;
+	}
+	size_t len = (unsigned char) in[0];
+	unsigned char type = (unsigned char) in[1] & ~SESSION_FLAG;
+	size_t header = (in[1] & SESSION_FLAG) ? FRAME_HEADER_SIZE + SESSION_HEADER_SIZE : FRAME_HEADER_SIZE;
+	if (len > sizeof(payload_t) || type >= MSG_TYPES_NUM) {
+		return -1;
+	}
+	if (inSize < header + len) {
+		return 0;
+	}
+	out->type = type;
+	out->session = (header > FRAME_HEADER_SIZE) ? (unsigned char) in[2] | (unsigned char) in[3] << 8 : 0;
+	memset(&out->payload, 0, sizeof(payload_t));
+	if (type == STATUS && len >= offsetof(status_t, heapStatus) && !(in[header + offsetof(status_t, flags)] & STATUS_KEYFRAME)) {
+		status_t * status = &out->payload.status;
+		size_t timingLen = len - offsetof(status_t, heapStatus);
+		if (timingLen > sizeof(move_timing_t)) {
+			return -1;
+		}
+		memcpy(status, in + header, offsetof(status_t, heapStatus));
+		memcpy(&status->timing, in + header + offsetof(status_t, heapStatus), timingLen);
+	} else {
+		memcpy(&out->payload, in + header, len);
+	}
+	return header + len;
 }
 
 /**
  * the function sends the message using sendSafe function
  **/
 int sendMessage(int sock_d, game_msg_t * msg) {
-	size_t msgSize = sizeof(game_msg_t);
+	char frame[MAX_FRAME_SIZE];
+	size_t frameSize = encodeFrame(msg, frame, sizeof(frame));
 	ssize_t bytes_sent;
-	bytes_sent = sendSafe(sock_d, msg, msgSize);
-	return bytes_sent == msgSize;
+	bytes_sent = sendSafe(sock_d, frame, frameSize);
+	return bytes_sent == frameSize;
 }
 
 /**
- * the function sends message using buffer
- * returns 1 on success or 0 on failure
+ * the function queues output of pending sessions in the sent buffer of their link:
+ * each session queues its backlog up to SESSION_BUDGET bytes and then its coalesced status,
+ * sessions take turns in the order they became pending, output left waits for the next time
  **/
-int sendMessageB(buffered_socket_t * socket, game_msg_t * msg) {
-	if (msg != NULL) {
-		size_t msgSize = sizeof(game_msg_t);
-		if (socket->rxBuffPos + msgSize >= BUFFER_SIZE) {
+void queuePendingSessions(buffered_socket_t * link) {
+	if (link->rxBuff == NULL && (link->rxBuff = poolAttach()) == NULL) {
+		return;
+	}
+	socket_mux_t * linkMux = link->mux;
+	buffered_socket_t * session = linkMux->pendingHead;
+	linkMux->pendingHead = NULL;
+	linkMux->pendingTail = NULL;
+	while (session != NULL) {
+		socket_mux_t * mux = session->mux;
+		buffered_socket_t * next = mux->pendingNext;
+		int taken = 0;
+		mux->pendingNext = NULL;
+		mux->linkEpoch = linkMux->sendEpoch;
+		mux->linkQueued = 0;
+		while (taken < mux->backlogLen) { /* frames of backlog are stamped with session ID */
+			int frameSize = FRAME_HEADER_SIZE + SESSION_HEADER_SIZE + (unsigned char) mux->backlog[taken];
+			if ((mux->linkQueued > 0 && mux->linkQueued + frameSize > SESSION_BUDGET) || frameSize > BUFFER_SIZE - link->rxBuffPos) {
+				break;
+			}
+			memcpy(link->rxBuff + link->rxBuffPos, mux->backlog + taken, frameSize);
+			link->rxBuffPos += frameSize;
+			mux->linkQueued += frameSize;
+			taken += frameSize;
+		}
+		memmove(mux->backlog, mux->backlog + taken, mux->backlogLen - taken);
+		mux->backlogLen -= taken;
+		if (mux->backlogLen == 0) { /* idle session keeps no backlog */
+			free(mux->backlog);
+			mux->backlog = NULL;
+			mux->backlogCap = 0;
+		}
+		if (mux->backlogLen == 0 && session->statusPending) {
+			size_t frameSize = encodeFrame(PENDING_STATUS(session), link->rxBuff + link->rxBuffPos, BUFFER_SIZE - link->rxBuffPos);
+			if (frameSize > 0) {
+				link->rxBuffPos += frameSize;
+				mux->linkQueued += frameSize;
+				session->statusPending = 0;
+			}
+		}
+		if (SESSION_PENDING(session)) {
+			linkPending(session);
+		}
+		session = next;
+	}
+}
+
+/**
+ * the function queues coalesced status of the socket after the buffered frames,
+ * so message that follows it can't overtake it
+ * returns 0 if the buffer is full
+ **/
+int queuePendingStatus(buffered_socket_t * socket) {
+	if (socket->rxBuff == NULL && (socket->rxBuff = poolAttach()) == NULL) {
+		errno = ENOBUFS;
+		return 0;
+	}
+	size_t frameSize = encodeFrame(PENDING_STATUS(socket), socket->rxBuff + socket->rxBuffPos, BUFFER_SIZE - socket->rxBuffPos);
+	if (frameSize == 0) {
+		errno = ENOBUFS;
+		return 0;
+	}
+	socket->rxBuffPos += frameSize;
+	socket->statusPending = 0;
+	return 1;
+}
+
+/**
+ * the function replaces coalesced status of socket with newer one
+ * timing of the move the client measures is kept till a newer timed status replaces it
+ **/
+void coalesceStatus(buffered_socket_t * socket, const game_msg_t * msg) {
+	game_msg_t * pending = PENDING_STATUS(socket);
+	if (socket->statusPending && (pending->payload.status.flags & STATUS_TIMED) && !(msg->payload.status.flags & STATUS_TIMED)) {
+		move_timing_t timing = pending->payload.status.timing;
+		*pending = *msg;
+		pending->payload.status.flags |= STATUS_TIMED;
+		pending->payload.status.timing = timing;
+	} else {
+		*pending = *msg;
+	}
+	socket->statusPending = 1;
+}
+
+/**
+ * the function appends frame of session message to backlog of the session, backlog grows up to BUFFER_SIZE
+ * CHAT leaves CHAT_RESERVE bytes of it for other frames
+ * returns 0 if the backlog is full (errno ENOBUFS) or there is no memory
+ **/
+int backlogFrame(buffered_socket_t * socket, const game_msg_t * msg) {
+	socket_mux_t * mux = socket->mux;
+	int frameSize = FRAME_HEADER_SIZE + SESSION_HEADER_SIZE + payloadSize(msg);
+	if (mux->backlogLen + frameSize > BUFFER_SIZE - ((msg->type == CHAT) ? CHAT_RESERVE : 0)) {
+		errno = ENOBUFS;
+		return 0;
+	}
+	if (mux->backlogLen + frameSize > mux->backlogCap) {
+		int cap = (mux->backlogCap > 0) ? mux->backlogCap : SESSION_BACKLOG_MIN;
+		while (cap < mux->backlogLen + frameSize) {
+			cap *= 2;
+		}
+		char * backlog = (char *) realloc(mux->backlog, (cap < BUFFER_SIZE) ? cap : BUFFER_SIZE);
+		if (backlog == NULL) {
 			return 0;
 		}
-		memcpy(socket->rxBuff + socket->rxBuffPos, (ssize_t *) msg, msgSize);
-		socket->rxBuffPos += msgSize;
+		mux->backlog = backlog;
+		mux->backlogCap = (cap < BUFFER_SIZE) ? cap : BUFFER_SIZE;
+	}
+	mux->backlogLen += encodeFrame(msg, mux->backlog + mux->backlogLen, mux->backlogCap - mux->backlogLen);
+	return 1;
+}
+
+/**
+ * the function sends message of session multiplexed over connection of socket->link
+ * frames are stamped with session ID and queued in link buffer, session queues SESSION_BUDGET bytes
+ * at most until link buffer is sent, so busy session can't take link from the others,
+ * frames over the budget wait in backlog of the session and are queued in turn with other sessions
+ * once link buffer is sent, STATUS of session is coalesced while link buffer is busy
+ * returns 1 on success or 0 on failure (errno ENOBUFS if backlog of session is full)
+ **/
+int sendSessionB(buffered_socket_t * socket, game_msg_t * msg) {
+	buffered_socket_t * link = socket->link;
+	if (msg == NULL) {
+		return sendMessageB(link, NULL);
+	}
+	socket_mux_t * mux = socket->mux;
+	game_msg_t framed = *msg;
+	framed.session = socket->session;
+	if (mux->linkEpoch != link->mux->sendEpoch) { /* link buffer was sent since - budget is renewed */
+		mux->linkEpoch = link->mux->sendEpoch;
+		mux->linkQueued = 0;
+	}
+	int wasPending = SESSION_PENDING(socket);
+	if (msg->type == STATUS && (link->rxBuffPos > 0 || wasPending)) {
+		/* session is behind - newer state replaces unsent one */
+		coalesceStatus(socket, &framed);
 	} else {
-		if (socket->rxBuffPos == 0) {
-			return 1;
+		if (FOLLOWS_STATUS(msg->type) && socket->statusPending) { /* frame waits behind coalesced status */
+			if (!backlogFrame(socket, PENDING_STATUS(socket))) {
+				return 0;
+			}
+			socket->statusPending = 0;
+		}
+		int frameSize = FRAME_HEADER_SIZE + SESSION_HEADER_SIZE + payloadSize(&framed);
+		if (mux->backlogLen == 0 && (mux->linkQueued == 0 || mux->linkQueued + frameSize <= SESSION_BUDGET) && frameSize <= BUFFER_SIZE - link->rxBuffPos) {
+			mux->linkQueued += frameSize;
+			return sendMessageB(link, &framed);
+		}
+		if (!backlogFrame(socket, &framed)) {
+			return 0;
+		}
+	}
+	if (!wasPending) {
+		linkPending(socket);
+	}
+	return sendMessageB(link, NULL);
+}
+
+/**
+ * the function sends message using buffer
+ * ordered messages are queued in the buffer, STATUS is coalesced:
+ * while older frames wait in the buffer only the newest STATUS is kept
+ * and it is queued once the buffer is sent
+ * message of multiplexed session is queued in the buffer of its link
+ * CHAT leaves CHAT_RESERVE bytes of the buffer for replies and game frames
+ * returns 1 on success or 0 on failure, errno is ENOBUFS if the message does not fit the buffer
+ **/
+int sendMessageB(buffered_socket_t * socket, game_msg_t * msg) {
+	if (socket->link != NULL) {
+		return sendSessionB(socket, msg);
+	}
+	if (msg != NULL) {
+		if (msg->type == STATUS && (socket->rxBuffPos > 0 || socket->statusPending)) {
+			/* client is behind - newer state replaces unsent one */
+			coalesceStatus(socket, msg);
+		} else {
+			if (FOLLOWS_STATUS(msg->type) && socket->statusPending && !queuePendingStatus(socket)) {
+				return 0;
+			}
+			if (socket->rxBuff == NULL && (socket->rxBuff = poolAttach()) == NULL) {
+				errno = ENOBUFS;
+				return 0;
+			}
+			int room = BUFFER_SIZE - socket->rxBuffPos - ((msg->type == CHAT) ? CHAT_RESERVE : 0);
+			size_t frameSize = (room > 0) ? encodeFrame(msg, socket->rxBuff + socket->rxBuffPos, room) : 0;
+			if (frameSize == 0) {
+				errno = ENOBUFS;
+				return 0;
+			}
+			socket->rxBuffPos += frameSize;
 		}
 	}
-	fd_set * writeSet = socket->writeSet;
 	ssize_t bytes_sent = 0;
 	while (1) {
+		if (bytes_sent == socket->rxBuffPos) {
+			socket->rxBuffPos = 0;
+			bytes_sent = 0;
+			if (socket->mux != NULL) { /* buffer of link is sent - session budgets are renewed */
+				socket->mux->sendEpoch++;
+			}
+			if (socket->mux != NULL && socket->mux->pendingHead != NULL) { /* buffer is sent - queue statuses of sessions */
+				queuePendingSessions(socket);
+				if (socket->rxBuffPos > 0) {
+					continue;
+				}
+			}
+			if (!socket->statusPending) {
+				if (socket->rxBuff != NULL) { /* nothing in flight - buffer goes back to the pool */
+					poolRelease(socket->rxBuff);
+					socket->rxBuff = NULL;
+				}
+				break;
+			}
+			/* buffer is sent - queue the newest state */
+			socket->rxBuffPos = encodeFrame(PENDING_STATUS(socket), socket->rxBuff, BUFFER_SIZE);
+			socket->statusPending = 0;
+		}
 		ssize_t sentNow = 0;
-		if (FD_ISSET(socket->socket, writeSet)) {
+		if (socket->writeReady) {
 			sentNow = send(socket->socket, socket->rxBuff + bytes_sent, socket->rxBuffPos - bytes_sent, 0);
 		}
 		if (sentNow == -1) {
-			return 0;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				return 0;
+			}
+			sentNow = 0; /* socket buffer is full - keep the rest for the next time */
+			socket->writeReady = 0;
+		} else if (sentNow == 0 && socket->writeReady) {
+			fprintf(stderr,"send failed while socket is write-ready\n");
 		}
 		if (sentNow == 0) {
-			if (FD_ISSET(socket->socket, writeSet)){
-				fprintf(stderr,"send failed while writeSet set\n");
-			}
 			memmove(socket->rxBuff, socket->rxBuff + bytes_sent, socket->rxBuffPos - bytes_sent);
 			socket->rxBuffPos -= bytes_sent;
 			break;
 		}
 		bytes_sent += sentNow;
-		if (bytes_sent == socket->rxBuffPos) {
-			socket->rxBuffPos = 0;
-			break;
-		}
 	}
+	if (HAS_QUEUED_OUTPUT(socket)) { /* the rest is sent when poller reports the socket write-ready */
+		return pollerWaitWrite(socket);
+	}
+	pollerUnwaitWrite(socket);
 	return 1;
 }
 
@@ -101,54 +598,157 @@ ssize_t recvSafe(int sock_d, void * out, size_t len) {
  * returns message received or NULL on failure
  **/
 game_msg_t * receiveMessage(int sock_d) {
-	size_t sizeType = sizeof(game_msg_t);
-	game_msg_t * out = malloc(sizeType);
-	ssize_t bytes_received;
-	bytes_received = recvSafe(sock_d, out, sizeType);
-	if (bytes_received != sizeType) {
+	char frame[MAX_FRAME_SIZE];
+	if (recvSafe(sock_d, frame, FRAME_HEADER_SIZE) != FRAME_HEADER_SIZE) {
+		return NULL;
+	}
+	size_t len = (unsigned char) frame[0];
+	if (len > sizeof(payload_t)) {
+		return NULL;
+	}
+	if (frame[1] & SESSION_FLAG) { /* session ID is read with the payload */
+		len += SESSION_HEADER_SIZE;
+	}
+	if (len > 0 && recvSafe(sock_d, frame + FRAME_HEADER_SIZE, len) != len) {
+		return NULL;
+	}
+	game_msg_t * out = malloc(sizeof(game_msg_t));
+	if (decodeFrame(frame, FRAME_HEADER_SIZE + len, out) <= 0) {
+		free(out);
+		return NULL;
+	}
+	return out;
+}
+
+/**
+ * the function sends one frame as datagram to each of the addresses,
+ * DATAGRAM_BATCH datagrams are handed to the kernel by one call
+ * datagrams that don't fit socket buffer are dropped, receivers detect gap by status seq
+ * returns number of datagrams sent
+ **/
+int sendDatagrams(int sock_d, const char * frame, size_t frameSize, struct sockaddr_in * addresses, int addressesCnt) {
+	struct mmsghdr msgs[DATAGRAM_BATCH];
+	struct iovec iov = { (void *) frame, frameSize };
+	int sentCnt = 0;
+	while (sentCnt < addressesCnt) {
+		int batch = (addressesCnt - sentCnt < DATAGRAM_BATCH) ? addressesCnt - sentCnt : DATAGRAM_BATCH;
+		int i;
+		memset(msgs, 0, sizeof(struct mmsghdr) * batch);
+		for (i = 0; i < batch; i++) {
+			msgs[i].msg_hdr.msg_name = &addresses[sentCnt + i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			msgs[i].msg_hdr.msg_iov = &iov;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int sentNow = sendmmsg(sock_d, msgs, batch, MSG_NOSIGNAL);
+		if (sentNow <= 0) {
+			break;
+		}
+		sentCnt += sentNow;
+	}
+	return sentCnt;
+}
+
+/**
+ * the function receives one datagram carrying one frame
+ * returns NULL on error or if datagram is not a valid frame
+ **/
+game_msg_t * receiveDatagram(int sock_d) {
+	char frame[MAX_FRAME_SIZE];
+	ssize_t size = recv(sock_d, frame, sizeof(frame), 0);
+	if (size <= 0) {
+		return NULL;
+	}
+	game_msg_t * out = malloc(sizeof(game_msg_t));
+	if (decodeFrame(frame, size, out) != size) {
+		free(out);
 		return NULL;
 	}
 	return out;
 }
 
+/**
+ * the function checks if complete message is already buffered
+ * returns 1 if receiveMessageB can return message without reading socket
+ **/
+int hasPendingMessage(buffered_socket_t * socket) {
+	game_msg_t msg;
+	if (socket->txBuff == NULL) {
+		return 0;
+	}
+	return decodeFrame(socket->txBuff, socket->txBuffPos, &msg) != 0;
+}
+
 /**
  * the function receives message using buffer
+ * buffered complete message is returned before reading the socket,
+ * socket->rxNs is stamped as soon as bytes are read
  * returns message received or NULL on failure
  **/
 game_msg_t * receiveMessageB(buffered_socket_t * socket, int * isDisconnect) {
-	size_t msgSize = sizeof(game_msg_t);
-	*isDisconnect=0;
-	ssize_t rxTotal = 0;
-	char buff[msgSize];
-	while (rxTotal < msgSize) {
-		ssize_t rxNow = recv(socket->socket, buff + rxTotal, msgSize - rxTotal, 0);
-		if (rxNow == -1) {
-			*isDisconnect = 1;
-			return NULL;
+	*isDisconnect = 0;
+	if (socket->txBuff == NULL && (socket->txBuff = poolAttach()) == NULL) {
+		*isDisconnect = 1;
+		return NULL;
+	}
+	game_msg_t * out = malloc(sizeof(game_msg_t));
+	ssize_t used = decodeFrame(socket->txBuff, socket->txBuffPos, out);
+	if (used == 0) {
+		ssize_t rxNow = recv(socket->socket, socket->txBuff + socket->txBuffPos, BUFFER_SIZE - socket->txBuffPos, 0);
+		if (rxNow > 0) {
+			socket->rxNs = nowNs();
 		}
-		if (rxNow == 0) {
-			break;
+		if (rxNow == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				*isDisconnect = 1;
+			}
+			rxNow = 0;
+		} else if (rxNow == 0) {
+			socket->rxAttempt++;
+			if (socket->rxAttempt >= RX_TIMEOUT) {
+				*isDisconnect = 1;
+			}
 		}
-		rxTotal += rxNow;
-	}
-	memcpy(socket->txBuff + socket->txBuffPos, buff, rxTotal);
-	socket->txBuffPos += rxTotal;
-	if (socket->txBuffPos >= msgSize) {
-		socket->rxAttempt=0;
-		assert(socket->txBuffPos == msgSize);
-		game_msg_t * out = malloc(msgSize);
-		memcpy(out, socket->txBuff, msgSize);
-		socket->txBuffPos -= msgSize;
-		assert(socket->txBuffPos == 0);
-		return out;
-	}
-	else if (socket->txBuffPos==0){
-		socket->rxAttempt++;
-		if (socket->rxAttempt>=RX_TIMEOUT){
+		socket->txBuffPos += rxNow;
+		used = (rxNow > 0) ? decodeFrame(socket->txBuff, socket->txBuffPos, out) : 0;
+	}
+	if (used > 0) {
+		socket->rxAttempt = 0;
+		memmove(socket->txBuff, socket->txBuff + used, socket->txBuffPos - used);
+		socket->txBuffPos -= used;
+	} else {
+		if (used == -1) { /* malformed frame - stream can't be resynchronized */
 			*isDisconnect = 1;
 		}
+		free(out);
+		out = NULL;
+	}
+	if (socket->txBuffPos == 0) { /* no partial frame - buffer goes back to the pool */
+		poolRelease(socket->txBuff);
+		socket->txBuff = NULL;
+	}
+	return out;
+}
+
+/**
+ * the function applies status message to locally kept heaps
+ * keyframe replaces all heaps, delta changes one heap and must follow lastSeq
+ * returns 1 if status applied, 0 on sequence gap - keyframe should be requested
+ **/
+int applyStatus(short * heaps, unsigned int * lastSeq, const status_t * status) {
+	if (status->flags & STATUS_KEYFRAME) {
+		memcpy(heaps, status->heapStatus.heap, sizeof(heap_status_t));
+		*lastSeq = status->seq;
+		return 1;
 	}
-	return NULL;
+	if (status->seq != *lastSeq + 1) {
+		return 0;
+	}
+	if (status->changedHeap >= 0 && status->changedHeap < MAX_HEAPS) {
+		heaps[(int) status->changedHeap] = status->changedAmount;
+	}
+	*lastSeq = status->seq;
+	return 1;
 }
 
 /**
@@ -158,6 +758,7 @@ game_msg_t * receiveMessageB(buffered_socket_t * socket, int * isDisconnect) {
 game_msg_t * createMessage(msgtype_t type, payload_t pl) {
 	game_msg_t* msg = (game_msg_t*) malloc(sizeof(game_msg_t));
 	msg->type = type;
+	msg->session = 0;
 	msg->payload = pl;
 	return msg;
 }
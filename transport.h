@@ -1,13 +1,30 @@
 #define MAX_CHAT_TEXT (60) /* maximal text message length from client to client */
 #define BUFFER_SIZE (1024) /* maximal output and input buffer size */
 #define RX_TIMEOUT (3) /* number of sending attempts if socket returns 0 */
+#define MAX_HEAPS (4) /* maximal number of heaps carried in status keyframe */
+#define FRAME_HEADER_SIZE (2) /* frame header: payload length and message type */
+#define SESSION_HEADER_SIZE (2) /* session ID following frame header of multiplexed session */
+#define SESSION_FLAG (0x80) /* message type flag: frame carries session ID */
+#define MAX_FRAME_SIZE (FRAME_HEADER_SIZE + SESSION_HEADER_SIZE + sizeof(payload_t)) /* largest encoded frame */
+#define MAX_SESSIONS (16384) /* sessions multiplexed over one connection, IDs 1 to MAX_SESSIONS - 1 */
+#define SESSION_BUDGET (BUFFER_SIZE / 4) /* output bytes one session queues on its connection until the buffer is sent */
+#define SESSION_BACKLOG_MIN (64) /* bytes of session backlog allocated first, backlog doubles up to BUFFER_SIZE */
+#define CHAT_RESERVE (BUFFER_SIZE / 4) /* bytes of output buffer and session backlog CHAT never takes, kept for replies and game frames */
+#define KEYFRAME_INTERVAL (16) /* every n-th status update is sent as full keyframe */
+#define STATUS_KEYFRAME (1) /* status flag: heapStatus carries full heaps state */
+#define STATUS_TIMED (2) /* status flag: timing carries timestamps of the move */
+#define WELCOME_STATUS (1) /* welcome flag: welcome carries the first status keyframe of the game */
+#define WELCOME_PROVISIONAL (2) /* welcome flag: client was placed on connect while seats are held, RESUME sent first gets its own WELCOME */
+#define WELCOME_RETRY (4) /* welcome flag: with gameType REJECTED - JOIN was shed by busy server, client stays connected and may send it again */
+#define DATAGRAM_BATCH (64) /* status datagrams sent by one system call */
+#define MAX_WINNING_MOVES (8) /* winning moves carried in analysis */
 
 static const char CLIENT_ID_INVALID = -1; /* invalid client ID */
 
 /**
  * definition of message types:
  * WELCOME - message from server to recently connected client
- * 			 contains gameType, playersCnt, clientId and clientStatus
+ * 			 contains gameType, playersCnt, clientId, clientStatus and sessionToken
  * STATUS - message from server with current game status
  * 			contains heapStatus, clientStatus and endGame status
  * TURN_REQ - message from client to server with new move received from a user
@@ -16,9 +33,24 @@ static const char CLIENT_ID_INVALID = -1; /* invalid client ID */
  * 			   response can be that move is LEGAL or ILLEGAL or NOT_YOUR_TURN
  * CHAT - chat message from client to client
  * 		  contains srcId, dstId and text
+ * STATUS_REQ - message from client to server asking for full status keyframe
+ * 				sent by client that joined late or detected gap in status sequence
+ * PING - round trip probe, contains seq and sender timestamp
+ * PONG - answer to PING, echoes its seq and timestamp back to the sender
+ * JOIN - message from client to server asking for game of given type and number of players
+ * 		  server running lobby waits for it before the WELCOME, other servers ignore it
+ * ANALYZE - message from client to server asking for value and winning moves of a position
+ * 			 current heaps of client's game or arbitrary position
+ * ANALYSIS - answer to ANALYZE, can come after messages sent later as positions are analyzed aside of the games
+ * RESUME - message from reconnected client to server asking for the seat it held, sent instead of JOIN
+ * 			server answers with WELCOME of the seat or places the client as new one
+ * LEAVE - message from client to server closing multiplexed session, the connection and its other sessions stay
+ * STANDING - message from server to tournament entrant after each round, entrant is placed into next round game
+ * 			  by new WELCOME, tournament is over after standing of the last round
+ * MSG_TYPES_NUM - number of message types, not a valid message type
  **/
 typedef enum {
-	WELCOME, STATUS, TURN_REQ, TURN_RESP, CHAT
+	WELCOME, STATUS, TURN_REQ, TURN_RESP, CHAT, STATUS_REQ, PING, PONG, JOIN, ANALYZE, ANALYSIS, RESUME, LEAVE, STANDING, MSG_TYPES_NUM
 } msgtype_t;
 
 /**
@@ -63,50 +95,208 @@ typedef enum {
 	YOU_WIN, YOU_LOSE, YOU_WATCHED, NOT_FINISHED
 } end_game_t;
 
+/**
+ * definition of position values for the player to move
+ * VALUE_UNKNOWN - position could not be analyzed
+ * VALUE_LOSS - every move leads to position winning for the opponent
+ * VALUE_WIN - some move leads to position losing for the opponent
+ **/
+typedef enum {
+	VALUE_UNKNOWN, VALUE_LOSS, VALUE_WIN
+} position_value_t;
+
+/**
+ * heap data
+ * heap[MAX_HEAPS] - current state of the heaps
+ **/
+typedef struct heap_status {
+	short heap[MAX_HEAPS];
+} heap_status_t;
+
 /**
  * welcome message data
  * gameType - current game type of game_type_t type, can be one of defined game types
  * playersCnt - number of players (p) in current game
  * clientId - ID received by client
  * clientStatus - current client status of client_status_t, can be one of defined client statuses
+ * sessionToken - token of the seat presented in RESUME after reconnect, 0 if server doesn't hold seats
+ * rating - rating of the player, 0 if player is not rated
+ * maxTake - maximal number of cubes taken in one move, 0 if not bounded
+ * flags - WELCOME_STATUS bit, set for client that asked for fast join: clientStatus, statusSeq, endGame
+ * 		   and heapStatus are its first status keyframe, no separate STATUS follows
+ * 		   WELCOME_PROVISIONAL bit, set for client placed on connect while seats are held: if the first message
+ * 		   of the client is RESUME, another WELCOME answers it - of the held seat or again of the placed client
+ * 		   WELCOME_RETRY bit, set with gameType REJECTED when busy server shed JOIN of the client: the connection stays
+ * 		   and JOIN may be sent again later
+ * statusSeq, endGame, heapStatus - with WELCOME_STATUS: seq, end game state and heaps of the keyframe
  **/
 typedef struct welcome_msg {
 	game_type_t gameType;
 	char playersCnt;
 	char clientId;
+	char flags;
+	char endGame;
 	client_status_t clientStatus;
+	unsigned int statusSeq;
+	unsigned long long sessionToken;
+	unsigned short rating;
+	unsigned short maxTake;
+	heap_status_t heapStatus;
 } welcome_msg_t;
 
 /**
- * heap data
- * heap[4] - current state of the heaps
+ * move timing data, durations are measured by the server clock
+ * clientSentNs - timestamp taken by client when move was sent, echoed back
+ * validateNs - time from move receipt till move validated
+ * residenceNs - time from move receipt till status broadcast flushed
  **/
-typedef struct heap_status {
-	short heap[4];
-} heap_status_t;
+typedef struct move_timing {
+	long long clientSentNs;
+	long long validateNs;
+	long long residenceNs;
+} move_timing_t;
 
 /**
  * status data
- * heapStatus - of heap_status_t type, contains current state of heaps array
+ * seq - game sequence number, incremented on every status update of the game
  * clientStatus - current client status
  * endGame - current game state
+ * flags - STATUS_KEYFRAME and STATUS_TIMED bits, tell which optional parts are sent
+ * changedHeap - delta only: index of heap changed since previous seq, -1 if none
+ * changedAmount - delta only: new amount of cubes in changedHeap
+ * heapStatus - keyframe only: current state of heaps array
+ * timing - timed only: timestamps of the move this status answers
  **/
 typedef struct status {
-	heap_status_t heapStatus;
+	unsigned int seq;
 	client_status_t clientStatus;
 	end_game_t endGame;
+	char flags;
+	char changedHeap;
+	short changedAmount;
+	heap_status_t heapStatus;
+	move_timing_t timing;
 } status_t;
 
 /**
  * user move data
  * heapIndex - index of a heap chosen by user
  * amount - amount of cubes to take from chosen heap
+ * moveSeq - client sequence number of the move echoed back in turn response, 0 if not tagged
+ * clientSentNs - client timestamp echoed back in timed status, 0 if not measured
  **/
 typedef struct turn_req {
 	char heapIndex;
 	short amount;
+	unsigned short moveSeq;
+	long long clientSentNs;
 } turn_req_t;
 
+/**
+ * turn response data
+ * resp - server response to the move
+ * moveSeq - moveSeq of the answered move, 0 if it was not tagged and only resp is sent
+ **/
+typedef struct turn_result {
+	turn_resp_t resp;
+	unsigned short moveSeq;
+} turn_result_t;
+
+/**
+ * join request data
+ * gameType - MISERE or REGULAR, -1 for server default
+ * playersCnt - number of players in requested game, 0 for server default
+ * spectate - 1 if client wants to watch a game instead of playing
+ * udpPort - UDP port in network byte order statuses are sent to while client watches, 0 - TCP only
+ * tournament - 1 if player enters next tournament instead of single game
+ * playerId - identity player is rated by, 0 - anonymous player is not rated
+ * fastJoin - 1 if WELCOME should carry the first status keyframe, client can move as soon as it arrives
+ **/
+typedef struct join {
+	char gameType;
+	char playersCnt;
+	char spectate;
+	char fastJoin;
+	unsigned short udpPort;
+	char tournament;
+	unsigned int playerId;
+} join_t;
+
+/**
+ * resume request data
+ * sessionToken - token of the seat received in WELCOME
+ * lastSeq - seq of the last status client applied, status keyframe is sent only if client missed statuses
+ **/
+typedef struct resume {
+	unsigned long long sessionToken;
+	unsigned int lastSeq;
+} resume_t;
+
+/**
+ * tournament standing data
+ * round, rounds - round just finished and number of rounds of the tournament
+ * place - place of the entrant after the round, entrants with equal points share the best place
+ * entrants - number of entrants
+ * points - points of the entrant: games won, byes and forfeits of opponents
+ * rating - rating of the entrant, results of the round are applied to it right after the standing is sent, 0 if not rated
+ **/
+typedef struct standing {
+	unsigned short round;
+	unsigned short rounds;
+	unsigned short place;
+	unsigned short entrants;
+	unsigned short points;
+	unsigned short rating;
+} standing_t;
+
+/**
+ * ping data
+ * seq - probe number chosen by sender
+ * sentNs - sender timestamp, echoed back unchanged in PONG
+ **/
+typedef struct ping {
+	unsigned int seq;
+	long long sentNs;
+} ping_t;
+
+/**
+ * analysis request data
+ * gameType - MISERE or REGULAR, -1 for game type of client's game
+ * current - 1 to analyze current heaps of client's game, heapStatus is ignored
+ * heapStatus - position to analyze
+ **/
+typedef struct analyze {
+	char gameType;
+	char current;
+	heap_status_t heapStatus;
+} analyze_t;
+
+/**
+ * move of the analysis
+ * heapIndex - index of a heap to take from
+ * amount - amount of cubes to take
+ **/
+typedef struct winning_move {
+	char heapIndex;
+	short amount;
+} winning_move_t;
+
+/**
+ * analysis data
+ * gameType - rules the position was analyzed by
+ * value - position_value_t for the player to move
+ * movesCnt - number of moves sent, up to MAX_WINNING_MOVES of winning moves
+ * heapStatus - position analyzed
+ * moves - moves leading to positions losing for the opponent
+ **/
+typedef struct analysis {
+	char gameType;
+	char value;
+	char movesCnt;
+	heap_status_t heapStatus;
+	winning_move_t moves[MAX_WINNING_MOVES];
+} analysis_t;
+
 /**
  * chat message data
  * srcId - sender ID
@@ -120,7 +310,7 @@ typedef struct chat {
 } chat_t;
 
 /**
- * message data - can be read as one of five types
+ * message data - can be read as one of seven types
  * accordingly to the message type
  **/
 typedef union payload {
@@ -128,46 +318,180 @@ typedef union payload {
 	welcome_msg_t welcomeMsg;
 	status_t status;
 	turn_req_t turnReq;
-	turn_resp_t turnResp;
+	turn_result_t turnResp;
+	ping_t ping;
+	join_t join;
+	analyze_t analyze;
+	analysis_t analysis;
+	resume_t resume;
+	standing_t standing;
 } payload_t;
 
 /**
  * structure for the message in the system
  * type - type of the message, can be one of four types defined by msgtype_t
+ * session - ID of session the message belongs to when sessions are multiplexed over one connection,
+ * 			 0 - message of the connection itself
  * payload - relevant data accordingly to the message type
  **/
 typedef struct game_msg {
 	msgtype_t type;
+	unsigned short session;
 	payload_t payload;
 } game_msg_t;
 
 /**
  * structure for buffered socket
+ * buffers are attached from the buffer pool only while they hold data
  * socket - socket fd
- * rxBuff - input buffer
  * rxBuffPos - current place in input buffer
  * rxAttempt - number of read attempts done
- * txBuff - output buffer
  * txBuffPos - current place in output buffer
- * writeSet - pointer to write-ready set
+ * waitSlot - 1 + index of the socket in waiting list of poller, 0 if output is not queued
+ * session - session ID stamped on frames of multiplexed session
+ * statusPending - 1 if newest STATUS waits for the buffered frames to be sent, the message is kept
+ * after the frames in the same pool buffer or in multiplexing state of session (PENDING_STATUS)
+ * writeReady - 1 if poller reported the socket write-ready in current loop iteration
+ * rxNs - time bytes were last read from the socket, frames decoded from the input buffer were received then
+ * rxBuff - input buffer, NULL if empty
+ * txBuff - output buffer, NULL if empty
+ * poller - poller the socket waits on for write readiness while output is queued, NULL if it doesn't wait
+ * link - socket of connection the session is multiplexed over, NULL for connection,
+ * 		  frames of session are queued in link buffer, session has no buffers of its own
+ * mux - multiplexing state of session or of connection sessions are multiplexed over, NULL for others
  **/
 typedef struct buffered_socket{
 	int socket;
-	char rxBuff[BUFFER_SIZE];
 	int rxBuffPos;
 	int rxAttempt;
-	char txBuff[BUFFER_SIZE];
 	int txBuffPos;
-	fd_set * writeSet;
+	int waitSlot;
+	unsigned short session;
+	char statusPending;
+	char writeReady;
+	long long rxNs;
+	char * rxBuff;
+	char * txBuff;
+	struct socket_poller * poller;
+	struct buffered_socket * link;
+	struct socket_mux * mux;
 }buffered_socket_t;
 
+/**
+ * multiplexing state of buffered socket, kept out of line as only links and their sessions have it
+ * linkQueued - bytes session queued in link buffer since the buffer was last sent
+ * linkEpoch - sendEpoch of link linkQueued is counted in
+ * sendEpoch - number of times the link buffer was sent completely
+ * pendingHead, pendingTail - sessions whose pending status or backlog waits for the link buffer to be sent, in order
+ * pendingNext - next session in pending list of link
+ * backlog - frames session sent over its budget or while link buffer was full, in order, NULL if empty
+ * backlogLen, backlogCap - bytes in backlog and allocated for it
+ * status - coalesced status of session
+ **/
+typedef struct socket_mux {
+	int linkQueued;
+	unsigned int linkEpoch;
+	unsigned int sendEpoch;
+	buffered_socket_t * pendingHead;
+	buffered_socket_t * pendingTail;
+	buffered_socket_t * pendingNext;
+	char * backlog;
+	int backlogLen;
+	int backlogCap;
+	game_msg_t status;
+} socket_mux_t;
+
+#define POLLER_WAITING_MIN (64) /* waiting list entries allocated first, list doubles when full */
+
+/**
+ * epoll instance of buffered sockets, sockets are registered for read readiness
+ * and for write readiness only while their output is queued
+ * epollFd - epoll instance, -1 if sockets are not polled
+ * waiting - sockets with queued output, flushed when they become write-ready
+ * waitingCnt - number of sockets in waiting
+ * waitingCap - allocated entries of waiting
+ **/
+typedef struct socket_poller {
+	int epollFd;
+	buffered_socket_t ** waiting;
+	int waitingCnt;
+	int waitingCap;
+} socket_poller_t;
+
+#define POOL_BUFFER_SIZE (BUFFER_SIZE + sizeof(game_msg_t)) /* frames and pending status */
+#define POOL_SLAB_BUFFERS (64) /* number of buffers allocated at once */
+#define PENDING_STATUS(sock) (((sock)->link != NULL) ? &(sock)->mux->status : (game_msg_t *) ((sock)->rxBuff + BUFFER_SIZE)) /* coalesced status */
+#define SESSION_PENDING(sock) ((sock)->statusPending || (sock)->mux->backlogLen > 0) /* session is in pending list of its link */
+#define FOLLOWS_STATUS(type) ((type) == WELCOME || (type) == STANDING) /* frames starting next game or following game end never overtake coalesced status */
+#define HAS_QUEUED_OUTPUT(sock) ((sock)->rxBuffPos > 0 || (sock)->statusPending || ((sock)->mux != NULL && (sock)->mux->pendingHead != NULL)) /* socket waits to be write-ready */
+
+/**
+ * pool of I/O buffers shared by buffered sockets
+ * freeList - free buffers linked through their first bytes
+ * slabsCnt - number of slabs of POOL_SLAB_BUFFERS buffers allocated
+ * inUse - number of buffers attached to sockets
+ **/
+typedef struct buffer_pool {
+	char * freeList;
+	long slabsCnt;
+	long inUse;
+} buffer_pool_t;
+
+extern buffer_pool_t bufferPool;
+
 /* headers of common functions */
 game_msg_t * createMessage(msgtype_t, payload_t);
 
+size_t payloadSize(const game_msg_t * msg);
+
+size_t encodeFrame(const game_msg_t * msg, char * out, size_t outSize);
+
+ssize_t decodeFrame(const char * in, size_t inSize, game_msg_t * out);
+
+char * poolAttach();
+
+void poolRelease(char * buffer);
+
+void releaseBuffers(buffered_socket_t * socket);
+
+int pollerWatch(buffered_socket_t * socket);
+
+int pollerWaitWrite(buffered_socket_t * socket);
+
+void pollerUnwaitWrite(buffered_socket_t * socket);
+
+void pollerMoved(buffered_socket_t * socket);
+
+int setLowLatency(int sock_d, int busyPollUs);
+
+ssize_t sendSafe(int sock_d, void * msg, size_t len);
+
+int hasPendingMessage(buffered_socket_t * socket);
+
+int applyStatus(short * heaps, unsigned int * lastSeq, const status_t * status);
+
 int sendMessage(int sock_d, game_msg_t * msg);
 
+void linkPending(buffered_socket_t * socket);
+
+void queuePendingSessions(buffered_socket_t * link);
+
+int queuePendingStatus(buffered_socket_t * socket);
+
+void coalesceStatus(buffered_socket_t * socket, const game_msg_t * msg);
+
+int backlogFrame(buffered_socket_t * socket, const game_msg_t * msg);
+
+int sendSessionB(buffered_socket_t * socket, game_msg_t * msg);
+
 int sendMessageB(buffered_socket_t * socket, game_msg_t * msg);
 
+struct sockaddr_in;
+
+int sendDatagrams(int sock_d, const char * frame, size_t frameSize, struct sockaddr_in * addresses, int addressesCnt);
+
+game_msg_t * receiveDatagram(int sock_d);
+
 game_msg_t * receiveMessage(int sock_d);
 
 game_msg_t * receiveMessageB(buffered_socket_t * socket,int * isDisconnect);
@@ -0,0 +1,671 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> /* for read(), write() */
+#include <sys/types.h> /* data types used in system calls */
+#include <sys/socket.h> /* sendmsg(), recvmsg(), SCM_RIGHTS */
+#include <errno.h> /* error messages */
+#include <string.h> /* string functions */
+#include "transport.h" /* common data with client */
+#include "rules.h" /* game variant rules */
+#include "admission.h" /* load shedding */
+#include "nim-server.h" /* server state */
+#include "lobby.h" /* lobby queues */
+#include "rating.h" /* player ratings */
+#include "tournament.h" /* tournaments */
+#include "upgrade.h"
+
+/**
+ * the function appends bytes to the snapshot, buffer is marked failed if it can't grow
+ **/
+void upgradePut(upgrade_buffer_t * buffer, const void * data, size_t size) {
+	if (size == 0 || buffer->failed) { /* data of empty socket buffer is NULL */
+		return;
+	}
+	if (buffer->pos + size > buffer->size) {
+		char * grown = (char *) realloc(buffer->data, (buffer->pos + size) * 2);
+		if (grown == NULL) {
+			buffer->failed = 1;
+			return;
+		}
+		buffer->data = grown;
+		buffer->size = (buffer->pos + size) * 2;
+	}
+	memcpy(buffer->data + buffer->pos, data, size);
+	buffer->pos += size;
+}
+
+/**
+ * the function takes bytes from the snapshot
+ * returns 0 if snapshot is too short
+ **/
+int upgradeGet(upgrade_buffer_t * buffer, void * data, size_t size) {
+	if (buffer->pos + size > buffer->size) {
+		return 0;
+	}
+	memcpy(data, buffer->data + buffer->pos, size);
+	buffer->pos += size;
+	return 1;
+}
+
+/**
+ * the function writes all bytes to blocking socket
+ * returns 0 on error
+ **/
+int upgradeWriteAll(int channel, const char * data, size_t size) {
+	while (size > 0) {
+		ssize_t n = send(channel, data, size, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return 0;
+		}
+		data += n;
+		size -= n;
+	}
+	return 1;
+}
+
+/**
+ * the function reads exactly size bytes from blocking socket
+ * returns 0 on error or end of stream
+ **/
+int upgradeReadAll(int channel, char * data, size_t size) {
+	while (size > 0) {
+		ssize_t n = read(channel, data, size);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return 0;
+		}
+		data += n;
+		size -= n;
+	}
+	return 1;
+}
+
+/**
+ * the function passes descriptors to the other end of unix socket
+ * returns 0 on error
+ **/
+int upgradeSendFds(int channel, const int * fds, int cnt) {
+	while (cnt > 0) {
+		int batch = (cnt < UPGRADE_FD_BATCH) ? cnt : UPGRADE_FD_BATCH;
+		char control[CMSG_SPACE(sizeof(int) * UPGRADE_FD_BATCH)];
+		char byte = 0;
+		struct iovec iov = { &byte, 1 };
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		memset(control, 0, sizeof(control));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * batch);
+		struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * batch);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * batch);
+		if (sendmsg(channel, &msg, MSG_NOSIGNAL) != 1) {
+			return 0;
+		}
+		fds += batch;
+		cnt -= batch;
+	}
+	return 1;
+}
+
+/**
+ * the function receives descriptors passed by upgradeSendFds
+ * returns 0 on error
+ **/
+int upgradeReceiveFds(int channel, int * fds, int cnt) {
+	while (cnt > 0) {
+		int batch = (cnt < UPGRADE_FD_BATCH) ? cnt : UPGRADE_FD_BATCH;
+		char control[CMSG_SPACE(sizeof(int) * UPGRADE_FD_BATCH)];
+		char byte;
+		struct iovec iov = { &byte, 1 };
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(channel, &msg, 0) != 1) {
+			return 0;
+		}
+		struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * batch)) {
+			return 0;
+		}
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * batch);
+		fds += batch;
+		cnt -= batch;
+	}
+	return 1;
+}
+
+/**
+ * the function returns ordinal of client in snapshot: connections are numbered by socket fd,
+ * sessions multiplexed over them follow in order of sessionList
+ * clientOrdinal - ordinal by socket fd
+ * slotBase - index of the first session slot of connection in sessionOrdinal by socket fd
+ * sessionOrdinal - ordinal of session by its slot, -1 if the session is not listed
+ **/
+int upgradeOrdinal(client_t * client, const int * clientOrdinal, const int * slotBase, const int * sessionOrdinal) {
+	if (!isSession(client)) {
+		return clientOrdinal[client->sock.socket];
+	}
+	return sessionOrdinal[slotBase[client->sock.link->socket] + client->sock.session];
+}
+
+/**
+ * the function restores rarely used state of client, it is allocated only if any of it is set
+ * returns 0 if there is no memory
+ **/
+int upgradeRestoreExt(client_t * client, unsigned short udpPort, unsigned int udpAddr, unsigned int playerId) {
+	if (udpPort == 0 && udpAddr == 0 && playerId == 0) {
+		return 1;
+	}
+	client_ext_t * ext = clientExt(client);
+	if (ext == NULL) {
+		return 0;
+	}
+	ext->udpPort = udpPort;
+	ext->udpAddr = udpAddr;
+	ext->playerId = playerId;
+	return 1;
+}
+
+/**
+ * the function sends server state to the successor:
+ * snapshot of settings, games, clients with their pending buffers, sessions, lobby queues and tournaments,
+ * then listening socket and client sockets in snapshot order
+ * returns 0 on error
+ **/
+int upgradeSend(int channel, int listSocket, upgrade_settings_t * settings) {
+	upgrade_buffer_t buffer = { NULL, 0, 0, 0 };
+	int gameOrdinal[MAX_GAMES]; /* game ordinal in snapshot by game slot */
+	int * clientOrdinal = (int *) malloc(sizeof(int) * (connCap + 1)); /* client ordinal in snapshot by socket fd */
+	int * slotBase = (int *) malloc(sizeof(int) * (connCap + 1)); /* first session slot of connection in sessionOrdinal by socket fd */
+	int * fds = (int *) malloc(sizeof(int) * (connCap + 1));
+	client_t ** sessionList = (client_t **) malloc(sizeof(client_t *) * (sessionsCnt + 1));
+	int * sessionOrdinal = NULL; /* session ordinal in snapshot by session slot */
+	int gamesCnt = 0, clientsCnt = 0, sessionsListed = 0, slotsCnt = 0, res = 0;
+	int i, fd;
+	if (clientOrdinal == NULL || slotBase == NULL || fds == NULL || sessionList == NULL) {
+		printf("Error: not enough memory for upgrade snapshot!\n");
+		goto done;
+	}
+	for (i = 0; i < MAX_GAMES; i++) {
+		gameOrdinal[i] = (gameTable.flags[i] & GAME_IN_USE) ? gamesCnt++ : -1;
+	}
+	fds[0] = listSocket;
+	for (fd = 0; fd < connCap; fd++) {
+		clientOrdinal[fd] = -1;
+		slotBase[fd] = slotsCnt;
+		if (connList[fd] != NULL) {
+			clientOrdinal[fd] = clientsCnt++;
+			fds[clientsCnt] = fd;
+			slotsCnt += CLIENT_EXT(connList[fd])->sessionsCap;
+		}
+	}
+	if ((sessionOrdinal = (int *) malloc(sizeof(int) * (slotsCnt + 1))) == NULL) {
+		printf("Error: not enough memory for upgrade snapshot!\n");
+		goto done;
+	}
+	for (i = 0; i < slotsCnt; i++) {
+		sessionOrdinal[i] = -1;
+	}
+	int magic = UPGRADE_MAGIC, version = UPGRADE_VERSION;
+	upgradePut(&buffer, &magic, sizeof(magic));
+	upgradePut(&buffer, &version, sizeof(version));
+	upgradePut(&buffer, settings, sizeof(upgrade_settings_t));
+	upgradePut(&buffer, &gamesCnt, sizeof(gamesCnt));
+	upgradePut(&buffer, &clientsCnt, sizeof(clientsCnt));
+	/* games */
+	for (i = 0; i < MAX_GAMES; i++) {
+		game_t * game = &games[i];
+		if (!(gameTable.flags[i] & GAME_IN_USE)) {
+			continue;
+		}
+		int isNewest = (game == newestGame[MISERE] || game == newestGame[REGULAR]);
+		int isTurnDone = (gameTable.flags[i] & GAME_TURN_DONE) != 0, needToSendStatus = (gameTable.flags[i] & GAME_SEND_STATUS) != 0;
+		upgradePut(&buffer, &isNewest, sizeof(isNewest));
+		upgradePut(&buffer, gameTable.heaps[i], sizeof(gameTable.heaps[i]));
+		upgradePut(&buffer, game->sentHeaps, sizeof(game->sentHeaps));
+		upgradePut(&buffer, &game->statusSeq, sizeof(game->statusSeq));
+		upgradePut(&buffer, &game->gameType, sizeof(game->gameType));
+		upgradePut(&buffer, &game->p, sizeof(game->p));
+		upgradePut(&buffer, &game->maxId, sizeof(game->maxId));
+		upgradePut(&buffer, &isTurnDone, sizeof(isTurnDone));
+		upgradePut(&buffer, &needToSendStatus, sizeof(needToSendStatus));
+		upgradePut(&buffer, game->seatTokens, sizeof(game->seatTokens));
+		upgradePut(&buffer, game->seatDetachedNs, sizeof(game->seatDetachedNs));
+		upgradePut(&buffer, &game->startMs, sizeof(game->startMs));
+		upgradePut(&buffer, &game->movesCnt, sizeof(game->movesCnt));
+		upgradePut(&buffer, &game->illegalCnt, sizeof(game->illegalCnt));
+		upgradePut(&buffer, game->movesBy, sizeof(game->movesBy));
+	}
+	/* clients with pending input and output */
+	for (fd = 0; fd < connCap; fd++) {
+		client_t * client = connList[fd];
+		if (client == NULL) {
+			continue;
+		}
+		int inGame = (client->game != NULL) ? gameOrdinal[client->game - games] : -1;
+		upgradePut(&buffer, &inGame, sizeof(inGame));
+		upgradePut(&buffer, &client->id, sizeof(client->id));
+		upgradePut(&buffer, &client->status, sizeof(client->status));
+		const client_ext_t * ext = CLIENT_EXT(client);
+		upgradePut(&buffer, &ext->udpPort, sizeof(ext->udpPort));
+		upgradePut(&buffer, &ext->udpAddr, sizeof(ext->udpAddr));
+		upgradePut(&buffer, &ext->playerId, sizeof(ext->playerId));
+		upgradePut(&buffer, &client->fastJoin, sizeof(client->fastJoin));
+		upgradePut(&buffer, &client->provisional, sizeof(client->provisional));
+		upgradePut(&buffer, &client->sock.rxBuffPos, sizeof(client->sock.rxBuffPos));
+		upgradePut(&buffer, client->sock.rxBuff, client->sock.rxBuffPos);
+		upgradePut(&buffer, &client->sock.rxAttempt, sizeof(client->sock.rxAttempt));
+		upgradePut(&buffer, &client->sock.txBuffPos, sizeof(client->sock.txBuffPos));
+		upgradePut(&buffer, client->sock.txBuff, client->sock.txBuffPos);
+		upgradePut(&buffer, &client->sock.statusPending, sizeof(client->sock.statusPending));
+		if (client->sock.statusPending) {
+			upgradePut(&buffer, PENDING_STATUS(&client->sock), sizeof(game_msg_t));
+		}
+		for (i = 0; i < ext->sessionsCap; i++) {
+			if (ext->sessions[i] != NULL && sessionsListed < sessionsCnt) {
+				sessionOrdinal[slotBase[fd] + i] = clientsCnt + sessionsListed;
+				sessionList[sessionsListed++] = ext->sessions[i];
+			}
+		}
+	}
+	/* sessions multiplexed over the connections, their backlogs and statuses pending on the link are queued again in order */
+	upgradePut(&buffer, &sessionsListed, sizeof(sessionsListed));
+	for (i = 0; i < sessionsListed; i++) {
+		client_t * session = sessionList[i];
+		int inGame = (session->game != NULL) ? gameOrdinal[session->game - games] : -1;
+		upgradePut(&buffer, &clientOrdinal[session->sock.socket], sizeof(int));
+		upgradePut(&buffer, &session->sock.session, sizeof(session->sock.session));
+		upgradePut(&buffer, &inGame, sizeof(inGame));
+		upgradePut(&buffer, &session->id, sizeof(session->id));
+		upgradePut(&buffer, &session->status, sizeof(session->status));
+		upgradePut(&buffer, &CLIENT_EXT(session)->playerId, sizeof(CLIENT_EXT(session)->playerId));
+		upgradePut(&buffer, &session->fastJoin, sizeof(session->fastJoin));
+		upgradePut(&buffer, &session->sock.statusPending, sizeof(session->sock.statusPending));
+		if (session->sock.statusPending) {
+			upgradePut(&buffer, PENDING_STATUS(&session->sock), sizeof(game_msg_t));
+		}
+		upgradePut(&buffer, &session->sock.mux->backlogLen, sizeof(session->sock.mux->backlogLen));
+		upgradePut(&buffer, session->sock.mux->backlog, session->sock.mux->backlogLen);
+	}
+	/* players holding seats while disconnected, they have no descriptor */
+	upgradePut(&buffer, &detachedCnt, sizeof(detachedCnt));
+	for (i = 0; i < MAX_GAMES; i++) {
+		int id;
+		for (id = 0; (gameTable.flags[i] & GAME_IN_USE) && id < MAX_ID; id++) {
+			client_t * client = games[i].clientList[id];
+			if (client != NULL && isDetached(client)) {
+				upgradePut(&buffer, &gameOrdinal[i], sizeof(int));
+				upgradePut(&buffer, &client->id, sizeof(client->id));
+				upgradePut(&buffer, &client->status, sizeof(client->status));
+				upgradePut(&buffer, &CLIENT_EXT(client)->playerId, sizeof(CLIENT_EXT(client)->playerId));
+			}
+		}
+	}
+	/* lobby queues in waiting order */
+	game_type_t type;
+	for (type = MISERE; type <= REGULAR; type++) {
+		for (i = 0; i <= MAX_PLAYERS; i++) {
+			lobby_queue_t * queue = getLobbyQueue(type, i);
+			if (queue == NULL) {
+				continue;
+			}
+			upgradePut(&buffer, &queue->count, sizeof(queue->count));
+			client_t * waiting;
+			for (waiting = queue->head; waiting != NULL; waiting = waiting->ext->queueNext) {
+				int ordinal = upgradeOrdinal(waiting, clientOrdinal, slotBase, sessionOrdinal);
+				upgradePut(&buffer, &ordinal, sizeof(int));
+			}
+		}
+	}
+	/* tournaments with their entrants and pairings of current round, ratings are looked up again by the successor */
+	for (i = 0; i < MAX_TOURNAMENTS; i++) {
+		tournament_t * tournament = &tournaments[i];
+		upgradePut(&buffer, &tournament->state, sizeof(tournament->state));
+		if (tournament->state == TOURNAMENT_FREE) {
+			continue;
+		}
+		int rounds = (tournament->kind == SWISS) ? tournament->rounds : 0, j;
+		upgradePut(&buffer, &tournament->size, sizeof(tournament->size));
+		upgradePut(&buffer, &rounds, sizeof(rounds));
+		upgradePut(&buffer, &tournament->gameType, sizeof(tournament->gameType));
+		upgradePut(&buffer, &tournament->cubes, sizeof(tournament->cubes));
+		upgradePut(&buffer, &tournament->entrantsCnt, sizeof(tournament->entrantsCnt));
+		upgradePut(&buffer, &tournament->round, sizeof(tournament->round));
+		upgradePut(&buffer, &tournament->pairingsCnt, sizeof(tournament->pairingsCnt));
+		upgradePut(&buffer, &tournament->nextPairing, sizeof(tournament->nextPairing));
+		upgradePut(&buffer, &tournament->pairingsLeft, sizeof(tournament->pairingsLeft));
+		for (j = 0; j < tournament->entrantsCnt; j++) {
+			entrant_t * entrant = &tournament->entrants[j];
+			/* withdrawn entrant stays in standings without client */
+			int ordinal = (entrant->client != NULL && !isDetached(entrant->client)) ? upgradeOrdinal(entrant->client, clientOrdinal, slotBase, sessionOrdinal) : -1;
+			upgradePut(&buffer, &ordinal, sizeof(ordinal));
+			upgradePut(&buffer, &entrant->playerId, sizeof(entrant->playerId));
+			upgradePut(&buffer, &entrant->seed, sizeof(entrant->seed));
+			upgradePut(&buffer, &entrant->points, sizeof(entrant->points));
+			upgradePut(&buffer, &entrant->byes, sizeof(entrant->byes));
+		}
+		if (tournament->opponents != NULL) {
+			upgradePut(&buffer, tournament->opponents, sizeof(int) * tournament->size * tournament->rounds);
+		}
+		for (j = 0; j < tournament->pairingsCnt; j++) {
+			pairing_t * pairing = &tournament->pairings[j];
+			int inGame = (pairing->game != NULL) ? gameOrdinal[pairing->game - games] : -1;
+			upgradePut(&buffer, &pairing->first, sizeof(pairing->first));
+			upgradePut(&buffer, &pairing->second, sizeof(pairing->second));
+			upgradePut(&buffer, &inGame, sizeof(inGame));
+			upgradePut(&buffer, &pairing->done, sizeof(pairing->done));
+		}
+	}
+	size_t size = buffer.pos;
+	if (buffer.failed) {
+		printf("Error: not enough memory for upgrade snapshot!\n");
+		goto done;
+	}
+	res = upgradeWriteAll(channel, (char *) &size, sizeof(size)) && upgradeWriteAll(channel, buffer.data, size) && upgradeSendFds(channel, fds, clientsCnt + 1);
+	done:
+	free(buffer.data);
+	free(sessionOrdinal);
+	free(sessionList);
+	free(fds);
+	free(slotBase);
+	free(clientOrdinal);
+	return res;
+}
+
+/**
+ * the function restores server state sent by upgradeSend
+ * received clients are polled by the successor main loop
+ * returns 0 on error
+ **/
+int upgradeReceive(int channel, int * listSocket, upgrade_settings_t * settings) {
+	upgrade_buffer_t buffer = { NULL, 0, 0, 0 };
+	size_t size;
+	if (!upgradeReadAll(channel, (char *) &size, sizeof(size))) {
+		return 0;
+	}
+	buffer.data = (char *) malloc(size);
+	buffer.size = size;
+	int res = 0;
+	int magic, version, gamesCnt, clientsCnt, restoredSessions = 0;
+	int * fds = NULL;
+	game_t ** restoredGames = NULL;
+	client_t ** restoredClients = NULL;
+	if (!upgradeReadAll(channel, buffer.data, size)) {
+		goto done;
+	}
+	if (!upgradeGet(&buffer, &magic, sizeof(magic)) || !upgradeGet(&buffer, &version, sizeof(version)) || magic != UPGRADE_MAGIC || version != UPGRADE_VERSION) {
+		fprintf(stderr, "Error: upgrade snapshot version mismatch!\n");
+		goto done;
+	}
+	if (!upgradeGet(&buffer, settings, sizeof(upgrade_settings_t)) || !upgradeGet(&buffer, &gamesCnt, sizeof(gamesCnt)) || !upgradeGet(&buffer, &clientsCnt, sizeof(clientsCnt)) || gamesCnt > MAX_GAMES || clientsCnt < 0) {
+		goto done;
+	}
+	fds = (int *) malloc(sizeof(int) * (clientsCnt + 1));
+	if (!upgradeReceiveFds(channel, fds, clientsCnt + 1)) {
+		goto done;
+	}
+	*listSocket = fds[0];
+	restoredGames = (game_t **) calloc(gamesCnt + 1, sizeof(game_t *));
+	restoredClients = (client_t **) calloc(clientsCnt + 1, sizeof(client_t *));
+	/* games */
+	initGames();
+	game_t * newest[2] = { NULL, NULL };
+	int i;
+	for (i = 0; i < gamesCnt; i++) {
+		game_t restored;
+		short heaps[NUM_OF_HEAPS];
+		int isNewest, isTurnDone, needToSendStatus;
+		memset(&restored, 0, sizeof(game_t));
+		if (!upgradeGet(&buffer, &isNewest, sizeof(isNewest)) || !upgradeGet(&buffer, heaps, sizeof(heaps)) || !upgradeGet(&buffer, restored.sentHeaps, sizeof(restored.sentHeaps)) || !upgradeGet(&buffer, &restored.statusSeq, sizeof(restored.statusSeq)) || !upgradeGet(&buffer, &restored.gameType, sizeof(restored.gameType)) || !upgradeGet(&buffer, &restored.p, sizeof(restored.p)) || !upgradeGet(&buffer, &restored.maxId, sizeof(restored.maxId)) || !upgradeGet(&buffer, &isTurnDone, sizeof(isTurnDone)) || !upgradeGet(&buffer, &needToSendStatus, sizeof(needToSendStatus))
+				|| !upgradeGet(&buffer, restored.seatTokens, sizeof(restored.seatTokens)) || !upgradeGet(&buffer, restored.seatDetachedNs, sizeof(restored.seatDetachedNs))
+				|| !upgradeGet(&buffer, &restored.startMs, sizeof(restored.startMs)) || !upgradeGet(&buffer, &restored.movesCnt, sizeof(restored.movesCnt))
+				|| !upgradeGet(&buffer, &restored.illegalCnt, sizeof(restored.illegalCnt)) || !upgradeGet(&buffer, restored.movesBy, sizeof(restored.movesBy))) {
+			goto done;
+		}
+		game_t * game = createGame(restored.gameType, restored.p, 0);
+		memcpy(game, &restored, sizeof(game_t));
+		memcpy(GAME_HEAPS(game), heaps, sizeof(heaps));
+		GAME_FLAGS(game) = GAME_IN_USE | ((isTurnDone) ? GAME_TURN_DONE : 0) | ((needToSendStatus) ? GAME_SEND_STATUS : 0);
+		initRules(&game->rules, game->gameType, MOVES_ONE_HEAP, settings->heapsCnt, settings->maxTake);
+		if (isNewest && (game->gameType == MISERE || game->gameType == REGULAR)) {
+			newest[game->gameType] = game;
+		}
+		restoredGames[i] = game;
+	}
+	newestGame[MISERE] = newest[MISERE];
+	newestGame[REGULAR] = newest[REGULAR];
+	/* clients */
+	for (i = 0; i < clientsCnt; i++) {
+		int inGame;
+		char id;
+		client_status_t status;
+		unsigned short udpPort;
+		unsigned int udpAddr, playerId;
+		client_t * client = createClient(fds[i + 1]);
+		if (client == NULL) {
+			goto done;
+		}
+		restoredClients[i] = client;
+		/* buffers are attached for restoring and returned below if empty */
+		if ((client->sock.rxBuff = poolAttach()) == NULL || (client->sock.txBuff = poolAttach()) == NULL) {
+			goto done;
+		}
+		if (!upgradeGet(&buffer, &inGame, sizeof(inGame)) || !upgradeGet(&buffer, &id, sizeof(id)) || !upgradeGet(&buffer, &status, sizeof(status))
+				|| !upgradeGet(&buffer, &udpPort, sizeof(udpPort)) || !upgradeGet(&buffer, &udpAddr, sizeof(udpAddr))
+				|| !upgradeGet(&buffer, &playerId, sizeof(playerId)) || !upgradeGet(&buffer, &client->fastJoin, sizeof(client->fastJoin))
+				|| !upgradeGet(&buffer, &client->provisional, sizeof(client->provisional)) || !upgradeRestoreExt(client, udpPort, udpAddr, playerId)) {
+			goto done;
+		}
+		if (!upgradeGet(&buffer, &client->sock.rxBuffPos, sizeof(int)) || client->sock.rxBuffPos < 0 || client->sock.rxBuffPos > BUFFER_SIZE || !upgradeGet(&buffer, client->sock.rxBuff, client->sock.rxBuffPos)) {
+			goto done;
+		}
+		if (!upgradeGet(&buffer, &client->sock.rxAttempt, sizeof(int))) {
+			goto done;
+		}
+		if (!upgradeGet(&buffer, &client->sock.txBuffPos, sizeof(int)) || client->sock.txBuffPos < 0 || client->sock.txBuffPos > BUFFER_SIZE || !upgradeGet(&buffer, client->sock.txBuff, client->sock.txBuffPos)) {
+			goto done;
+		}
+		if (!upgradeGet(&buffer, &client->sock.statusPending, sizeof(client->sock.statusPending)) || (client->sock.statusPending && !upgradeGet(&buffer, PENDING_STATUS(&client->sock), sizeof(game_msg_t)))) {
+			goto done;
+		}
+		if (client->sock.rxBuffPos == 0 && !client->sock.statusPending) {
+			poolRelease(client->sock.rxBuff);
+			client->sock.rxBuff = NULL;
+		}
+		if (client->sock.txBuffPos == 0) {
+			poolRelease(client->sock.txBuff);
+			client->sock.txBuff = NULL;
+		}
+		client->status = status;
+		if (inGame >= 0 && inGame < gamesCnt && id >= 0 && id < MAX_ID) {
+			client->game = restoredGames[inGame];
+			client->id = id;
+			client->game->clientList[(int) id] = client;
+		}
+	}
+	/* sessions */
+	if (!upgradeGet(&buffer, &restoredSessions, sizeof(restoredSessions)) || restoredSessions < 0) {
+		goto done;
+	}
+	client_t ** grown = (client_t **) realloc(restoredClients, sizeof(client_t *) * (clientsCnt + restoredSessions + 1));
+	if (grown == NULL) {
+		goto done;
+	}
+	restoredClients = grown;
+	for (i = 0; i < restoredSessions; i++) {
+		int linkOrdinal, inGame;
+		unsigned int playerId;
+		unsigned short sessionId;
+		char id;
+		client_status_t status;
+		restoredClients[clientsCnt + i] = NULL;
+		if (!upgradeGet(&buffer, &linkOrdinal, sizeof(linkOrdinal)) || !upgradeGet(&buffer, &sessionId, sizeof(sessionId)) || !upgradeGet(&buffer, &inGame, sizeof(inGame))
+				|| !upgradeGet(&buffer, &id, sizeof(id)) || !upgradeGet(&buffer, &status, sizeof(status)) || linkOrdinal < 0 || linkOrdinal >= clientsCnt || sessionId == 0) {
+			goto done;
+		}
+		client_t * session = getSession(restoredClients[linkOrdinal], sessionId);
+		if (session == NULL) {
+			goto done;
+		}
+		restoredClients[clientsCnt + i] = session;
+		if (!upgradeGet(&buffer, &playerId, sizeof(playerId)) || !upgradeGet(&buffer, &session->fastJoin, sizeof(session->fastJoin))
+				|| !upgradeGet(&buffer, &session->sock.statusPending, sizeof(session->sock.statusPending)) || !upgradeRestoreExt(session, 0, 0, playerId)) {
+			goto done;
+		}
+		socket_mux_t * mux = session->sock.mux; /* allocated by getSession */
+		int backlogLen;
+		if ((session->sock.statusPending && !upgradeGet(&buffer, PENDING_STATUS(&session->sock), sizeof(game_msg_t)))
+				|| !upgradeGet(&buffer, &backlogLen, sizeof(backlogLen)) || backlogLen < 0 || backlogLen > BUFFER_SIZE) {
+			goto done;
+		}
+		if (backlogLen > 0) {
+			if ((mux->backlog = (char *) malloc(backlogLen)) == NULL || !upgradeGet(&buffer, mux->backlog, backlogLen)) {
+				goto done;
+			}
+			mux->backlogLen = backlogLen;
+			mux->backlogCap = backlogLen;
+		}
+		if (SESSION_PENDING(&session->sock)) {
+			linkPending(&session->sock);
+		}
+		session->status = status;
+		if (inGame >= 0 && inGame < gamesCnt && id >= 0 && id < MAX_ID) {
+			session->game = restoredGames[inGame];
+			session->id = id;
+			session->game->clientList[(int) id] = session;
+		}
+	}
+	/* held seats */
+	int detachedSeats;
+	if (!upgradeGet(&buffer, &detachedSeats, sizeof(detachedSeats))) {
+		goto done;
+	}
+	for (i = 0; i < detachedSeats; i++) {
+		int inGame;
+		char id;
+		client_status_t status;
+		unsigned int playerId;
+		if (!upgradeGet(&buffer, &inGame, sizeof(inGame)) || !upgradeGet(&buffer, &id, sizeof(id)) || !upgradeGet(&buffer, &status, sizeof(status))
+				|| !upgradeGet(&buffer, &playerId, sizeof(playerId)) || inGame < 0 || inGame >= gamesCnt || id < 0 || id >= MAX_ID) {
+			goto done;
+		}
+		client_t * client = (client_t *) calloc(1, sizeof(client_t));
+		if (client == NULL || !upgradeRestoreExt(client, 0, 0, playerId)) {
+			free(client);
+			goto done;
+		}
+		client->sock.socket = -1;
+		client->status = status;
+		client->game = restoredGames[inGame];
+		client->id = id;
+		client->game->clientList[(int) id] = client;
+		detachedCnt++;
+	}
+	for (i = 0; i < gamesCnt; i++) { /* game table follows restored rosters */
+		indexGame(restoredGames[i]);
+	}
+	/* lobby queues */
+	game_type_t type;
+	for (type = MISERE; type <= REGULAR; type++) {
+		for (i = 0; i <= MAX_PLAYERS; i++) {
+			lobby_queue_t * queue = getLobbyQueue(type, i);
+			int count, ordinal;
+			if (queue == NULL) {
+				continue;
+			}
+			if (!upgradeGet(&buffer, &count, sizeof(count))) {
+				goto done;
+			}
+			while (count-- > 0) {
+				if (!upgradeGet(&buffer, &ordinal, sizeof(ordinal)) || ordinal < 0 || ordinal >= clientsCnt + restoredSessions) {
+					goto done;
+				}
+				if (!lobbyPush(queue, restoredClients[ordinal])) {
+					goto done;
+				}
+			}
+		}
+	}
+	/* tournaments */
+	for (i = 0; i < MAX_TOURNAMENTS; i++) {
+		tournament_state_t state;
+		int tournamentSize, rounds, cubes, entrantsCnt, round, pairingsCnt, nextPairing, pairingsLeft, j;
+		game_type_t tournamentType;
+		if (!upgradeGet(&buffer, &state, sizeof(state))) {
+			goto done;
+		}
+		if (state == TOURNAMENT_FREE) {
+			continue;
+		}
+		if (!upgradeGet(&buffer, &tournamentSize, sizeof(tournamentSize)) || !upgradeGet(&buffer, &rounds, sizeof(rounds)) || !upgradeGet(&buffer, &tournamentType, sizeof(tournamentType))
+				|| !upgradeGet(&buffer, &cubes, sizeof(cubes)) || !upgradeGet(&buffer, &entrantsCnt, sizeof(entrantsCnt)) || !upgradeGet(&buffer, &round, sizeof(round))
+				|| !upgradeGet(&buffer, &pairingsCnt, sizeof(pairingsCnt)) || !upgradeGet(&buffer, &nextPairing, sizeof(nextPairing)) || !upgradeGet(&buffer, &pairingsLeft, sizeof(pairingsLeft))) {
+			goto done;
+		}
+		tournament_t * tournament = tournamentOpen(tournamentSize, rounds, tournamentType, cubes);
+		if (tournament == NULL || entrantsCnt < 0 || entrantsCnt > tournamentSize || pairingsCnt < 0 || pairingsCnt > tournamentSize / 2 + 1
+				|| nextPairing < 0 || nextPairing > pairingsCnt || pairingsLeft < 0 || pairingsLeft > pairingsCnt) {
+			goto done;
+		}
+		tournament->state = state;
+		tournament->round = round;
+		tournament->pairingsCnt = pairingsCnt;
+		tournament->nextPairing = nextPairing;
+		tournament->pairingsLeft = pairingsLeft;
+		for (j = 0; j < entrantsCnt; j++) {
+			entrant_t * entrant = &tournament->entrants[j];
+			int ordinal;
+			if (!upgradeGet(&buffer, &ordinal, sizeof(ordinal)) || !upgradeGet(&buffer, &entrant->playerId, sizeof(entrant->playerId)) || !upgradeGet(&buffer, &entrant->seed, sizeof(entrant->seed))
+					|| !upgradeGet(&buffer, &entrant->points, sizeof(entrant->points)) || !upgradeGet(&buffer, &entrant->byes, sizeof(entrant->byes)) || ordinal < -1 || ordinal >= clientsCnt + restoredSessions) {
+				goto done;
+			}
+			entrant->ratingIdx = -1; /* looked up once ratings are open */
+			tournament->entrantsCnt++;
+			if (ordinal != -1) {
+				client_ext_t * ext = clientExt(restoredClients[ordinal]);
+				if (ext == NULL) {
+					goto done;
+				}
+				entrant->client = restoredClients[ordinal];
+				ext->tournament = tournament;
+				ext->entrant = j;
+			}
+		}
+		if (tournament->opponents != NULL && !upgradeGet(&buffer, tournament->opponents, sizeof(int) * tournament->size * tournament->rounds)) {
+			goto done;
+		}
+		for (j = 0; j < pairingsCnt; j++) {
+			pairing_t * pairing = &tournament->pairings[j];
+			int inGame;
+			if (!upgradeGet(&buffer, &pairing->first, sizeof(pairing->first)) || !upgradeGet(&buffer, &pairing->second, sizeof(pairing->second)) || !upgradeGet(&buffer, &inGame, sizeof(inGame))
+					|| !upgradeGet(&buffer, &pairing->done, sizeof(pairing->done)) || pairing->first < 0 || pairing->first >= tournamentSize
+					|| pairing->second < -1 || pairing->second >= tournamentSize || inGame < -1 || inGame >= gamesCnt) {
+				goto done;
+			}
+			if (inGame != -1) {
+				pairing->game = restoredGames[inGame];
+				pairing->game->tournament = tournament;
+				pairing->game->pairing = j;
+			}
+		}
+	}
+	res = 1;
+	done:
+	free(buffer.data);
+	free(fds);
+	free(restoredGames);
+	free(restoredClients);
+	return res;
+}
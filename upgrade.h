@@ -0,0 +1,47 @@
+#define UPGRADE_MAGIC 0x4e494d55 /* "NIMU" */
+#define UPGRADE_VERSION 17 /* layout of the state snapshot */
+#define UPGRADE_FD_BATCH 64 /* descriptors passed in one message */
+#define UPGRADE_ACK_TIMEOUT 5 /* seconds to wait for successor to take over */
+
+/**
+ * server settings carried over to the successor
+ * lobbyMode, p, gameType, M, heapsCnt, maxTake, lowLatency, busyPollUs, datagramMode, sessionGraceSec, overloadControl,
+ * tournamentSize, tournamentRounds - command line settings of the server
+ * gamesStarted, playersMatched - lobby counters
+ **/
+typedef struct upgrade_settings {
+	int lobbyMode;
+	int p;
+	game_type_t gameType;
+	int M;
+	int heapsCnt;
+	int maxTake;
+	int lowLatency;
+	int busyPollUs;
+	int datagramMode;
+	int sessionGraceSec;
+	int overloadControl;
+	int tournamentSize;
+	int tournamentRounds;
+	long gamesStarted;
+	long playersMatched;
+} upgrade_settings_t;
+
+/**
+ * growing buffer for state snapshot
+ * data - snapshot bytes
+ * size - allocated size
+ * pos - write position, or read position while restoring
+ * failed - 1 if memory for the snapshot ran out, nothing more is appended and the upgrade is aborted
+ **/
+typedef struct upgrade_buffer {
+	char * data;
+	size_t size;
+	size_t pos;
+	int failed;
+} upgrade_buffer_t;
+
+/* headers of upgrade functions */
+int upgradeSend(int channel, int listSocket, upgrade_settings_t * settings);
+
+int upgradeReceive(int channel, int * listSocket, upgrade_settings_t * settings);